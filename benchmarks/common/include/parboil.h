@@ -45,7 +45,8 @@ pb_Parameters_CountInputs(struct pb_Parameters *p);
 
 /* A time or duration. */
 #if _POSIX_VERSION >= 200112L
-typedef unsigned long long pb_Timestamp; /* time in microseconds */
+typedef unsigned long long pb_Timestamp; /* in ticks of the clock named
+					  * by pb_ClockName */
 #else
 # error "Timestamps not implemented"
 #endif
@@ -125,8 +126,13 @@ struct pb_SubTimer {
   char *label;
   struct pb_Timer timer;
   struct pb_SubTimer *next;
+  enum pb_TimerID category;	/* Category the sub-timer belongs to */
 };
 
+/* Interned sub-timer, an index into pb_TimerSet.sub_timers */
+typedef int pb_SubTimerID;
+#define pb_SubTimerID_NONE (-1)
+
 struct pb_SubTimerList {
   struct pb_SubTimer *current;
   struct pb_SubTimer *subtimer_list;
@@ -140,6 +146,20 @@ struct pb_TimerSet {
   pb_Timestamp wall_begin;
   struct pb_Timer timers[pb_TimerID_LAST];
   struct pb_SubTimerList *sub_timer_list[pb_TimerID_LAST];
+
+  /* The fields below are only used by the CPU timer library */
+  struct pb_SubTimer **sub_timers;	/* Sub-timers indexed by ID */
+  int sub_timer_count;
+  int sub_timer_capacity;
+  pb_SubTimerID current_sub;		/* Running sub-timer, or NONE */
+  struct pb_SubTimerIndex *index;	/* (category, label) -> ID, shared
+					 * with the per-thread sets */
+  struct pb_TimerSet **thread_sets;	/* Per-thread sets, merged by
+					 * pb_PrintTimerSet */
+  int thread_count;
+  struct pb_TimerSet *parent;		/* Set a per-thread set belongs to */
+  struct pb_Counters *counters;		/* Hardware counters, or NULL */
+  struct pb_Energy *energy;		/* RAPL energy counters, or NULL */
 };
 
 /* Reset all timers in the set. */
@@ -158,6 +178,59 @@ pb_SwitchToTimer(struct pb_TimerSet *timers, enum pb_TimerID timer);
 void
 pb_SwitchToSubTimer(struct pb_TimerSet *timers, char *label, enum pb_TimerID category);
 
+/* Register a sub-timer if it does not exist yet and return its ID.
+ * Switching by ID does not search for the label, which keeps the cost
+ * of a switch to one clock read.  Sub-timers must be registered from a
+ * single thread, before pb_InitializeThreadTimerSets. */
+pb_SubTimerID
+pb_InternSubTimer(struct pb_TimerSet *timers, const char *label, enum pb_TimerID category);
+
+/* Switch to a sub-timer by ID; its category timer is started if it is
+ * not running yet.  pb_SubTimerID_NONE stops the running sub-timer and
+ * leaves the category timer running. */
+void
+pb_SwitchToSubTimerID(struct pb_TimerSet *timers, pb_SubTimerID id);
+
+/* Create one timer set per thread (for instance per OpenMP thread) that
+ * shares the sub-timer IDs of timers.  Each thread switches its own set,
+ * so no synchronization is needed inside parallel regions, and
+ * pb_PrintTimerSet(timers) reports the total, mean and maximum over the
+ * threads. */
+void
+pb_InitializeThreadTimerSets(struct pb_TimerSet *timers, int nthreads);
+
+/* The set of thread tid, or NULL if there is none */
+struct pb_TimerSet *
+pb_GetThreadTimerSet(struct pb_TimerSet *timers, int tid);
+
+/* Attach hardware performance counters (perf_event) to the timers of
+ * a set: cycles, instructions, LLC misses, retired FP arithmetic, dTLB
+ * misses and page faults are opened on every OpenMP thread, accumulated
+ * per category and sub-timer, and printed with the derived IPC, GB/s,
+ * GFLOPS and dTLB misses per 1000 instructions by pb_PrintTimerSet.
+ * pb_InitializeTimerSet does this when PB_COUNTERS is set.  Returns the
+ * number of events that could be opened; with 0 the set keeps recording
+ * time only. */
+int
+pb_EnableCounters(struct pb_TimerSet *timers);
+
+/* Attribute RAPL energy (package, core and DRAM, summed over the
+ * sockets) to the timer categories of a set.  The counters are read
+ * from the powercap tree at root, /sys/class/powercap if NULL, on every
+ * switch, and pb_PrintTimerSet reports joules and average watts per
+ * category.  pb_InitializeTimerSet does this when PB_ENERGY is set: to
+ * a directory laid out like the powercap tree (a fake energy source),
+ * or to anything else for the real one.  Returns the number of domains
+ * found; with 0 the set keeps recording time only. */
+int
+pb_EnableEnergy(struct pb_TimerSet *timers, const char *root);
+
+/* Name of the clock the CPU timer library reads: "tsc" (calibrated
+ * invariant TSC) or "monotonic-raw".  PB_CLOCK selects one of them;
+ * the TSC is the default when it is invariant. */
+const char *
+pb_ClockName(void);
+
 /* Print timer values to standard output. */
 void
 pb_PrintTimerSet(struct pb_TimerSet *timers);
@@ -169,6 +242,219 @@ pb_DestroyTimerSet(struct pb_TimerSet * timers);
 void
 pb_SetOpenCL(void *clContextPtr, void *clCommandQueuePtr);
 
+/* Adaptive benchmark harness.
+ *
+ * Runs a kernel callback repeatedly: first warm-up iterations until the
+ * coefficient of variation of the last few samples drops below a
+ * threshold, then a measured run calibrated to last about target_secs.
+ * Every sample is taken with a monotonic clock.  Kernels much shorter
+ * than min_sample are timed in batches and each sample is the mean of
+ * the batch.
+ */
+typedef void (*pb_KernelFunc)(void *arg);
+
+struct pb_HarnessConfig {
+  double target_secs;		/* Length of the measured run (SECS) */
+  int iterations;		/* If > 0, run exactly this many measured
+				 * iterations instead of calibrating (ITERS) */
+  int min_warmup;		/* Warm-up iterations run at least... */
+  int max_warmup;		/* ...and at most */
+  double max_warmup_secs;	/* Warm-up gives up after this long */
+  int window;			/* Samples the warm-up CV is computed over */
+  double cv_threshold;		/* Warm-up is stable below this CV */
+  double min_sample;		/* Shortest timed interval, in seconds */
+};
+
+struct pb_HarnessResult {
+  int warmup;			/* Warm-up iterations run */
+  double cold;			/* Seconds of the first call */
+  int stable;			/* Warm-up reached cv_threshold */
+  double warmup_cv;		/* CV of the last warm-up window */
+  int iterations;		/* Measured kernel calls */
+  int batch;			/* Kernel calls per sample */
+  int nsamples;
+  double *samples;		/* Seconds per call, in run order; owned */
+  double total;			/* Seconds spent in the measured run */
+  double mean, stddev, min, max;
+  double median, p95, p99;
+  double mean_lo, mean_hi;	/* 95% confidence interval of the mean */
+  double median_lo, median_hi;	/* 95% confidence interval of the median */
+};
+
+/* Fill in the defaults, then apply the SECS and ITERS environment
+ * variables.  Returns 0 on success.  If neither is set an error message
+ * is printed on stderr and -1 is returned. */
+int
+pb_InitHarnessConfig(struct pb_HarnessConfig *config);
+
+/* Warm up, calibrate and measure kernel(arg).  Returns 0 on success.
+ * If the samples cannot be allocated an error message is printed on
+ * stderr and -1 is returned. */
+int
+pb_RunHarness(struct pb_HarnessConfig *config,
+	      pb_KernelFunc kernel, void *arg,
+	      struct pb_HarnessResult *result);
+
+/* Print the warm-up outcome and the statistics of a result. */
+void
+pb_PrintHarnessResult(const char *name, struct pb_HarnessResult *result);
+
+/* Release the samples of a result */
+void
+pb_FreeHarnessResult(struct pb_HarnessResult *result);
+
+/* Machine-readable results.
+ *
+ * A run record collects what one benchmark run measured.  It is written
+ * as a single line appended to the file named by PB_RESULTS: CSV (with
+ * a header if the file is new) when the name ends in .csv, otherwise a
+ * JSON object per line.  Without PB_RESULTS nothing is written.  Runs
+ * may share a file, records never interleave.
+ */
+struct pb_RunRecord {
+  const char *benchmark;
+  const char *dataset;		/* PB_DATASET, else the input file */
+  int threads;			/* OpenMP threads, 1 without OpenMP */
+  struct pb_HarnessResult *harness; /* Per-iteration statistics, or NULL */
+  int iterations;		/* Without a harness: measured iterations */
+  double seconds;		/* and mean seconds per iteration */
+  struct pb_TimerSet *timers;	/* Time per category, or NULL */
+  double flops;			/* Work of one iteration, used for the */
+  double bytes;			/* GFLOP/s, GB/s and edges/s columns; */
+  double edges;			/* 0 where it does not apply */
+};
+
+/* Clear a record and fill in the benchmark name, the dataset (named by
+ * PB_DATASET, or else by its input file, which may be NULL) and the
+ * thread count. */
+void
+pb_InitRunRecord(struct pb_RunRecord *record, const char *benchmark,
+		 const char *input);
+
+/* Append the record to PB_RESULTS.  Returns 0 on success or if
+ * PB_RESULTS is not set; on error a message is printed on stderr and -1
+ * is returned.  Call it before the timer set is destroyed. */
+int
+pb_EmitRunRecord(struct pb_RunRecord *record);
+
+/* NUMA-aware allocation.
+ *
+ * pb_Alloc maps size zeroed bytes, page aligned, and places their pages
+ * before it returns, so that the serial initialization of the benchmark
+ * (reading the input, for instance) does not decide where they land:
+ *
+ *   PB_ALLOC_SERIAL       pages land where they are first written, as
+ *                         with malloc
+ *   PB_ALLOC_FIRST_TOUCH  every OpenMP thread touches an equal contiguous
+ *                         share, the one a schedule(static) loop over the
+ *                         outermost dimension gives it, so its pages are
+ *                         local to the thread that works on them
+ *   PB_ALLOC_INTERLEAVE   pages round robin over the NUMA nodes, for data
+ *                         every thread reads (or reads at random)
+ *
+ * PB_ALLOC_HUGE may be added: the mapping is aligned to 2 MB and advised
+ * to use transparent huge pages.  PB_ALLOC_HUGETLB maps explicit 2 MB
+ * pages from the hugetlb pool instead, and falls back to transparent
+ * ones if the pool is too small.  PB_NUMA=serial|first-touch|interleave
+ * overrides the placement the benchmark asks for, PB_HUGE=none|thp|
+ * hugetlb the pages.  Returns NULL if the memory cannot be mapped.
+ * Allocations are not thread safe; make them outside parallel
+ * regions. */
+#define PB_ALLOC_SERIAL		0
+#define PB_ALLOC_FIRST_TOUCH	1
+#define PB_ALLOC_INTERLEAVE	2
+#define PB_ALLOC_PLACEMENT	3
+#define PB_ALLOC_HUGE		4
+#define PB_ALLOC_HUGETLB	8
+
+void *
+pb_Alloc(const char *name, size_t size, int flags);
+
+/* Release memory from pb_Alloc */
+void
+pb_Free(void *p);
+
+/* Arenas.
+ *
+ * An arena reserves one mapping of capacity bytes, the sum of the
+ * sizes of the blocks it will hand out, with the flags of pb_Alloc.
+ * pb_ArenaAlloc hands out the next block, aligned to 64 bytes, and
+ * faults in its pages at once (in parallel unless the placement is
+ * PB_ALLOC_SERIAL), so a working set allocated before the timed run
+ * takes no page faults in it and shares a few huge pages instead of
+ * rounding every array up to its own.  Blocks are released together by
+ * pb_DestroyArena.  Returns NULL if the arena is full. */
+struct pb_Arena;
+
+struct pb_Arena *
+pb_CreateArena(const char *name, size_t capacity, int flags);
+
+void *
+pb_ArenaAlloc(struct pb_Arena *arena, size_t size);
+
+void
+pb_DestroyArena(struct pb_Arena *arena);
+
+/* Print a [NUMA] line per live allocation or arena: its name, size,
+ * placement, the share backed by huge pages and the share of its pages
+ * on every node. */
+void
+pb_PrintAllocations(void);
+
+/* Persistent teams.
+ *
+ * An iterative kernel can keep one parallel region open over all of its
+ * time steps instead of forking a team for every step: each thread takes
+ * a fixed range of the work with pb_ThreadRange and the steps are
+ * separated by pb_BarrierWait.  The barrier is a combining tree (four
+ * threads per node, a cache line per node) released by one flag, and
+ * waiters spin briefly before they yield the processor.  It times every
+ * wait of every thread, so load imbalance shows in pb_PrintBarrier.
+ *
+ * pb_CreateBarrier returns NULL if the barrier cannot be allocated.  All
+ * nthreads threads, identified by tid in [0, nthreads), must call
+ * pb_BarrierWait the same number of times.  A thread limit or OMP_DYNAMIC
+ * may start fewer threads than asked for, so a region that waits on its
+ * own barrier sizes it from omp_get_num_threads() inside the region,
+ * created in an omp single; pb_RunTeamHarness does this itself.
+ */
+struct pb_Barrier;
+
+struct pb_Barrier *
+pb_CreateBarrier(const char *name, int nthreads);
+
+void
+pb_BarrierWait(struct pb_Barrier *barrier, int tid);
+
+/* Print a [BARRIER] line per thread: the time it spent waiting, the
+ * number of waits and the share of the time since the barrier was
+ * created, up to the last wait. */
+void
+pb_PrintBarrier(struct pb_Barrier *barrier);
+
+void
+pb_DestroyBarrier(struct pb_Barrier *barrier);
+
+/* The share [*begin, *end) of n items thread tid of nthreads works on:
+ * contiguous, in thread order, the one PB_ALLOC_FIRST_TOUCH places. */
+void
+pb_ThreadRange(long n, int tid, int nthreads, long *begin, long *end);
+
+/* pb_RunHarness with kernel(arg) run by every thread of a persistent
+ * team in a single parallel region: the master times the calls, a
+ * barrier starts and ends every one of them.  The barrier is created
+ * inside the region for the team that was actually started and stored
+ * in *barrier before the first call, so the kernel may wait on it too;
+ * the caller prints and destroys it.  The kernel gets its thread and
+ * the team size from omp_get_thread_num() and omp_get_num_threads().
+ * Returns -1 if the barrier cannot be allocated.  Without OpenMP the
+ * team is the calling thread. */
+int
+pb_RunTeamHarness(struct pb_HarnessConfig *config,
+		  pb_KernelFunc kernel, void *arg,
+		  const char *name, struct pb_Barrier **barrier,
+		  struct pb_HarnessResult *result);
+
 #ifdef __cplusplus
 }
 #endif
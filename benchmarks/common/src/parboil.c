@@ -6,9 +6,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 
 #if _POSIX_VERSION >= 200112L
 # include <sys/time.h>
+# include <sched.h>
+#endif
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+# include <x86intrin.h>
+# define HAVE_TSC 1
 #endif
 
 /* Free an array of owned strings. */
@@ -222,39 +245,137 @@ pb_Parameters_CountInputs(struct pb_Parameters *p)
 /*****************************************************************************/
 /* Timer routines */
 
+/* Timestamps are ticks of the invariant TSC, calibrated once against
+ * CLOCK_MONOTONIC_RAW, or nanoseconds of CLOCK_MONOTONIC_RAW where the
+ * TSC cannot be trusted.  Both are monotonic; reading either costs a
+ * few tens of cycles, unlike gettimeofday. */
+
+#ifdef CLOCK_MONOTONIC_RAW
+# define RAW_CLOCK CLOCK_MONOTONIC_RAW
+#else
+# define RAW_CLOCK CLOCK_MONOTONIC
+#endif
+
+enum clock_source {
+  clock_UNINITIALIZED = 0,
+  clock_RAW,
+  clock_TSC
+};
+
+static enum clock_source clock_source = clock_UNINITIALIZED;
+static double tick_seconds;	/* Seconds per timestamp tick */
+
+static pb_Timestamp
+raw_nanoseconds()
+{
+  struct timespec ts;
+  clock_gettime(RAW_CLOCK, &ts);
+  return (pb_Timestamp) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+static int
+tsc_is_invariant()
+{
+  unsigned int a, b, c, d;
+
+  if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+    return 0;
+  __get_cpuid(0x80000007, &a, &b, &c, &d);
+  return (d >> 8) & 1;
+}
+
+/* TSC ticks per second, measured over 10 ms of the raw clock */
+static double
+calibrate_tsc()
+{
+  pb_Timestamp t0, t1;
+  unsigned long long c0, c1;
+
+  t0 = raw_nanoseconds();
+  c0 = __rdtsc();
+  do {
+    t1 = raw_nanoseconds();
+  } while (t1 - t0 < 10000000ULL);
+  c1 = __rdtsc();
+
+  return (c1 - c0) / ((t1 - t0) * 1e-9);
+}
+#endif
+
+/* Pick and calibrate the clock source.  Called from pb_ResetTimer and
+ * pb_InitializeTimerSet, which run before any parallel region. */
+static void
+initialize_clock()
+{
+  const char *env = getenv("PB_CLOCK");
+
+  if (clock_source != clock_UNINITIALIZED)
+    return;
+
+  clock_source = clock_RAW;
+  tick_seconds = 1e-9;
+
+#ifdef HAVE_TSC
+  if (env != NULL ? strcmp(env, "tsc") == 0 : tsc_is_invariant()) {
+    if (!tsc_is_invariant())
+      fputs("Warning: the TSC is not invariant\n", stderr);
+    tick_seconds = 1.0 / calibrate_tsc();
+    clock_source = clock_TSC;
+  }
+#else
+  if (env != NULL && strcmp(env, "tsc") == 0)
+    fputs("Warning: no TSC on this platform, using CLOCK_MONOTONIC_RAW\n", stderr);
+#endif
+}
+
+static inline pb_Timestamp
+get_time()
+{
+#ifdef HAVE_TSC
+  if (clock_source == clock_TSC)
+    return __rdtsc();
+#endif
+  return raw_nanoseconds();
+}
+
+const char *
+pb_ClockName(void)
+{
+  initialize_clock();
+  return clock_source == clock_TSC ? "tsc" : "monotonic-raw";
+}
+
 static void
 accumulate_time(pb_Timestamp *accum,
 		pb_Timestamp start,
 		pb_Timestamp end)
 {
-#if _POSIX_VERSION >= 200112L
   *accum += end - start;
-#else
-# error "Timestamps not implemented for this system"
-#endif
 }
 
-#if _POSIX_VERSION >= 200112L
-static pb_Timestamp get_time()
+static inline void
+start_timer_at(struct pb_Timer *timer, pb_Timestamp now)
 {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (pb_Timestamp) (tv.tv_sec * 1000000LL + tv.tv_usec);
+  timer->state = pb_Timer_RUNNING;
+  timer->init = now;
+}
+
+static inline void
+stop_timer_at(struct pb_Timer *timer, pb_Timestamp now)
+{
+  timer->state = pb_Timer_STOPPED;
+  accumulate_time(&timer->elapsed, timer->init, now);
+  timer->init = now;
 }
-#else
-# error "no supported time libraries are available on this platform"
-#endif
 
 void
 pb_ResetTimer(struct pb_Timer *timer)
 {
-  timer->state = pb_Timer_STOPPED;
+  initialize_clock();
 
-#if _POSIX_VERSION >= 200112L
+  timer->state = pb_Timer_STOPPED;
   timer->elapsed = 0;
-#else
-# error "pb_ResetTimer: not implemented for this system"
-#endif
 }
 
 void
@@ -265,22 +386,13 @@ pb_StartTimer(struct pb_Timer *timer)
     return;
   }
 
-  timer->state = pb_Timer_RUNNING;
-
-#if _POSIX_VERSION >= 200112L
-  {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    timer->init = tv.tv_sec * 1000000LL + tv.tv_usec;
-  }
-#else
-# error "pb_StartTimer: not implemented for this system"
-#endif
+  start_timer_at(timer, get_time());
 }
 
 void
 pb_StartTimerAndSubTimer(struct pb_Timer *timer, struct pb_Timer *subtimer)
 {
+  pb_Timestamp now;
   unsigned int numNotStopped = 0x3; // 11
   if (timer->state != pb_Timer_STOPPED) {
     fputs("Warning: Timer was not stopped\n", stderr);
@@ -295,59 +407,31 @@ pb_StartTimerAndSubTimer(struct pb_Timer *timer, struct pb_Timer *subtimer)
     return;
   }
 
-  timer->state = pb_Timer_RUNNING;
-  subtimer->state = pb_Timer_RUNNING;
+  now = get_time();
 
-#if _POSIX_VERSION >= 200112L
-  {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    
-    if (numNotStopped & 0x2) {
-      timer->init = tv.tv_sec * 1000000LL + tv.tv_usec;
-    }
-  
-    if (numNotStopped & 0x1) {
-      subtimer->init = tv.tv_sec * 1000000LL + tv.tv_usec;
-    }
+  if (numNotStopped & 0x2) {
+    start_timer_at(timer, now);
   }
-#else
-# error "pb_StartTimer: not implemented for this system"
-#endif
 
+  if (numNotStopped & 0x1) {
+    start_timer_at(subtimer, now);
+  }
 }
 
 void
 pb_StopTimer(struct pb_Timer *timer)
 {
-
-  pb_Timestamp fini;
-
   if (timer->state != pb_Timer_RUNNING) {
     fputs("Ignoring attempt to stop a stopped timer\n", stderr);
     return;
   }
 
-  timer->state = pb_Timer_STOPPED;
-
-#if _POSIX_VERSION >= 200112L
-  {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    fini = tv.tv_sec * 1000000LL + tv.tv_usec;
-  }
-#else
-# error "pb_StopTimer: not implemented for this system"
-#endif
-
-  accumulate_time(&timer->elapsed, timer->init, fini);
-  timer->init = fini;
-
+  stop_timer_at(timer, get_time());
 }
 
 void pb_StopTimerAndSubTimer(struct pb_Timer *timer, struct pb_Timer *subtimer) {
 
-  pb_Timestamp fini;
+  pb_Timestamp now;
 
   unsigned int numNotRunning = 0x3; // 0b11
   if (timer->state != pb_Timer_RUNNING) {
@@ -363,212 +447,975 @@ void pb_StopTimerAndSubTimer(struct pb_Timer *timer, struct pb_Timer *subtimer)
     return;
   }
 
-
-  timer->state = pb_Timer_STOPPED;
-  subtimer->state = pb_Timer_STOPPED;
-
-#if _POSIX_VERSION >= 200112L
-  {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    fini = tv.tv_sec * 1000000LL + tv.tv_usec;
-  }
-#else
-# error "pb_StopTimer: not implemented for this system"
-#endif
+  now = get_time();
 
   if (numNotRunning & 0x2) {
-    accumulate_time(&timer->elapsed, timer->init, fini);
-    timer->init = fini;
+    stop_timer_at(timer, now);
   }
-  
+
   if (numNotRunning & 0x1) {
-    accumulate_time(&subtimer->elapsed, subtimer->init, fini);
-    subtimer->init = fini;
+    stop_timer_at(subtimer, now);
   }
-
 }
 
 /* Get the elapsed time in seconds. */
 double
 pb_GetElapsedTime(struct pb_Timer *timer)
 {
-  double ret;
-
   if (timer->state != pb_Timer_STOPPED) {
     fputs("Elapsed time from a running timer is inaccurate\n", stderr);
   }
 
-#if _POSIX_VERSION >= 200112L
-  ret = timer->elapsed / 1e6;
-#else
-# error "pb_GetElapsedTime: not implemented for this system"
+  return timer->elapsed * tick_seconds;
+}
+
+/* Hardware performance counters.  Every thread gets up to four
+ * perf_event groups led by their first event: the generic one (cycles,
+ * instructions, LLC misses), on Intel FP_ARITH_INST_RETIRED split by the
+ * number of flops per instruction, dTLB load and store misses, and page
+ * faults (a software event, so it is there even where the hardware
+ * ones are not).  A switch reads all groups,
+ * sums them over the threads and charges the difference since the
+ * start of a timer to that timer, exactly like elapsed time. */
+
+enum counter_event {
+  ev_CYCLES,
+  ev_INSTRUCTIONS,
+  ev_LLC_MISSES,
+  ev_FP_SCALAR,			/* Scalar single and double, 1 flop */
+  ev_FP_128D,			/* 2 flops */
+  ev_FP_128S_256D,		/* 4 flops */
+  ev_FP_256S,			/* 8 flops */
+  ev_DTLB_LOAD_MISSES,
+  ev_DTLB_STORE_MISSES,
+  ev_PAGE_FAULTS,
+  ev_COUNT
+};
+
+#define COUNTER_GROUPS 4
+
+struct counter_event_info {
+  int group;
+  unsigned int type;
+  unsigned long long config;
+  double flops;			/* Per retired instruction, FP events only */
+};
+
+#ifdef __linux__
+/* FP_ARITH_INST_RETIRED is event 0xC7, the umask selects the width */
+# define FP_ARITH(umask) (0xC7 | ((umask) << 8))
+# define DTLB_MISSES(op) (PERF_COUNT_HW_CACHE_DTLB | ((op) << 8) | \
+			  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct counter_event_info counter_events[ev_COUNT] = {
+  { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0 },
+  { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0 },
+  { 0, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 0 },
+  { 1, PERF_TYPE_RAW, FP_ARITH(0x03), 1 },
+  { 1, PERF_TYPE_RAW, FP_ARITH(0x04), 2 },
+  { 1, PERF_TYPE_RAW, FP_ARITH(0x18), 4 },
+  { 1, PERF_TYPE_RAW, FP_ARITH(0x20), 8 },
+  { 2, PERF_TYPE_HW_CACHE, DTLB_MISSES(PERF_COUNT_HW_CACHE_OP_READ), 0 },
+  { 2, PERF_TYPE_HW_CACHE, DTLB_MISSES(PERF_COUNT_HW_CACHE_OP_WRITE), 0 },
+  { 3, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0 }
+};
 #endif
-  return ret;
+
+struct counter_thread {
+  int leader[COUNTER_GROUPS];		/* -1 if the group is not open */
+  int members[COUNTER_GROUPS][ev_COUNT];	/* Events in read order */
+  int fds[COUNTER_GROUPS][ev_COUNT];	/* Their descriptors */
+  int nmembers[COUNTER_GROUPS];
+};
+
+struct pb_Counters {
+  int nthreads;
+  struct counter_thread *threads;
+  int available[ev_COUNT];
+  int slots;				/* Categories, then sub-timers */
+  double *start;			/* [slots][ev_COUNT] at timer start */
+  double *total;			/* [slots][ev_COUNT] accumulated */
+};
+
+#ifdef __linux__
+static int
+open_counter(enum counter_event ev, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = counter_events[ev].type;
+  attr.config = counter_events[ev].config;
+  attr.disabled = (group_fd == -1);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP |
+    PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
 }
 
-void
-pb_InitializeTimerSet(struct pb_TimerSet *timers)
+static int
+cpu_is_intel()
 {
-  int n;
-  
-  timers->wall_begin = get_time();
+#ifdef HAVE_TSC
+  unsigned int a, b, c, d;
 
-  timers->current = pb_TimerID_NONE;
+  if (!__get_cpuid(0, &a, &b, &c, &d))
+    return 0;
+  return b == 0x756e6547 && d == 0x49656e69 && c == 0x6c65746e; /* GenuineIntel */
+#else
+  return 0;
+#endif
+}
 
-  timers->async_markers = NULL;
-  
+/* Open both groups for the calling thread; events that the CPU or the
+ * kernel refuse are left out */
+static void
+open_counter_thread(struct counter_thread *t, int fp_events)
+{
+  int g, ev, fd;
+
+  for (g = 0; g < COUNTER_GROUPS; g++) {
+    t->leader[g] = -1;
+    t->nmembers[g] = 0;
+    if (g == 1 && !fp_events)
+      continue;
+
+    for (ev = 0; ev < ev_COUNT; ev++) {
+      if (counter_events[ev].group != g)
+        continue;
+      fd = open_counter((enum counter_event)ev, t->leader[g]);
+      if (fd < 0) {
+        if (t->leader[g] == -1)
+          break;		/* No leader, no group */
+        continue;
+      }
+      if (t->leader[g] == -1)
+        t->leader[g] = fd;
+      t->fds[g][t->nmembers[g]] = fd;
+      t->members[g][t->nmembers[g]++] = ev;
+    }
 
-  for (n = 0; n < pb_TimerID_LAST; n++) {
-    pb_ResetTimer(&timers->timers[n]);
-    timers->sub_timer_list[n] = NULL; // free first?
+    if (t->leader[g] != -1) {
+      ioctl(t->leader[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(t->leader[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
   }
 }
 
-void
-pb_AddSubTimer(struct pb_TimerSet *timers, char *label, enum pb_TimerID pb_Category) {  
-  
-  struct pb_SubTimer *subtimer = (struct pb_SubTimer *) malloc
-    (sizeof(struct pb_SubTimer));
-    
-  int len = strlen(label);
-    
-  subtimer->label = (char *) malloc (sizeof(char)*(len+1));
-  sprintf(subtimer->label, "%s\0", label);
-  
-  pb_ResetTimer(&subtimer->timer);
-  subtimer->next = NULL;
-  
-  struct pb_SubTimerList *subtimerlist = timers->sub_timer_list[pb_Category];
-  if (subtimerlist == NULL) {
-    subtimerlist = (struct pb_SubTimerList *) malloc
-      (sizeof(struct pb_SubTimerList));
-    subtimerlist->subtimer_list = subtimer;
-    timers->sub_timer_list[pb_Category] = subtimerlist;
-  } else {
-    // Append to list
-    struct pb_SubTimer *element = subtimerlist->subtimer_list;
-    while (element->next != NULL) {
-      element = element->next;
+/* Current counts summed over the threads, scaled for multiplexing */
+static void
+read_counters(struct pb_Counters *c, double *counts)
+{
+  unsigned long long buf[3 + ev_COUNT];
+  int n, g, i;
+
+  for (i = 0; i < ev_COUNT; i++)
+    counts[i] = 0;
+
+  for (n = 0; n < c->nthreads; n++) {
+    struct counter_thread *t = &c->threads[n];
+    for (g = 0; g < COUNTER_GROUPS; g++) {
+      double scale;
+      if (t->leader[g] == -1)
+        continue;
+      if (read(t->leader[g], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(buf[0])))
+        continue;
+      /* buf: nr, time enabled, time running, values */
+      if (buf[2] == 0)
+        continue;
+      scale = (double)buf[1] / buf[2];
+      for (i = 0; i < (int)buf[0] && i < t->nmembers[g]; i++)
+        counts[t->members[g][i]] += buf[3 + i] * scale;
     }
-    element->next = subtimer;
   }
-  
 }
+#else
+static void
+read_counters(struct pb_Counters *c, double *counts)
+{
+  memset(counts, 0, ev_COUNT * sizeof(double));
+}
+#endif
 
-void
-pb_SwitchToSubTimer(struct pb_TimerSet *timers, char *label, enum pb_TimerID category)
+/* Make room for at least slots timers */
+static void
+grow_counter_slots(struct pb_Counters *c, int slots)
 {
+  int old = c->slots;
 
-// switchToSub( NULL, NONE
-// switchToSub( NULL, some
-// switchToSub( some, some
-// switchToSub( some, NONE -- tries to find "some" in NONE's sublist, which won't be printed
-  
-  struct pb_Timer *topLevelToStop = NULL;
-  if (timers->current != category && timers->current != pb_TimerID_NONE) {
-    // Switching to subtimer in a different category needs to stop the top-level current, different categoried timer.
-    // NONE shouldn't have a timer associated with it, so exclude from branch
-    topLevelToStop = &timers->timers[timers->current];
-  } 
-
-  struct pb_SubTimerList *subtimerlist = timers->sub_timer_list[timers->current];
-  struct pb_SubTimer *curr = (subtimerlist == NULL) ? NULL : subtimerlist->current;
-  
-  if (timers->current != pb_TimerID_NONE) {
-    if (curr != NULL && topLevelToStop != NULL) {
-      pb_StopTimerAndSubTimer(topLevelToStop, &curr->timer);
-    } else if (curr != NULL) {
-      pb_StopTimer(&curr->timer);
-    } else {
-      pb_StopTimer(topLevelToStop);
-    }
+  if (slots <= old)
+    return;
+  if (slots < 2 * old)
+    slots = 2 * old;
+
+  c->start = (double *) realloc(c->start, slots * ev_COUNT * sizeof(double));
+  c->total = (double *) realloc(c->total, slots * ev_COUNT * sizeof(double));
+  memset(c->start + old * ev_COUNT, 0, (slots - old) * ev_COUNT * sizeof(double));
+  memset(c->total + old * ev_COUNT, 0, (slots - old) * ev_COUNT * sizeof(double));
+  c->slots = slots;
+}
+
+static inline void
+start_counters_at(struct pb_Counters *c, int slot, const double *counts)
+{
+  memcpy(c->start + slot * ev_COUNT, counts, ev_COUNT * sizeof(double));
+}
+
+static inline void
+stop_counters_at(struct pb_Counters *c, int slot, const double *counts)
+{
+  int i;
+
+  for (i = 0; i < ev_COUNT; i++)
+    c->total[slot * ev_COUNT + i] += counts[i] - c->start[slot * ev_COUNT + i];
+}
+
+static void
+destroy_counters(struct pb_Counters *c)
+{
+  int n, g, i;
+
+  if (c == NULL)
+    return;
+  for (n = 0; n < c->nthreads; n++)
+    for (g = 0; g < COUNTER_GROUPS; g++)
+      for (i = 0; i < c->threads[n].nmembers[g]; i++)
+        close(c->threads[n].fds[g][i]);
+  free(c->threads);
+  free(c->start);
+  free(c->total);
+  free(c);
+}
+
+int
+pb_EnableCounters(struct pb_TimerSet *timers)
+{
+#ifdef __linux__
+  struct pb_Counters *c;
+  int fp_events = cpu_is_intel();
+  int g, i, opened = 0;
+
+  if (timers->counters != NULL)
+    return 0;
+
+  c = (struct pb_Counters *) calloc(1, sizeof(struct pb_Counters));
+#ifdef _OPENMP
+  c->nthreads = omp_get_max_threads();
+#else
+  c->nthreads = 1;
+#endif
+  c->threads = (struct counter_thread *) calloc(c->nthreads, sizeof(struct counter_thread));
+
+  /* perf_event counts the thread that opens it, so every thread of the
+   * team opens its own groups */
+#ifdef _OPENMP
+  #pragma omp parallel num_threads(c->nthreads)
+  open_counter_thread(&c->threads[omp_get_thread_num()], fp_events);
+#else
+  open_counter_thread(&c->threads[0], fp_events);
+#endif
+
+  /* An event is reported if the master thread could open it */
+  for (g = 0; g < COUNTER_GROUPS; g++)
+    for (i = 0; i < c->threads[0].nmembers[g]; i++)
+      c->available[c->threads[0].members[g][i]] = 1;
+  for (i = 0; i < ev_COUNT; i++)
+    opened += c->available[i];
+
+  if (opened == 0) {
+    perror("Hardware counters unavailable, recording time only");
+    destroy_counters(c);
+    return 0;
   }
-  
-  subtimerlist = timers->sub_timer_list[category];
-  struct pb_SubTimer *subtimer = NULL;
-  
-  if (label != NULL) {  
-    subtimer = subtimerlist->subtimer_list;
-    while (subtimer != NULL) {
-      if (strcmp(subtimer->label, label) == 0) {
-        break;
-      } else {
-        subtimer = subtimer->next;
-      }
-    }
-  }  
-  
-  if (category != pb_TimerID_NONE) {
-    
-    if (subtimerlist != NULL) {
-      subtimerlist->current = subtimer;
-    }
-    
-    if (category != timers->current && subtimer != NULL) {
-      pb_StartTimerAndSubTimer(&timers->timers[category], &subtimer->timer);
-    } else if (subtimer != NULL) {
-      // Same category, different non-NULL subtimer
-      pb_StartTimer(&subtimer->timer);
-    } else{
-      // Different category, but no subtimer (not found or specified as NULL) -- unprefered way of setting topLevel timer
-      pb_StartTimer(&timers->timers[category]);
-    }
-  }  
-  
-  timers->current = category;
-  
+
+  grow_counter_slots(c, pb_TimerID_LAST + timers->sub_timer_capacity);
+  timers->counters = c;
+  return opened;
+#else
+  fputs("Hardware counters unavailable on this platform, recording time only\n", stderr);
+  return 0;
+#endif
 }
 
-void
-pb_SwitchToTimer(struct pb_TimerSet *timers, enum pb_TimerID timer)
+/* One line of counter totals and derived rates for a timer */
+static void
+print_counters(struct pb_Counters *c, int slot, double seconds)
 {
-  /* Stop the currently running timer */
-  if (timers->current != pb_TimerID_NONE) {
-    struct pb_SubTimer *currSubTimer = NULL;
-    struct pb_SubTimerList *subtimerlist = timers->sub_timer_list[timers->current];
-    
-    if ( subtimerlist != NULL) {
-      currSubTimer = timers->sub_timer_list[timers->current]->current;
-    }
-    if ( currSubTimer!= NULL) {
-      pb_StopTimerAndSubTimer(&timers->timers[timers->current], &currSubTimer->timer);
-    } else {
-      pb_StopTimer(&timers->timers[timers->current]);
+  const double *v = c->total + slot * ev_COUNT;
+  double flops = 0, vector = 0;
+  int i;
+
+  printf("            ");
+  if (c->available[ev_CYCLES] && c->available[ev_INSTRUCTIONS])
+    printf("cycles %.4g, instructions %.4g, IPC %.2f",
+           v[ev_CYCLES], v[ev_INSTRUCTIONS],
+           v[ev_CYCLES] > 0 ? v[ev_INSTRUCTIONS] / v[ev_CYCLES] : 0);
+  else
+    printf("cycles n/a, instructions n/a");
+
+  if (c->available[ev_LLC_MISSES])
+    printf(", LLC misses %.4g (%.2f GB/s)", v[ev_LLC_MISSES],
+           seconds > 0 ? v[ev_LLC_MISSES] * 64 / seconds * 1e-9 : 0);
+  else
+    printf(", LLC misses n/a");
+
+  if (c->available[ev_FP_SCALAR]) {
+    for (i = ev_FP_SCALAR; i <= ev_FP_256S; i++) {
+#ifdef __linux__
+      flops += v[i] * counter_events[i].flops;
+#endif
+      if (i != ev_FP_SCALAR)
+        vector += v[i];
     }
-    
+    printf(", FP vector %.4g (%.2f GFLOPS)", vector,
+           seconds > 0 ? flops / seconds * 1e-9 : 0);
+  } else {
+    printf(", FP n/a");
   }
 
-  timers->current = timer;
+  if (c->available[ev_DTLB_LOAD_MISSES])
+    printf(", dTLB misses %.4g (%.2f per 1k instructions)",
+           v[ev_DTLB_LOAD_MISSES] + v[ev_DTLB_STORE_MISSES],
+           v[ev_INSTRUCTIONS] > 0 ?
+           (v[ev_DTLB_LOAD_MISSES] + v[ev_DTLB_STORE_MISSES]) * 1000 / v[ev_INSTRUCTIONS] : 0);
+  else
+    printf(", dTLB n/a");
+  if (c->available[ev_PAGE_FAULTS])
+    printf(", page faults %.4g", v[ev_PAGE_FAULTS]);
+  printf("\n");
+}
 
-  if (timer != pb_TimerID_NONE) {
-    pb_StartTimer(&timers->timers[timer]);
-  }
+/* RAPL energy.  The package, core (PP0) and DRAM energy counters of
+ * every socket are read from the powercap tree (energy_uj) with one
+ * pread per zone per switch.  The counters wrap at max_energy_range_uj,
+ * so every read folds the difference to the previous one into a running
+ * total; a switch at least once per wrap period (about a minute at full
+ * load) keeps that exact.  Any directory laid out like
+ * /sys/class/powercap can stand in for it, which is how the attribution
+ * is tested on machines without RAPL. */
+
+enum energy_domain {
+  energy_PKG,
+  energy_PP0,
+  energy_DRAM,
+  energy_DOMAINS
+};
+
+static const char *energy_names[energy_DOMAINS] = { "package", "core", "dram" };
+
+#define ENERGY_MAX_ZONES 32
+
+struct energy_zone {
+  int fd;			/* energy_uj, kept open */
+  enum energy_domain domain;
+  unsigned long long max_range;	/* Wraparound value, in uJ */
+  unsigned long long last;	/* Previous reading, in uJ */
+};
+
+struct pb_Energy {
+  int nzones;
+  struct energy_zone zones[ENERGY_MAX_ZONES];
+  int available[energy_DOMAINS];
+  double joules[energy_DOMAINS];	/* Unwrapped, since enabling */
+  double start[pb_TimerID_LAST][energy_DOMAINS];
+  double total[pb_TimerID_LAST][energy_DOMAINS];
+};
+
+static int
+read_zone_file(int fd, unsigned long long *value)
+{
+  char buf[32];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  *value = strtoull(buf, NULL, 10);
+  return 0;
 }
 
-void
-pb_PrintTimerSet(struct pb_TimerSet *timers)
+/* Open the energy counter of the zone in directory dir if it is one of
+ * the tracked domains */
+static void
+open_energy_zone(struct pb_Energy *e, const char *dir)
 {
+  char path[512], name[64];
+  struct energy_zone *zone;
+  unsigned long long value;
+  int fd, n;
 
-  pb_Timestamp wall_end = get_time();
+  if (e->nzones == ENERGY_MAX_ZONES)
+    return;
+  zone = &e->zones[e->nzones];
 
-  struct pb_Timer *t = timers->timers;
-  struct pb_SubTimer* sub = NULL;
-  
-  int maxSubLength;
-    
-  const char *categories[] = {
-    "IO", "Kernel", "Copy", "Driver", "Copy Async", "Compute"
-  };
-  
-  const int maxCategoryLength = 10;
+  snprintf(path, sizeof(path), "%s/name", dir);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return;
+  n = read(fd, name, sizeof(name) - 1);
+  close(fd);
+  if (n <= 0)
+    return;
+  name[n] = '\0';
+
+  if (strncmp(name, "package", 7) == 0)
+    zone->domain = energy_PKG;
+  else if (strncmp(name, "core", 4) == 0)
+    zone->domain = energy_PP0;
+  else if (strncmp(name, "dram", 4) == 0)
+    zone->domain = energy_DRAM;
+  else
+    return;
+
+  snprintf(path, sizeof(path), "%s/max_energy_range_uj", dir);
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return;
+  n = read_zone_file(fd, &zone->max_range);
+  close(fd);
+  if (n != 0)
+    return;
+
+  snprintf(path, sizeof(path), "%s/energy_uj", dir);
+  if ((zone->fd = open(path, O_RDONLY)) < 0)
+    return;
+  if (read_zone_file(zone->fd, &value) != 0) {
+    close(zone->fd);
+    return;
+  }
+
+  zone->last = value;
+  e->available[zone->domain] = 1;
+  e->nzones++;
+}
+
+/* Running energy totals in joules */
+static void
+read_energy(struct pb_Energy *e, double *joules)
+{
+  unsigned long long value, delta;
+  int z;
+
+  for (z = 0; z < e->nzones; z++) {
+    struct energy_zone *zone = &e->zones[z];
+    if (read_zone_file(zone->fd, &value) != 0)
+      continue;
+    /* The counter runs from 0 to max_range inclusive */
+    delta = (value >= zone->last) ? value - zone->last
+      : value + zone->max_range + 1 - zone->last;
+    zone->last = value;
+    e->joules[zone->domain] += delta * 1e-6;
+  }
+
+  memcpy(joules, e->joules, sizeof(e->joules));
+}
+
+int
+pb_EnableEnergy(struct pb_TimerSet *timers, const char *root)
+{
+  struct pb_Energy *e;
+  char dir[512];
+  int pkg, sub, d, domains = 0;
+
+  if (timers->energy != NULL)
+    return 0;
+  if (root == NULL)
+    root = "/sys/class/powercap";
+
+  e = (struct pb_Energy *) calloc(1, sizeof(struct pb_Energy));
+
+  // intel-rapl:N is a package, intel-rapl:N:M its core/uncore/dram zones
+  for (pkg = 0; pkg < ENERGY_MAX_ZONES; pkg++) {
+    snprintf(dir, sizeof(dir), "%s/intel-rapl:%d", root, pkg);
+    if (access(dir, F_OK) != 0)
+      break;
+    open_energy_zone(e, dir);
+    for (sub = 0; sub < 8; sub++) {
+      snprintf(dir, sizeof(dir), "%s/intel-rapl:%d/intel-rapl:%d:%d", root, pkg, pkg, sub);
+      if (access(dir, F_OK) != 0)
+        break;
+      open_energy_zone(e, dir);
+    }
+  }
+
+  for (d = 0; d < energy_DOMAINS; d++)
+    domains += e->available[d];
+
+  if (domains == 0) {
+    fprintf(stderr, "No readable RAPL energy counters under %s, recording time only\n", root);
+    free(e);
+    return 0;
+  }
+
+  timers->energy = e;
+  return domains;
+}
+
+static void
+destroy_energy(struct pb_Energy *e)
+{
+  int z;
+
+  if (e == NULL)
+    return;
+  for (z = 0; z < e->nzones; z++)
+    close(e->zones[z].fd);
+  free(e);
+}
+
+static void
+print_energy(struct pb_Energy *e, int category, double seconds)
+{
+  int d;
+
+  printf("            energy");
+  for (d = 0; d < energy_DOMAINS; d++) {
+    if (!e->available[d])
+      continue;
+    printf(" %s %.3f J (%.2f W)", energy_names[d], e->total[category][d],
+           seconds > 0 ? e->total[category][d] / seconds : 0);
+  }
+  printf("\n");
+}
+
+/* Open-addressing hash of (category, label) -> sub-timer ID */
+struct pb_SubTimerIndex {
+  int capacity;			/* Power of two */
+  pb_SubTimerID *slots;		/* pb_SubTimerID_NONE if empty */
+};
+
+static unsigned int
+label_hash(const char *label, enum pb_TimerID category)
+{
+  unsigned int h = 2166136261u ^ (unsigned int)category;
+
+  while (*label) {
+    h ^= (unsigned char)*label++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static pb_SubTimerID
+find_sub_timer(struct pb_TimerSet *timers, const char *label, enum pb_TimerID category)
+{
+  struct pb_SubTimerIndex *index = timers->index;
+  unsigned int slot;
+  pb_SubTimerID id;
+
+  if (index == NULL)
+    return pb_SubTimerID_NONE;
+
+  slot = label_hash(label, category) & (index->capacity - 1);
+  while ((id = index->slots[slot]) != pb_SubTimerID_NONE) {
+    struct pb_SubTimer *sub = timers->sub_timers[id];
+    if (sub->category == category && strcmp(sub->label, label) == 0)
+      return id;
+    slot = (slot + 1) & (index->capacity - 1);
+  }
+  return pb_SubTimerID_NONE;
+}
+
+static void
+index_sub_timer(struct pb_TimerSet *timers, pb_SubTimerID id)
+{
+  struct pb_SubTimerIndex *index = timers->index;
+  struct pb_SubTimer *sub = timers->sub_timers[id];
+  unsigned int slot;
+
+  slot = label_hash(sub->label, sub->category) & (index->capacity - 1);
+  while (index->slots[slot] != pb_SubTimerID_NONE)
+    slot = (slot + 1) & (index->capacity - 1);
+  index->slots[slot] = id;
+}
+
+/* Keep the index at most half full */
+static void
+grow_index(struct pb_TimerSet *timers)
+{
+  struct pb_SubTimerIndex *index = timers->index;
+  int capacity = index->capacity ? 2 * index->capacity : 16;
+  pb_SubTimerID id;
+  int i;
+
+  free(index->slots);
+  index->slots = (pb_SubTimerID *) malloc(capacity * sizeof(pb_SubTimerID));
+  index->capacity = capacity;
+  for (i = 0; i < capacity; i++)
+    index->slots[i] = pb_SubTimerID_NONE;
+  for (id = 0; id < timers->sub_timer_count; id++)
+    index_sub_timer(timers, id);
+}
+
+static void
+initialize_timer_set(struct pb_TimerSet *timers)
+{
+  int n;
+
+  initialize_clock();
+
+  timers->wall_begin = get_time();
+
+  timers->current = pb_TimerID_NONE;
+
+  timers->async_markers = NULL;
+
+
+  for (n = 0; n < pb_TimerID_LAST; n++) {
+    pb_ResetTimer(&timers->timers[n]);
+    timers->sub_timer_list[n] = NULL; // free first?
+  }
+
+  timers->sub_timers = NULL;
+  timers->sub_timer_count = 0;
+  timers->sub_timer_capacity = 0;
+  timers->current_sub = pb_SubTimerID_NONE;
+  timers->index = NULL;
+  timers->thread_sets = NULL;
+  timers->thread_count = 0;
+  timers->parent = NULL;
+  timers->counters = NULL;
+  timers->energy = NULL;
+}
+
+void
+pb_InitializeTimerSet(struct pb_TimerSet *timers)
+{
+  const char *energy = getenv("PB_ENERGY");
+
+  initialize_timer_set(timers);
+
+  if (getenv("PB_COUNTERS") != NULL)
+    pb_EnableCounters(timers);
+  if (energy != NULL) {
+    struct stat st;
+    pb_EnableEnergy(timers, (stat(energy, &st) == 0 && S_ISDIR(st.st_mode)) ? energy : NULL);
+  }
+}
+
+pb_SubTimerID
+pb_InternSubTimer(struct pb_TimerSet *timers, const char *label, enum pb_TimerID category)
+{
+  struct pb_SubTimer *subtimer;
+  struct pb_SubTimerList *subtimerlist;
+  pb_SubTimerID id;
+
+  if (timers->parent != NULL) {
+    fputs("Sub-timers must be added to the main timer set\n", stderr);
+    return pb_SubTimerID_NONE;
+  }
+
+  id = find_sub_timer(timers, label, category);
+  if (id != pb_SubTimerID_NONE)
+    return id;
+
+  subtimer = (struct pb_SubTimer *) malloc(sizeof(struct pb_SubTimer));
+  subtimer->label = (char *) malloc(strlen(label) + 1);
+  strcpy(subtimer->label, label);
+  pb_ResetTimer(&subtimer->timer);
+  subtimer->next = NULL;
+  subtimer->category = category;
+
+  // Append to the list of its category, which keeps the print order
+  subtimerlist = timers->sub_timer_list[category];
+  if (subtimerlist == NULL) {
+    subtimerlist = (struct pb_SubTimerList *) malloc
+      (sizeof(struct pb_SubTimerList));
+    subtimerlist->current = NULL;
+    subtimerlist->subtimer_list = subtimer;
+    timers->sub_timer_list[category] = subtimerlist;
+  } else {
+    struct pb_SubTimer *element = subtimerlist->subtimer_list;
+    while (element->next != NULL) {
+      element = element->next;
+    }
+    element->next = subtimer;
+  }
+
+  if (timers->sub_timer_count == timers->sub_timer_capacity) {
+    timers->sub_timer_capacity = timers->sub_timer_capacity ? 2 * timers->sub_timer_capacity : 8;
+    timers->sub_timers = (struct pb_SubTimer **) realloc
+      (timers->sub_timers, timers->sub_timer_capacity * sizeof(struct pb_SubTimer *));
+  }
+  id = timers->sub_timer_count++;
+  timers->sub_timers[id] = subtimer;
+
+  if (timers->index == NULL) {
+    timers->index = (struct pb_SubTimerIndex *) calloc(1, sizeof(struct pb_SubTimerIndex));
+  }
+  if (2 * timers->sub_timer_count > timers->index->capacity) {
+    grow_index(timers);
+  } else {
+    index_sub_timer(timers, id);
+  }
+
+  return id;
+}
+
+void
+pb_AddSubTimer(struct pb_TimerSet *timers, char *label, enum pb_TimerID pb_Category) {
+  pb_InternSubTimer(timers, label, pb_Category);
+}
+
+/* Stop what is running and start category and sub-timer id, all at the
+ * same timestamp.  Timers that keep running are left alone. */
+static void
+switch_timers(struct pb_TimerSet *timers, enum pb_TimerID category, pb_SubTimerID id)
+{
+  struct pb_Counters *c = timers->counters;
+  struct pb_Energy *e = timers->energy;
+  double counts[ev_COUNT];
+  double joules[energy_DOMAINS];
+  pb_Timestamp now;
+  int i;
+
+  if (c != NULL) {
+    read_counters(c, counts);
+    grow_counter_slots(c, pb_TimerID_LAST + timers->sub_timer_count);
+  }
+  if (e != NULL)
+    read_energy(e, joules);
+  now = get_time();
+
+  if (timers->current != pb_TimerID_NONE) {
+    if (timers->current_sub != pb_SubTimerID_NONE && timers->current_sub != id) {
+      stop_timer_at(&timers->sub_timers[timers->current_sub]->timer, now);
+      if (c != NULL)
+        stop_counters_at(c, pb_TimerID_LAST + timers->current_sub, counts);
+    }
+    if (timers->current != category) {
+      stop_timer_at(&timers->timers[timers->current], now);
+      if (c != NULL)
+        stop_counters_at(c, timers->current, counts);
+      if (e != NULL)
+        for (i = 0; i < energy_DOMAINS; i++)
+          e->total[timers->current][i] += joules[i] - e->start[timers->current][i];
+    }
+  }
+
+  if (category != pb_TimerID_NONE) {
+    if (timers->current != category) {
+      start_timer_at(&timers->timers[category], now);
+      if (c != NULL)
+        start_counters_at(c, category, counts);
+      if (e != NULL)
+        memcpy(e->start[category], joules, sizeof(joules));
+    }
+    if (id != pb_SubTimerID_NONE && id != timers->current_sub) {
+      start_timer_at(&timers->sub_timers[id]->timer, now);
+      if (c != NULL)
+        start_counters_at(c, pb_TimerID_LAST + id, counts);
+    }
+  } else {
+    id = pb_SubTimerID_NONE;
+  }
+
+  timers->current = category;
+  timers->current_sub = id;
+}
+
+void
+pb_SwitchToSubTimer(struct pb_TimerSet *timers, char *label, enum pb_TimerID category)
+{
+  // A label that is not found behaves like NULL: only the category runs
+  pb_SubTimerID id = (label == NULL) ? pb_SubTimerID_NONE
+    : find_sub_timer(timers, label, category);
+
+  switch_timers(timers, category, id);
+}
+
+void
+pb_SwitchToSubTimerID(struct pb_TimerSet *timers, pb_SubTimerID id)
+{
+  if (id == pb_SubTimerID_NONE) {
+    switch_timers(timers, timers->current, pb_SubTimerID_NONE);
+    return;
+  }
+
+  if (id < 0 || id >= timers->sub_timer_count) {
+    fputs("Ignoring switch to an unknown sub-timer\n", stderr);
+    return;
+  }
+
+  switch_timers(timers, timers->sub_timers[id]->category, id);
+}
+
+void
+pb_SwitchToTimer(struct pb_TimerSet *timers, enum pb_TimerID timer)
+{
+  switch_timers(timers, timer, pb_SubTimerID_NONE);
+}
+
+static void
+destroy_thread_timer_sets(struct pb_TimerSet *timers)
+{
+  int t;
+
+  for (t = 0; t < timers->thread_count; t++) {
+    struct pb_TimerSet *set = timers->thread_sets[t];
+    if (set->sub_timer_count > 0)
+      free(set->sub_timers[0]);
+    free(set->sub_timers);
+    free(set);
+  }
+  free(timers->thread_sets);
+  timers->thread_sets = NULL;
+  timers->thread_count = 0;
+}
+
+void
+pb_InitializeThreadTimerSets(struct pb_TimerSet *timers, int nthreads)
+{
+  int count = timers->sub_timer_count;
+  int t, id;
+
+  destroy_thread_timer_sets(timers);
+
+  timers->thread_sets = (struct pb_TimerSet **) malloc
+    (nthreads * sizeof(struct pb_TimerSet *));
+  timers->thread_count = nthreads;
+
+  for (t = 0; t < nthreads; t++) {
+    struct pb_TimerSet *set;
+    struct pb_SubTimer *subs;
+    void *p;
+
+    // A cache line of its own for every set, threads switch them concurrently
+    if (posix_memalign(&p, 64, (sizeof(struct pb_TimerSet) + 63) & ~(size_t)63) != 0) {
+      fputs("Cannot allocate thread timer sets\n", stderr);
+      exit(-1);
+    }
+    set = (struct pb_TimerSet *) p;
+    initialize_timer_set(set);
+    set->parent = timers;
+    set->index = timers->index;
+
+    // Same IDs as the main set; labels are borrowed from it
+    set->sub_timer_count = set->sub_timer_capacity = count;
+    if (count > 0) {
+      set->sub_timers = (struct pb_SubTimer **) malloc(count * sizeof(struct pb_SubTimer *));
+      subs = (struct pb_SubTimer *) malloc(count * sizeof(struct pb_SubTimer));
+      for (id = 0; id < count; id++) {
+        subs[id].label = timers->sub_timers[id]->label;
+        subs[id].category = timers->sub_timers[id]->category;
+        subs[id].next = NULL;
+        pb_ResetTimer(&subs[id].timer);
+        set->sub_timers[id] = &subs[id];
+      }
+    }
+
+    timers->thread_sets[t] = set;
+  }
+}
+
+struct pb_TimerSet *
+pb_GetThreadTimerSet(struct pb_TimerSet *timers, int tid)
+{
+  if (tid < 0 || tid >= timers->thread_count)
+    return NULL;
+  return timers->thread_sets[tid];
+}
+
+/* Total, mean and maximum of one timer over all per-thread sets; id
+ * selects a sub-timer, or the category timer if it is NONE */
+static double
+merge_thread_timers(struct pb_TimerSet *timers, enum pb_TimerID category,
+		    pb_SubTimerID id, double *max)
+{
+  double total = 0, t;
+  int n;
+
+  *max = 0;
+  for (n = 0; n < timers->thread_count; n++) {
+    struct pb_TimerSet *set = timers->thread_sets[n];
+    t = (id == pb_SubTimerID_NONE) ? pb_GetElapsedTime(&set->timers[category])
+      : pb_GetElapsedTime(&set->sub_timers[id]->timer);
+    total += t;
+    if (t > *max)
+      *max = t;
+  }
+  return total;
+}
+
+static pb_SubTimerID
+sub_timer_id(struct pb_TimerSet *timers, struct pb_SubTimer *sub)
+{
+  pb_SubTimerID id;
+
+  for (id = 0; id < timers->sub_timer_count; id++)
+    if (timers->sub_timers[id] == sub)
+      return id;
+  return pb_SubTimerID_NONE;
+}
+
+static void
+print_thread_timers(struct pb_TimerSet *timers, const char **categories,
+		    int maxCategoryLength)
+{
+  double total, max;
+  int maxSubLength;
+  int i, id;
+
+  printf("Threads   : %d (total, mean, max)\n", timers->thread_count);
+
+  for (i = 1; i < pb_TimerID_LAST-1; ++i) {
+    enum pb_TimerID category = (enum pb_TimerID)i;
+
+    total = merge_thread_timers(timers, category, pb_SubTimerID_NONE, &max);
+    if (total == 0)
+      continue;
+
+    printf("%-*s: %f %f %f\n", maxCategoryLength, categories[i-1],
+           total, total / timers->thread_count, max);
+
+    maxSubLength = maxCategoryLength;
+    for (id = 0; id < timers->sub_timer_count; id++) {
+      if (timers->sub_timers[id]->category == category &&
+          (int)strlen(timers->sub_timers[id]->label) > maxSubLength)
+        maxSubLength = strlen(timers->sub_timers[id]->label);
+    }
+
+    for (id = 0; id < timers->sub_timer_count; id++) {
+      if (timers->sub_timers[id]->category != category)
+        continue;
+      total = merge_thread_timers(timers, category, id, &max);
+      printf(" -%-*s: %f %f %f\n", maxSubLength, timers->sub_timers[id]->label,
+             total, total / timers->thread_count, max);
+    }
+  }
+}
+
+void
+pb_PrintTimerSet(struct pb_TimerSet *timers)
+{
+
+  pb_Timestamp wall_end = get_time();
+
+  struct pb_Timer *t = timers->timers;
+  struct pb_SubTimer* sub = NULL;
+  
+  int maxSubLength;
+    
+  const char *categories[] = {
+    "IO", "Kernel", "Copy", "Driver", "Copy Async", "Compute"
+  };
+  
+  const int maxCategoryLength = 10;
   
   int i;
+
+  if (timers->counters != NULL)
+    grow_counter_slots(timers->counters, pb_TimerID_LAST + timers->sub_timer_count);
   for(i = 1; i < pb_TimerID_LAST-1; ++i) { // exclude NONE and OVRELAP from this format
     if(pb_GetElapsedTime(&t[i]) != 0) {
     
       // Print Category Timer
       printf("%-*s: %f\n", maxCategoryLength, categories[i-1], pb_GetElapsedTime(&t[i]));
+      if (timers->counters != NULL)
+        print_counters(timers->counters, i, pb_GetElapsedTime(&t[i]));
+      if (timers->energy != NULL)
+        print_energy(timers->energy, i, pb_GetElapsedTime(&t[i]));
       
       if (timers->sub_timer_list[i] != NULL) {
         sub = timers->sub_timer_list[i]->subtimer_list;
@@ -591,6 +1438,9 @@ pb_PrintTimerSet(struct pb_TimerSet *timers)
         // Print SubTimers
         while (sub != NULL) {
           printf(" -%-*s: %f\n", maxSubLength, sub->label, pb_GetElapsedTime(&sub->timer));
+          if (timers->counters != NULL && pb_GetElapsedTime(&sub->timer) != 0)
+            print_counters(timers->counters, pb_TimerID_LAST + sub_timer_id(timers, sub),
+                           pb_GetElapsedTime(&sub->timer));
           sub = sub->next;
         }
       }
@@ -600,7 +1450,10 @@ pb_PrintTimerSet(struct pb_TimerSet *timers)
   if(pb_GetElapsedTime(&t[pb_TimerID_OVERLAP]) != 0)
     printf("CPU/Kernel Overlap: %f\n", pb_GetElapsedTime(&t[pb_TimerID_OVERLAP]));
         
-  float walltime = (wall_end - timers->wall_begin)/ 1e6;
+  if (timers->thread_count > 0)
+    print_thread_timers(timers, categories, maxCategoryLength);
+
+  float walltime = (wall_end - timers->wall_begin) * tick_seconds;
   printf("Timer Wall Time: %f\n", walltime);  
   
 }
@@ -630,6 +1483,1173 @@ void pb_DestroyTimerSet(struct pb_TimerSet * timers)
       free(timers->sub_timer_list[i]);
     }
   }
+
+  destroy_thread_timer_sets(timers);
+  destroy_counters(timers->counters);
+  timers->counters = NULL;
+  destroy_energy(timers->energy);
+  timers->energy = NULL;
+  free(timers->sub_timers);
+  if (timers->index != NULL) {
+    free(timers->index->slots);
+    free(timers->index);
+  }
+}
+
+
+
+/*****************************************************************************/
+/* Benchmark harness */
+
+/* Samples kept before batches are made longer */
+#define HARNESS_MAX_SAMPLES (1 << 22)
+
+static double
+monotonic_seconds()
+{
+  return get_time() * tick_seconds;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Linear interpolation between the closest ranks of a sorted array */
+static double
+percentile(double *sorted, int n, double q)
+{
+  double r = q * (n - 1);
+  int i = (int)r;
+
+  if (i >= n - 1)
+    return sorted[n - 1];
+  return sorted[i] + (r - i) * (sorted[i + 1] - sorted[i]);
+}
+
+/* Two-sided 95% Student t quantile */
+static double
+t_quantile(int df)
+{
+  static const double t[] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+    2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+    2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045
+  };
+
+  if (df < 1)
+    return 0;
+  if (df < 30)
+    return t[df];
+  return 1.96;
+}
+
+static double
+coefficient_of_variation(double *x, int n)
+{
+  double mean = 0, var = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    mean += x[i];
+  mean /= n;
+  for (i = 0; i < n; i++)
+    var += (x[i] - mean) * (x[i] - mean);
+  if (n < 2 || mean <= 0)
+    return 0;
+  return sqrt(var / (n - 1)) / mean;
+}
+
+int
+pb_InitHarnessConfig(struct pb_HarnessConfig *config)
+{
+  const char *env_secs = getenv("SECS");
+  const char *env_itrs = getenv("ITERS");
+
+  config->target_secs = (env_secs != NULL) ? atof(env_secs) : 0;
+  config->iterations = (env_itrs != NULL) ? atoi(env_itrs) : 0;
+  config->min_warmup = 3;
+  config->max_warmup = 100000;
+  config->max_warmup_secs = config->target_secs > 4 ? 0.25 * config->target_secs : 1;
+  config->window = 10;
+  config->cv_threshold = 0.05;
+  config->min_sample = 1e-4;
+
+  if (config->target_secs <= 0 && config->iterations <= 0) {
+    fprintf(stderr, "You must set a time larger than 0 seconds!\n");
+    return -1;
+  }
+  return 0;
+}
+
+int
+pb_RunHarness(struct pb_HarnessConfig *config,
+	      pb_KernelFunc kernel, void *arg,
+	      struct pb_HarnessResult *result)
+{
+  int window = config->window > 1 ? config->window : 2;
+  double *recent = (double *)malloc(window * sizeof(double));
+  double *sorted;
+  double begin, start, end, estimate, sum, var;
+  int n, i, j, lo, hi;
+
+  initialize_clock();
+  memset(result, 0, sizeof(*result));
+  if (recent == NULL) {
+    fprintf(stderr, "Cannot allocate harness samples\n");
+    return -1;
+  }
+
+  /* Warm-up: until the last window of samples is stable, bounded in
+   * iterations and time */
+  begin = monotonic_seconds();
+  for (i = 0; i < config->max_warmup; i++) {
+    start = monotonic_seconds();
+    kernel(arg);
+    end = monotonic_seconds();
+    recent[i % window] = end - start;
+    if (i == 0)
+      result->cold = end - start;
+
+    n = i + 1 < window ? i + 1 : window;
+    result->warmup_cv = coefficient_of_variation(recent, n);
+    if (i + 1 >= config->min_warmup && n == window &&
+        result->warmup_cv < config->cv_threshold) {
+      result->stable = 1;
+      i++;
+      break;
+    }
+    if (end - begin > config->max_warmup_secs) {
+      i++;
+      break;
+    }
+  }
+  result->warmup = i;
+
+  /* Calibration: the mean of the last window estimates one call */
+  n = result->warmup < window ? result->warmup : window;
+  estimate = 0;
+  for (i = 0; i < n; i++)
+    estimate += recent[i] / n;
+  if (estimate < 1e-9)
+    estimate = 1e-9;
+  free(recent);
+
+  if (config->iterations > 0) {
+    result->batch = 1;
+    result->nsamples = config->iterations;
+  } else {
+    result->batch = estimate < config->min_sample ?
+      (int)ceil(config->min_sample / estimate) : 1;
+    if (config->target_secs / (estimate * result->batch) > HARNESS_MAX_SAMPLES)
+      result->batch = (int)ceil(config->target_secs / (estimate * HARNESS_MAX_SAMPLES));
+    result->nsamples = (int)ceil(config->target_secs / (estimate * result->batch));
+    if (result->nsamples < 1)
+      result->nsamples = 1;
+  }
+  result->iterations = result->nsamples * result->batch;
+
+  /* Measured run */
+  result->samples = (double *)malloc(2 * result->nsamples * sizeof(double));
+  if (result->samples == NULL) {
+    fprintf(stderr, "Cannot allocate %d harness samples\n", result->nsamples);
+    return -1;
+  }
+  begin = monotonic_seconds();
+  for (i = 0; i < result->nsamples; i++) {
+    start = monotonic_seconds();
+    for (j = 0; j < result->batch; j++)
+      kernel(arg);
+    end = monotonic_seconds();
+    result->samples[i] = (end - start) / result->batch;
+  }
+  result->total = monotonic_seconds() - begin;
+
+  /* Statistics, on a sorted copy behind the samples */
+  n = result->nsamples;
+  sorted = result->samples + n;
+  memcpy(sorted, result->samples, n * sizeof(double));
+  qsort(sorted, n, sizeof(double), compare_double);
+
+  sum = 0;
+  for (i = 0; i < n; i++)
+    sum += sorted[i];
+  result->mean = sum / n;
+  var = 0;
+  for (i = 0; i < n; i++)
+    var += (sorted[i] - result->mean) * (sorted[i] - result->mean);
+  result->stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+
+  result->min = sorted[0];
+  result->max = sorted[n - 1];
+  result->median = percentile(sorted, n, 0.5);
+  result->p95 = percentile(sorted, n, 0.95);
+  result->p99 = percentile(sorted, n, 0.99);
+
+  result->mean_lo = result->mean - t_quantile(n - 1) * result->stddev / sqrt(n);
+  result->mean_hi = result->mean + t_quantile(n - 1) * result->stddev / sqrt(n);
+
+  /* Distribution-free interval from order statistics (normal
+   * approximation of the binomial ranks) */
+  lo = (int)floor((n - 1.96 * sqrt(n)) / 2) - 1;
+  hi = (int)ceil(1 + (n + 1.96 * sqrt(n)) / 2) - 1;
+  result->median_lo = sorted[lo > 0 ? lo : 0];
+  result->median_hi = sorted[hi < n - 1 ? hi : n - 1];
+
+  return 0;
+}
+
+void
+pb_PrintHarnessResult(const char *name, struct pb_HarnessResult *result)
+{
+  printf("[HARNESS]:%s\n", name);
+  printf("Warm-up %d itrs, CV %.2f%% (%s).\n", result->warmup,
+         result->warmup_cv * 100, result->stable ? "stable" : "not stable");
+  printf("Cold run %lf ms, %.2fx the median.\n", result->cold * 1000,
+         result->median > 0 ? result->cold / result->median : 0);
+  printf("Measured %d itrs in %d samples of %d, %lf s.\n", result->iterations,
+         result->nsamples, result->batch, result->total);
+  printf("iterated %d times, average time is %lf ms.\n", result->iterations,
+         result->mean * 1000);
+  printf("median %lf ms, p95 %lf ms, p99 %lf ms, min %lf ms, max %lf ms.\n",
+         result->median * 1000, result->p95 * 1000, result->p99 * 1000,
+         result->min * 1000, result->max * 1000);
+  printf("95%% CI: mean [%lf, %lf] ms, median [%lf, %lf] ms.\n",
+         result->mean_lo * 1000, result->mean_hi * 1000,
+         result->median_lo * 1000, result->median_hi * 1000);
+}
+
+void
+pb_FreeHarnessResult(struct pb_HarnessResult *result)
+{
+  free(result->samples);
+  result->samples = NULL;
+}
+
+/*****************************************************************************/
+/* Machine-readable results */
+
+static const char *result_categories[pb_TimerID_LAST] = {
+  NULL, "io", "kernel", "copy", "driver", "copy_async", "compute", "overlap"
+};
+
+/* A growing line of output */
+struct result_line {
+  char *buf;
+  size_t len, cap;
+};
+
+static void
+append(struct result_line *line, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  for (;;) {
+    va_start(ap, fmt);
+    n = vsnprintf(line->buf + line->len, line->cap - line->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      return;
+    if (line->len + n < line->cap)
+      break;
+    line->cap = 2 * (line->len + n + 1);
+    line->buf = (char *) realloc(line->buf, line->cap);
+  }
+  line->len += n;
+}
+
+/* A number, or an empty CSV field / JSON null if it is unknown */
+static void
+append_number(struct result_line *line, int json, double x)
+{
+  if (isfinite(x))
+    append(line, "%.9g", x);
+  else if (json)
+    append(line, "null");
+}
+
+static void
+append_string(struct result_line *line, int json, const char *s)
+{
+  append(line, "\"");
+  for (; *s; s++) {
+    if (json && (*s == '"' || *s == '\\'))
+      append(line, "\\%c", *s);
+    else if (json && (unsigned char)*s < 0x20)
+      append(line, "\\u%04x", *s);
+    else if (!json && *s == '"')
+      append(line, "\"\"");
+    else
+      append(line, "%c", *s);
+  }
+  append(line, "\"");
+}
+
+void
+pb_InitRunRecord(struct pb_RunRecord *record, const char *benchmark,
+		 const char *input)
+{
+  const char *dataset = getenv("PB_DATASET");
+
+  memset(record, 0, sizeof(*record));
+  record->benchmark = benchmark;
+  if (dataset == NULL)
+    dataset = input;
+  record->dataset = dataset != NULL ? dataset : "";
+#ifdef _OPENMP
+  record->threads = omp_get_max_threads();
+#else
+  record->threads = 1;
+#endif
+}
+
+int
+pb_EmitRunRecord(struct pb_RunRecord *record)
+{
+  const char *path = getenv("PB_RESULTS");
+  struct pb_HarnessResult *h = record->harness;
+  struct pb_TimerSet *timers = record->timers;
+  struct result_line line = { NULL, 0, 0 };
+  double stats[13], mean, wall = NAN;
+  const char *names[13] = {
+    "mean_s", "stddev_s", "min_s", "max_s", "median_s", "p95_s", "p99_s",
+    "mean_lo_s", "mean_hi_s", "median_lo_s", "median_hi_s",
+    "iterations", "seconds_total"
+  };
+  double derived[3];
+  const char *derived_names[3] = { "gflops", "gbs", "edges_per_s" };
+  int json, fd, i, d, err = 0;
+  size_t n;
+  struct stat st;
+
+  if (path == NULL || path[0] == '\0')
+    return 0;
+  n = strlen(path);
+  json = !(n >= 4 && strcmp(path + n - 4, ".csv") == 0);
+
+  /* Per-iteration statistics, from the harness when there is one */
+  for (i = 0; i < 13; i++)
+    stats[i] = NAN;
+  if (h != NULL) {
+    stats[0] = h->mean; stats[1] = h->stddev;
+    stats[2] = h->min; stats[3] = h->max;
+    stats[4] = h->median; stats[5] = h->p95; stats[6] = h->p99;
+    stats[7] = h->mean_lo; stats[8] = h->mean_hi;
+    stats[9] = h->median_lo; stats[10] = h->median_hi;
+    stats[11] = h->iterations; stats[12] = h->total;
+  } else if (record->iterations > 0) {
+    stats[0] = record->seconds;
+    stats[11] = record->iterations;
+    stats[12] = record->seconds * record->iterations;
+  }
+
+  /* Throughput of one iteration */
+  mean = stats[0];
+  derived[0] = (record->flops > 0 && mean > 0) ? record->flops / mean * 1e-9 : NAN;
+  derived[1] = (record->bytes > 0 && mean > 0) ? record->bytes / mean * 1e-9 : NAN;
+  derived[2] = (record->edges > 0 && mean > 0) ? record->edges / mean : NAN;
+
+  if (timers != NULL)
+    wall = (get_time() - timers->wall_begin) * tick_seconds;
+
+  if (json) {
+    append(&line, "{\"benchmark\":");
+    append_string(&line, 1, record->benchmark);
+    append(&line, ",\"dataset\":");
+    append_string(&line, 1, record->dataset);
+    append(&line, ",\"threads\":%d,\"clock\":\"%s\",\"time\":%lld",
+           record->threads, pb_ClockName(), (long long) time(NULL));
+    if (h != NULL)
+      append(&line, ",\"warmup\":%d,\"stable\":%s,\"warmup_cv\":%.6g,\"cold\":%.9g,\"batch\":%d,\"samples\":%d",
+             h->warmup, h->stable ? "true" : "false", h->warmup_cv, h->cold, h->batch, h->nsamples);
+    for (i = 0; i < 13; i++) {
+      if (isfinite(stats[i])) {
+        append(&line, ",\"%s\":", names[i]);
+        append_number(&line, 1, stats[i]);
+      }
+    }
+    for (i = 0; i < 3; i++) {
+      if (isfinite(derived[i])) {
+        append(&line, ",\"%s\":", derived_names[i]);
+        append_number(&line, 1, derived[i]);
+      }
+    }
+    if (timers != NULL) {
+      append(&line, ",\"wall_s\":");
+      append_number(&line, 1, wall);
+      append(&line, ",\"timers_s\":{");
+      for (i = 1; i < pb_TimerID_LAST; i++)
+        append(&line, "%s\"%s\":%.9g", i > 1 ? "," : "", result_categories[i],
+               pb_GetElapsedTime(&timers->timers[i]));
+      append(&line, "}");
+      if (timers->energy != NULL) {
+        append(&line, ",\"energy_j\":{");
+        for (i = 1; i < pb_TimerID_LAST; i++) {
+          /* Package (which includes the cores) plus DRAM */
+          double *j = timers->energy->total[i];
+          append(&line, "%s\"%s\":%.9g", i > 1 ? "," : "", result_categories[i],
+                 j[energy_PKG] + j[energy_DRAM]);
+        }
+        append(&line, "}");
+      }
+    }
+    append(&line, "}\n");
+  } else {
+    append_string(&line, 0, record->benchmark);
+    append(&line, ",");
+    append_string(&line, 0, record->dataset);
+    append(&line, ",%d,%s,%lld,", record->threads, pb_ClockName(), (long long) time(NULL));
+    if (h != NULL)
+      append(&line, "%d,%d,%.6g,%.9g,%d,%d", h->warmup, h->stable, h->warmup_cv, h->cold,
+             h->batch, h->nsamples);
+    else
+      append(&line, ",,,,,");
+    for (i = 0; i < 13; i++) {
+      append(&line, ",");
+      append_number(&line, 0, stats[i]);
+    }
+    for (i = 0; i < 3; i++) {
+      append(&line, ",");
+      append_number(&line, 0, derived[i]);
+    }
+    append(&line, ",");
+    append_number(&line, 0, wall);
+    for (i = 1; i < pb_TimerID_LAST; i++) {
+      append(&line, ",");
+      if (timers != NULL)
+        append(&line, "%.9g", pb_GetElapsedTime(&timers->timers[i]));
+    }
+    /* Energy per category and domain, empty where it was not measured */
+    for (i = 1; i < pb_TimerID_LAST; i++)
+      for (d = 0; d < energy_DOMAINS; d++) {
+        append(&line, ",");
+        if (timers != NULL && timers->energy != NULL && timers->energy->available[d])
+          append(&line, "%.9g", timers->energy->total[i][d]);
+      }
+    append(&line, "\n");
+  }
+
+  /* One write per record to a file opened for appending, so that runs
+   * sharing the file never interleave; the lock keeps two runs from
+   * both writing the CSV header */
+  fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    perror(path);
+    free(line.buf);
+    return -1;
+  }
+  flock(fd, LOCK_EX);
+  if (!json && fstat(fd, &st) == 0 && st.st_size == 0) {
+    struct result_line header = { NULL, 0, 0 };
+    append(&header, "benchmark,dataset,threads,clock,time,warmup,stable,warmup_cv,cold,batch,samples");
+    for (i = 0; i < 13; i++)
+      append(&header, ",%s", names[i]);
+    for (i = 0; i < 3; i++)
+      append(&header, ",%s", derived_names[i]);
+    append(&header, ",wall_s");
+    for (i = 1; i < pb_TimerID_LAST; i++)
+      append(&header, ",%s_s", result_categories[i]);
+    for (i = 1; i < pb_TimerID_LAST; i++)
+      for (d = 0; d < energy_DOMAINS; d++)
+        append(&header, ",%s_%s_j", result_categories[i], energy_names[d]);
+    append(&header, "\n");
+    if (write(fd, header.buf, header.len) != (ssize_t) header.len)
+      err = -1;
+    free(header.buf);
+  }
+  if (write(fd, line.buf, line.len) != (ssize_t) line.len)
+    err = -1;
+  flock(fd, LOCK_UN);
+  close(fd);
+  free(line.buf);
+
+  if (err)
+    fprintf(stderr, "Could not write the results to %s\n", path);
+  return err;
+}
+
+/* NUMA-aware allocation.
+ *
+ * Allocations are anonymous mappings of whole pages, so where their
+ * pages land can be chosen: first touched in parallel, a contiguous
+ * share per OpenMP thread, or interleaved with mbind.  MPOL_INTERLEAVE
+ * and move_pages are called through syscall(), so there is no libnuma
+ * dependency.  Every allocation is kept in a list for
+ * pb_PrintAllocations.  An arena is one such allocation, reserved
+ * whole and handed out in blocks whose pages are faulted in as they are
+ * handed out. */
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif
+
+#define PB_MPOL_INTERLEAVE 3	/* linux/mempolicy.h */
+#define PB_MAX_NODES 64
+#define PB_HUGE_PAGE (2UL << 20)
+#define PB_ARENA_ALIGN 64
+
+struct pb_Allocation {
+  const char *name;
+  void *addr;			/* what pb_Alloc returned */
+  void *map;			/* the mapping, or the malloc block */
+  size_t size;			/* in use; for an arena, handed out */
+  size_t length;		/* of the mapping */
+  int flags;			/* placement and pages actually used */
+  struct pb_Arena *arena;	/* NULL for pb_Alloc */
+  struct pb_Allocation *next;
+};
+
+struct pb_Arena {
+  struct pb_Allocation *allocation;
+  size_t used;			/* bytes handed out, with alignment */
+  size_t faulted;		/* pages below this offset are present */
+  int blocks;
+};
+
+static struct pb_Allocation *allocations = NULL;
+
+static const char *
+placement_name(int flags)
+{
+  switch (flags & PB_ALLOC_PLACEMENT) {
+  case PB_ALLOC_FIRST_TOUCH: return "first-touch";
+  case PB_ALLOC_INTERLEAVE: return "interleave";
+  default: return "serial";
+  }
+}
+
+/* Placement from PB_NUMA and page size from PB_HUGE, or the ones the
+ * benchmark asked for */
+static int
+allocation_flags(int flags)
+{
+  const char *env = getenv("PB_NUMA");
+
+  if (env != NULL && env[0] != '\0') {
+    if (strcmp(env, "first-touch") == 0)
+      flags = (flags & ~PB_ALLOC_PLACEMENT) | PB_ALLOC_FIRST_TOUCH;
+    else if (strcmp(env, "interleave") == 0)
+      flags = (flags & ~PB_ALLOC_PLACEMENT) | PB_ALLOC_INTERLEAVE;
+    else if (strcmp(env, "serial") == 0)
+      flags = flags & ~PB_ALLOC_PLACEMENT;
+    else
+      fprintf(stderr, "PB_NUMA must be serial, first-touch or interleave\n");
+  }
+
+  env = getenv("PB_HUGE");
+  if (env != NULL && env[0] != '\0') {
+    if (strcmp(env, "none") == 0)
+      flags &= ~(PB_ALLOC_HUGE | PB_ALLOC_HUGETLB);
+    else if (strcmp(env, "thp") == 0)
+      flags = (flags & ~PB_ALLOC_HUGETLB) | PB_ALLOC_HUGE;
+    else if (strcmp(env, "hugetlb") == 0)
+      flags |= PB_ALLOC_HUGETLB;
+    else
+      fprintf(stderr, "PB_HUGE must be none, thp or hugetlb\n");
+  }
+  return flags;
+}
+
+/* Online NUMA nodes as a bit mask; returns the number of nodes */
+static int
+online_nodes(unsigned long *mask)
+{
+  char buf[256], *p;
+  int fd, nodes = 0;
+  ssize_t n;
+
+  *mask = 0;
+  fd = open("/sys/devices/system/node/online", O_RDONLY);
+  if (fd < 0)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+
+  /* "0-1,4" */
+  for (p = buf; *p >= '0' && *p <= '9'; ) {
+    long lo = strtol(p, &p, 10), hi = lo, i;
+    if (*p == '-')
+      hi = strtol(p + 1, &p, 10);
+    for (i = lo; i <= hi && i < PB_MAX_NODES; i++, nodes++)
+      *mask |= 1UL << i;
+    if (*p == ',')
+      p++;
+  }
+  return nodes;
+}
+
+static size_t
+base_page(void)
+{
+#ifdef __linux__
+  return (size_t) sysconf(_SC_PAGESIZE);
+#else
+  return 4096;
+#endif
+}
+
+/* Touch the pages of [addr, addr + size), addr page aligned.  With
+ * parallel, thread t of the team a parallel region gets takes the pages
+ * that start in bytes [size t / nt, size (t + 1) / nt): its share of a
+ * schedule(static) loop over the outermost dimension. */
+static void
+touch_pages(char *addr, size_t size, size_t page, int parallel)
+{
+#ifdef _OPENMP
+# pragma omp parallel if(parallel)
+#endif
+  {
+    int tid = 0, nt = 1;
+    size_t lo, hi, i;
+#ifdef _OPENMP
+    tid = omp_get_thread_num();
+    nt = omp_get_num_threads();
+#endif
+    lo = (size_t) ((double) size * tid / nt);
+    hi = tid == nt - 1 ? size : (size_t) ((double) size * (tid + 1) / nt);
+    lo = (lo + page - 1) / page * page;
+    hi = (hi + page - 1) / page * page;
+    for (i = lo; i < hi && i < size; i += page)
+      ((volatile char *) addr)[i] = 0;
+  }
+}
+
+/* Map size bytes for a with the pages and placement of flags; nothing
+ * is touched yet.  Explicit huge pages fall back to transparent ones
+ * when the hugetlb pool cannot hold the mapping.  Returns the start. */
+static char *
+map_allocation(struct pb_Allocation *a, size_t size, int *flags)
+{
+  size_t page = base_page(), align;
+  char *map, *addr;
+
+#ifdef __linux__
+# ifdef MAP_HUGETLB
+  if (*flags & PB_ALLOC_HUGETLB) {
+    a->length = ((size > 0 ? size : 1) + PB_HUGE_PAGE - 1) / PB_HUGE_PAGE * PB_HUGE_PAGE;
+    /* Without MAP_NORESERVE the pool is checked now, not at a fault */
+    map = (char *) mmap(NULL, a->length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != (char *) MAP_FAILED) {
+      a->map = map;
+      *flags &= ~PB_ALLOC_HUGE;
+      goto placed;
+    }
+    fprintf(stderr, "%s: no %lu kB hugetlb pages for %lu MB, using transparent huge pages\n",
+	    a->name ? a->name : "pb_Alloc", PB_HUGE_PAGE >> 10,
+	    (unsigned long) (a->length >> 20));
+  }
+# endif
+  if (*flags & PB_ALLOC_HUGETLB)
+    *flags = (*flags & ~PB_ALLOC_HUGETLB) | PB_ALLOC_HUGE;
+
+  align = (*flags & PB_ALLOC_HUGE) ? PB_HUGE_PAGE : page;
+  a->length = ((size > 0 ? size : 1) + align - 1) / align * align;
+  /* Over-map to align huge page candidates, then trim */
+  map = (char *) mmap(NULL, a->length + align - page, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map == (char *) MAP_FAILED)
+    return NULL;
+  addr = (char *) (((size_t) map + align - 1) / align * align);
+  if (addr > map)
+    munmap(map, addr - map);
+  if (align > page)
+    munmap(addr + a->length, (map + a->length + align - page) - (addr + a->length));
+  a->map = addr;
+
+# ifdef MADV_HUGEPAGE
+  if (*flags & PB_ALLOC_HUGE)
+    madvise(addr, a->length, MADV_HUGEPAGE);
+# endif
+
+#ifdef MAP_HUGETLB
+ placed:
+#endif
+  /* On a single node (or without NUMA support) there is nothing to
+   * interleave */
+  if ((*flags & PB_ALLOC_PLACEMENT) == PB_ALLOC_INTERLEAVE) {
+    unsigned long mask;
+    if (online_nodes(&mask) > 1)
+      syscall(SYS_mbind, a->map, a->length, PB_MPOL_INTERLEAVE, &mask,
+	      PB_MAX_NODES + 1, 0);
+  }
+#else
+  (void) page;
+  (void) align;
+  (void) addr;
+  *flags &= ~(PB_ALLOC_HUGE | PB_ALLOC_HUGETLB);
+  a->length = size > 0 ? size : 1;
+  if (posix_memalign((void **) &map, PB_ARENA_ALIGN, a->length) != 0)
+    return NULL;
+  memset(map, 0, a->length);
+  a->map = map;
+#endif
+  return (char *) a->map;
+}
+
+static void
+unmap_allocation(struct pb_Allocation *a)
+{
+#ifdef __linux__
+  munmap(a->map, a->length);
+#else
+  free(a->map);
+#endif
+}
+
+static struct pb_Allocation *
+new_allocation(const char *name, size_t size, int flags)
+{
+  struct pb_Allocation *a, **tail;
+
+  a = (struct pb_Allocation *) calloc(1, sizeof(*a));
+  if (a == NULL)
+    return NULL;
+  a->name = name;
+  flags = allocation_flags(flags);
+  a->addr = map_allocation(a, size, &flags);
+  if (a->addr == NULL) {
+    free(a);
+    return NULL;
+  }
+  a->size = size;
+  a->flags = flags;
+  for (tail = &allocations; *tail != NULL; tail = &(*tail)->next)
+    ;
+  *tail = a;
+  return a;
+}
+
+static void
+delete_allocation(struct pb_Allocation *found)
+{
+  struct pb_Allocation **a;
+
+  for (a = &allocations; *a != NULL && *a != found; a = &(*a)->next)
+    ;
+  if (*a != NULL)
+    *a = found->next;
+  unmap_allocation(found);
+  free(found);
+}
+
+void *
+pb_Alloc(const char *name, size_t size, int flags)
+{
+  struct pb_Allocation *a = new_allocation(name, size, flags);
+
+  if (a == NULL)
+    return NULL;
+#ifdef __linux__
+  if ((a->flags & PB_ALLOC_PLACEMENT) != PB_ALLOC_SERIAL)
+    touch_pages((char *) a->map, a->length, base_page(), 1);
+#endif
+  return a->addr;
+}
+
+void
+pb_Free(void *p)
+{
+  struct pb_Allocation *a;
+
+  if (p == NULL)
+    return;
+  for (a = allocations; a != NULL && (a->addr != p || a->arena != NULL); a = a->next)
+    ;
+  if (a == NULL) {
+    fprintf(stderr, "pb_Free: %p was not allocated by pb_Alloc\n", p);
+    return;
+  }
+  delete_allocation(a);
+}
+
+struct pb_Arena *
+pb_CreateArena(const char *name, size_t capacity, int flags)
+{
+  struct pb_Arena *arena;
+
+  arena = (struct pb_Arena *) calloc(1, sizeof(*arena));
+  if (arena == NULL)
+    return NULL;
+  /* Room for the alignment of every block: untouched pages of the
+   * reservation cost no memory */
+  arena->allocation = new_allocation(name, capacity + PB_HUGE_PAGE, flags);
+  if (arena->allocation == NULL) {
+    free(arena);
+    return NULL;
+  }
+  arena->allocation->arena = arena;
+  arena->allocation->size = 0;
+  return arena;
 }
 
+void *
+pb_ArenaAlloc(struct pb_Arena *arena, size_t size)
+{
+  struct pb_Allocation *a = arena->allocation;
+  size_t page = base_page(), offset, end;
+  char *map = (char *) a->map;
+
+  offset = (arena->used + PB_ARENA_ALIGN - 1) / PB_ARENA_ALIGN * PB_ARENA_ALIGN;
+  if (offset + size > a->length) {
+    fprintf(stderr, "%s: arena of %lu bytes is full\n", a->name ? a->name : "pb_Arena",
+	    (unsigned long) a->length);
+    return NULL;
+  }
+  arena->used = offset + size;
+  arena->blocks++;
+  a->size = arena->used;
+
+  /* Fault in the pages of the block that no earlier block has: they
+   * hold no data yet, so writing a zero to each is harmless */
+  end = (arena->used + page - 1) / page * page;
+#ifdef __linux__
+  if (end > arena->faulted)
+    touch_pages(map + arena->faulted, end - arena->faulted, page,
+		(a->flags & PB_ALLOC_PLACEMENT) != PB_ALLOC_SERIAL);
+#endif
+  if (end > arena->faulted)
+    arena->faulted = end;
+  return map + offset;
+}
 
+void
+pb_DestroyArena(struct pb_Arena *arena)
+{
+  if (arena == NULL)
+    return;
+  delete_allocation(arena->allocation);
+  free(arena);
+}
+
+/* Per-node page counts of the first size bytes of an allocation;
+ * pages[PB_MAX_NODES] counts the pages that are not present.  At most
+ * 65536 pages are asked about, evenly spaced; returns the stride
+ * between them. */
+static size_t
+count_node_pages(struct pb_Allocation *a, size_t page, size_t *pages)
+{
+  size_t npages = (a->size + page - 1) / page, stride, i, n;
+  void *addr[1024];
+  int status[1024];
+
+  memset(pages, 0, (PB_MAX_NODES + 1) * sizeof(*pages));
+  stride = npages > 65536 ? (npages + 65535) / 65536 : 1;
+  for (i = 0; i < npages; ) {
+    size_t k;
+    for (n = 0; n < 1024 && i < npages; n++, i += stride)
+      addr[n] = (char *) a->map + i * page;
+    for (k = 0; k < n; k++)
+      status[k] = -1;
+#ifdef __linux__
+    syscall(SYS_move_pages, 0, n, addr, NULL, status, 0);
+#endif
+    for (k = 0; k < n; k++)
+      pages[status[k] >= 0 && status[k] < PB_MAX_NODES ? status[k] : PB_MAX_NODES]++;
+  }
+  return stride;
+}
+
+/* Bytes of [start, start + length) backed by transparent huge pages,
+ * from the AnonHugePages of the mappings in /proc/self/smaps */
+static size_t
+huge_page_bytes(void *start, size_t length)
+{
+  size_t bytes = 0;
+#ifdef __linux__
+  unsigned long lo, hi, from = (unsigned long) start, to = from + length;
+  unsigned long kb;
+  int inside = 0;
+  char line[512];
+  FILE *f = fopen("/proc/self/smaps", "r");
+
+  if (f == NULL)
+    return 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+      inside = lo < to && hi > from;
+    else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+      bytes += kb << 10;
+  }
+  fclose(f);
+#endif
+  (void) start;
+  return bytes < length ? bytes : length;
+}
+
+void
+pb_PrintAllocations(void)
+{
+  struct pb_Allocation *a;
+  size_t pages[PB_MAX_NODES + 1];
+  size_t page = base_page();
+  int node;
+
+  for (a = allocations; a != NULL; a = a->next) {
+    size_t stride = count_node_pages(a, page, pages), total = 0;
+    for (node = 0; node <= PB_MAX_NODES; node++)
+      total += pages[node];
+    printf("[NUMA] %s: %.1f %s", a->name ? a->name : "?",
+	   a->size >= 1048576 ? a->size / 1048576.0 : a->size / 1024.0,
+	   a->size >= 1048576 ? "MB" : "KB");
+    if (a->arena != NULL)
+      printf(" in %d blocks", a->arena->blocks);
+    printf(", %s", placement_name(a->flags));
+    if (a->flags & PB_ALLOC_HUGETLB)
+      printf(", hugetlb pages");
+    else if ((a->flags & PB_ALLOC_HUGE) && a->size > 0)
+      printf(", huge pages %.0f%%", 100.0 * huge_page_bytes(a->map, a->size) / a->size);
+    if (stride > 1)
+      printf(", sampled");
+    printf(":");
+    for (node = 0; node < PB_MAX_NODES; node++)
+      if (pages[node] > 0)
+	printf(" node%d %.1f%%", node, 100.0 * pages[node] / total);
+    if (pages[PB_MAX_NODES] > 0)
+      printf(" not present %.1f%%", 100.0 * pages[PB_MAX_NODES] / total);
+    printf("\n");
+  }
+}
+
+
+/*****************************************************************************/
+/* Persistent teams */
+
+#define BARRIER_FANIN 4
+/* Polls of the release flag before a waiter starts to yield */
+#define BARRIER_SPIN 2000
+
+/* A node of the combining tree: the last of its expected arrivals
+ * resets it and goes on to the parent */
+struct barrier_node {
+  int count;
+  int expected;
+  int parent;			/* -1 at the root */
+  char pad[64 - 3 * sizeof(int)];
+};
+
+/* Aligned rather than padded: the compiler accounts for the hole after
+ * sense, so every thread has a line of its own. */
+struct barrier_thread {
+  int sense;
+  unsigned long waits;
+  pb_Timestamp waited;
+  pb_Timestamp last;		/* when its last wait ended */
+} __attribute__((aligned(64)));
+
+struct pb_Barrier {
+  const char *name;
+  int nthreads;
+  int sense;			/* flipped by the root to release the team */
+  pb_Timestamp created;
+  struct barrier_node *nodes;
+  struct barrier_thread *threads;
+};
+
+struct pb_Barrier *
+pb_CreateBarrier(const char *name, int nthreads)
+{
+  struct pb_Barrier *b;
+  void *nodes = NULL, *threads = NULL;
+  int nnodes, width, first, i;
+
+  if (nthreads < 1)
+    return NULL;
+  nnodes = 0;
+  for (width = nthreads; width > 1; width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN)
+    nnodes += (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+  if (nnodes == 0)
+    nnodes = 1;
+
+  b = (struct pb_Barrier *) calloc(1, sizeof(*b));
+  if (b == NULL ||
+      posix_memalign(&nodes, 64, nnodes * sizeof(struct barrier_node)) != 0 ||
+      posix_memalign(&threads, 64, nthreads * sizeof(struct barrier_thread)) != 0) {
+    free(b);
+    free(nodes);
+    return NULL;
+  }
+  b->name = name;
+  b->nthreads = nthreads;
+  b->nodes = (struct barrier_node *) nodes;
+  b->threads = (struct barrier_thread *) threads;
+  memset(nodes, 0, nnodes * sizeof(struct barrier_node));
+  memset(threads, 0, nthreads * sizeof(struct barrier_thread));
+
+  /* Thread t arrives at leaf t / BARRIER_FANIN; the nodes of a level
+   * follow those of the level below */
+  first = 0;
+  width = nthreads;
+  do {
+    int groups = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+    for (i = 0; i < groups; i++) {
+      b->nodes[first + i].expected = width - i * BARRIER_FANIN < BARRIER_FANIN ?
+	width - i * BARRIER_FANIN : BARRIER_FANIN;
+      b->nodes[first + i].parent = groups > 1 ? first + groups + i / BARRIER_FANIN : -1;
+    }
+    first += groups;
+    width = groups;
+  } while (width > 1);
+
+  /* The team reads the clock before the harness would set it up */
+  initialize_clock();
+  b->created = get_time();
+  return b;
+}
+
+void
+pb_BarrierWait(struct pb_Barrier *b, int tid)
+{
+  struct barrier_thread *self = &b->threads[tid];
+  int sense = !self->sense;
+  int node = tid / BARRIER_FANIN;
+  pb_Timestamp start = get_time(), end;
+  long spins;
+
+  self->sense = sense;
+  for (;;) {
+    struct barrier_node *n = &b->nodes[node];
+    if (__atomic_add_fetch(&n->count, 1, __ATOMIC_ACQ_REL) < n->expected)
+      break;
+    /* Nobody arrives here again before the release */
+    __atomic_store_n(&n->count, 0, __ATOMIC_RELAXED);
+    if (n->parent < 0) {
+      __atomic_store_n(&b->sense, sense, __ATOMIC_RELEASE);
+      goto released;
+    }
+    node = n->parent;
+  }
+
+  for (spins = 0; __atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense; spins++) {
+    if (spins < BARRIER_SPIN) {
+#ifdef HAVE_TSC
+      _mm_pause();
+#endif
+    }
+#if _POSIX_VERSION >= 200112L
+    else
+      sched_yield();
+#endif
+  }
+
+released:
+  end = get_time();
+  self->waited += end - start;
+  self->waits++;
+  self->last = end;
+}
+
+void
+pb_PrintBarrier(struct pb_Barrier *b)
+{
+  pb_Timestamp last = b->created;
+  double span;
+  int t;
+
+  for (t = 0; t < b->nthreads; t++)
+    if (b->threads[t].last > last)
+      last = b->threads[t].last;
+  span = (last - b->created) * tick_seconds;
+  for (t = 0; t < b->nthreads; t++) {
+    double waited = b->threads[t].waited * tick_seconds;
+    printf("[BARRIER] %s: thread %d waited %lf ms in %lu waits (%.1f%%)\n",
+	   b->name ? b->name : "?", t, waited * 1000, b->threads[t].waits,
+	   span > 0 ? 100 * waited / span : 0.0);
+  }
+}
+
+void
+pb_DestroyBarrier(struct pb_Barrier *b)
+{
+  if (b == NULL)
+    return;
+  free(b->nodes);
+  free(b->threads);
+  free(b);
+}
+
+void
+pb_ThreadRange(long n, int tid, int nthreads, long *begin, long *end)
+{
+  *begin = (long) ((double) n * tid / nthreads);
+  *end = tid == nthreads - 1 ? n : (long) ((double) n * (tid + 1) / nthreads);
+}
+
+#ifdef _OPENMP
+/* A harness call on the master of a persistent team: the first barrier
+ * starts the workers on the kernel, the second waits for them */
+struct team_call {
+  pb_KernelFunc kernel;
+  void *arg;
+  struct pb_Barrier *barrier;
+  int stop;
+};
+
+static void
+team_invoke(void *arg)
+{
+  struct team_call *call = (struct team_call *) arg;
+
+  pb_BarrierWait(call->barrier, 0);
+  call->kernel(call->arg);
+  pb_BarrierWait(call->barrier, 0);
+}
+#endif
+
+int
+pb_RunTeamHarness(struct pb_HarnessConfig *config,
+		  pb_KernelFunc kernel, void *arg,
+		  const char *name, struct pb_Barrier **barrier,
+		  struct pb_HarnessResult *result)
+{
+#ifdef _OPENMP
+  struct team_call call = { kernel, arg, NULL, 0 };
+  int status = 0;
+
+# pragma omp parallel
+  {
+    int tid = omp_get_thread_num();
+
+    /* Sized from the team actually started, which a thread limit or
+     * OMP_DYNAMIC may make smaller than asked for */
+#  pragma omp single
+    {
+      *barrier = call.barrier = pb_CreateBarrier(name, omp_get_num_threads());
+      if (call.barrier == NULL) {
+	fprintf(stderr, "Cannot create the barrier of a team of %d threads\n",
+		omp_get_num_threads());
+	status = -1;
+      }
+    }
+
+    if (call.barrier == NULL) {
+      /* Every thread sees it, nobody waits */
+    } else if (tid == 0) {
+      status = pb_RunHarness(config, team_invoke, &call, result);
+      call.stop = 1;
+      pb_BarrierWait(call.barrier, 0);
+    } else {
+      for (;;) {
+	pb_BarrierWait(call.barrier, tid);
+	if (call.stop)
+	  break;
+	kernel(arg);
+	pb_BarrierWait(call.barrier, tid);
+      }
+    }
+  }
+  return status;
+#else
+  *barrier = pb_CreateBarrier(name, 1);
+  if (*barrier == NULL)
+    return -1;
+  return pb_RunHarness(config, kernel, arg, result);
+#endif
+}
@@ -10,10 +10,19 @@
 #include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
 #include "backprop.h"
 #include <math.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #define OPEN
 
+#define JBLK 32          /* columns the forward kernel keeps in registers */
+#define PAR_MIN_ROWS 256 /* smaller layers are not worth a parallel region */
+#define BPNN_KC 256      /* weight rows per cache block of the batched kernels */
+
 #define ABS(x)          (((x) > 0.0) ? (x) : (-(x)))
 
 #define fastcopy(to,from,len)\
@@ -50,6 +59,13 @@ float x;
   return (1.0 / (1.0 + exp(-x)));
 }
 
+/*** Sigmoid of the forward epilogues, BPNN_SIGMOID_* ***/
+#ifdef __AVX2__
+int bpnn_sigmoid = BPNN_SIGMOID_ACCURATE;
+#else
+int bpnn_sigmoid = BPNN_SIGMOID_REF;
+#endif
+
 
 /*** Allocate 1d array of floats ***/
 
@@ -67,13 +83,16 @@ int n;
 }
 
 
-/*** Allocate 2d array of floats ***/
+/*** Allocate 2d array of floats.  The rows live in one zeroed,
+     BPNN_ALIGN-aligned block with the row length padded to BPNN_LD(n),
+     so new[0] can be walked as a plain matrix with that leading
+     dimension.  Free with free_2d_dbl. ***/
 
 float **alloc_2d_dbl(m, n)
 int m, n;
 {
-  int i;
-  float **new;
+  int i, ld;
+  float **new, *block;
 
   new = (float **) malloc ((unsigned) (m * sizeof (float *)));
   if (new == NULL) {
@@ -81,26 +100,28 @@ int m, n;
     return (NULL);
   }
 
+  ld = BPNN_LD(n);
+  block = (float *) memalign(BPNN_ALIGN, (size_t) m * ld * sizeof (float));
+  if (block == NULL) {
+    printf("ALLOC_2D_DBL: Couldn't allocate array of floats\n");
+    free(new);
+    return (NULL);
+  }
+  memset(block, 0, (size_t) m * ld * sizeof (float));
+
   for (i = 0; i < m; i++) {
-    new[i] = alloc_1d_dbl(n);
+    new[i] = block + (size_t) i * ld;
   }
 
   return (new);
 }
 
 
-bpnn_trans_randomize_weights(w, v, m, n)
-float **w, **v;
-int m, n;
+void free_2d_dbl(m)
+float **m;
 {
-  int i, j;
-
-  for (i = 0; i <= m; i++) {
-    for (j = 0; j <= n; j++) {
-      v[j][i] = w[i][j];
-      //  w[i][j] = dpn1();
-    }
-  }
+  free((char *) m[0]);
+  free((char *) m);
 }
 
 bpnn_randomize_weights(w, m, n)
@@ -174,8 +195,6 @@ int n_in, n_hidden, n_out;
 
   newnet->input_weights = alloc_2d_dbl(n_in + 1, n_hidden + 1);
   newnet->hidden_weights = alloc_2d_dbl(n_hidden + 1, n_out + 1);
-  newnet->input_weights_t = alloc_2d_dbl(n_hidden + 1, n_in + 1);
-  newnet->hidden_weights_t = alloc_2d_dbl(n_out + 1, n_hidden + 1);
 
   newnet->input_prev_weights = alloc_2d_dbl(n_in + 1, n_hidden + 1);
   newnet->hidden_prev_weights = alloc_2d_dbl(n_hidden + 1, n_out + 1);
@@ -187,12 +206,6 @@ int n_in, n_hidden, n_out;
 void bpnn_free(net)
 BPNN *net;
 {
-  int n1, n2, n3, i;
-
-  n1 = net->input_n;
-  n2 = net->hidden_n;
-  n3 = net->output_n;
-
   free((char *) net->input_units);
   free((char *) net->hidden_units);
   free((char *) net->output_units);
@@ -201,24 +214,10 @@ BPNN *net;
   free((char *) net->output_delta);
   free((char *) net->target);
 
-  for (i = 0; i <= n1; i++) {
-    free((char *) net->input_weights[i]);
-    free((char *) net->input_prev_weights[i]);
-  }
-  free((char *) net->input_weights);
-  free((char *) net->input_prev_weights);
-
-  for (i = 0; i <= n2; i++) {
-    free((char *) net->hidden_weights[i]);
-    free((char *) net->input_weights_t[i]);
-    free((char *) net->hidden_prev_weights[i]);
-  }
-  for (i = 0; i <= n3; i++)
-    free((char *) net->hidden_weights_t[i]);
-  free((char *) net->hidden_weights_t);
-  free((char *) net->input_weights_t);
-  free((char *) net->hidden_weights);
-  free((char *) net->hidden_prev_weights);
+  free_2d_dbl(net->input_weights);
+  free_2d_dbl(net->input_prev_weights);
+  free_2d_dbl(net->hidden_weights);
+  free_2d_dbl(net->hidden_prev_weights);
 
   free((char *) net);
 }
@@ -243,13 +242,10 @@ int n_in, n_hidden, n_out;
 
   #ifdef INITZERO
   bpnn_zero_weights(newnet->input_weights, n_in, n_hidden);
-  bpnn_zero_weights(newnet->input_weights_t, n_hidden, n_in);
   #else
   bpnn_randomize_weights(newnet->input_weights, n_in, n_hidden);
-  bpnn_trans_randomize_weights(newnet->input_weights, newnet->input_weights_t, n_in, n_hidden);
   #endif
   bpnn_randomize_weights(newnet->hidden_weights, n_hidden, n_out);
-  bpnn_trans_randomize_weights(newnet->hidden_weights, newnet->hidden_weights_t, n_hidden, n_out);
   bpnn_zero_weights(newnet->input_prev_weights, n_in, n_hidden);
   bpnn_zero_weights(newnet->hidden_prev_weights, n_hidden, n_out);
   bpnn_randomize_row(newnet->target, n_out);
@@ -257,28 +253,343 @@ int n_in, n_hidden, n_out;
 }
 
 
+/*** Transposed GEMV on rows [kb, ke) of w: y[0..ld) = sum_k w[k][.] * x[k].
+     Rows are streamed in memory order and a block of JBLK columns is kept
+     in registers, so every weight is loaded exactly once. ***/
+
+static void gemv_t_rows(const float *w, int ld, const float *x, int kb, int ke, float *y)
+{
+  int j0, j, k;
+
+  for (j0 = 0; j0 < ld; j0 += JBLK) {
+    int jn = ld - j0 < JBLK ? ld - j0 : JBLK;
+#ifdef __AVX2__
+    int v, nv = jn / BPNN_VLEN;
+    __m256 acc[JBLK / BPNN_VLEN];
+    for (v = 0; v < nv; v++) acc[v] = _mm256_setzero_ps();
+    for (k = kb; k < ke; k++) {
+      const float *row = w + (size_t) k * ld + j0;
+      __m256 xk = _mm256_broadcast_ss(&x[k]);
+      for (v = 0; v < nv; v++)
+        acc[v] = _mm256_fmadd_ps(_mm256_load_ps(row + v * BPNN_VLEN), xk, acc[v]);
+    }
+    for (v = 0; v < nv; v++) _mm256_storeu_ps(y + j0 + v * BPNN_VLEN, acc[v]);
+#else
+    float acc[JBLK];
+    for (j = 0; j < jn; j++) acc[j] = 0.0;
+    for (k = kb; k < ke; k++) {
+      const float *row = w + (size_t) k * ld + j0;
+      float xk = x[k];
+      #pragma omp simd
+      for (j = 0; j < jn; j++) acc[j] += row[j] * xk;
+    }
+    for (j = 0; j < jn; j++) y[j0 + j] = acc[j];
+#endif
+  }
+}
+
+/*** Rank-1 update with momentum of one weight row, columns 1..ndelta:
+     dw = ETA * delta[j] * lyk + MOMENTUM * oldw[j]. ***/
+
+static void rank1_row(float *w, float *oldw, const float *delta, float eta_lyk, int ndelta)
+{
+  int j, j0 = 1;
+#ifdef __AVX2__
+  __m256 s = _mm256_set1_ps(eta_lyk);
+  __m256 m = _mm256_set1_ps(MOMENTUM);
+  for (; j0 + BPNN_VLEN <= ndelta + 1; j0 += BPNN_VLEN) {
+    __m256 dw = _mm256_fmadd_ps(_mm256_loadu_ps(delta + j0), s,
+                                _mm256_mul_ps(m, _mm256_loadu_ps(oldw + j0)));
+    _mm256_storeu_ps(w + j0, _mm256_add_ps(_mm256_loadu_ps(w + j0), dw));
+    _mm256_storeu_ps(oldw + j0, dw);
+  }
+#endif
+  #pragma omp simd
+  for (j = j0; j <= ndelta; j++) {
+    float new_dw = delta[j] * eta_lyk + (float) MOMENTUM * oldw[j];
+    w[j] += new_dw;
+    oldw[j] = new_dw;
+  }
+}
+
+/*** Register tile of the batched forward GEMM: c[b][j0..) += sum_k
+     x[b][k] * w[k][j0..) over rows [kb, ke) of w, for BPNN_BATCH_MR
+     patterns and nv (1 or 2) vectors of columns.  Every weight row is
+     loaded once per tile and feeds BPNN_BATCH_MR FMAs per vector. ***/
+
+static inline void gemm_tile(const float *x, int ldx, const float *w, int ld,
+                             int kb, int ke, int j0, int nv, float *c)
+{
+  int b, k;
+#ifdef __AVX2__
+  __m256 acc[BPNN_BATCH_MR][2];
+  for (b = 0; b < BPNN_BATCH_MR; b++) {
+    acc[b][0] = _mm256_load_ps(c + (size_t) b * ld + j0);
+    acc[b][1] = nv > 1 ? _mm256_load_ps(c + (size_t) b * ld + j0 + BPNN_VLEN) : acc[b][0];
+  }
+  for (k = kb; k < ke; k++) {
+    const float *row = w + (size_t) k * ld + j0;
+    __m256 w0 = _mm256_load_ps(row);
+    __m256 w1 = nv > 1 ? _mm256_load_ps(row + BPNN_VLEN) : w0;
+    for (b = 0; b < BPNN_BATCH_MR; b++) {
+      __m256 xb = _mm256_broadcast_ss(x + (size_t) b * ldx + k);
+      acc[b][0] = _mm256_fmadd_ps(w0, xb, acc[b][0]);
+      if (nv > 1) acc[b][1] = _mm256_fmadd_ps(w1, xb, acc[b][1]);
+    }
+  }
+  for (b = 0; b < BPNN_BATCH_MR; b++) {
+    _mm256_store_ps(c + (size_t) b * ld + j0, acc[b][0]);
+    if (nv > 1) _mm256_store_ps(c + (size_t) b * ld + j0 + BPNN_VLEN, acc[b][1]);
+  }
+#else
+  int j, jn = nv * BPNN_VLEN;
+  float acc[BPNN_BATCH_MR][2 * BPNN_VLEN];
+  for (b = 0; b < BPNN_BATCH_MR; b++)
+    for (j = 0; j < jn; j++) acc[b][j] = c[(size_t) b * ld + j0 + j];
+  for (k = kb; k < ke; k++) {
+    const float *row = w + (size_t) k * ld + j0;
+    for (b = 0; b < BPNN_BATCH_MR; b++) {
+      float xb = x[(size_t) b * ldx + k];
+      #pragma omp simd
+      for (j = 0; j < jn; j++) acc[b][j] += row[j] * xb;
+    }
+  }
+  for (b = 0; b < BPNN_BATCH_MR; b++)
+    for (j = 0; j < jn; j++) c[(size_t) b * ld + j0 + j] = acc[b][j];
+#endif
+}
+
+/*** Batched forward GEMM on rows [kb, ke) of w: c[b][0..ld) = sum_k
+     x[b][k] * w[k][.] for all rows patterns (a multiple of BPNN_BATCH_MR).
+     The rows are taken in blocks of BPNN_KC, which stay in cache while
+     every pattern tile passes over them. ***/
+
+static void gemm_rows(const float *x, int ldx, int rows, const float *w, int ld,
+                      int kb, int ke, float *c)
+{
+  int b0, j0, k0;
+
+  memset(c, 0, (size_t) rows * ld * sizeof (float));
+  for (k0 = kb; k0 < ke; k0 += BPNN_KC) {
+    int k1 = ke - k0 < BPNN_KC ? ke : k0 + BPNN_KC;
+    for (b0 = 0; b0 < rows; b0 += BPNN_BATCH_MR)
+      for (j0 = 0; j0 < ld; j0 += 2 * BPNN_VLEN)
+        gemm_tile(x + (size_t) b0 * ldx, ldx, w, ld, k0, k1, j0,
+                  ld - j0 >= 2 * BPNN_VLEN ? 2 : 1, c + (size_t) b0 * ld);
+  }
+}
+
+/*** Register tile of the batched weight update, kr (BPNN_BATCH_MR or 1)
+     weight rows from k by nv vectors of columns:
+     dw = scale * sum_b x[b][k] * delta[b][.] + MOMENTUM * oldw,
+     w += dw, oldw = dw.  The momentum step is fused into the tile, so w
+     and oldw are read and written once.  Column 0 and the padding of
+     delta are zero, and so stay those of oldw: whole vectors can be
+     updated. ***/
+
+static inline void update_tile(const float *x, int ldx, int rows,
+                               const float *delta, int ldd,
+                               float *w, float *oldw, int ld,
+                               int k, int kr, int j0, int nv, float scale)
+{
+  int b, r;
+#ifdef __AVX2__
+  __m256 acc[BPNN_BATCH_MR][2];
+  __m256 s = _mm256_set1_ps(scale);
+  __m256 m = _mm256_set1_ps(MOMENTUM);
+  for (r = 0; r < kr; r++) acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+  for (b = 0; b < rows; b++) {
+    const float *d = delta + (size_t) b * ldd + j0;
+    __m256 d0 = _mm256_load_ps(d);
+    __m256 d1 = nv > 1 ? _mm256_load_ps(d + BPNN_VLEN) : d0;
+    for (r = 0; r < kr; r++) {
+      __m256 xb = _mm256_broadcast_ss(x + (size_t) b * ldx + k + r);
+      acc[r][0] = _mm256_fmadd_ps(d0, xb, acc[r][0]);
+      if (nv > 1) acc[r][1] = _mm256_fmadd_ps(d1, xb, acc[r][1]);
+    }
+  }
+  for (r = 0; r < kr; r++) {
+    int v;
+    for (v = 0; v < nv; v++) {
+      float *wp = w + (size_t) (k + r) * ld + j0 + v * BPNN_VLEN;
+      float *op = oldw + (size_t) (k + r) * ld + j0 + v * BPNN_VLEN;
+      __m256 dw = _mm256_fmadd_ps(acc[r][v], s, _mm256_mul_ps(m, _mm256_load_ps(op)));
+      _mm256_store_ps(wp, _mm256_add_ps(_mm256_load_ps(wp), dw));
+      _mm256_store_ps(op, dw);
+    }
+  }
+#else
+  int j, jn = nv * BPNN_VLEN;
+  float acc[BPNN_BATCH_MR][2 * BPNN_VLEN];
+  for (r = 0; r < kr; r++)
+    for (j = 0; j < jn; j++) acc[r][j] = 0.0;
+  for (b = 0; b < rows; b++) {
+    const float *d = delta + (size_t) b * ldd + j0;
+    for (r = 0; r < kr; r++) {
+      float xb = x[(size_t) b * ldx + k + r];
+      #pragma omp simd
+      for (j = 0; j < jn; j++) acc[r][j] += d[j] * xb;
+    }
+  }
+  for (r = 0; r < kr; r++) {
+    float *wp = w + (size_t) (k + r) * ld + j0;
+    float *op = oldw + (size_t) (k + r) * ld + j0;
+    #pragma omp simd
+    for (j = 0; j < jn; j++) {
+      float dw = acc[r][j] * scale + (float) MOMENTUM * op[j];
+      wp[j] += dw;
+      op[j] = dw;
+    }
+  }
+#endif
+}
+#ifdef __AVX2__
+/*** exp(z) for z in [-87, 88]: z = n ln2 + r with |r| <= ln2/2, a
+     polynomial in r, and n added to its exponent.  The degree 6 Cephes
+     polynomial is within 1 ulp, the degree 4 Taylor one within 5e-5. ***/
+
+static inline __m256 exp_ps(__m256 z, int fast)
+{
+  __m256 n, r, p;
+  __m256i e;
+
+  n = _mm256_round_ps(_mm256_mul_ps(z, _mm256_set1_ps(1.44269504088896341f)),
+                      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), z);
+  r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+  if (fast) {
+    p = _mm256_set1_ps(1.0f / 24);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 6));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.5f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+  } else {
+    p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+  }
+  e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+/*** 1 / (1 + exp(-x)); the fast tier takes the reciprocal from rcpps
+     and one Newton step instead of a division. ***/
+
+static inline __m256 sigmoid_ps(__m256 x, int fast)
+{
+  __m256 z = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), x),
+                                         _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+  __m256 d = _mm256_add_ps(_mm256_set1_ps(1.0f), exp_ps(z, fast));
+  __m256 y;
+
+  if (!fast)
+    return _mm256_div_ps(_mm256_set1_ps(1.0f), d);
+  y = _mm256_rcp_ps(d);
+  return _mm256_mul_ps(y, _mm256_fnmadd_ps(d, y, _mm256_set1_ps(2.0f)));
+}
+
+/* lanes [0, n) of a vector */
+static inline __m256i tail_mask(int n)
+{
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+static inline float hsum_ps(__m256 v)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+#endif
+
+/*** Forward epilogue of one pattern, a vector of units at a time:
+     l2[j] = sigmoid(sum_t partial[t][j]) for j = 1..n2, with the
+     partials of thread t stride floats apart.  The reference tier is
+     the scalar squash loop. ***/
+
+static void sigmoid_epilogue(const float *partial, int nthreads, size_t stride,
+                             float *l2, int n2)
+{
+  int j, t;
+
+#ifdef __AVX2__
+  if (bpnn_sigmoid != BPNN_SIGMOID_REF) {
+    int fast = bpnn_sigmoid == BPNN_SIGMOID_FAST;
+    for (j = 1; j <= n2; j += BPNN_VLEN) {
+      __m256i m = tail_mask(n2 + 1 - j);
+      __m256 s = _mm256_maskload_ps(partial + j, m);
+      for (t = 1; t < nthreads; t++)
+        s = _mm256_add_ps(s, _mm256_maskload_ps(partial + t * stride + j, m));
+      _mm256_maskstore_ps(l2 + j, m, sigmoid_ps(s, fast));
+    }
+    return;
+  }
+#endif
+  for (j = 1; j <= n2; j++) {
+    float sum = 0.0;
+    for (t = 0; t < nthreads; t++) sum += partial[t * stride + j];
+    l2[j] = squash(sum);
+  }
+}
+
+/*** Partials of layer_partials, grown on demand and kept, so that a
+     training step does not allocate. ***/
+
+static float *layer_scratch;
+static size_t layer_scratch_len;
+
+/*** Every thread sums its own block of the n1 + 1 rows of conn against
+     l1, into the partials it returns (owned by layer_partials). ***/
+
+static float *layer_partials(const float *l1, float **conn, int n1, int ld, int *nthreads)
+{
+  float *partial;
+  size_t len = (size_t) omp_get_max_threads() * ld;
+  int nt_used = 1;
+
+  if (len > layer_scratch_len) {
+    free(layer_scratch);
+    layer_scratch = (float *) memalign(BPNN_ALIGN, len * sizeof (float));
+    layer_scratch_len = len;
+  }
+  partial = layer_scratch;
+  #ifdef OPEN
+  #pragma omp parallel if(n1 >= PAR_MIN_ROWS)
+  #endif
+  {
+    int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+    int kb = (int) ((long) (n1 + 1) * tid / nt);
+    int ke = (int) ((long) (n1 + 1) * (tid + 1) / nt);
+    if (tid == 0) nt_used = nt;
+    gemv_t_rows(conn[0], ld, l1, kb, ke, partial + (size_t) tid * ld);
+  }
+  *nthreads = nt_used;
+  return (partial);
+}
+
+/*** conn is the (n1+1) x (n2+1) weight matrix from alloc_2d_dbl. ***/
+
 void bpnn_layerforward(l1, l2, conn, n1, n2)
 float *l1, *l2, **conn;
 int n1, n2;
 {
-  float sum;
-  int j, k;
+  int ld = BPNN_LD(n2 + 1);
+  int nthreads;
+  float *partial;
 
   /*** Set up thresholding unit ***/
   l1[0] = 1.0;
-  #ifdef OPEN
-  #pragma omp parallel for simd shared(conn, n1, n2, l1) private(k, j) reduction(+: sum) schedule(auto)
-  #endif
-  /*** For each unit in second layer ***/
-  for (j = 1; j <= n2; j++) {
 
-    /*** Compute weighted sum of its inputs ***/
-    sum = 0.0;
-    for (k = 0; k <= n1; k++) {
-      sum += conn[j][k] * l1[k];
-    }
-    l2[j] = squash(sum);
-  }
+  /*** Every thread sums its own block of input rows ***/
+  partial = layer_partials(l1, conn, n1, ld, &nthreads);
+
+  /*** For each unit in second layer ***/
+  sigmoid_epilogue(partial, nthreads, ld, l2, n2);
 }
 
 //extern "C"
@@ -326,27 +637,119 @@ void bpnn_hidden_error(delta_h,
   }
 
 
+/*** Output layer epilogue of one pattern, a single pass over its units:
+     o = sigmoid of the summed partials, the output error
+     delta_o = o (1 - o) (t - o) and from it the hidden error
+     delta_h[j] = h[j] (1 - h[j]) sum_k delta_o[k] who[j][k].  The
+     reference tier is the squash loop, bpnn_output_error and
+     bpnn_hidden_error. ***/
+
+static void output_epilogue(const float *partial, int nthreads, size_t stride,
+                            float *o, float *target, float *delta_o, int no,
+                            float *hidden, float **who, float *delta_h, int nh,
+                            float *eo, float *eh)
+{
+#ifdef __AVX2__
+  if (bpnn_sigmoid != BPNN_SIGMOID_REF) {
+    int fast = bpnn_sigmoid == BPNN_SIGMOID_FAST;
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 abs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 err = _mm256_setzero_ps();
+    float h, errsum;
+    int j, k, t;
+
+    for (j = 1; j <= no; j += BPNN_VLEN) {
+      __m256i m = tail_mask(no + 1 - j);
+      __m256 s = _mm256_maskload_ps(partial + j, m), y, d;
+      for (t = 1; t < nthreads; t++)
+        s = _mm256_add_ps(s, _mm256_maskload_ps(partial + t * stride + j, m));
+      y = sigmoid_ps(s, fast);
+      d = _mm256_mul_ps(_mm256_mul_ps(y, _mm256_sub_ps(one, y)),
+                        _mm256_sub_ps(_mm256_maskload_ps(target + j, m), y));
+      d = _mm256_and_ps(d, _mm256_castsi256_ps(m));
+      _mm256_maskstore_ps(o + j, m, y);
+      _mm256_maskstore_ps(delta_o + j, m, d);
+      err = _mm256_add_ps(err, _mm256_and_ps(d, abs));
+    }
+    *eo = hsum_ps(err);
+
+    /* The weights out of hidden unit j are the contiguous row who[j] */
+    errsum = 0.0f;
+    for (j = 1; j <= nh; j++) {
+      __m256 sum = _mm256_setzero_ps();
+      for (k = 1; k <= no; k += BPNN_VLEN) {
+        __m256i m = tail_mask(no + 1 - k);
+        sum = _mm256_fmadd_ps(_mm256_maskload_ps(delta_o + k, m),
+                              _mm256_maskload_ps(who[j] + k, m), sum);
+      }
+      h = hidden[j];
+      delta_h[j] = h * (1.0f - h) * hsum_ps(sum);
+      errsum += ABS(delta_h[j]);
+    }
+    *eh = errsum;
+    return;
+  }
+#endif
+  sigmoid_epilogue(partial, nthreads, stride, o, no);
+  bpnn_output_error(delta_o, target, o, no, eo);
+  bpnn_hidden_error(delta_h, nh, delta_o, no, who, hidden, eh);
+}
+
+
+/*** The forward pass into the output layer fused with the error
+     computation: bpnn_layerforward, bpnn_output_error and
+     bpnn_hidden_error with one epilogue.  l1 are the hidden units and
+     conn the hidden weights. ***/
+
+void bpnn_output_layer(float *l1, float *l2, float **conn, int n1, int n2, float *target,
+                       float *delta_o, float *delta_h, float *eo, float *eh)
+{
+  int ld = BPNN_LD(n2 + 1);
+  int nthreads;
+  float *partial;
+
+  l1[0] = 1.0;
+  partial = layer_partials(l1, conn, n1, ld, &nthreads);
+  output_epilogue(partial, nthreads, ld, l2, target, delta_o, n2,
+                  l1, conn, delta_h, n1, eo, eh);
+}
+
+
+/*** Selects the sigmoid by name (ref, accurate or fast), NULL for the
+     default.  Without AVX2 every tier is the reference. ***/
+
+int bpnn_set_sigmoid(const char *name)
+{
+  static const char *names[] = { "ref", "accurate", "fast" };
+  int i;
+
+  for (i = 0; name != NULL && i < 3; i++) {
+    if (strcmp(name, names[i]) == 0) break;
+  }
+  if (i == 3) return (-1);
+  if (name != NULL) bpnn_sigmoid = i;
+#ifndef __AVX2__
+  bpnn_sigmoid = BPNN_SIGMOID_REF;
+#endif
+  printf("Sigmoid: %s\n", names[bpnn_sigmoid]);
+  return (0);
+}
+
+
   void bpnn_adjust_weights(delta, ndelta, ly, nly, w, oldw)
   float *delta, *ly, **w, **oldw;
   {
-    float new_dw;
-    int k, j;
+    int k;
     ly[0] = 1.0;
     //eta = 0.3;
     //momentum = 0.3;
 
+    /*** w and oldw are contiguous, so row k of both is streamed once ***/
     #ifdef OPEN
-    #pragma omp parallel for simd \
-    shared(oldw, w, delta) \
-    private(j, k, new_dw) \
-    firstprivate(ndelta, nly)
+    #pragma omp parallel for schedule(static) if(nly >= PAR_MIN_ROWS)
     #endif
     for (k = 0; k <= nly; k++) {
-      for (j = 1; j <= ndelta; j++) {
-        new_dw = ((ETA * delta[j] * ly[k]) + (MOMENTUM * oldw[k][j]));
-        w[k][j] += new_dw;
-        oldw[k][j] = new_dw;
-      }
+      rank1_row(w[k], oldw[k], delta, (float) (ETA * ly[k]), ndelta);
     }
   }
 
@@ -362,9 +765,9 @@ void bpnn_hidden_error(delta_h,
 
     /*** Feed forward input activations. ***/
     bpnn_layerforward(net->input_units, net->hidden_units,
-      net->input_weights_t, in, hid);
+      net->input_weights, in, hid);
       bpnn_layerforward(net->hidden_units, net->output_units,
-        net->hidden_weights_t, hid, out);
+        net->hidden_weights, hid, out);
 
       }
 
@@ -382,15 +785,12 @@ void bpnn_hidden_error(delta_h,
 
         /*** Feed forward input activations. ***/
         bpnn_layerforward(net->input_units, net->hidden_units,
-          net->input_weights_t, in, hid);
-          bpnn_layerforward(net->hidden_units, net->output_units,
-            net->hidden_weights_t, hid, out);
-
-            /*** Compute error on output and hidden units. ***/
-            bpnn_output_error(net->output_delta, net->target, net->output_units,
-              out, &out_err);
-              bpnn_hidden_error(net->hidden_delta, hid, net->output_delta, out,
-                net->hidden_weights, net->hidden_units, &hid_err);
+          net->input_weights, in, hid);
+          /*** and on into the output layer, computing the error on
+               output and hidden units in the same pass. ***/
+          bpnn_output_layer(net->hidden_units, net->output_units,
+            net->hidden_weights, hid, out, net->target,
+            net->output_delta, net->hidden_delta, &out_err, &hid_err);
                 *eo = out_err;
                 *eh = hid_err;
 
@@ -403,6 +803,181 @@ void bpnn_hidden_error(delta_h,
                   }
 
 
+/*** Creates a batch of n patterns for net, all of them zero with the
+     threshold unit set and the targets of bpnn_create.  The pattern
+     matrices have BPNN_BATCH_MR-rounded rows; the forward pass fills the
+     hidden padding rows, but their deltas stay zero, so they do not
+     change the weights.  The
+     partials of the forward GEMMs are allocated here too, for the
+     current maximum number of threads. ***/
+
+BPNN_BATCH *bpnn_batch_create(BPNN *net, int n)
+{
+  BPNN_BATCH *batch;
+  int b, rows = (n + BPNN_BATCH_MR - 1) / BPNN_BATCH_MR * BPNN_BATCH_MR;
+  int ldi = BPNN_LD(net->input_n + 1);
+  int ldh = BPNN_LD(net->hidden_n + 1);
+  int ldo = BPNN_LD(net->output_n + 1);
+  size_t size = (size_t) rows * (ldi + 2 * ldh + 3 * ldo) * sizeof (float);
+  int nthreads = omp_get_max_threads();
+  float *block, *partial;
+
+  batch = (BPNN_BATCH *) malloc (sizeof (BPNN_BATCH));
+  block = (float *) memalign(BPNN_ALIGN, size);
+  partial = (float *) memalign(BPNN_ALIGN, (size_t) nthreads * rows *
+                               (ldh > ldo ? ldh : ldo) * sizeof (float));
+  if (batch == NULL || block == NULL || partial == NULL) {
+    printf("BPNN_BATCH_CREATE: Couldn't allocate a batch of %d patterns\n", n);
+    free(batch);
+    free(block);
+    free(partial);
+    return (NULL);
+  }
+  memset(block, 0, size);
+
+  batch->n = n;
+  batch->rows = rows;
+  batch->nthreads = nthreads;
+  batch->partial = partial;
+  batch->input = block;
+  batch->hidden = batch->input + (size_t) rows * ldi;
+  batch->hidden_delta = batch->hidden + (size_t) rows * ldh;
+  batch->output = batch->hidden_delta + (size_t) rows * ldh;
+  batch->output_delta = batch->output + (size_t) rows * ldo;
+  batch->target = batch->output_delta + (size_t) rows * ldo;
+  for (b = 0; b < n; b++) {
+    batch->input[(size_t) b * ldi] = 1.0;
+    bpnn_randomize_row(batch->target + (size_t) b * ldo, net->output_n);
+  }
+  return (batch);
+}
+
+
+void bpnn_batch_free(BPNN_BATCH *batch)
+{
+  free((char *) batch->input);
+  free((char *) batch->partial);
+  free((char *) batch);
+}
+
+
+/*** Batched layer_partials: as for one pattern, every thread sums its
+     own block of input rows, here for all rows of a batch at once, into
+     the partials of the batch.  The partials of thread t start at
+     t * rows * ld, and the team is capped to the threads they were
+     allocated for. ***/
+
+static float *batch_partials(BPNN_BATCH *batch, const float *x, int ldx, float **conn,
+                             int n1, int ld, int *nthreads)
+{
+  float *partial = batch->partial;
+  int rows = batch->rows;
+  int nt_used = 1;
+
+  #ifdef OPEN
+  #pragma omp parallel if(n1 >= PAR_MIN_ROWS) num_threads(batch->nthreads)
+  #endif
+  {
+    int tid = omp_get_thread_num(), nt = omp_get_num_threads();
+    int kb = (int) ((long) (n1 + 1) * tid / nt);
+    int ke = (int) ((long) (n1 + 1) * (tid + 1) / nt);
+    if (tid == 0) nt_used = nt;
+    gemm_rows(x, ldx, rows, conn[0], ld, kb, ke, partial + (size_t) tid * rows * ld);
+  }
+  *nthreads = nt_used;
+  return (partial);
+}
+
+
+/*** Batched bpnn_layerforward: y[b] = sigmoid(x[b] . conn) for all rows
+     of a batch, the reduction of the partials and the sigmoid in one
+     epilogue pass. ***/
+
+static void bpnn_batch_layerforward(BPNN_BATCH *batch, const float *x, int ldx, float *y,
+                                    float **conn, int n1, int n2)
+{
+  int ld = BPNN_LD(n2 + 1);
+  int rows = batch->rows;
+  int nthreads, b;
+  float *partial;
+
+  partial = batch_partials(batch, x, ldx, conn, n1, ld, &nthreads);
+  for (b = 0; b < rows; b++) {
+    y[(size_t) b * ld] = 1.0;
+    sigmoid_epilogue(partial + (size_t) b * ld, nthreads, (size_t) rows * ld,
+                     y + (size_t) b * ld, n2);
+  }
+}
+
+
+/*** Batched bpnn_adjust_weights: the mean of the weight changes of the
+     patterns, dw = ETA / n * sum_b ly[b][k] * delta[b][.], plus momentum.
+     Row blocks of BPNN_BATCH_MR are split over the threads. ***/
+
+static void bpnn_batch_adjust_weights(const float *delta, int ndelta, const float *ly, int nly,
+                                      int rows, int n, float **w, float **oldw)
+{
+  int ld = BPNN_LD(ndelta + 1);
+  int ldy = BPNN_LD(nly + 1);
+  int nblk = (nly + 1) / BPNN_BATCH_MR;
+  float scale = (float) (ETA / n);
+  int i, k, j0;
+
+  #ifdef OPEN
+  #pragma omp parallel for schedule(static) private(j0) if(nly >= PAR_MIN_ROWS)
+  #endif
+  for (i = 0; i < nblk; i++) {
+    for (j0 = 0; j0 < ld; j0 += 2 * BPNN_VLEN)
+      update_tile(ly, ldy, rows, delta, ld, w[0], oldw[0], ld, i * BPNN_BATCH_MR,
+                  BPNN_BATCH_MR, j0, ld - j0 >= 2 * BPNN_VLEN ? 2 : 1, scale);
+  }
+  for (k = nblk * BPNN_BATCH_MR; k <= nly; k++) {
+    for (j0 = 0; j0 < ld; j0 += 2 * BPNN_VLEN)
+      update_tile(ly, ldy, rows, delta, ld, w[0], oldw[0], ld, k,
+                  1, j0, ld - j0 >= 2 * BPNN_VLEN ? 2 : 1, scale);
+  }
+}
+
+
+/*** One training step on a batch: forward, error and the mean weight
+     change of its patterns, forward and update as blocked GEMMs.  With
+     one pattern this is bpnn_train. ***/
+
+void bpnn_train_batch(BPNN *net, BPNN_BATCH *batch, float *eo, float *eh)
+{
+  int in = net->input_n, hid = net->hidden_n, out = net->output_n;
+  int ldi = BPNN_LD(in + 1), ldh = BPNN_LD(hid + 1), ldo = BPNN_LD(out + 1);
+  int b, nthreads;
+  float out_err = 0.0, hid_err = 0.0;
+  float *partial;
+
+  bpnn_batch_layerforward(batch, batch->input, ldi, batch->hidden,
+                          net->input_weights, in, hid);
+
+  /*** The output layer with the output and hidden error of every
+       pattern in its epilogue ***/
+  partial = batch_partials(batch, batch->hidden, ldh, net->hidden_weights, hid, ldo,
+                           &nthreads);
+  for (b = 0; b < batch->n; b++) {
+    float eo_b, eh_b;
+    output_epilogue(partial + (size_t) b * ldo, nthreads, (size_t) batch->rows * ldo,
+                    batch->output + (size_t) b * ldo, batch->target + (size_t) b * ldo,
+                    batch->output_delta + (size_t) b * ldo, out,
+                    batch->hidden + (size_t) b * ldh, net->hidden_weights,
+                    batch->hidden_delta + (size_t) b * ldh, hid, &eo_b, &eh_b);
+    out_err += eo_b;
+    hid_err += eh_b;
+  }
+
+  bpnn_batch_adjust_weights(batch->output_delta, out, batch->hidden, hid,
+                            batch->rows, batch->n, net->hidden_weights, net->hidden_prev_weights);
+  bpnn_batch_adjust_weights(batch->hidden_delta, hid, batch->input, in,
+                            batch->rows, batch->n, net->input_weights, net->input_prev_weights);
+  *eo = out_err;
+  *eh = hid_err;
+}
+
+
 
 
                   void bpnn_save(net, filename)
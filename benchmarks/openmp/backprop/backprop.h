@@ -8,6 +8,19 @@
 #define MOMENTUM 0.3  //momentum value
 //#define NUM_THREAD 8 //OpenMP threads
 
+#define BPNN_ALIGN 64 //alignment of weight matrices (bytes)
+#define BPNN_VLEN 8   //floats per AVX2 register
+
+/* row length of a weight matrix with n columns, padded to whole vectors */
+#define BPNN_LD(n) ((((n) + BPNN_VLEN - 1) / BPNN_VLEN) * BPNN_VLEN)
+
+#define BPNN_BATCH_MR 4 //patterns per register tile of the batched kernels
+
+/* Sigmoid of the forward epilogues (bpnn_set_sigmoid, SIGMOID=...) */
+#define BPNN_SIGMOID_REF      0 //squash() in double, bit-exact with the scalar code
+#define BPNN_SIGMOID_ACCURATE 1 //AVX2 degree 6 exp and a division, within 3 ulp
+#define BPNN_SIGMOID_FAST     2 //AVX2 degree 4 exp and rcpps, within 2e-5
+
 
 typedef struct {
   int input_n;                  /* number of input units */
@@ -23,8 +36,9 @@ typedef struct {
 
   float *target;               /* storage for target vector */
 
-  float **input_weights_t;
-  float **hidden_weights_t;
+  /* Weight matrices are one contiguous aligned block each (see
+     alloc_2d_dbl), row k holding the weights from unit k of the lower
+     layer to all units of the upper one. */
   float **input_weights;       /* weights from input to hidden layer */
   float **hidden_weights;      /* weights from hidden to output layer */
 
@@ -34,6 +48,29 @@ typedef struct {
 } BPNN;
 
 
+/* A mini-batch of patterns for bpnn_train_batch.  Each matrix has one
+   row per pattern, with the leading dimension BPNN_LD of its layer and
+   column 0 for the threshold unit; the rows are rounded up to
+   BPNN_BATCH_MR.  The padding rows of the deltas stay zero; the forward
+   pass fills those of hidden. */
+typedef struct {
+  int n;                       /* number of patterns */
+  int rows;                    /* n rounded up to BPNN_BATCH_MR */
+
+  float *input;                /* [rows][BPNN_LD(input_n + 1)] */
+  float *hidden;               /* [rows][BPNN_LD(hidden_n + 1)] */
+  float *output;               /* [rows][BPNN_LD(output_n + 1)] */
+
+  float *hidden_delta;         /* [rows][BPNN_LD(hidden_n + 1)] */
+  float *output_delta;         /* [rows][BPNN_LD(output_n + 1)] */
+
+  float *target;               /* [rows][BPNN_LD(output_n + 1)] */
+
+  int nthreads;                /* threads the partials have room for */
+  float *partial;              /* [nthreads][rows][larger BPNN_LD] forward scratch */
+} BPNN_BATCH;
+
+
 /*** User-level functions ***/
 
 void bpnn_initialize();
@@ -43,6 +80,12 @@ void bpnn_free();
 
 void bpnn_train();
 void bpnn_feedforward();
+void bpnn_output_layer();
+int bpnn_set_sigmoid();
+
+BPNN_BATCH *bpnn_batch_create();
+void bpnn_batch_free();
+void bpnn_train_batch();
 
 void bpnn_save();
 BPNN *bpnn_read();
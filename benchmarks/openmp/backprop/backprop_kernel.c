@@ -2,9 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
-#include <sys/time.h>
 #include <omp.h>
 
+#include <parboil.h>
+
 #include "backprop.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -15,6 +16,8 @@ extern void bpnn_output_error(float *delta, float *target, float *output, int nj
 
 extern void bpnn_hidden_error(float *delta_h, int nh, float *delta_o, int no, float **who, float *hidden, float *err);
 
+extern void bpnn_output_layer(float *l1, float *l2, float **conn, int n1, int n2, float *target, float *delta_o, float *delta_h, float *eo, float *eh);
+
 extern void bpnn_adjust_weights(float *delta, int ndelta, float *ly, int nly, float **w, float **oldw);
 
 
@@ -24,10 +27,32 @@ extern float **alloc_2d_dbl(int m, int n);
 
 extern float squash(float x);
 
-double gettime() {
-  struct timeval t;
-  gettimeofday(&t,NULL);
-  return t.tv_sec+t.tv_usec*1e-6;
+struct train_args {
+  BPNN *net;
+  BPNN_BATCH *batch;
+};
+
+/* One forward and backward pass over the network, one harness iteration */
+static void bpnn_train_step(void *arg)
+{
+  struct train_args *a = (struct train_args *)arg;
+  BPNN *net = a->net;
+  int in, hid, out;
+  float out_err, hid_err;
+
+  if (a->batch) {
+    bpnn_train_batch(net, a->batch, &out_err, &hid_err);
+    return;
+  }
+
+  in = net->input_n;
+  hid = net->hidden_n;
+  out = net->output_n;
+
+  bpnn_layerforward(net->input_units, net->hidden_units,net->input_weights, in, hid);
+  bpnn_output_layer(net->hidden_units, net->output_units, net->hidden_weights, hid, out, net->target, net->output_delta, net->hidden_delta, &out_err, &hid_err);
+  bpnn_adjust_weights(net->output_delta, out, net->hidden_units, hid, net->hidden_weights, net->hidden_prev_weights);
+  bpnn_adjust_weights(net->hidden_delta, hid, net->input_units, in, net->input_weights, net->input_prev_weights);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,83 +65,42 @@ main( int argc, char** argv)
 }
 
 
-void bpnn_train_kernel(BPNN *net, float *eo, float *eh)
+void bpnn_train_kernel(BPNN *net, BPNN_BATCH *batch, float *eo, float *eh)
 {
-  int in, hid, out;
-  float out_err, hid_err;
-
-  in = net->input_n;
-  hid = net->hidden_n;
-  out = net->output_n;
+  struct pb_HarnessConfig config;
+  struct pb_HarnessResult result;
+  struct pb_RunRecord record;
+  struct train_args args = { net, batch };
+  char layer_size[32];
+  double w1, w2, nb = batch ? batch->n : 1;
 
   printf("Performing CPU computation\n");
 
-  int i;
-  // const char* env_iter = getenv("ITER");
-  // int iteration = (env_iter != NULL) ? atoi(env_iter) : 1;
-  // printf("[ITERATION NUM]:%d\n", iteration);
-  const char* env_itrs = getenv("ITERS");
-  int nIter = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-  const char* env_secs = getenv("SECS");
-  int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
-  //int timeRestrict = (env_secs != NULL) ? 1 : 0;
-
-  double start_t;
-  double end_t;
-  double total_s0, total_s1, total_s2 = 0.0;
-  //double total_s0, total_s1, total_s2;
-  //total_s0 = total_s1 = total_s2 = 0;
-  int c0, c1, c2;
-  c0 = 0;
-  c1 = 0;
-  c2 = 0;
-
-  if(secs == -1) {
-    fprintf(stderr, "You must set a time larger than 0 seconds!\n");
-    return 1;
-  }
-
-  for (int i = -60; i<nIter; i++) {
-
-    start_t = gettime();
-
-    bpnn_layerforward(net->input_units, net->hidden_units,net->input_weights, in, hid);
-    bpnn_layerforward(net->hidden_units, net->output_units, net->hidden_weights, hid, out);
-    bpnn_output_error(net->output_delta, net->target, net->output_units, out, &out_err);
-    bpnn_hidden_error(net->hidden_delta, hid, net->output_delta, out, net->hidden_weights, net->hidden_units, &hid_err);
-    bpnn_adjust_weights(net->output_delta, out, net->hidden_units, hid, net->hidden_weights, net->hidden_prev_weights);
-    bpnn_adjust_weights(net->hidden_delta, hid, net->input_units, in, net->input_weights, net->input_prev_weights);
-
-    end_t = gettime();
-    if(i < -40)
-    {
-      c0++;
-      total_s0 += end_t - start_t;
-    }
-    else if(i < -20 && i >= -40)
-    {
-      c1++;
-      total_s1 += end_t - start_t;
-    }
-    else if(i >= -40)
-    {
-      c2++;
-      total_s2 += end_t - start_t;
-
-      if (i == -1)
-      {
-        double tPerIter = total_s2 / c2;
-        printf("Sampling from the first 20 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-        printf("Sampling from the middle 20 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-        printf("Sampling from the last 20 itrs.\nEstimated time: %lf s.\n", tPerIter);
-        nIter = (int)((double)secs / tPerIter) + 1;
-        printf("Adjust %d iterations to meet %d seconds.\n", nIter, secs);
-        c2 = 0;
-        total_s2=0;
-      }
-    }
-  }
-  double averMsecs = total_s2 / nIter * 1000;
-  printf("Finish %d iterations and spent %lf secs!\n", nIter, total_s2);
-  printf("average time is %lf ms.\n", averMsecs);
+  if (pb_InitHarnessConfig(&config) != 0)
+    exit(1);
+
+  if (pb_RunHarness(&config, bpnn_train_step, &args, &result) != 0)
+    exit(1);
+  pb_PrintHarnessResult(batch ? "backprop_batch" : "backprop", &result);
+  pb_FreeHarnessResult(&result);
+
+  /* Per weight and pattern: 2 flops forward, 2 for its change and for
+   * the hidden layer 2 more to propagate the error, plus 3 per weight to
+   * apply the change with momentum; the weights are read forward, and
+   * read and written with their previous deltas when adjusted.  A batch
+   * adds its input patterns, read once forward and once to adjust. */
+  w1 = (double)(net->input_n + 1) * (net->hidden_n + 1);
+  w2 = (double)(net->hidden_n + 1) * (net->output_n + 1);
+  if (batch)
+    snprintf(layer_size, sizeof(layer_size), "%dx%d", net->input_n, batch->n);
+  else
+    snprintf(layer_size, sizeof(layer_size), "%d", net->input_n);
+  pb_InitRunRecord(&record, batch ? "backprop_batch" : "backprop", layer_size);
+  record.harness = &result;
+  record.flops = (4 * nb + 3) * w1 + (6 * nb + 3) * w2;
+  record.bytes = 5 * sizeof(float) * (w1 + w2);
+  if (batch)
+    record.bytes += 2 * sizeof(float) * nb * (net->input_n + 1);
+  if (pb_EmitRunRecord(&record) != 0)
+    exit(1);
 }
@@ -8,18 +8,28 @@ extern char *strcpy();
 extern void exit();
 
 int layer_size = 0;
+int batch_size = 0; /* patterns per training step, 0 trains on one */
 
 backprop_face()
 {
   BPNN *net;
+  BPNN_BATCH *batch = NULL;
   int i;
   float out_err, hid_err;
   net = bpnn_create(layer_size, 16, 1); // (16, 1 can not be changed)
   printf("Input layer size : %d\n", layer_size);
-  load(net);
+  if (batch_size > 0) {
+    printf("Batch size : %d\n", batch_size);
+    batch = bpnn_batch_create(net, batch_size);
+    if (batch == NULL) exit(1);
+    load_batch(net, batch);
+  } else {
+    load(net);
+  }
   //entering the training kernel, only one iteration
   printf("Starting training kernel\n");
-  bpnn_train_kernel(net, &out_err, &hid_err);
+  bpnn_train_kernel(net, batch, &out_err, &hid_err);
+  if (batch) bpnn_batch_free(batch);
   bpnn_free(net);
   printf("Training done\n");
 }
@@ -28,17 +38,22 @@ int setup(argc, argv)
 int argc;
 char *argv[];
 {
-  if(argc!=2){
-  fprintf(stderr, "usage: backprop <num of input elements>\n");
+  if(argc!=2 && argc!=3){
+  fprintf(stderr, "usage: backprop <num of input elements> [<patterns per batch>]\n");
   exit(0);
   }
 
   layer_size = atoi(argv[1]);
+  if (argc == 3) batch_size = atoi(argv[2]);
   
   int seed;
 
   seed = 7;   
   bpnn_initialize(seed);
+  if (bpnn_set_sigmoid(getenv("SIGMOID")) != 0) {
+  fprintf(stderr, "SIGMOID must be ref, accurate or fast\n");
+  exit(1);
+  }
   backprop_face();
 
   exit(0);
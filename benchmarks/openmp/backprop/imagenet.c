@@ -22,3 +22,23 @@ BPNN *net;
 	  k++;
     }
 }
+
+/* Batch mode: a random pattern for every row of the batch, the first
+   one the pattern load() gives the input units */
+load_batch(net, batch)
+BPNN *net;
+BPNN_BATCH *batch;
+{
+  float *units;
+  int nr, ld, b, k;
+
+  nr = layer_size;
+  ld = BPNN_LD(nr + 1);
+
+  for (b = 0; b < batch->n; b++) {
+    units = batch->input + (size_t) b * ld;
+    for (k = 1; k <= nr; k++) {
+      units[k] = (float) rand()/RAND_MAX ;
+    }
+  }
+}
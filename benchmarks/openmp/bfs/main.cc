@@ -142,9 +142,10 @@ void runCPU( int argc, char** argv)
 	int source;
 
 	fscanf(fp,"%d",&no_of_nodes);
-	// allocate host memory
-	Node* h_graph_nodes = (Node*) malloc(sizeof(Node)*no_of_nodes);
-	int *color = (int*) malloc(sizeof(int)*no_of_nodes);
+	// allocate host memory; the graph is walked in wavefront order,
+	// which no thread owns, so the pages are spread over the nodes
+	Node* h_graph_nodes = (Node*) pb_Alloc("h_graph_nodes", sizeof(Node)*no_of_nodes, PB_ALLOC_INTERLEAVE);
+	int *color = (int*) pb_Alloc("color", sizeof(int)*no_of_nodes, PB_ALLOC_INTERLEAVE);
 	int start, edgeno;   
 	// initalize the memory
 	for( unsigned int i = 0; i < no_of_nodes; i++) 
@@ -158,7 +159,7 @@ void runCPU( int argc, char** argv)
 	fscanf(fp,"%d",&source);
 	fscanf(fp,"%d",&edge_list_size);
 	int id,cost;
-	Edge* h_graph_edges = (Edge*) malloc(sizeof(Edge)*edge_list_size);
+	Edge* h_graph_edges = (Edge*) pb_Alloc("h_graph_edges", sizeof(Edge)*edge_list_size, PB_ALLOC_INTERLEAVE);
 	for(int i=0; i < edge_list_size ; i++)
 	{
 		fscanf(fp,"%d",&id);
@@ -172,16 +173,21 @@ void runCPU( int argc, char** argv)
 	//printf("Read File\n");
 
 	// allocate mem for the result on host side
-	int* h_cost = (int*) malloc( sizeof(int)*no_of_nodes);
+	int* h_cost = (int*) pb_Alloc("h_cost", sizeof(int)*no_of_nodes, PB_ALLOC_INTERLEAVE);
 	for(int i = 0; i < no_of_nodes; i++){
 		h_cost[i] = INF;
 	}
 	h_cost[source] = 0;
 	//printf("start cpu version\n");
 	unsigned int cpu_timer = 0;
+	struct pb_Timer bfs_timer;
     pb_SwitchToTimer(&timers, pb_TimerID_COMPUTE);
+	pb_ResetTimer(&bfs_timer);
+	pb_StartTimer(&bfs_timer);
 	BFS_CPU( h_graph_nodes, h_graph_edges, color, h_cost,  source 
 		 );
+	pb_StopTimer(&bfs_timer);
+	pb_PrintAllocations();
     pb_SwitchToTimer(&timers, pb_TimerID_IO);
     if(params->outFile!=NULL)
     {
@@ -196,11 +202,21 @@ void runCPU( int argc, char** argv)
 
     pb_SwitchToTimer(&timers, pb_TimerID_COMPUTE);
 	// cleanup memory
-	free( h_graph_nodes);
-	free( h_graph_edges);
-	free( color);
-	free( h_cost);
+	pb_Free( h_graph_nodes);
+	pb_Free( h_graph_edges);
+	pb_Free( color);
+	pb_Free( h_cost);
     pb_SwitchToTimer(&timers, pb_TimerID_NONE);
+
+    // one traversal, every edge is visited once
+    struct pb_RunRecord record;
+    pb_InitRunRecord(&record, "bfs", params->inpFiles[0]);
+    record.iterations = 1;
+    record.seconds = pb_GetElapsedTime(&bfs_timer);
+    record.timers = &timers;
+    record.edges = edge_list_size;
+    if (pb_EmitRunRecord(&record) != 0)
+        exit(1);
     pb_PrintTimerSet(&timers);
     pb_FreeParameters(params);
 }
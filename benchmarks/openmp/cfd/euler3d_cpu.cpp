@@ -13,18 +13,51 @@
 #endif
 
 #include <omp.h>
+#include <parboil.h>
+#include "mesh.h"
 #include <stdlib.h>
+#include <string.h>
 
-struct float3 { float x, y, z; };
+template <typename T>
+struct vec3 { T x, y, z; };
 
+/*
+ * Variants
+ *
+ * One source builds every variant. The kernel is a template on the storage
+ * type S of the state and mesh, the type A that fluxes are computed and
+ * accumulated in, the block length and whether the flux contributions of
+ * all elements are precomputed into arrays before each stage (instead of
+ * being recomputed for every neighbour). The instantiation is picked at run
+ * time:
+ *
+ *   PRECISION=float   S = A = float
+ *   PRECISION=double  S = A = double
+ *   PRECISION=mixed   S = float, A = double: float state and mesh traffic,
+ *                     double flux accumulation and residual update
+ *   PRECOMPUTE=0|1    redundant or precomputed flux contributions
+ *   BLOCK_LENGTH=n    elements per block, one of 1, 2, 4, ..., 64
+ *
+ * The defaults come from the build (-Ddefault_precision=..., -Dprecompute=1,
+ * -Dblock_length=n), which is how the makefile keeps the four historical
+ * binaries.
+ */
 #ifndef block_length
 	#ifdef _OPENMP
-	#error "you need to define block_length"
+	#define block_length 8
 	#else
 	#define block_length 1
 	#endif
 #endif
 
+#ifndef default_precision
+#define default_precision "float"
+#endif
+
+#ifndef precompute
+#define precompute 0
+#endif
+
 /*
  * Options
  *
@@ -32,9 +65,6 @@ struct float3 { float x, y, z; };
 #define GAMMA 1.4
 int iterations=100;
 
-#define NDIM 3
-#define NNB 4
-
 #define RK 3	// 3rd order RK
 #define ff_mach 1.2
 #define deg_angle_of_attack 0.0f
@@ -47,53 +77,33 @@ int iterations=100;
 #define VAR_DENSITY_ENERGY (VAR_MOMENTUM+NDIM)
 #define NVAR (VAR_DENSITY_ENERGY+1)
 
+// precomputed flux contributions: momentum x, y, z and density energy,
+// NDIM components each
+#define FC_MOMENTUM_X 0
+#define FC_MOMENTUM_Y (FC_MOMENTUM_X+NDIM)
+#define FC_MOMENTUM_Z (FC_MOMENTUM_Y+NDIM)
+#define FC_DENSITY_ENERGY (FC_MOMENTUM_Z+NDIM)
+#define NFC (FC_DENSITY_ENERGY+NDIM)
+
 
 #ifdef restrict
 #define __restrict restrict
 #else
-#define __restrict 
+#define __restrict
 #endif
 
-/*
- * Generic functions
- */
-template <typename T>
-T* alloc(int N)
-{
-	return new T[N];
-}
 
-template <typename T>
-void dealloc(T* array)
-{
-	delete[] array;
-}
-
-#ifdef OMP_OFFLOAD
-#pragma omp declare target
-#endif
-template <typename T>
-void copy(T* dst, T* src, int N)
-{
-	#pragma omp parallel for default(shared) schedule(static)
-	for(int i = 0; i < N; i++)
-	{
-		dst[i] = src[i];
-	}
-}
-#ifdef OMP_OFFLOAD
-#pragma omp end declare target
-#endif
-
-
-void dump(float* variables, int nel, int nelr)
+// order maps file element numbers to storage slots (NULL if the mesh was not
+// reordered), so the output is always written in file order
+template <typename S>
+void dump(S* variables, int nel, int nelr, int* order)
 {
 
 
 	{
 		std::ofstream file("density");
 		file << nel << " " << nelr << std::endl;
-		for(int i = 0; i < nel; i++) file << variables[i + VAR_DENSITY*nelr] << std::endl;
+		for(int i = 0; i < nel; i++) file << variables[(order ? order[i] : i) + VAR_DENSITY*nelr] << std::endl;
 	}
 
 
@@ -102,7 +112,7 @@ void dump(float* variables, int nel, int nelr)
 		file << nel << " " << nelr << std::endl;
 		for(int i = 0; i < nel; i++)
 		{
-			for(int j = 0; j != NDIM; j++) file << variables[i + (VAR_MOMENTUM+j)*nelr] << " ";
+			for(int j = 0; j != NDIM; j++) file << variables[(order ? order[i] : i) + (VAR_MOMENTUM+j)*nelr] << " ";
 			file << std::endl;
 		}
 	}
@@ -110,24 +120,34 @@ void dump(float* variables, int nel, int nelr)
 	{
 		std::ofstream file("density_energy");
 		file << nel << " " << nelr << std::endl;
-		for(int i = 0; i < nel; i++) file << variables[i + VAR_DENSITY_ENERGY*nelr] << std::endl;
+		for(int i = 0; i < nel; i++) file << variables[(order ? order[i] : i) + VAR_DENSITY_ENERGY*nelr] << std::endl;
 	}
 
 }
 
-void initialize_variables(int nelr, float* variables, float* ff_variable)
+// far field state and its flux contributions, in compute precision
+template <typename A>
+struct far_field
+{
+	A variable[NVAR];
+	vec3<A> fc_momentum_x, fc_momentum_y, fc_momentum_z, fc_density_energy;
+};
+
+template <typename S, typename A>
+void initialize_variables(int nelr, S* variables, const far_field<A>& ff)
 {
 	#pragma omp parallel for default(shared) schedule(static)
 	for(int i = 0; i < nelr; i++)
 	{
-		for(int j = 0; j < NVAR; j++) variables[i + j*nelr] = ff_variable[j];
+		for(int j = 0; j < NVAR; j++) variables[i + j*nelr] = S(ff.variable[j]);
 	}
 }
 
 #ifdef OMP_OFFLOAD
 #pragma omp declare target
 #endif
-inline void compute_flux_contribution(float& density, float3& momentum, float& density_energy, float& pressure, float3& velocity, float3& fc_momentum_x, float3& fc_momentum_y, float3& fc_momentum_z, float3& fc_density_energy)
+template <typename A>
+inline void compute_flux_contribution(A& density, vec3<A>& momentum, A& density_energy, A& pressure, vec3<A>& velocity, vec3<A>& fc_momentum_x, vec3<A>& fc_momentum_y, vec3<A>& fc_momentum_z, vec3<A>& fc_density_energy)
 {
 	fc_momentum_x.x = velocity.x*momentum.x + pressure;
 	fc_momentum_x.y = velocity.x*momentum.y;
@@ -141,117 +161,176 @@ inline void compute_flux_contribution(float& density, float3& momentum, float& d
 	fc_momentum_z.y = fc_momentum_y.z;
 	fc_momentum_z.z = velocity.z*momentum.z + pressure;
 
-	float de_p = density_energy+pressure;
+	A de_p = density_energy+pressure;
 	fc_density_energy.x = velocity.x*de_p;
 	fc_density_energy.y = velocity.y*de_p;
 	fc_density_energy.z = velocity.z*de_p;
 }
 
-inline void compute_velocity(float& density, float3& momentum, float3& velocity)
+template <typename A>
+inline void compute_velocity(A& density, vec3<A>& momentum, vec3<A>& velocity)
 {
 	velocity.x = momentum.x / density;
 	velocity.y = momentum.y / density;
 	velocity.z = momentum.z / density;
 }
 
-inline float compute_speed_sqd(float3& velocity)
+template <typename A>
+inline A compute_speed_sqd(vec3<A>& velocity)
 {
 	return velocity.x*velocity.x + velocity.y*velocity.y + velocity.z*velocity.z;
 }
 
-inline float compute_pressure(float& density, float& density_energy, float& speed_sqd)
+template <typename A>
+inline A compute_pressure(A& density, A& density_energy, A& speed_sqd)
 {
-	return (float(GAMMA)-float(1.0f))*(density_energy - float(0.5f)*density*speed_sqd);
+	return (A(GAMMA)-A(1.0f))*(density_energy - A(0.5f)*density*speed_sqd);
 }
 
-inline float compute_speed_of_sound(float& density, float& pressure)
+template <typename A>
+inline A compute_speed_of_sound(A& density, A& pressure)
 {
-	return std::sqrt(float(GAMMA)*pressure/density);
+	return std::sqrt(A(GAMMA)*pressure/density);
 }
 
+// state of element i, widened to compute precision
+template <typename S, typename A>
+inline void load_state(int i, int nelr, const S* variables, A& density, vec3<A>& momentum, A& density_energy)
+{
+	density = variables[i + VAR_DENSITY*nelr];
+	momentum.x = variables[i + (VAR_MOMENTUM+0)*nelr];
+	momentum.y = variables[i + (VAR_MOMENTUM+1)*nelr];
+	momentum.z = variables[i + (VAR_MOMENTUM+2)*nelr];
+	density_energy = variables[i + VAR_DENSITY_ENERGY*nelr];
+}
 
-void compute_step_factor(int nelr, float* __restrict variables, float* areas, float* __restrict step_factors)
+template <typename S, typename A>
+inline void load_flux_contribution(int i, int nelr, const S* fc, vec3<A>& fc_momentum_x, vec3<A>& fc_momentum_y, vec3<A>& fc_momentum_z, vec3<A>& fc_density_energy)
 {
-	#pragma omp parallel for default(shared) schedule(auto)
-        for(int blk = 0; blk < nelr/block_length; ++blk)
-        {
-            int b_start = blk*block_length;
-            int b_end = (blk+1)*block_length > nelr ? nelr : (blk+1)*block_length;
-#pragma omp simd
-	for(int i = b_start; i < b_end; i++)
-	{
-		float density = variables[i + VAR_DENSITY*nelr];
+	fc_momentum_x.x = fc[i + (FC_MOMENTUM_X+0)*nelr];
+	fc_momentum_x.y = fc[i + (FC_MOMENTUM_X+1)*nelr];
+	fc_momentum_x.z = fc[i + (FC_MOMENTUM_X+2)*nelr];
+	fc_momentum_y.x = fc[i + (FC_MOMENTUM_Y+0)*nelr];
+	fc_momentum_y.y = fc[i + (FC_MOMENTUM_Y+1)*nelr];
+	fc_momentum_y.z = fc[i + (FC_MOMENTUM_Y+2)*nelr];
+	fc_momentum_z.x = fc[i + (FC_MOMENTUM_Z+0)*nelr];
+	fc_momentum_z.y = fc[i + (FC_MOMENTUM_Z+1)*nelr];
+	fc_momentum_z.z = fc[i + (FC_MOMENTUM_Z+2)*nelr];
+	fc_density_energy.x = fc[i + (FC_DENSITY_ENERGY+0)*nelr];
+	fc_density_energy.y = fc[i + (FC_DENSITY_ENERGY+1)*nelr];
+	fc_density_energy.z = fc[i + (FC_DENSITY_ENERGY+2)*nelr];
+}
+
+template <typename S, typename A>
+inline A compute_step_factor(int i, int nelr, S* variables, S* areas)
+{
+		A density, density_energy;
+		vec3<A> momentum;
+		load_state(i, nelr, variables, density, momentum, density_energy);
 
-		float3 momentum;
-		momentum.x = variables[i + (VAR_MOMENTUM+0)*nelr];
-		momentum.y = variables[i + (VAR_MOMENTUM+1)*nelr];
-		momentum.z = variables[i + (VAR_MOMENTUM+2)*nelr];
+		vec3<A> velocity;	   compute_velocity(density, momentum, velocity);
+		A speed_sqd          = compute_speed_sqd(velocity);
+		A pressure           = compute_pressure(density, density_energy, speed_sqd);
+		A speed_of_sound     = compute_speed_of_sound(density, pressure);
 
-		float density_energy = variables[i + VAR_DENSITY_ENERGY*nelr];
-		float3 velocity;	   compute_velocity(density, momentum, velocity);
-		float speed_sqd      = compute_speed_sqd(velocity);
-		float pressure       = compute_pressure(density, density_energy, speed_sqd);
-		float speed_of_sound = compute_speed_of_sound(density, pressure);
+		// dt = A(0.5f) * std::sqrt(areas[i]) /  (||v|| + c).... but when we do time stepping, this later would need to be divided by the area, so we just do it all at once
+		return A(0.5f) / (std::sqrt(A(areas[i])) * (std::sqrt(speed_sqd) + speed_of_sound));
+}
 
-		// dt = float(0.5f) * std::sqrt(areas[i]) /  (||v|| + c).... but when we do time stepping, this later would need to be divided by the area, so we just do it all at once
-		step_factors[i] = float(0.5f) / (std::sqrt(areas[i]) * (std::sqrt(speed_sqd) + speed_of_sound));
+// flux contributions of elements [begin, end) for the precomputed variant,
+// stored like variables (i + k*nelr) in storage precision
+template <typename S, typename A>
+void compute_flux_contributions(int begin, int end, int nelr, S* variables, S* fc)
+{
+	for(int i = begin; i < end; i++)
+	{
+		A density_i, density_energy_i;
+		vec3<A> momentum_i;
+		load_state(i, nelr, variables, density_i, momentum_i, density_energy_i);
+
+		vec3<A> velocity_i;             			compute_velocity(density_i, momentum_i, velocity_i);
+		A speed_sqd_i                              = compute_speed_sqd(velocity_i);
+		A pressure_i                               = compute_pressure(density_i, density_energy_i, speed_sqd_i);
+		vec3<A> fc_i_momentum_x, fc_i_momentum_y, fc_i_momentum_z;
+		vec3<A> fc_i_density_energy;
+		compute_flux_contribution(density_i, momentum_i, density_energy_i, pressure_i, velocity_i, fc_i_momentum_x, fc_i_momentum_y, fc_i_momentum_z, fc_i_density_energy);
+
+		fc[i + (FC_MOMENTUM_X+0)*nelr] = S(fc_i_momentum_x.x);
+		fc[i + (FC_MOMENTUM_X+1)*nelr] = S(fc_i_momentum_x.y);
+		fc[i + (FC_MOMENTUM_X+2)*nelr] = S(fc_i_momentum_x.z);
+		fc[i + (FC_MOMENTUM_Y+0)*nelr] = S(fc_i_momentum_y.x);
+		fc[i + (FC_MOMENTUM_Y+1)*nelr] = S(fc_i_momentum_y.y);
+		fc[i + (FC_MOMENTUM_Y+2)*nelr] = S(fc_i_momentum_y.z);
+		fc[i + (FC_MOMENTUM_Z+0)*nelr] = S(fc_i_momentum_z.x);
+		fc[i + (FC_MOMENTUM_Z+1)*nelr] = S(fc_i_momentum_z.y);
+		fc[i + (FC_MOMENTUM_Z+2)*nelr] = S(fc_i_momentum_z.z);
+		fc[i + (FC_DENSITY_ENERGY+0)*nelr] = S(fc_i_density_energy.x);
+		fc[i + (FC_DENSITY_ENERGY+1)*nelr] = S(fc_i_density_energy.y);
+		fc[i + (FC_DENSITY_ENERGY+2)*nelr] = S(fc_i_density_energy.z);
 	}
-        }
 }
 
 
 /*
+ * One Runge-Kutta stage over blocks [blk_begin, blk_end): the flux of every
+ * element is computed from variables and applied right away,
+ * new = old + step_factor/(RK+1-j) * flux, while the element's data is still
+ * in registers. No fluxes array goes through memory and there is one sweep
+ * (and one barrier) per stage. Stage 0 also computes the step factors, it
+ * sees the state at the start of the step.
  *
+ * new_variables must not alias variables (neighbours still read it), but it
+ * may be old_variables: each element only reads its own old state.
  *
+ * Everything is loaded from S and computed in A; only the new state is
+ * narrowed back to S. With Pre the flux contributions of the element and its
+ * neighbours come from fc (computed from variables by
+ * compute_flux_contributions) instead of being recomputed per neighbour.
 */
 
-void compute_flux(int nelr, int* elements_surrounding_elements, float* normals, float* variables, float* fluxes, float* ff_variable, float3 ff_flux_contribution_momentum_x, float3 ff_flux_contribution_momentum_y, float3 ff_flux_contribution_momentum_z, float3 ff_flux_contribution_density_energy)
+template <typename S, typename A, int BL, bool Pre>
+void compute_stage(int j, int blk_begin, int blk_end, int nelr, int* elements_surrounding_elements, S* normals, S* areas, S* variables, S* old_variables, A* step_factors, S* new_variables, S* fc, const far_field<A>& ff)
 {
-	const float smoothing_coefficient = float(0.2f);
+	const A smoothing_coefficient = A(0.2f);
 
-	#pragma omp parallel for default(shared) schedule(auto)
-        for(int blk = 0; blk < nelr/block_length; ++blk)
+        for(int blk = blk_begin; blk < blk_end; ++blk)
         {
-            int b_start = blk*block_length;
-            int b_end = (blk+1)*block_length > nelr ? nelr : (blk+1)*block_length;
+            int b_start = blk*BL;
 #pragma omp simd
-	for(int i = b_start; i < b_end; ++i)
+	for(int i = b_start; i < b_start + BL; ++i)
 	{
-                float density_i = variables[i + VAR_DENSITY*nelr];
-		float3 momentum_i;
-		momentum_i.x = variables[i + (VAR_MOMENTUM+0)*nelr];
-		momentum_i.y = variables[i + (VAR_MOMENTUM+1)*nelr];
-		momentum_i.z = variables[i + (VAR_MOMENTUM+2)*nelr];
-
-		float density_energy_i = variables[i + VAR_DENSITY_ENERGY*nelr];
-
-		float3 velocity_i;             				 compute_velocity(density_i, momentum_i, velocity_i);
-		float speed_sqd_i                          = compute_speed_sqd(velocity_i);
-		float speed_i                              = std::sqrt(speed_sqd_i);
-		float pressure_i                           = compute_pressure(density_i, density_energy_i, speed_sqd_i);
-		float speed_of_sound_i                     = compute_speed_of_sound(density_i, pressure_i);
-		float3 flux_contribution_i_momentum_x, flux_contribution_i_momentum_y, flux_contribution_i_momentum_z;
-		float3 flux_contribution_i_density_energy;
-		compute_flux_contribution(density_i, momentum_i, density_energy_i, pressure_i, velocity_i, flux_contribution_i_momentum_x, flux_contribution_i_momentum_y, flux_contribution_i_momentum_z, flux_contribution_i_density_energy);
-
-		float flux_i_density = float(0.0f);
-		float3 flux_i_momentum;
-		flux_i_momentum.x = float(0.0f);
-		flux_i_momentum.y = float(0.0f);
-		flux_i_momentum.z = float(0.0f);
-		float flux_i_density_energy = float(0.0f);
-
-		float3 velocity_nb;
-		float density_nb, density_energy_nb;
-		float3 momentum_nb;
-		float3 flux_contribution_nb_momentum_x, flux_contribution_nb_momentum_y, flux_contribution_nb_momentum_z;
-		float3 flux_contribution_nb_density_energy;
-		float speed_sqd_nb, speed_of_sound_nb, pressure_nb;
+		A density_i, density_energy_i;
+		vec3<A> momentum_i;
+		load_state(i, nelr, variables, density_i, momentum_i, density_energy_i);
+
+		vec3<A> velocity_i;             				 compute_velocity(density_i, momentum_i, velocity_i);
+		A speed_sqd_i                              = compute_speed_sqd(velocity_i);
+		A speed_i                                  = std::sqrt(speed_sqd_i);
+		A pressure_i                               = compute_pressure(density_i, density_energy_i, speed_sqd_i);
+		A speed_of_sound_i                         = compute_speed_of_sound(density_i, pressure_i);
+		vec3<A> flux_contribution_i_momentum_x, flux_contribution_i_momentum_y, flux_contribution_i_momentum_z;
+		vec3<A> flux_contribution_i_density_energy;
+		if(Pre) load_flux_contribution(i, nelr, fc, flux_contribution_i_momentum_x, flux_contribution_i_momentum_y, flux_contribution_i_momentum_z, flux_contribution_i_density_energy);
+		else compute_flux_contribution(density_i, momentum_i, density_energy_i, pressure_i, velocity_i, flux_contribution_i_momentum_x, flux_contribution_i_momentum_y, flux_contribution_i_momentum_z, flux_contribution_i_density_energy);
+
+		A flux_i_density = A(0.0f);
+		vec3<A> flux_i_momentum;
+		flux_i_momentum.x = A(0.0f);
+		flux_i_momentum.y = A(0.0f);
+		flux_i_momentum.z = A(0.0f);
+		A flux_i_density_energy = A(0.0f);
+
+		vec3<A> velocity_nb;
+		A density_nb, density_energy_nb;
+		vec3<A> momentum_nb;
+		vec3<A> flux_contribution_nb_momentum_x, flux_contribution_nb_momentum_y, flux_contribution_nb_momentum_z;
+		vec3<A> flux_contribution_nb_density_energy;
+		A speed_sqd_nb, speed_of_sound_nb, pressure_nb;
 #pragma unroll
 		for(int j = 0; j < NNB; j++)
 		{
-                        float3 normal; float normal_len;
-		        float factor;
+                        vec3<A> normal; A normal_len;
+		        A factor;
 
 			int nb = elements_surrounding_elements[i + j*nelr];
 			normal.x = normals[i + (j + 0*NNB)*nelr];
@@ -261,19 +340,16 @@ void compute_flux(int nelr, int* elements_surrounding_elements, float* normals,
 
 			if(nb >= 0) 	// a legitimate neighbor
 			{
-				density_nb =        variables[nb + VAR_DENSITY*nelr];
-				momentum_nb.x =     variables[nb + (VAR_MOMENTUM+0)*nelr];
-				momentum_nb.y =     variables[nb + (VAR_MOMENTUM+1)*nelr];
-				momentum_nb.z =     variables[nb + (VAR_MOMENTUM+2)*nelr];
-				density_energy_nb = variables[nb + VAR_DENSITY_ENERGY*nelr];
+				load_state(nb, nelr, variables, density_nb, momentum_nb, density_energy_nb);
 													compute_velocity(density_nb, momentum_nb, velocity_nb);
 				speed_sqd_nb                      = compute_speed_sqd(velocity_nb);
 				pressure_nb                       = compute_pressure(density_nb, density_energy_nb, speed_sqd_nb);
 				speed_of_sound_nb                 = compute_speed_of_sound(density_nb, pressure_nb);
-													compute_flux_contribution(density_nb, momentum_nb, density_energy_nb, pressure_nb, velocity_nb, flux_contribution_nb_momentum_x, flux_contribution_nb_momentum_y, flux_contribution_nb_momentum_z, flux_contribution_nb_density_energy);
+				if(Pre) load_flux_contribution(nb, nelr, fc, flux_contribution_nb_momentum_x, flux_contribution_nb_momentum_y, flux_contribution_nb_momentum_z, flux_contribution_nb_density_energy);
+				else compute_flux_contribution(density_nb, momentum_nb, density_energy_nb, pressure_nb, velocity_nb, flux_contribution_nb_momentum_x, flux_contribution_nb_momentum_y, flux_contribution_nb_momentum_z, flux_contribution_nb_density_energy);
 
 				// artificial viscosity
-				factor = -normal_len*smoothing_coefficient*float(0.5f)*(speed_i + std::sqrt(speed_sqd_nb) + speed_of_sound_i + speed_of_sound_nb);
+				factor = -normal_len*smoothing_coefficient*A(0.5f)*(speed_i + std::sqrt(speed_sqd_nb) + speed_of_sound_i + speed_of_sound_nb);
 				flux_i_density += factor*(density_i-density_nb);
 				flux_i_density_energy += factor*(density_energy_i-density_energy_nb);
 				flux_i_momentum.x += factor*(momentum_i.x-momentum_nb.x);
@@ -281,21 +357,21 @@ void compute_flux(int nelr, int* elements_surrounding_elements, float* normals,
 				flux_i_momentum.z += factor*(momentum_i.z-momentum_nb.z);
 
 				// accumulate cell-centered fluxes
-				factor = float(0.5f)*normal.x;
+				factor = A(0.5f)*normal.x;
 				flux_i_density += factor*(momentum_nb.x+momentum_i.x);
 				flux_i_density_energy += factor*(flux_contribution_nb_density_energy.x+flux_contribution_i_density_energy.x);
 				flux_i_momentum.x += factor*(flux_contribution_nb_momentum_x.x+flux_contribution_i_momentum_x.x);
 				flux_i_momentum.y += factor*(flux_contribution_nb_momentum_y.x+flux_contribution_i_momentum_y.x);
 				flux_i_momentum.z += factor*(flux_contribution_nb_momentum_z.x+flux_contribution_i_momentum_z.x);
 
-				factor = float(0.5f)*normal.y;
+				factor = A(0.5f)*normal.y;
 				flux_i_density += factor*(momentum_nb.y+momentum_i.y);
 				flux_i_density_energy += factor*(flux_contribution_nb_density_energy.y+flux_contribution_i_density_energy.y);
 				flux_i_momentum.x += factor*(flux_contribution_nb_momentum_x.y+flux_contribution_i_momentum_x.y);
 				flux_i_momentum.y += factor*(flux_contribution_nb_momentum_y.y+flux_contribution_i_momentum_y.y);
 				flux_i_momentum.z += factor*(flux_contribution_nb_momentum_z.y+flux_contribution_i_momentum_z.y);
 
-				factor = float(0.5f)*normal.z;
+				factor = A(0.5f)*normal.z;
 				flux_i_density += factor*(momentum_nb.z+momentum_i.z);
 				flux_i_density_energy += factor*(flux_contribution_nb_density_energy.z+flux_contribution_i_density_energy.z);
 				flux_i_momentum.x += factor*(flux_contribution_nb_momentum_x.z+flux_contribution_i_momentum_x.z);
@@ -310,169 +386,232 @@ void compute_flux(int nelr, int* elements_surrounding_elements, float* normals,
 			}
 			else if(nb == -2) // a far field boundary
 			{
-				factor = float(0.5f)*normal.x;
-				flux_i_density += factor*(ff_variable[VAR_MOMENTUM+0]+momentum_i.x);
-				flux_i_density_energy += factor*(ff_flux_contribution_density_energy.x+flux_contribution_i_density_energy.x);
-				flux_i_momentum.x += factor*(ff_flux_contribution_momentum_x.x + flux_contribution_i_momentum_x.x);
-				flux_i_momentum.y += factor*(ff_flux_contribution_momentum_y.x + flux_contribution_i_momentum_y.x);
-				flux_i_momentum.z += factor*(ff_flux_contribution_momentum_z.x + flux_contribution_i_momentum_z.x);
-
-				factor = float(0.5f)*normal.y;
-				flux_i_density += factor*(ff_variable[VAR_MOMENTUM+1]+momentum_i.y);
-				flux_i_density_energy += factor*(ff_flux_contribution_density_energy.y+flux_contribution_i_density_energy.y);
-				flux_i_momentum.x += factor*(ff_flux_contribution_momentum_x.y + flux_contribution_i_momentum_x.y);
-				flux_i_momentum.y += factor*(ff_flux_contribution_momentum_y.y + flux_contribution_i_momentum_y.y);
-				flux_i_momentum.z += factor*(ff_flux_contribution_momentum_z.y + flux_contribution_i_momentum_z.y);
-
-				factor = float(0.5f)*normal.z;
-				flux_i_density += factor*(ff_variable[VAR_MOMENTUM+2]+momentum_i.z);
-				flux_i_density_energy += factor*(ff_flux_contribution_density_energy.z+flux_contribution_i_density_energy.z);
-				flux_i_momentum.x += factor*(ff_flux_contribution_momentum_x.z + flux_contribution_i_momentum_x.z);
-				flux_i_momentum.y += factor*(ff_flux_contribution_momentum_y.z + flux_contribution_i_momentum_y.z);
-				flux_i_momentum.z += factor*(ff_flux_contribution_momentum_z.z + flux_contribution_i_momentum_z.z);
+				factor = A(0.5f)*normal.x;
+				flux_i_density += factor*(ff.variable[VAR_MOMENTUM+0]+momentum_i.x);
+				flux_i_density_energy += factor*(ff.fc_density_energy.x+flux_contribution_i_density_energy.x);
+				flux_i_momentum.x += factor*(ff.fc_momentum_x.x + flux_contribution_i_momentum_x.x);
+				flux_i_momentum.y += factor*(ff.fc_momentum_y.x + flux_contribution_i_momentum_y.x);
+				flux_i_momentum.z += factor*(ff.fc_momentum_z.x + flux_contribution_i_momentum_z.x);
+
+				factor = A(0.5f)*normal.y;
+				flux_i_density += factor*(ff.variable[VAR_MOMENTUM+1]+momentum_i.y);
+				flux_i_density_energy += factor*(ff.fc_density_energy.y+flux_contribution_i_density_energy.y);
+				flux_i_momentum.x += factor*(ff.fc_momentum_x.y + flux_contribution_i_momentum_x.y);
+				flux_i_momentum.y += factor*(ff.fc_momentum_y.y + flux_contribution_i_momentum_y.y);
+				flux_i_momentum.z += factor*(ff.fc_momentum_z.y + flux_contribution_i_momentum_z.y);
+
+				factor = A(0.5f)*normal.z;
+				flux_i_density += factor*(ff.variable[VAR_MOMENTUM+2]+momentum_i.z);
+				flux_i_density_energy += factor*(ff.fc_density_energy.z+flux_contribution_i_density_energy.z);
+				flux_i_momentum.x += factor*(ff.fc_momentum_x.z + flux_contribution_i_momentum_x.z);
+				flux_i_momentum.y += factor*(ff.fc_momentum_y.z + flux_contribution_i_momentum_y.z);
+				flux_i_momentum.z += factor*(ff.fc_momentum_z.z + flux_contribution_i_momentum_z.z);
 
 			}
                 }
-		fluxes[i + VAR_DENSITY*nelr] = flux_i_density;
-		fluxes[i + (VAR_MOMENTUM+0)*nelr] = flux_i_momentum.x;
-		fluxes[i + (VAR_MOMENTUM+1)*nelr] = flux_i_momentum.y;
-		fluxes[i + (VAR_MOMENTUM+2)*nelr] = flux_i_momentum.z;
-		fluxes[i + VAR_DENSITY_ENERGY*nelr] = flux_i_density_energy;
-                
-	}
-        }
-}
+		// time step
+		if(j == 0) step_factors[i] = compute_step_factor<S, A>(i, nelr, variables, areas);
+		A factor = step_factors[i]/A(RK+1-j);
 
-void time_step(int j, int nelr, float* old_variables, float* variables, float* step_factors, float* fluxes)
-{
-    #pragma omp parallel for  default(shared) schedule(auto)
-    for(int blk = 0; blk < nelr/block_length; ++blk)
-    {
-        int b_start = blk*block_length;
-        int b_end = (blk+1)*block_length > nelr ? nelr : (blk+1)*block_length;
-        #pragma omp simd
-        for(int i = b_start; i < b_end; ++i)
-        {
-            float factor = step_factors[i]/float(RK+1-j);
-
-            variables[i + VAR_DENSITY*nelr] = old_variables[i + VAR_DENSITY*nelr] + factor*fluxes[i + VAR_DENSITY*nelr];
-            variables[i + (VAR_MOMENTUM+0)*nelr] = old_variables[i + (VAR_MOMENTUM+0)*nelr] + factor*fluxes[i + (VAR_MOMENTUM+0)*nelr];
-            variables[i + (VAR_MOMENTUM+1)*nelr] = old_variables[i + (VAR_MOMENTUM+1)*nelr] + factor*fluxes[i + (VAR_MOMENTUM+1)*nelr];
-            variables[i + (VAR_MOMENTUM+2)*nelr] = old_variables[i + (VAR_MOMENTUM+2)*nelr] + factor*fluxes[i + (VAR_MOMENTUM+2)*nelr];
-            variables[i + VAR_DENSITY_ENERGY*nelr] = old_variables[i + VAR_DENSITY_ENERGY*nelr] + factor*fluxes[i + VAR_DENSITY_ENERGY*nelr];
+		new_variables[i + VAR_DENSITY*nelr] = S(old_variables[i + VAR_DENSITY*nelr] + factor*flux_i_density);
+		new_variables[i + (VAR_MOMENTUM+0)*nelr] = S(old_variables[i + (VAR_MOMENTUM+0)*nelr] + factor*flux_i_momentum.x);
+		new_variables[i + (VAR_MOMENTUM+1)*nelr] = S(old_variables[i + (VAR_MOMENTUM+1)*nelr] + factor*flux_i_momentum.y);
+		new_variables[i + (VAR_MOMENTUM+2)*nelr] = S(old_variables[i + (VAR_MOMENTUM+2)*nelr] + factor*flux_i_momentum.z);
+		new_variables[i + VAR_DENSITY_ENERGY*nelr] = S(old_variables[i + VAR_DENSITY_ENERGY*nelr] + factor*flux_i_density_energy);
 
+	}
         }
-    }
 }
 #ifdef OMP_OFFLOAD
 #pragma omp end declare target
 #endif
+
 /*
- * Main function
+ * Mesh loading
+ *
+ * Text meshes are parsed and padded to the block length. Binary meshes
+ * (mesh.h, written by mesh_convert) are mapped, and by default their
+ * arrays are then copied in parallel, every thread the blocks it gets in
+ * the solver: every page is first touched by, and so on a multi-socket
+ * machine placed on the node of, the thread that works on it.
+ * FIRST_TOUCH=0 runs the solver straight on the mapping instead (no copy,
+ * pages wherever the page cache put them) if the stored precision is S.
  */
-int main(int argc, char** argv)
+template <typename S, typename R, int BL>
+void place_mesh(const mesh_header* h, mesh<S>& m)
 {
-	if (argc < 2)
+	const char* base = (const char*)h;
+	const R* areas = (const R*)(base + h->areas);
+	const int* elements_surrounding_elements = (const int*)(base + h->elements_surrounding_elements);
+	const R* normals = (const R*)(base + h->normals);
+	int nelr = m.nelr;
+
+	m.areas = alloc<S>(nelr);
+	m.elements_surrounding_elements = alloc<int>(nelr*NNB);
+	m.normals = alloc<S>(NDIM*NNB*nelr);
+
+	// nelr is a multiple of MESH_PAD and so of BL
+	#pragma omp parallel default(shared)
 	{
-		std::cout << "specify data file name" << std::endl;
-		return 0;
+		long blk_begin, blk_end;
+		pb_ThreadRange(nelr/BL, omp_get_thread_num(), omp_get_num_threads(), &blk_begin, &blk_end);
+		for(int i = blk_begin*BL; i < blk_end*BL; ++i)
+		{
+			m.areas[i] = S(areas[i]);
+			for(int j = 0; j < NNB; j++)
+			{
+				m.elements_surrounding_elements[i + j*nelr] = elements_surrounding_elements[i + j*nelr];
+				for(int k = 0; k < NDIM; k++) m.normals[i + (j + k*NNB)*nelr] = S(normals[i + (j + k*NNB)*nelr]);
+			}
+		}
 	}
-	const char* data_file_name = argv[1];
+}
 
-        float ff_variable[NVAR];
-        float3 ff_flux_contribution_momentum_x, ff_flux_contribution_momentum_y, ff_flux_contribution_momentum_z, ff_flux_contribution_density_energy;
+template <typename S, int BL>
+int load_mesh(const char* file_name, mesh<S>& m)
+{
+	// renumber the elements for locality of the neighbour gathers (REORDER=0 keeps file order)
+	const char* env_reorder = getenv("REORDER");
+	bool reorder = env_reorder == NULL || atoi(env_reorder) != 0;
+	bool reordered = false;
+	const char* how = "text";
 
-	// set far field conditions
+#ifdef _OPENMP
+	double start = omp_get_wtime();
+#endif
+	if(is_binary_mesh(file_name))
 	{
-		const float angle_of_attack = float(3.1415926535897931 / 180.0f) * float(deg_angle_of_attack);
-
-		ff_variable[VAR_DENSITY] = float(1.4);
-
-		float ff_pressure = float(1.0f);
-		float ff_speed_of_sound = sqrt(GAMMA*ff_pressure / ff_variable[VAR_DENSITY]);
-		float ff_speed = float(ff_mach)*ff_speed_of_sound;
-
-		float3 ff_velocity;
-		ff_velocity.x = ff_speed*float(cos((float)angle_of_attack));
-		ff_velocity.y = ff_speed*float(sin((float)angle_of_attack));
-		ff_velocity.z = 0.0f;
+		const mesh_header* h;
+		void* map;
+		size_t length;
+		if(map_binary_mesh(file_name, h, map, length) != 0) return -1;
+
+		m.nel = h->nel;
+		m.nelr = h->nelr;
+		reordered = h->flags & MESH_REORDERED;
+
+		const char* env_first_touch = getenv("FIRST_TOUCH");
+		bool first_touch = env_first_touch == NULL || atoi(env_first_touch) != 0;
+		if(!first_touch && h->real_size == sizeof(S) && (reordered || !reorder))
+		{
+			m.areas = (S*)((char*)map + h->areas);
+			m.elements_surrounding_elements = (int*)((char*)map + h->elements_surrounding_elements);
+			m.normals = (S*)((char*)map + h->normals);
+			m.order = reordered ? (int*)((char*)map + h->order) : NULL;
+			m.map = map;
+			m.map_length = length;
+			how = "binary, mapped";
+		}
+		else
+		{
+			if(h->real_size == sizeof(float)) place_mesh<S, float, BL>(h, m);
+			else place_mesh<S, double, BL>(h, m);
+			m.order = NULL;
+			if(reordered)
+			{
+				m.order = alloc<int>(m.nel);
+				memcpy(m.order, (char*)map + h->order, m.nel*sizeof(int));
+			}
+			m.map = NULL;
+			munmap(map, length);
+			how = "binary, first touch";
+		}
+	}
+	else if(read_text_mesh(file_name, BL, m) != 0)
+	{
+		return -1;
+	}
+#ifdef _OPENMP
+	printf("[MESH LOAD]:%s, %d elements, %.3f s\n", how, m.nel, omp_get_wtime() - start);
+#endif
 
-		ff_variable[VAR_MOMENTUM+0] = ff_variable[VAR_DENSITY] * ff_velocity.x;
-		ff_variable[VAR_MOMENTUM+1] = ff_variable[VAR_DENSITY] * ff_velocity.y;
-		ff_variable[VAR_MOMENTUM+2] = ff_variable[VAR_DENSITY] * ff_velocity.z;
+	if(reordered)
+	{
+		printf("[MESH REORDER]:RCM, done by mesh_convert\n");
+	}
+	else if(reorder)
+	{
+		int nel = m.nel, nelr = m.nelr;
+		double distance_before, far_before, distance_after, far_after;
+		gather_locality(nel, nelr, m.elements_surrounding_elements, distance_before, far_before);
 
-		ff_variable[VAR_DENSITY_ENERGY] = ff_variable[VAR_DENSITY]*(float(0.5f)*(ff_speed*ff_speed)) + (ff_pressure / float(GAMMA-1.0f));
+		m.order = alloc<int>(nel);
+		rcm_order(nel, nelr, m.elements_surrounding_elements, m.order);
+		reorder_mesh(nel, nelr, m.order, m.areas, m.elements_surrounding_elements, m.normals);
 
-		float3 ff_momentum;
-		ff_momentum.x = *(ff_variable+VAR_MOMENTUM+0);
-		ff_momentum.y = *(ff_variable+VAR_MOMENTUM+1);
-		ff_momentum.z = *(ff_variable+VAR_MOMENTUM+2);
-		compute_flux_contribution(ff_variable[VAR_DENSITY], ff_momentum, ff_variable[VAR_DENSITY_ENERGY], ff_pressure, ff_velocity, ff_flux_contribution_momentum_x, ff_flux_contribution_momentum_y, ff_flux_contribution_momentum_z, ff_flux_contribution_density_energy);
+		gather_locality(nel, nelr, m.elements_surrounding_elements, distance_after, far_after);
+		printf("[MESH REORDER]:RCM, mean neighbour distance %.1f -> %.1f, gathers beyond %d elements %.1f%% -> %.1f%%\n",
+		       distance_before, distance_after, gather_window, 100.0*far_before, 100.0*far_after);
 	}
-	int nel;
-	int nelr;
+	return 0;
+}
 
+/*
+ * Solver for one variant
+ */
+template <typename S, typename A, int BL, bool Pre>
+int run(const char* data_file_name, const char* variant_name)
+{
+	far_field<A> ff;
 
-	// read in domain geometry
-	float* areas;
-	int* elements_surrounding_elements;
-	float* normals;
+	// set far field conditions
 	{
-		std::ifstream file(data_file_name);
+		const A angle_of_attack = A(3.1415926535897931 / 180.0f) * A(deg_angle_of_attack);
 
-		file >> nel;
-		nelr = block_length*((nel / block_length )+ std::min(1, nel % block_length));
+		ff.variable[VAR_DENSITY] = A(1.4);
 
-		areas = new float[nelr];
-		elements_surrounding_elements = new int[nelr*NNB];
-		normals = new float[NDIM*NNB*nelr];
+		A ff_pressure = A(1.0f);
+		A ff_speed_of_sound = std::sqrt(A(GAMMA)*ff_pressure / ff.variable[VAR_DENSITY]);
+		A ff_speed = A(ff_mach)*ff_speed_of_sound;
 
-		// read in data
-		for(int i = 0; i < nel; i++)
-		{
-			file >> areas[i];
-			for(int j = 0; j < NNB; j++)
-			{
-				file >> elements_surrounding_elements[i + j*nelr];
-				if(elements_surrounding_elements[i+j*nelr] < 0) elements_surrounding_elements[i+j*nelr] = -1;
-				elements_surrounding_elements[i + j*nelr]--; //it's coming in with Fortran numbering
+		vec3<A> ff_velocity;
+		ff_velocity.x = ff_speed*A(std::cos(angle_of_attack));
+		ff_velocity.y = ff_speed*A(std::sin(angle_of_attack));
+		ff_velocity.z = A(0.0f);
 
-				for(int k = 0; k < NDIM; k++)
-				{
-					file >>  normals[i + (j + k*NNB)*nelr];
-					normals[i + (j + k*NNB)*nelr] = -normals[i + (j + k*NNB)*nelr];
-				}
-			}
-		}
+		ff.variable[VAR_MOMENTUM+0] = ff.variable[VAR_DENSITY] * ff_velocity.x;
+		ff.variable[VAR_MOMENTUM+1] = ff.variable[VAR_DENSITY] * ff_velocity.y;
+		ff.variable[VAR_MOMENTUM+2] = ff.variable[VAR_DENSITY] * ff_velocity.z;
 
-		// fill in remaining data
-		int last = nel-1;
-		for(int i = nel; i < nelr; i++)
-		{
-			areas[i] = areas[last];
-			for(int j = 0; j < NNB; j++)
-			{
-				// duplicate the last element
-				elements_surrounding_elements[i + j*nelr] = elements_surrounding_elements[last + j*nelr];
-				for(int k = 0; k < NDIM; k++) normals[i + (j + k*NNB)*nelr] = normals[last + (j + k*NNB)*nelr];
-			}
-		}
+		ff.variable[VAR_DENSITY_ENERGY] = ff.variable[VAR_DENSITY]*(A(0.5f)*(ff_speed*ff_speed)) + (ff_pressure / A(GAMMA-1.0f));
+
+		vec3<A> ff_momentum;
+		ff_momentum.x = *(ff.variable+VAR_MOMENTUM+0);
+		ff_momentum.y = *(ff.variable+VAR_MOMENTUM+1);
+		ff_momentum.z = *(ff.variable+VAR_MOMENTUM+2);
+		compute_flux_contribution(ff.variable[VAR_DENSITY], ff_momentum, ff.variable[VAR_DENSITY_ENERGY], ff_pressure, ff_velocity, ff.fc_momentum_x, ff.fc_momentum_y, ff.fc_momentum_z, ff.fc_density_energy);
 	}
 
+	// read in domain geometry
+	mesh<S> m;
+	if(load_mesh<S, BL>(data_file_name, m) != 0) return 1;
+	int nel = m.nel;
+	int nelr = m.nelr;
+	S* areas = m.areas;
+	int* elements_surrounding_elements = m.elements_surrounding_elements;
+	S* normals = m.normals;
+	int* order = m.order;
+
 	// Create arrays and set initial conditions
-	float* variables = alloc<float>(nelr*NVAR);
-	initialize_variables(nelr, variables, ff_variable);
+	S* variables = alloc<S>(nelr*NVAR);
+	initialize_variables(nelr, variables, ff);
 
-	float* old_variables = alloc<float>(nelr*NVAR);
-	float* fluxes = alloc<float>(nelr*NVAR);
-	float* step_factors = alloc<float>(nelr);
+	// intermediate RK stages ping-pong between these two, variables keeps the
+	// state of the start of the step until the last stage overwrites it
+	S* stage_variables[2];
+	stage_variables[0] = alloc<S>(nelr*NVAR);
+	stage_variables[1] = alloc<S>(nelr*NVAR);
+	A* step_factors = alloc<A>(nelr);
+	S* fc = Pre ? alloc<S>(nelr*NFC) : NULL;
+
+	struct pb_Barrier* barrier = NULL;
 
 	// these need to be computed the first time in order to compute time step
 	std::cout << "Starting..." << std::endl;
 #ifdef _OPENMP
 	double start = omp_get_wtime();
     #ifdef OMP_OFFLOAD
-        #pragma omp target map(alloc: old_variables[0:(nelr*NVAR)]) map(to: nelr, areas[0:nelr], step_factors[0:nelr], elements_surrounding_elements[0:(nelr*NNB)], normals[0:(NDIM*NNB*nelr)], fluxes[0:(nelr*NVAR)], ff_variable[0:NVAR], ff_flux_contribution_momentum_x, ff_flux_contribution_momentum_y, ff_flux_contribution_momentum_z, ff_flux_contribution_density_energy) map(variables[0:(nelr*NVAR)])
+        #pragma omp target map(alloc: stage_variables[0][0:(nelr*NVAR)], stage_variables[1][0:(nelr*NVAR)]) map(to: nelr, areas[0:nelr], step_factors[0:nelr], elements_surrounding_elements[0:(nelr*NNB)], normals[0:(NDIM*NNB*nelr)], ff) map(variables[0:(nelr*NVAR)])
     #endif
 #endif
 	// Begin iterations
@@ -481,42 +620,151 @@ int main(int argc, char** argv)
         iterations = (env_iter != NULL) ? atoi(env_iter) : 1;
         printf("[ITERATION NUM]:%d\n", iterations);
 
-	for(int i = 0; i < iterations; i++)
+	// One team for all steps and stages: every thread keeps its blocks and a
+	// barrier ends every sweep. A stage reads the neighbours of the state the
+	// one before wrote and the next but one overwrites it, so one barrier
+	// after each stage (and with Pre one after the flux contributions) is
+	// all the ordering there is. The barrier is sized from the team actually
+	// started, which a thread limit or OMP_DYNAMIC may make smaller than asked
+	// for.
+	#pragma omp parallel
 	{
-                copy<float>(old_variables, variables, nelr*NVAR);
+		int tid = omp_get_thread_num();
+		int nthreads = omp_get_num_threads();
+		long blk_begin, blk_end;
+		pb_ThreadRange(nelr/BL, tid, nthreads, &blk_begin, &blk_end);
 
-		// for the first iteration we compute the time step
-		compute_step_factor(nelr, variables, areas, step_factors);
+		#pragma omp single
+		barrier = pb_CreateBarrier("stages", nthreads);
 
-		for(int j = 0; j < RK; j++)
+		for(int i = 0; barrier != NULL && i < iterations; i++)
 		{
-			compute_flux(nelr, elements_surrounding_elements, normals, variables, fluxes, ff_variable, ff_flux_contribution_momentum_x, ff_flux_contribution_momentum_y, ff_flux_contribution_momentum_z, ff_flux_contribution_density_energy);
-			time_step(j, nelr, old_variables, variables, step_factors, fluxes);
+			S* current = variables;
+			for(int j = 0; j < RK; j++)
+			{
+				S* next = (j == RK-1) ? variables : stage_variables[j % 2];
+				if(Pre)
+				{
+					compute_flux_contributions<S, A>(blk_begin*BL, blk_end*BL, nelr, current, fc);
+					pb_BarrierWait(barrier, tid);
+				}
+				compute_stage<S, A, BL, Pre>(j, blk_begin, blk_end, nelr, elements_surrounding_elements, normals, areas, current, variables, step_factors, next, fc, ff);
+				pb_BarrierWait(barrier, tid);
+				current = next;
+			}
 		}
 	}
+	if(barrier == NULL)
+	{
+		std::cerr << "Cannot create the barrier" << std::endl;
+		return 1;
+	}
 
 #ifdef _OPENMP
 	double end = omp_get_wtime();
 	std::cout  << "Compute time: " << (end-start) << std::endl;
+	pb_PrintBarrier(barrier);
+
+	struct pb_RunRecord record;
+	pb_InitRunRecord(&record, variant_name, data_file_name);
+	record.iterations = iterations;
+	record.seconds = (end-start) / iterations;
+	// compulsory traffic of one iteration: per stage the own, old and new
+	// state and the mesh (neighbour gathers assumed to hit in cache), with
+	// Pre the flux contributions written and read once; per step the areas
+	// and step factors
+	record.bytes = double(RK) * nelr * (3*NVAR*sizeof(S) + NNB*(sizeof(int) + NDIM*sizeof(S)) + (Pre ? 2*NFC*sizeof(S) : 0))
+		+ double(nelr) * (sizeof(S) + 2*sizeof(A));
+	if(pb_EmitRunRecord(&record) != 0) return 1;
 #endif
 
 
 	std::cout << "Saving solution..." << std::endl;
-	dump(variables, nel, nelr);
+	dump(variables, nel, nelr, order);
 	std::cout << "Saved solution..." << std::endl;
 
 
 	std::cout << "Cleaning up..." << std::endl;
-	dealloc<float>(areas);
-	dealloc<int>(elements_surrounding_elements);
-	dealloc<float>(normals);
+	free_mesh(m);
 
-	dealloc<float>(variables);
-	dealloc<float>(old_variables);
-	dealloc<float>(fluxes);
-	dealloc<float>(step_factors);
+	dealloc<S>(variables);
+	dealloc<S>(stage_variables[0]);
+	dealloc<S>(stage_variables[1]);
+	dealloc<A>(step_factors);
+	if(fc) dealloc<S>(fc);
+	pb_DestroyBarrier(barrier);
 
 	std::cout << "Done..." << std::endl;
 
 	return 0;
 }
+
+/*
+ * Runtime dispatch
+ */
+typedef int (*run_func)(const char*, const char*);
+
+template <typename S, typename A, bool Pre>
+run_func select_block_length(int bl)
+{
+	switch(bl)
+	{
+		case 1: return run<S, A, 1, Pre>;
+		case 2: return run<S, A, 2, Pre>;
+		case 4: return run<S, A, 4, Pre>;
+		case 8: return run<S, A, 8, Pre>;
+		case 16: return run<S, A, 16, Pre>;
+		case 32: return run<S, A, 32, Pre>;
+		case 64: return run<S, A, 64, Pre>;
+	}
+	return NULL;
+}
+
+template <typename S, typename A>
+run_func select_variant(bool pre, int bl)
+{
+	return pre ? select_block_length<S, A, true>(bl) : select_block_length<S, A, false>(bl);
+}
+
+/*
+ * Main function
+ */
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cout << "specify data file name" << std::endl;
+		return 0;
+	}
+	const char* data_file_name = argv[1];
+
+	const char* precision = getenv("PRECISION");
+	if(precision == NULL) precision = default_precision;
+	const char* env_precompute = getenv("PRECOMPUTE");
+	bool pre = env_precompute != NULL ? atoi(env_precompute) != 0 : precompute != 0;
+	const char* env_block_length = getenv("BLOCK_LENGTH");
+	int bl = env_block_length != NULL ? atoi(env_block_length) : block_length;
+
+	run_func f = NULL;
+	const char* suffix = "";
+	if(strcmp(precision, "float") == 0) f = select_variant<float, float>(pre, bl);
+	else if(strcmp(precision, "double") == 0) { f = select_variant<double, double>(pre, bl); suffix = "_double"; }
+	else if(strcmp(precision, "mixed") == 0) { f = select_variant<float, double>(pre, bl); suffix = "_mixed"; }
+	else
+	{
+		std::cerr << "PRECISION must be float, double or mixed" << std::endl;
+		return 1;
+	}
+	if(f == NULL)
+	{
+		std::cerr << "BLOCK_LENGTH must be a power of two from 1 to 64" << std::endl;
+		return 1;
+	}
+
+	// named like the historical binaries, e.g. pre_euler3d_cpu_double
+	char variant_name[64];
+	snprintf(variant_name, sizeof(variant_name), "%seuler3d_cpu%s", pre ? "pre_" : "", suffix);
+	printf("[VARIANT]:%s, block length %d\n", variant_name, bl);
+
+	return f(data_file_name, variant_name);
+}
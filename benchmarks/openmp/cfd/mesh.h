@@ -0,0 +1,391 @@
+// Copyright 2009, Andrew Corrigan, acorriga@gmu.edu
+// This code is from the AIAA-2009-4001 paper
+
+/*
+ * cfd meshes: the fvcorr.domn text format, the binary mesh container and
+ * element renumbering. Shared by euler3d_cpu and mesh_convert.
+ */
+#ifndef CFD_MESH_H
+#define CFD_MESH_H
+
+#include <fstream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NDIM 3
+#define NNB 4
+
+/*
+ * Generic functions
+ */
+template <typename T>
+T* alloc(int N)
+{
+	return new T[N];
+}
+
+template <typename T>
+void dealloc(T* array)
+{
+	delete[] array;
+}
+
+/*
+ * Mesh reordering
+ *
+ * compute_flux gathers the state of the NNB neighbours of every element, so
+ * in mesh file order those loads are close to random. At load time (or once,
+ * by mesh_convert) elements are renumbered with Reverse Cuthill-McKee on the
+ * neighbour graph, which keeps neighbours within a narrow band of indices.
+ * (The mesh files carry no coordinates, so there is nothing to build a
+ * space-filling curve from.) All per-element arrays are permuted together
+ * and dump() writes the solution back in file order.
+ */
+
+// fill the padding elements nel..nelr-1 with copies of the last element
+template <typename S>
+void pad_mesh(int nel, int nelr, S* areas, int* elements_surrounding_elements, S* normals)
+{
+	int last = nel-1;
+	for(int i = nel; i < nelr; i++)
+	{
+		areas[i] = areas[last];
+		for(int j = 0; j < NNB; j++)
+		{
+			// duplicate the last element
+			elements_surrounding_elements[i + j*nelr] = elements_surrounding_elements[last + j*nelr];
+			for(int k = 0; k < NDIM; k++) normals[i + (j + k*NNB)*nelr] = normals[last + (j + k*NNB)*nelr];
+		}
+	}
+}
+
+// locality of the neighbour gathers: mean index distance between an element
+// and its neighbours, and the share of neighbours more than gather_window
+// elements away (those almost certainly miss in L1: with five variable
+// arrays a window of 1024 floats is already 20 KB)
+#define gather_window 1024
+inline void gather_locality(int nel, int nelr, int* elements_surrounding_elements, double& mean_distance, double& far_fraction)
+{
+	long long total = 0, far = 0, count = 0;
+
+	#pragma omp parallel for default(shared) schedule(static) reduction(+:total,far,count)
+	for(int i = 0; i < nel; i++)
+	{
+		for(int j = 0; j < NNB; j++)
+		{
+			int nb = elements_surrounding_elements[i + j*nelr];
+			if(nb < 0) continue;
+			int distance = nb > i ? nb - i : i - nb;
+			total += distance;
+			far += distance > gather_window;
+			count++;
+		}
+	}
+	mean_distance = count ? double(total)/count : 0.0;
+	far_fraction = count ? double(far)/count : 0.0;
+}
+
+// Reverse Cuthill-McKee numbering; order[old] = new
+inline void rcm_order(int nel, int nelr, int* elements_surrounding_elements, int* order)
+{
+	int* degree = alloc<int>(nel);
+	int* by_degree = alloc<int>(nel);
+	int* queue = alloc<int>(nel);
+	int bucket[NNB+2] = {0};
+
+	for(int i = 0; i < nel; i++)
+	{
+		degree[i] = 0;
+		for(int j = 0; j < NNB; j++) degree[i] += elements_surrounding_elements[i + j*nelr] >= 0;
+		bucket[degree[i]+1]++;
+		order[i] = -1;
+	}
+
+	// start every connected component from a lowest-degree (boundary) element
+	for(int d = 0; d <= NNB; d++) bucket[d+1] += bucket[d];
+	for(int i = 0; i < nel; i++) by_degree[bucket[degree[i]]++] = i;
+
+	int head = 0, tail = 0;
+	for(int s = 0; s < nel; s++)
+	{
+		int start = by_degree[s];
+		if(order[start] >= 0) continue;
+		order[start] = tail;
+		queue[tail++] = start;
+
+		while(head < tail)
+		{
+			int e = queue[head++];
+
+			// unvisited neighbours in order of increasing degree
+			int nbs[NNB], n = 0;
+			for(int j = 0; j < NNB; j++)
+			{
+				int nb = elements_surrounding_elements[e + j*nelr];
+				if(nb < 0 || order[nb] >= 0) continue;
+				int k = n++;
+				while(k > 0 && degree[nbs[k-1]] > degree[nb]) { nbs[k] = nbs[k-1]; k--; }
+				nbs[k] = nb;
+			}
+			for(int k = 0; k < n; k++)
+			{
+				if(order[nbs[k]] >= 0) continue;
+				order[nbs[k]] = tail;
+				queue[tail++] = nbs[k];
+			}
+		}
+	}
+
+	for(int i = 0; i < nel; i++) order[i] = nel-1 - order[i];
+
+	dealloc<int>(degree);
+	dealloc<int>(by_degree);
+	dealloc<int>(queue);
+}
+
+// apply order to every per-element array of the mesh
+template <typename S>
+void reorder_mesh(int nel, int nelr, int* order, S*& areas, int*& elements_surrounding_elements, S*& normals)
+{
+	S* new_areas = alloc<S>(nelr);
+	int* new_elements_surrounding_elements = alloc<int>(nelr*NNB);
+	S* new_normals = alloc<S>(NDIM*NNB*nelr);
+
+	#pragma omp parallel for default(shared) schedule(static)
+	for(int i = 0; i < nel; i++)
+	{
+		int k = order[i];
+		new_areas[k] = areas[i];
+		for(int j = 0; j < NNB; j++)
+		{
+			int nb = elements_surrounding_elements[i + j*nelr];
+			new_elements_surrounding_elements[k + j*nelr] = nb >= 0 ? order[nb] : nb;
+			for(int d = 0; d < NDIM; d++) new_normals[k + (j + d*NNB)*nelr] = normals[i + (j + d*NNB)*nelr];
+		}
+	}
+	pad_mesh(nel, nelr, new_areas, new_elements_surrounding_elements, new_normals);
+
+	dealloc<S>(areas);
+	dealloc<int>(elements_surrounding_elements);
+	dealloc<S>(normals);
+	areas = new_areas;
+	elements_surrounding_elements = new_elements_surrounding_elements;
+	normals = new_normals;
+}
+
+/*
+ * A mesh as the kernels index it: element i, neighbour j, dimension k at
+ * areas[i], elements_surrounding_elements[i + j*nelr] and
+ * normals[i + (j + k*NNB)*nelr], with neighbours numbered from 0 (-1 wing,
+ * -2 far field), normals pointing inwards and nelr-nel padding elements.
+ */
+template <typename S>
+struct mesh
+{
+	int nel;
+	int nelr;
+	S* areas;
+	int* elements_surrounding_elements;
+	S* normals;
+	int* order;		// file element -> storage slot, NULL if in file order
+	void* map;		// binary mesh the arrays point into, NULL if they are owned
+	size_t map_length;
+};
+
+template <typename S>
+void free_mesh(mesh<S>& m)
+{
+	if(m.map)
+	{
+		munmap(m.map, m.map_length);
+	}
+	else
+	{
+		dealloc<S>(m.areas);
+		dealloc<int>(m.elements_surrounding_elements);
+		dealloc<S>(m.normals);
+		if(m.order) dealloc<int>(m.order);
+	}
+	m.map = NULL;
+}
+
+// read a fvcorr.domn text mesh, padded to a multiple of pad elements
+template <typename S>
+int read_text_mesh(const char* file_name, int pad, mesh<S>& m)
+{
+	std::ifstream file(file_name);
+	if(!(file >> m.nel) || m.nel <= 0)
+	{
+		fprintf(stderr, "Cannot read mesh %s\n", file_name);
+		return -1;
+	}
+	int nel = m.nel;
+	int nelr = m.nelr = pad*((nel / pad )+ std::min(1, nel % pad));
+
+	S* areas = m.areas = alloc<S>(nelr);
+	int* elements_surrounding_elements = m.elements_surrounding_elements = alloc<int>(nelr*NNB);
+	S* normals = m.normals = alloc<S>(NDIM*NNB*nelr);
+	m.order = NULL;
+	m.map = NULL;
+
+	// read in data
+	for(int i = 0; i < nel; i++)
+	{
+		file >> areas[i];
+		for(int j = 0; j < NNB; j++)
+		{
+			file >> elements_surrounding_elements[i + j*nelr];
+			if(elements_surrounding_elements[i+j*nelr] < 0) elements_surrounding_elements[i+j*nelr] = -1;
+			elements_surrounding_elements[i + j*nelr]--; //it's coming in with Fortran numbering
+
+			for(int k = 0; k < NDIM; k++)
+			{
+				file >>  normals[i + (j + k*NNB)*nelr];
+				normals[i + (j + k*NNB)*nelr] = -normals[i + (j + k*NNB)*nelr];
+			}
+		}
+	}
+	if(!file)
+	{
+		fprintf(stderr, "Mesh %s is truncated\n", file_name);
+		free_mesh(m);
+		return -1;
+	}
+
+	// fill in remaining data
+	pad_mesh(nel, nelr, areas, elements_surrounding_elements, normals);
+	return 0;
+}
+
+/*
+ * Binary meshes
+ *
+ * A header followed by the arrays of struct mesh exactly as the kernels
+ * index them, so a mesh can be used straight from an mmap of the file.
+ * Arrays start on a cache line. nelr is padded to MESH_PAD elements, a
+ * multiple of every block length, and areas and normals are stored in
+ * float or double (real_size). A mesh renumbered by the converter carries
+ * its order, so the solution is still written in fvcorr file order. Files
+ * are in host byte order.
+ */
+#define MESH_MAGIC "CFDMESH1"
+#define MESH_PAD 64
+#define MESH_ALIGN 64
+#define MESH_REORDERED 1
+
+struct mesh_header
+{
+	char magic[8];
+	int32_t nel;
+	int32_t nelr;
+	int32_t real_size;	// bytes per area and normal component, 4 or 8
+	int32_t flags;
+	// byte offsets of the arrays from the start of the file
+	int64_t areas;
+	int64_t elements_surrounding_elements;
+	int64_t normals;
+	int64_t order;		// 0 unless MESH_REORDERED
+};
+
+inline int64_t mesh_align(int64_t offset)
+{
+	return (offset + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+}
+
+inline bool is_binary_mesh(const char* file_name)
+{
+	char magic[8];
+	FILE* file = fopen(file_name, "rb");
+	if(file == NULL) return false;
+	bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MESH_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+	return binary;
+}
+
+template <typename S>
+int write_binary_mesh(const char* file_name, const mesh<S>& m)
+{
+	mesh_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MESH_MAGIC, sizeof(h.magic));
+	h.nel = m.nel;
+	h.nelr = m.nelr;
+	h.real_size = sizeof(S);
+	h.flags = m.order ? MESH_REORDERED : 0;
+	h.areas = mesh_align(sizeof(h));
+	h.elements_surrounding_elements = mesh_align(h.areas + int64_t(m.nelr)*sizeof(S));
+	h.normals = mesh_align(h.elements_surrounding_elements + int64_t(m.nelr)*NNB*sizeof(int));
+	if(m.order) h.order = mesh_align(h.normals + int64_t(m.nelr)*NDIM*NNB*sizeof(S));
+
+	FILE* file = fopen(file_name, "wb");
+	if(file == NULL)
+	{
+		fprintf(stderr, "Cannot create %s\n", file_name);
+		return -1;
+	}
+
+	static const char zeros[MESH_ALIGN] = {0};
+	const void* arrays[4] = { m.areas, m.elements_surrounding_elements, m.normals, m.order };
+	int64_t offsets[4] = { h.areas, h.elements_surrounding_elements, h.normals, h.order };
+	size_t sizes[4] = { m.nelr*sizeof(S), m.nelr*NNB*sizeof(int), m.nelr*NDIM*NNB*sizeof(S), m.nel*sizeof(int) };
+	int64_t position = sizeof(h);
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+	for(int a = 0; a < (m.order ? 4 : 3) && ok; a++)
+	{
+		size_t gap = offsets[a] - position;
+		ok = fwrite(zeros, 1, gap, file) == gap && fwrite(arrays[a], 1, sizes[a], file) == sizes[a];
+		position = offsets[a] + sizes[a];
+	}
+	ok = (fclose(file) == 0) && ok;
+	if(!ok) fprintf(stderr, "Cannot write %s\n", file_name);
+	return ok ? 0 : -1;
+}
+
+// map a binary mesh read-only; h points to the header at the start of the map
+inline int map_binary_mesh(const char* file_name, const mesh_header*& h, void*& map, size_t& length)
+{
+	int fd = open(file_name, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "Cannot open %s\n", file_name);
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	length = st.st_size;
+	map = length >= sizeof(mesh_header) ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map %s\n", file_name);
+		return -1;
+	}
+
+	h = (const mesh_header*)map;
+	int64_t real_size = h->real_size, nelr = h->nelr;
+	bool valid = memcmp(h->magic, MESH_MAGIC, sizeof(h->magic)) == 0
+		&& (real_size == 4 || real_size == 8)
+		&& h->nel > 0 && nelr >= h->nel && nelr % MESH_PAD == 0
+		&& h->areas >= int64_t(sizeof(mesh_header))
+		&& h->areas + nelr*real_size <= h->elements_surrounding_elements
+		&& h->elements_surrounding_elements + nelr*NNB*int64_t(sizeof(int)) <= h->normals
+		&& h->normals + nelr*NDIM*NNB*real_size <= int64_t(length)
+		&& (!(h->flags & MESH_REORDERED) || (h->order >= h->normals + nelr*NDIM*NNB*real_size
+		                                     && h->order + h->nel*int64_t(sizeof(int)) <= int64_t(length)));
+	if(!valid)
+	{
+		fprintf(stderr, "%s is not a valid binary mesh\n", file_name);
+		munmap(map, length);
+		return -1;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,74 @@
+// Copyright 2009, Andrew Corrigan, acorriga@gmu.edu
+// This code is from the AIAA-2009-4001 paper
+
+/*
+ * Converts a fvcorr.domn text mesh into the binary mesh format of mesh.h,
+ * which euler3d_cpu maps instead of parsing. The mesh is padded to
+ * MESH_PAD elements and, unless -n is given, renumbered with RCM so the
+ * solver can skip that step as well.
+ *
+ *   mesh_convert [-d] [-n] fvcorr.domn.193K fvcorr.193K.mesh
+ *
+ *   -d  store areas and normals in double (default float)
+ *   -n  keep the elements in file order
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mesh.h"
+
+template <typename S>
+int convert(const char* in_file_name, const char* out_file_name, bool reorder)
+{
+	mesh<S> m;
+	if(read_text_mesh(in_file_name, MESH_PAD, m) != 0) return 1;
+
+	if(reorder)
+	{
+		double distance_before, far_before, distance_after, far_after;
+		gather_locality(m.nel, m.nelr, m.elements_surrounding_elements, distance_before, far_before);
+
+		m.order = alloc<int>(m.nel);
+		rcm_order(m.nel, m.nelr, m.elements_surrounding_elements, m.order);
+		reorder_mesh(m.nel, m.nelr, m.order, m.areas, m.elements_surrounding_elements, m.normals);
+
+		gather_locality(m.nel, m.nelr, m.elements_surrounding_elements, distance_after, far_after);
+		printf("RCM: mean neighbour distance %.1f -> %.1f, gathers beyond %d elements %.1f%% -> %.1f%%\n",
+		       distance_before, distance_after, gather_window, 100.0*far_before, 100.0*far_after);
+	}
+
+	int status = write_binary_mesh(out_file_name, m);
+	if(status == 0)
+		printf("%s: %d elements (%d padded), %s%s\n", out_file_name, m.nel, m.nelr,
+		       sizeof(S) == sizeof(float) ? "float" : "double", reorder ? ", renumbered" : "");
+	free_mesh(m);
+	return status == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	bool use_double = false, reorder = true;
+	int opt;
+
+	while((opt = getopt(argc, argv, "dn")) != -1)
+	{
+		switch(opt)
+		{
+			case 'd': use_double = true; break;
+			case 'n': reorder = false; break;
+			default:
+				std::cerr << "usage: " << argv[0] << " [-d] [-n] text_mesh binary_mesh" << std::endl;
+				return 1;
+		}
+	}
+	if(argc - optind != 2)
+	{
+		std::cerr << "usage: " << argv[0] << " [-d] [-n] text_mesh binary_mesh" << std::endl;
+		return 1;
+	}
+
+	if(use_double) return convert<double>(argv[optind], argv[optind+1], reorder);
+	return convert<float>(argv[optind], argv[optind+1], reorder);
+}
@@ -102,6 +102,8 @@ int main(int argc, char *argv[]) {
 
   struct pb_Parameters *parameters;
   struct pb_TimerSet timers;
+  struct pb_Timer kernel_timer;
+  struct pb_RunRecord record;
 
   /* Read input parameters */
   parameters = pb_ReadParameters(&argc, argv);
@@ -147,10 +149,13 @@ int main(int argc, char *argv[]) {
   /*
    * CPU kernel
    */
+  pb_ResetTimer(&kernel_timer);
+  pb_StartTimer(&kernel_timer);
   if (cpu_compute_cutoff_potential_lattice(cpu_lattice, cutoff, atom)) {
     fprintf(stderr, "Computation failed\n");
     exit(1);
   }
+  pb_StopTimer(&kernel_timer);
 
   /*
    * Zero the lattice points that are too close to an atom.  This is
@@ -173,6 +178,15 @@ int main(int argc, char *argv[]) {
   free_atom(atom);
 
   pb_SwitchToTimer(&timers, pb_TimerID_NONE);
+
+  /* The work depends on how many atoms are within the cutoff of each
+   * lattice point, so only the time is recorded */
+  pb_InitRunRecord(&record, "cutcp", parameters->inpFiles[0]);
+  record.iterations = 1;
+  record.seconds = pb_GetElapsedTime(&kernel_timer);
+  record.timers = &timers;
+  if (pb_EmitRunRecord(&record) != 0)
+    exit(1);
   pb_PrintTimerSet(&timers);
   pb_FreeParameters(parameters);
 
@@ -26,6 +26,8 @@
 int main(int argc, char* argv[]) {
   struct pb_TimerSet timers;
   struct pb_Parameters *parameters;
+  struct pb_Timer histo_timer;
+  struct pb_RunRecord record;
 
   printf("Base implementation of histogramming.\n");
 
@@ -88,6 +90,8 @@ int main(int argc, char* argv[]) {
 
   pb_SwitchToTimer(&timers, pb_TimerID_COMPUTE);
 
+  pb_ResetTimer(&histo_timer);
+  pb_StartTimer(&histo_timer);
   int iter;
   for (iter = 0; iter < numIterations; iter++){
     memset(histo,0,histo_height*histo_width*sizeof(unsigned char));
@@ -103,6 +107,7 @@ int main(int argc, char* argv[]) {
       }
     }
   }
+  pb_StopTimer(&histo_timer);
 
 //  pb_SwitchToTimer(&timers, pb_TimerID_IO);
   pb_SwitchToSubTimer(&timers, outputStr, pb_TimerID_IO);
@@ -118,6 +123,15 @@ int main(int argc, char* argv[]) {
 
   pb_SwitchToTimer(&timers, pb_TimerID_NONE);
 
+  /* Every iteration reads the image once */
+  pb_InitRunRecord(&record, "histo", parameters->inpFiles[0]);
+  record.iterations = numIterations;
+  record.seconds = numIterations > 0 ? pb_GetElapsedTime(&histo_timer) / numIterations : 0;
+  record.timers = &timers;
+  record.bytes = (double)img_width * img_height * sizeof(unsigned int);
+  if (pb_EmitRunRecord(&record) != 0)
+    return -1;
+
   printf("\n");
   pb_PrintTimerSet(&timers);
   pb_FreeParameters(parameters);
@@ -6,184 +6,306 @@
  *
  ***************************************************************************/
 
-#include <alloca.h>
-#include <assert.h>
+#define _GNU_SOURCE
+#include <limits.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
-#include "FauxBlock.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
-typedef void *(*pthrd_start_func) (void *);    // Used by pthreads as the thread func signature
+#include "FauxBlock.h"
 
 //=====================================================
 //=====================================================
 //=====================================================
 //=====================================================
 
-#include <stdlib.h>
+/*
+ * The runners form one persistent pool.  A batch of blocks is published
+ * by bumping a generation word, which wakes every worker at once; worker
+ * w runs block w (or w+1 when the caller runs block 0 itself), so a block
+ * array costs one wake-up rather than a condvar round-trip per block.
+ * The batch itself is read under a sequence count and tagged with its
+ * generation, so a worker that wakes late never runs a block of a batch
+ * that was published after the one it woke for.
+ * Completion is a sense-reversing barrier over the blocks of the batch.
+ * Waiters spin for FAUX_BLOCK_SPIN iterations before parking on a futex,
+ * and wakers only enter the kernel when somebody is actually parked, so
+ * back-to-back phases never leave user space.  Spinning only pays while
+ * every pool thread has a CPU of its own; oversubscribed pools park
+ * straight away.  The dispatch functions are not reentrant from inside
+ * a block.
+ */
+
+// Spin iterations before a waiter parks; around 20-50 microseconds
+#ifndef FAUX_BLOCK_SPIN
+#define FAUX_BLOCK_SPIN (1 << 14)
+#endif
 
-typedef void (*exec_block_func) (faux_block_t *);
+#define FAUX_CACHE_LINE 64
 
-typedef struct async_runner
+typedef struct faux_worker
+{
+    pthread_t      t;
+    int            index;
+    int            cpu;                  // -1 if not pinned
+    unsigned int   seen;                 // Last generation handled
+} __attribute__((aligned(FAUX_CACHE_LINE))) faux_worker_t;
+
+typedef struct faux_barrier
+{
+    unsigned int   count;                // Arrivals still missing
+    unsigned int   sense;                // Flips when the last one arrives
+    unsigned int   sleepers;
+} __attribute__((aligned(FAUX_CACHE_LINE))) faux_barrier_t;
+
+static struct faux_pool
+{
+    // Written by the dispatching thread, read by the workers
+    unsigned int   generation __attribute__((aligned(FAUX_CACHE_LINE)));
+    unsigned int   sleepers;
+    int            shutdown;
+    unsigned int   seq;                  // Odd while the batch is rewritten
+    unsigned int   batch_generation;     // Generation the batch belongs to
+    faux_block_t  *batch;
+    size_t         len;
+    size_t         offset;               // 1 if the caller runs block 0
+
+    faux_barrier_t done;
+    unsigned int   done_sense;           // Sense of the outstanding batch
+    faux_block_t  *pending;              // Deferred batch not joined yet
+
+    faux_worker_t **workers;
+    int             nworkers;
+    int             spin;                // Spin iterations before parking
+    int            *cpus;                // Allowed CPUs, in order
+    int             ncpus;
+} pool;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void cpu_relax()
 {
-             pthread_t        t;
-             pthread_mutex_t  m;
-             pthread_cond_t   go;
-    volatile unsigned int     ready;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
 
-             pthread_mutex_t  m2;
-             pthread_cond_t   done;
+static inline void futex_wait(unsigned int *word, unsigned int old)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, old, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
 
-    volatile exec_block_func   f;
-    volatile void *           d;
-} async_runner_t;
+static inline void futex_wake(unsigned int *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
 
+/**
+ * Wait until *word differs from 'old' and return its new value.  The
+ * sleepers count and the word are both sequentially consistent, so a
+ * waker that changes the word and then sees no sleepers cannot miss a
+ * waiter that is about to park.
+ */
+static unsigned int wait_change(unsigned int *word, unsigned int old, unsigned int *sleepers)
+{
+    unsigned int v;
+    int i, spin = __atomic_load_n(&pool.spin, __ATOMIC_RELAXED);
 
+    for (i = 0; i < spin; ++i)
+    {
+        v = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (v != old)
+            return v;
+        cpu_relax();
+    }
 
-#define MAX_CACHED_RUNNERS 12 
-static async_runner_t* runner_stack[MAX_CACHED_RUNNERS];
-static int next = -1;
+    __atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+    while ((v = __atomic_load_n(word, __ATOMIC_SEQ_CST)) == old)
+        futex_wait(word, old);
+    __atomic_sub_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
 
+    return v;
+}
 
-static void dispose_runner(async_runner_t *r)
+static void wake_all(unsigned int *word, unsigned int *sleepers)
 {
-    pthread_mutex_destroy (&(r->m));
-    pthread_mutex_destroy (&(r->m2));
-    pthread_cond_destroy  (&(r->go));
-    pthread_cond_destroy  (&(r->done));
-    pthread_detach((r->t));
+    if (__atomic_load_n(sleepers, __ATOMIC_SEQ_CST) != 0)
+        futex_wake(word);
+}
 
-    free (r);
+/**
+ * One arrival at the barrier; the last one flips the sense.
+ */
+static void barrier_arrive(faux_barrier_t *b)
+{
+    if (__atomic_sub_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        __atomic_store_n(&b->sense, b->sense ^ 1, __ATOMIC_SEQ_CST);
+        wake_all(&b->sense, &b->sleepers);
+    }
 }
 
 /**
  * This is the thread code that loops forever (more or less) in the
  * runner threads.
  */
-static void *thread_pool_thread(void *data)
+static void *pool_worker(void *data)
 {
-    async_runner_t* r = (async_runner_t*)data;
+    faux_worker_t *w = (faux_worker_t*)data;
+    faux_block_t *batch;
+    size_t len, offset;
+    unsigned int seq, gen;
 
-    exec_block_func  f;
-    void*            d;
+#ifdef __linux__
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
 
-    pthread_mutex_lock (&(r->m));                   // Lock
     do
     {
-        // Only wait if we don't have ready signaled.  If we don't
-        // have the protective 'if', we can lose signals and hang.
-        if (r->ready == 0)
-            pthread_cond_wait(&(r->go), &(r->m));       // Wait ... mutex unlocked inside, locked before return ...
-
-        f = r->f;
-        if (f == 0)
-            goto done;
-
-        d = (void*)(r->d);
-
-        (*f)((faux_block_t*)d);
-
-        r->f = 0;
-        r->d = 0;
-        r->ready = 0;
-        // Signal that we are done.  The join() method cares ...
-        pthread_mutex_lock(&(r->m2));
-        pthread_cond_signal(&(r->done));
-        pthread_mutex_unlock(&(r->m2));
+        size_t i;
+
+        w->seen = wait_change(&pool.generation, w->seen, &pool.sleepers);
+        if (__atomic_load_n(&pool.shutdown, __ATOMIC_ACQUIRE))
+            break;
+
+        do
+        {
+            seq    = __atomic_load_n(&pool.seq, __ATOMIC_ACQUIRE);
+            gen    = __atomic_load_n(&pool.batch_generation, __ATOMIC_RELAXED);
+            batch  = __atomic_load_n(&pool.batch, __ATOMIC_RELAXED);
+            len    = __atomic_load_n(&pool.len, __ATOMIC_RELAXED);
+            offset = __atomic_load_n(&pool.offset, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || seq != __atomic_load_n(&pool.seq, __ATOMIC_RELAXED));
+
+        // A later batch means ours finished without this worker
+        if (gen != w->seen)
+            continue;
+
+        i = w->index + offset;
+        if (i < len)
+        {
+            exec_faux_block(batch + i);
+            barrier_arrive(&pool.done);
+        }
     } while (1);
 
-done:
-    dispose_runner(r);
-
-    pthread_exit(0);
     return 0;
 }
 
-static pthread_mutex_t runner_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 /**
- * Block until the runner thread has finished handling its current task.
+ * The CPUs this process may run on.  Workers are pinned round-robin
+ * starting with the second one; the first is left to the caller.
  */
-static void join (async_runner_t *runner)
+static void init_cpus()
 {
-    // Wait (if necessary) for the runner thread to tell us it is finished
-    // running its current task.
-
-    pthread_mutex_lock(&(runner->m2));
-    if (runner->f)
-        pthread_cond_wait(&(runner->done), &(runner->m2));
-    pthread_mutex_unlock(&(runner->m2));
-
-    // Get back the mutex from the worker...
-    pthread_mutex_lock (&(runner->m));
-
-    pthread_mutex_lock(&runner_pool_mutex);
-    // Return the runnable to the stack of available runnables.
-    if (next < (MAX_CACHED_RUNNERS - 1))
+    pool.ncpus = 0;
+#ifdef __linux__
     {
-        ++next;
-        runner_stack[next] = runner;
-        pthread_mutex_unlock(&runner_pool_mutex);
-    }
-    else
-    {
-        pthread_mutex_unlock(&runner_pool_mutex);
-
-        // "Run" this again, with func as null (which is how the thread left things).
-        // With a null func, the thread will exit, which is what we want since we
-        // can't access it after we fail to put it back on the stack.
-
-        pthread_cond_signal(&(runner->go));
-        pthread_mutex_unlock (&(runner->m));          // Allow the worker thread to run
+        cpu_set_t set;
+        int c;
+
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            pool.cpus = (int*)malloc(CPU_COUNT(&set) * sizeof(int));
+            for (c = 0; c < CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &set))
+                    pool.cpus[pool.ncpus++] = c;
+        }
     }
+#endif
 }
 
+/**
+ * Grow the pool to at least 'n' workers.  Only called between batches.
+ */
+static void ensure_workers(int n)
+{
+    if (n <= pool.nworkers)
+        return;
 
+    if (pool.cpus == 0)
+        init_cpus();
 
+    pool.workers = (faux_worker_t**)realloc(pool.workers, n * sizeof(faux_worker_t*));
 
-
-// async_runner_t* run_async (pthrd_start_func func, void *data)
-static async_runner_t* run_async (exec_block_func func, void *data)
-{
-    async_runner_t *r = 0;
-
-    pthread_mutex_lock(&runner_pool_mutex);
-    if (next >= 0)
+    while (pool.nworkers < n)
     {
-        r = runner_stack[next];
-        --next;
+        faux_worker_t *w;
+
+        if (posix_memalign((void**)&w, FAUX_CACHE_LINE, sizeof(faux_worker_t)) != 0)
+        {
+            fprintf(stderr, "Cannot allocate a runner thread.\n");
+            exit(-51);
+        }
+        w->index = pool.nworkers;
+        w->cpu   = pool.ncpus > 1 ? pool.cpus[(w->index + 1) % pool.ncpus] : -1;
+        w->seen  = pool.generation;
+
+        if (pthread_create(&(w->t), 0, pool_worker, w) != 0)
+        {
+            fprintf(stderr, "Cannot create a runner thread.\n");
+            exit(-51);
+        }
+        pool.workers[pool.nworkers++] = w;
     }
-    pthread_mutex_unlock(&runner_pool_mutex);
 
-    if (r == 0)
-    {
-        r = (async_runner_t*)malloc (sizeof(async_runner_t));
+    __atomic_store_n(&pool.spin, pool.nworkers < pool.ncpus ? FAUX_BLOCK_SPIN : 0, __ATOMIC_RELAXED);
+}
 
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-        pthread_mutex_init (&(r->m), 0);
-        pthread_cond_init  (&(r->go), 0);
+/**
+ * Hand 'len' blocks to the pool, starting with block 'offset'.
+ */
+static void publish(faux_block_t block[], size_t len, size_t offset)
+{
+    unsigned int gen = pool.generation + 1;
 
-        pthread_mutex_init (&(r->m2), 0);
-        pthread_cond_init  (&(r->done), 0);
-        r->ready = 1;
-        pthread_mutex_lock (&(r->m));
+    ensure_workers((int)(len - offset));
 
-       pthread_create(&(r->t), &attr, thread_pool_thread, r);
-    }
+    __atomic_store_n(&pool.seq, pool.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&pool.batch_generation, gen, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool.batch, block, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool.len, len, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool.offset, offset, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool.seq, pool.seq + 1, __ATOMIC_RELEASE);
 
-    r->f = func;
-    r->d = data;
+    pool.done.count = (unsigned int)len;
+    pool.done_sense = __atomic_load_n(&pool.done.sense, __ATOMIC_RELAXED);
 
-    // Already locked ... either from the block above, or from the join() method
-    pthread_cond_signal(&(r->go));
-    pthread_mutex_unlock (&(r->m));          // Allow the worker thread to run
+    __atomic_add_fetch(&pool.generation, 1, __ATOMIC_SEQ_CST);
+    wake_all(&pool.generation, &pool.sleepers);
+}
 
-    return r;
+/**
+ * Block until every block of the outstanding batch has finished.
+ */
+static void wait_done()
+{
+    wait_change(&pool.done.sense, pool.done_sense, &pool.done.sleepers);
 }
+
 //======================
 //======================
 //======================
@@ -191,18 +313,33 @@ static async_runner_t* run_async (exec_block_func func, void *data)
 
 
 /**
- *
+ * Stop and join the runner threads.  The pool is recreated on next use.
  */
 void clear_runners()
 {
-    while (next >= 0)
+    int i;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool.pending)
     {
-        async_runner_t *r = runner_stack[next];
-        pthread_cond_signal(&(r->go));
-        pthread_mutex_unlock (&(r->m));          // Allow the worker thread to run
-        --next;
-        // dispose_runner(r);
+        wait_done();
+        pool.pending = 0;
     }
+
+    __atomic_store_n(&pool.shutdown, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool.generation, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&pool.generation);
+
+    for (i = 0; i < pool.nworkers; ++i)
+    {
+        pthread_join(pool.workers[i]->t, 0);
+        free(pool.workers[i]);
+    }
+    free(pool.workers);
+    pool.workers  = 0;
+    pool.nworkers = 0;
+    pool.shutdown = 0;
+    pthread_mutex_unlock(&pool_mutex);
 }
 
 
@@ -214,52 +351,81 @@ void exec_faux_block (faux_block_t *block)
     block->func((void*)(block->args));
 }
 
-//## TODO: Handle call when block still assigned to other thread
-
 
 /**
- * Execute 'len' of the passed in 'block' FauxBlocks, each on its own thread.
+ * Start 'len' of the passed in 'block' FauxBlocks, each on its own pool
+ * thread, and return without waiting.  One batch may be outstanding at a
+ * time; starting another one joins the previous first.
  */
 int exec_faux_block_deferred (faux_block_t block[], size_t len)
 {
-// printf("exec_faux_block_deferred(%p, %d)\n", block, len);
-
     size_t i;
 
+    if (len == 0)
+        return 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool.pending)
+        wait_done();
+
     for (i = 0; i < len; ++i)
-    {
-        async_runner_t *r = run_async (exec_faux_block, block + i);
-        block[i].tid = r; // t;       // join will want this ...
-    }
+        block[i].tid = &pool;                // join will want this ...
+
+    pool.pending = block;
+    publish(block, len, 0);
+    pthread_mutex_unlock(&pool_mutex);
 
-    //## TODO Handle errors ...
     return 0;
 }
 
 
-
-void *thread_pool_thread(void *data);
 /**
  * Wait until 'len' of the passed in 'block' FauxBlocks are done executing..
  */
 void faux_block_exec_join(faux_block_t block[], size_t len)
 {
-    //## TODO: Handle join w/o tid set
-
     size_t i;
 
-    for (i = 0; i < len; ++i)
+    pthread_mutex_lock(&pool_mutex);
+    if (pool.pending == block)
     {
-        join ((async_runner_t*) block[i].tid);
-        block[i].tid = 0;                  // Zero out the tid ... we aren't running in a thread anymore
+        wait_done();
+        pool.pending = 0;
     }
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (i = 0; i < len; ++i)
+        block[i].tid = 0;                  // Zero out the tid ... we aren't running in a thread anymore
 }
 
 
+/**
+ * Run 'len' blocks to completion.  The calling thread runs the first one
+ * and the pool the rest, all released by a single wake-up.
+ */
 void faux_block_run (faux_block_t block[], size_t len)
 {
-    exec_faux_block_deferred (block, len);
-    faux_block_exec_join     (block, len);
+    if (len == 0)
+        return;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool.pending)
+    {
+        wait_done();
+        pool.pending = 0;
+    }
+
+    if (len > 1)
+        publish(block, len, 1);
+
+    exec_faux_block(block);
+
+    if (len > 1)
+    {
+        barrier_arrive(&pool.done);
+        wait_done();
+    }
+    pthread_mutex_unlock(&pool_mutex);
 }
 
 
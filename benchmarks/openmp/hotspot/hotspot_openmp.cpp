@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <omp.h>
 #include <sys/time.h>
+#include <parboil.h>
 
 // Returns the current system time in microseconds 
 long long get_time()
@@ -49,23 +50,20 @@ int num_omp_threads;
 
 /* Single iteration of the transient solver in the grid model.
  * advances the solution of the discretized difference equations 
- * by one time step
+ * by one time step, over the chunks [chunk_begin, chunk_end) of
+ * the calling thread
  */
 void single_iteration(FLOAT *result, FLOAT *temp, FLOAT *power, int row, int col,
 					  FLOAT Cap_1, FLOAT Rx_1, FLOAT Ry_1, FLOAT Rz_1, 
-					  FLOAT step)
+					  FLOAT step, int chunk_begin, int chunk_end)
 {
     FLOAT delta;
     int r, c;
     int chunk;
-    int num_chunk = row*col / (BLOCK_SIZE_R * BLOCK_SIZE_C);
     int chunks_in_row = col/BLOCK_SIZE_C;
     int chunks_in_col = row/BLOCK_SIZE_R;
 
-#ifdef OPEN
-    #pragma omp parallel for shared(power, temp, result) private(chunk, r, c, delta) firstprivate(row, col, num_chunk, chunks_in_row) schedule(static)
-#endif
-    for ( chunk = 0; chunk < num_chunk; ++chunk )
+    for ( chunk = chunk_begin; chunk < chunk_end; ++chunk )
     {
         int r_start = BLOCK_SIZE_R*(chunk/chunks_in_col);
         int c_start = BLOCK_SIZE_C*(chunk%chunks_in_row); 
@@ -184,13 +182,14 @@ void compute_tran_temp(FLOAT *result, int num_iterations, FLOAT *temp, FLOAT *po
 	fprintf(stdout, "Rx: %g\tRy: %g\tRz: %g\tCap: %g\n", Rx, Ry, Rz, Cap);
 	#endif
 
+    int num_chunk = row*col / (BLOCK_SIZE_R * BLOCK_SIZE_C);
+
 #ifdef OMP_OFFLOAD
         int array_size = row*col;
 #pragma omp target \
         map(temp[0:array_size]) \
-        map(to: power[0:array_size], row, col, Cap_1, Rx_1, Ry_1, Rz_1, step, num_iterations) \
+        map(to: power[0:array_size], row, col, Cap_1, Rx_1, Ry_1, Rz_1, step, num_iterations, num_chunk) \
         map( result[0:array_size])
-#endif
         {
             FLOAT* r = result;
             FLOAT* t = temp;
@@ -199,12 +198,54 @@ void compute_tran_temp(FLOAT *result, int num_iterations, FLOAT *temp, FLOAT *po
                 #ifdef VERBOSE
                 fprintf(stdout, "iteration %d\n", i++);
                 #endif
-                single_iteration(r, t, power, row, col, Cap_1, Rx_1, Ry_1, Rz_1, step);
+                #pragma omp parallel for schedule(static)
+                for (int chunk = 0; chunk < num_chunk; ++chunk)
+                    single_iteration(r, t, power, row, col, Cap_1, Rx_1, Ry_1, Rz_1, step, chunk, chunk + 1);
+                FLOAT* tmp = t;
+                t = r;
+                r = tmp;
+            }	
+        }
+#else
+        /* One team for all the steps: every thread keeps its chunks,
+         * a barrier ends each step */
+        struct pb_Barrier *barrier = NULL;
+
+        #pragma omp parallel
+        {
+            int tid = omp_get_thread_num();
+            int nthreads = omp_get_num_threads();
+            long chunk_begin, chunk_end;
+
+            /* Sized from the team actually started, which a thread limit
+             * or OMP_DYNAMIC may make smaller than asked for */
+            #pragma omp single
+            {
+                barrier = pb_CreateBarrier("steps", nthreads);
+                if (barrier == NULL) {
+                    fprintf(stderr, "error: cannot create the barrier\n");
+                    exit(1);
+                }
+            }
+            pb_ThreadRange(num_chunk, tid, nthreads, &chunk_begin, &chunk_end);
+            FLOAT* r = result;
+            FLOAT* t = temp;
+            for (int i = 0; i < num_iterations ; i++)
+            {
+                #ifdef VERBOSE
+                if (tid == 0)
+                    fprintf(stdout, "iteration %d\n", i);
+                #endif
+                single_iteration(r, t, power, row, col, Cap_1, Rx_1, Ry_1, Rz_1, step, chunk_begin, chunk_end);
+                pb_BarrierWait(barrier, tid);
                 FLOAT* tmp = t;
                 t = r;
                 r = tmp;
             }	
         }
+        pb_PrintBarrier(barrier);
+        pb_DestroyBarrier(barrier);
+#endif
 	#ifdef VERBOSE
 	fprintf(stdout, "iteration %d\n", i++);
 	#endif
@@ -267,7 +308,7 @@ void usage(int argc, char **argv)
 	fprintf(stderr, "\t<grid_rows>  - number of rows in the grid (positive integer)\n");
 	fprintf(stderr, "\t<grid_cols>  - number of columns in the grid (positive integer)\n");
 	fprintf(stderr, "\t<sim_time>   - number of iterations\n");
-	fprintf(stderr, "\t<no. of threads>   - number of threads\n");
+	fprintf(stderr, "\t<no. of threads>   - number of threads, 0 for OMP_NUM_THREADS\n");
 	fprintf(stderr, "\t<temp_file>  - name of the file containing the initial temperature values of each cell\n");
 	fprintf(stderr, "\t<power_file> - name of the file containing the dissipated power values of each cell\n");
         fprintf(stderr, "\t<output_file> - name of the output file\n");
@@ -286,9 +327,11 @@ int main(int argc, char **argv)
 	if ((grid_rows = atoi(argv[1])) <= 0 ||
 		(grid_cols = atoi(argv[2])) <= 0 ||
 		(sim_time = atoi(argv[3])) <= 0 || 
-		(num_omp_threads = atoi(argv[4])) <= 0
+		(num_omp_threads = atoi(argv[4])) < 0
 		)
 		usage(argc, argv);
+	if (num_omp_threads > 0)
+		omp_set_num_threads(num_omp_threads);
 
 	/* allocate memory for the temperature and power arrays	*/
 	temp = (FLOAT *) calloc (grid_rows * grid_cols, sizeof(FLOAT));
@@ -316,6 +359,16 @@ int main(int argc, char **argv)
     printf("Ending simulation\n");
     printf("Total time: %.3f seconds\n", ((float) (end_time - start_time)) / (1000*1000));
 
+    /* About 15 flops per cell and step; temp and power are read, result written */
+    struct pb_RunRecord record;
+    pb_InitRunRecord(&record, "hotspot", tfile);
+    record.iterations = sim_time;
+    record.seconds = (end_time - start_time) * 1e-6 / sim_time;
+    record.flops = 15.0 * grid_rows * grid_cols;
+    record.bytes = 3.0 * sizeof(FLOAT) * grid_rows * grid_cols;
+    if (pb_EmitRunRecord(&record) != 0)
+        return 1;
+
     writeoutput((1&sim_time) ? result : temp, grid_rows, grid_cols, ofile);
 
 	/* output results	*/
@@ -110,3 +110,88 @@ int cluster(int      numObjects,      /* number of input objects */
 
     return 0;
 }
+
+/*---< cluster_sweep() >-----------------------------------------------------*/
+/* Independent runs for every cluster count in [min_nclusters,
+ * max_nclusters] and every restart, all on the same feature matrix.  The
+ * threads are split into teams that take runs off a shared queue, largest
+ * cluster count first, and cluster with a nested team each; a run seeds
+ * from seed, its count and its restart only, so the results do not depend
+ * on which team picked it up.  runs[] gets one entry per run; the centres
+ * of the lowest inertia run with min_nclusters are returned. */
+int cluster_sweep(int      numObjects,
+                  int      numAttributes,
+                  float  **attributes,
+                  int      min_nclusters,
+                  int      max_nclusters,
+                  int      restarts,
+                  int      seeding,         /* KMEANS_SEED_* */
+                  unsigned long long seed,
+                  float    threshold,
+                  struct cluster_run *runs, /* out: [counts * restarts] */
+                  float ***cluster_centres, /* out: [min_nclusters][numAttributes] */
+                  int      num_omp_threads
+                  )
+{
+    int     nruns = (max_nclusters - min_nclusters + 1) * restarts;
+    int     teams = nruns < num_omp_threads ? nruns : num_omp_threads;
+    int     base  = num_omp_threads / teams, extra = num_omp_threads % teams;
+    double  best_inertia = 0;
+    int     best_restart = 0;
+    float **best = NULL;
+    int     r;
+
+    omp_set_max_active_levels(2);
+
+#pragma omp parallel for num_threads(teams) schedule(dynamic, 1)
+    for (r = 0; r < nruns; r++) {
+        struct kmeans_params params;
+        struct cluster_run  *run = &runs[r];
+        int     team = omp_get_thread_num();
+        int    *membership = (int*) malloc(numObjects * sizeof(int));
+        float **centres;
+        double  start;
+
+        run->nclusters    = max_nclusters - r / restarts;
+        run->restart      = r % restarts;
+        run->team_threads = base + (team < extra);
+
+        params.seeding   = seeding;
+        params.seed      = seed ^ ((unsigned long long)run->nclusters << 32 | run->restart);
+        params.max_loops = 500;
+
+        start   = omp_get_wtime();
+        centres = kmeans_clustering_params(attributes, numAttributes, numObjects,
+                                           run->nclusters, threshold, membership,
+                                           run->team_threads, &params);
+        run->seconds = omp_get_wtime() - start;
+        run->loops   = params.loops;
+        run->inertia = params.inertia;
+        free(membership);
+
+#pragma omp critical
+        {
+            if (run->nclusters == min_nclusters &&
+                (best == NULL || run->inertia < best_inertia ||
+                 (run->inertia == best_inertia && run->restart < best_restart))) {
+                float **t = best;
+                best = centres;
+                best_inertia = run->inertia;
+                best_restart = run->restart;
+                centres = t;
+            }
+        }
+        if (centres) {
+            free(centres[0]);
+            free(centres);
+        }
+    }
+
+    if (*cluster_centres) {
+        free((*cluster_centres)[0]);
+        free(*cluster_centres);
+    }
+    *cluster_centres = best;
+
+    return 0;
+}
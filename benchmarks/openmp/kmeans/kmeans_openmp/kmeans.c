@@ -77,12 +77,14 @@
 #include <fcntl.h>
 #include <omp.h>
 #include "getopt.h"
+#include <parboil.h>
 
 #include "kmeans.h"
 
 extern double wtime(void);
 
-int num_omp_threads = 40;
+/* -n, else OMP_NUM_THREADS */
+int num_omp_threads = 0;
 
 /*---< usage() >------------------------------------------------------------*/
 void usage(char *argv0) {
@@ -91,33 +93,98 @@ void usage(char *argv0) {
   "       -i filename     		: file containing data to be clustered\n"
   "       -b                 	: input file is in binary format\n"
   "       -k                 	: number of clusters (default is 5) \n"
+  "       -m max_nclusters	: sweep cluster counts from -k to max_nclusters\n"
+  "       -r restarts		: independent runs per cluster count (default 1)\n"
+  "       -p                 	: k-means++ seeding (default: first k objects)\n"
+  "       -s seed			: seed for k-means++ (default 7)\n"
   "       -t threshold		: threshold value\n"
-  "       -n no. of threads	: number of threads\n";
+  "       -n no. of threads	: number of threads (default OMP_NUM_THREADS)\n";
   fprintf(stderr, help, argv0);
   exit(-1);
 }
 
+struct cluster_args {
+  int      numObjects;
+  int      numAttributes;
+  float  **attributes;
+  int      nclusters;
+  float    threshold;
+  float ***cluster_centres;
+  /* sweep mode: -m, -r or -p */
+  int      sweep;
+  int      max_nclusters;
+  int      restarts;
+  int      seeding;
+  unsigned long long seed;
+  struct cluster_run *runs;
+};
+
+/*---< cluster_kernel() >---------------------------------------------------*/
+/* one harness iteration; cluster() frees the centres of the previous one */
+static void cluster_kernel(void *arg) {
+  struct cluster_args *a = (struct cluster_args *)arg;
+
+  if (a->sweep) {
+    cluster_sweep(a->numObjects, a->numAttributes, a->attributes,
+      a->nclusters, a->max_nclusters, a->restarts, a->seeding, a->seed,
+      a->threshold, a->runs, a->cluster_centres, num_omp_threads);
+    return;
+  }
+
+  cluster(a->numObjects,
+    a->numAttributes,
+    a->attributes,           /* [numObjects][numAttributes] */
+    a->nclusters,
+    a->threshold,
+    a->cluster_centres,
+    num_omp_threads
+  );
+}
+
+/*---< print_runs() >-------------------------------------------------------*/
+/* the runs of the last sweep, best restart of every cluster count starred */
+static void print_runs(struct cluster_run *runs, int nruns, int seeding) {
+  int i, j;
+
+  printf("[SWEEP]:%d runs, %s seeding\n", nruns,
+         seeding == KMEANS_SEED_PLUSPLUS ? "k-means++" : "first objects");
+  printf("  %8s %8s %8s %6s %16s %10s\n",
+         "clusters", "restart", "threads", "loops", "inertia", "seconds");
+  for (i = nruns - 1; i >= 0; i--) {
+    int best = 1;
+    for (j = 0; j < nruns; j++)
+      if (runs[j].nclusters == runs[i].nclusters &&
+          (runs[j].inertia < runs[i].inertia ||
+           (runs[j].inertia == runs[i].inertia && runs[j].restart < runs[i].restart)))
+        best = 0;
+    printf("%c %8d %8d %8d %6d %16.6e %10.4f\n", best ? '*' : ' ',
+           runs[i].nclusters, runs[i].restart, runs[i].team_threads,
+           runs[i].loops, runs[i].inertia, runs[i].seconds);
+  }
+}
+
 /*---< main() >-------------------------------------------------------------*/
 int main(int argc, char **argv) {
   int     opt;
   extern char   *optarg;
   extern int     optind;
   int     nclusters=5;
+  int     max_nclusters=0;
+  int     restarts=1;
+  int     seeding=KMEANS_SEED_FIRST;
+  unsigned long long seed=7;
   char   *filename = 0;
-  float  *buf;
+  struct features features;
   float **attributes;
   float **cluster_centres=NULL;
-  int     i, j;
-
   int     numAttributes;
   int     numObjects;
-  char    line[1024];
   int     isBinaryFile = 0;
   int     nloops = 1;
   float   threshold = 0.001;
-  double  timing;
+  double  timing, io_start;
 
-  while ( (opt=getopt(argc,argv,"i:k:t:b:n:?"))!= EOF) {
+  while ( (opt=getopt(argc,argv,"i:k:t:b:n:m:r:ps:?"))!= EOF) {
     switch (opt) {
       case 'i': filename=optarg;
       break;
@@ -129,6 +196,14 @@ int main(int argc, char **argv) {
       break;
       case 'n': num_omp_threads = atoi(optarg);
       break;
+      case 'm': max_nclusters = atoi(optarg);
+      break;
+      case 'r': restarts = atoi(optarg);
+      break;
+      case 'p': seeding = KMEANS_SEED_PLUSPLUS;
+      break;
+      case 's': seed = strtoull(optarg, NULL, 0);
+      break;
       case '?': usage(argv[0]);
       break;
       default: usage(argv[0]);
@@ -140,161 +215,59 @@ int main(int argc, char **argv) {
 
 
   if (filename == 0) usage(argv[0]);
+  if (max_nclusters < nclusters)
+    max_nclusters = nclusters;
+  if (nclusters < 1 || restarts < 1) usage(argv[0]);
+  if (num_omp_threads <= 0)
+    num_omp_threads = omp_get_max_threads();
 
   numAttributes = numObjects = 0;
 
-  /* from the input file, get the numAttributes and numObjects ------------*/
-
-  if (isBinaryFile) {
-    int infile;
-    if ((infile = open(filename, O_RDONLY, "0600")) == -1) {
-      fprintf(stderr, "Error: no such file (%s)\n", filename);
-      exit(1);
-    }
-    printf("INFILE: %d", infile);
-    read(infile, &numObjects,    sizeof(int));
-    read(infile, &numAttributes, sizeof(int));
-
-
-    /* allocate space for attributes[] and read attributes of all objects */
-    buf           = (float*) memalign(16, numObjects*numAttributes*sizeof(float));
-    attributes    = (float**)memalign(16, numObjects*             sizeof(float*));
-    attributes[0] = (float*) memalign(16, numObjects*numAttributes*sizeof(float));
-    for (i=1; i<numObjects; i++)
-    attributes[i] = attributes[i-1] + numAttributes;
-
-    read(infile, buf, numObjects*numAttributes*sizeof(float));
-
-    close(infile);
-  }
-  else {
-    FILE *infile;
-    if ((infile = fopen(filename, "r")) == NULL) {
-      fprintf(stderr, "Error: no such file (%s)\n", filename);
-      exit(1);
-    }
-    while (fgets(line, 1024, infile) != NULL)
-    if (strtok(line, " \t\n") != 0)
-    numObjects++;
-    rewind(infile);
-    while (fgets(line, 1024, infile) != NULL) {
-      if (strtok(line, " \t\n") != 0) {
-        /* ignore the id (first attribute): numAttributes = 1; */
-        while (strtok(NULL, " ,\t\n") != NULL) {
-          //          printf("NULL != NULL!!!\n");
-          numAttributes++;
-        }
-        break;
-      }
-    }
-
-
-    /* Do padding for AVX*/
-    int realAttr;
-    realAttr = numAttributes;
-    numAttributes += (8-(numAttributes%8));
-    /* allocate space for attributes[] and read attributes of all objects */
-    buf           = (float*) memalign(16, numObjects*numAttributes*sizeof(float));
-    attributes    = (float**)memalign(16, numObjects*             sizeof(float*));
-    attributes[0] = (float*) memalign(16, numObjects*numAttributes*sizeof(float));
-    for (i=1; i<numObjects; i++)
-    attributes[i] = attributes[i-1] + numAttributes;
-    rewind(infile);
-    i = 0;
-    while (fgets(line, 1024, infile) != NULL) {
-      if (strtok(line, " \t\n") == NULL) continue;
-      for (j=0; j<numAttributes; j++) {
-        if(j < realAttr)
-        buf[i] = atof(strtok(NULL, " ,\t\n"));
-        else
-        buf[i] = 0;
-        //printf("buf[i]:%f, i:%d\n", buf[i], i);
-        i++;
-      }
-    }
-    fclose(infile);
-  }
-  printf("I/O completed\n");
-
-  memcpy(attributes[0], buf, numObjects*numAttributes*sizeof(float));
-
-  const char* env_itrs = getenv("ITERS");
-  int nIter = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-  const char* env_secs = getenv("SECS");
-  int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
-  //int timeRestrict = (env_secs != NULL) ? 1 : 0;
-
-  double start_t = 0;
-  double end_t = 0;
-  double total_s0, total_s1, total_s2 = 0.0;
-  //double total_s0, total_s1, total_s2;
-  //total_s0 = total_s1 = total_s2 = 0;
-  int c0, c1, c2;
-  c0 = 0;
-  c1 = 0;
-  c2 = 0;
-
-  if(secs == -1) {
-    fprintf(stderr, "You must set a time larger than 0 seconds!\n");
+  /* read the objects into a padded feature matrix --------------------------*/
+  io_start = omp_get_wtime();
+  if (read_features(filename, isBinaryFile, num_omp_threads, &features) != 0)
+    exit(1);
+  numObjects    = features.npoints;
+  numAttributes = features.nfeatures;
+  attributes    = features.rows;
+  printf("I/O completed in %.3f s (%d objects%s)\n", omp_get_wtime() - io_start,
+         numObjects, features.map ? ", mapped" : "");
+
+  struct pb_HarnessConfig config;
+  struct pb_HarnessResult result;
+  struct cluster_args args = {
+    numObjects, numAttributes, attributes, nclusters, threshold, &cluster_centres,
+    max_nclusters > nclusters || restarts > 1 || seeding != KMEANS_SEED_FIRST,
+    max_nclusters, restarts, seeding, seed, NULL
+  };
+  int     nruns = (max_nclusters - nclusters + 1) * restarts;
+  if (args.sweep)
+    args.runs = (struct cluster_run*) calloc(nruns, sizeof(struct cluster_run));
+
+  if (pb_InitHarnessConfig(&config) != 0)
     return 1;
-  }
 
   printf("[Number of threads]:%d\n", num_omp_threads);
 
-  for (int i = -60000; i<nIter; i++) {
-    start_t = omp_get_wtime();
-    //printf("%lf\n", start_t);
-    if(i == 0)
-    timing = omp_get_wtime();
-
-    cluster_centres = NULL;
-    //printf("num_omp_threads = %d\n", num_omp_threads);
-    cluster(numObjects,
-      numAttributes,
-      attributes,           /* [numObjects][numAttributes] */
-      nclusters,
-      threshold,
-      &cluster_centres,
-      num_omp_threads
-    );
-    // break;
-    end_t = omp_get_wtime();
-    if(i < -40000)
-    {
-      c0++;
-      total_s0 += end_t - start_t;
-    }
-    else if(i < -20000 && i >= -40000)
-    {
-      c1++;
-      total_s1 += end_t - start_t;
-    }
-    else if(i >= -20000)
-    {
-      c2++;
-      total_s2 += end_t - start_t;
-
-      if (i == -1)
-      {
-        double tPerIter = total_s2 / c2;
-        printf("Sampling from the first 20000 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-        printf("Sampling from the middle 20000 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-        printf("Sampling from the last 20000 itrs.\nEstimated time: %lf s.\n", tPerIter);
-        nIter = (int)((double)secs / tPerIter) + 1;
-        printf("Adjust %d iterations to meet %d seconds.\n", nIter, secs);
-        c2 = 0;
-        total_s2=0;
-      }
-    }
-  }
-
-  timing = omp_get_wtime() - timing;
-
-  double averMsecs = total_s2 / nIter * 1000;
-  printf("iterated %d times, average time is %lf ms.\n", nIter, averMsecs);
+  if (pb_RunHarness(&config, cluster_kernel, &args, &result) != 0)
+    return 1;
+  timing = result.total;
+
+  pb_PrintHarnessResult("kmeans", &result);
+  if (args.sweep)
+    print_runs(args.runs, nruns, seeding);
+  pb_FreeHarnessResult(&result);
+
+  /* The number of passes to convergence varies, so no throughput */
+  struct pb_RunRecord record;
+  pb_InitRunRecord(&record, "kmeans", filename);
+  record.harness = &result;
+  record.threads = num_omp_threads;
+  if (pb_EmitRunRecord(&record) != 0)
+    return 1;
 
   printf("number of Clusters %d\n",nclusters);
-  printf("number of Attributes %d\n\n",numAttributes);
+  printf("number of Attributes %d\n\n",features.attributes);
   /*  	printf("Cluster Centers Output\n");
   printf("The first number is cluster number and the following data is arribute value\n");
   printf("=============================================================================\n\n");
@@ -308,9 +281,9 @@ int main(int argc, char **argv) {
 */
 printf("Time for process: %f\n", timing);
 
-free(attributes);
+free_features(&features);
+free(args.runs);
 free(cluster_centres[0]);
 free(cluster_centres);
-free(buf);
 return(0);
 }
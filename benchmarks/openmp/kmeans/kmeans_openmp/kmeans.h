@@ -39,15 +39,71 @@
 #ifndef _H_FUZZY_KMEANS
 #define _H_FUZZY_KMEANS
 
+#include <stddef.h>
+
 #ifndef FLT_MAX
 #define FLT_MAX 3.40282347e+38
 #endif
 
+/* Feature matrix layout.  Rows are zero padded to a multiple of
+   KMEANS_PAD floats, so the 8-wide AVX kernel needs no remainder loop,
+   and the matrix starts on a KMEANS_LINE boundary.  KMEANS_ROW_ALIGN is
+   the row alignment the clustering kernel relies on: any float for
+   kmeans_clustering.c, build kmeans_clustering_avx.c (aligned 256-bit
+   loads) with -DKMEANS_ROW_ALIGN=32. */
+#define KMEANS_PAD  8
+#define KMEANS_LINE 64
+#ifndef KMEANS_ROW_ALIGN
+#define KMEANS_ROW_ALIGN 4
+#endif
+
+/* kmeans_io.c */
+struct features {
+  int      npoints;
+  int      nfeatures;     /* row length, a multiple of KMEANS_PAD */
+  int      attributes;    /* per object in the file, before the padding */
+  float  **rows;          /* [npoints] */
+  float   *data;          /* the rows, NULL if they point into map */
+  void    *map;           /* mapped binary input */
+  size_t   map_length;
+};
+int     read_features(const char*, int, int, struct features*);
+void    free_features(struct features*);
+
+/* Seeding and stopping of one clustering run.  kmeans_clustering() is
+   the benchmark: the first nclusters points as centres and ITER Lloyd
+   iterations. */
+#define KMEANS_SEED_FIRST     0
+#define KMEANS_SEED_PLUSPLUS  1
+
+struct kmeans_params {
+  int      seeding;       /* KMEANS_SEED_* */
+  unsigned long long seed;
+  int      max_loops;     /* iterate until delta <= threshold, at most this */
+  /* out */
+  int      loops;
+  double   inertia;       /* sum of squared distances to the nearest centre */
+};
+
+/* One run of a sweep over cluster counts and restarts */
+struct cluster_run {
+  int      nclusters;
+  int      restart;
+  int      team_threads;
+  int      loops;
+  double   inertia;
+  double   seconds;
+};
+
 /* cluster.c */
 int     cluster(int, int, float**, int, float, float***, int);
+int     cluster_sweep(int, int, float**, int, int, int, int, unsigned long long,
+                      float, struct cluster_run*, float***, int);
 
 /* kmeans_clustering.c */
 float **kmeans_clustering(float**, int, int, int, float, int*, int);
+float **kmeans_clustering_params(float**, int, int, int, float, int*, int,
+                                 struct kmeans_params*);
 float   euclid_dist_2        (float*, float*, int);
 int     find_nearest_point   (float* , int, float**, int);
 
@@ -80,7 +80,7 @@ int find_nearest_point(float  *pt,          /* [nfeatures] */
 		float **pts,         /* [npts][nfeatures] */
 		int     npts)
 {
-	int index, i;
+	int index = 0, i;
 	float min_dist=FLT_MAX;
 
 	/* find the cluster center id with min distance to pt */
@@ -116,6 +116,85 @@ double gettime() {
 	return t.tv_sec+t.tv_usec*1e-6;
 }
 
+/*----< uniform() >--------------------------------------------------------*/
+/* splitmix64 step, as a double in [0, 1) */
+static double uniform(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*----< seed_plusplus() >---------------------------------------------------*/
+/* k-means++: the first centre is a uniformly drawn point, every further one
+   a point drawn with probability proportional to its squared distance to
+   the nearest centre so far.  Each thread keeps those distances up to date
+   for its static share of the points against the newest centre only and
+   sums them; the draw then walks the per-thread prefix sums, so only the
+   thread whose share holds the target scans its points. */
+static void seed_plusplus(float **feature, int nfeatures, int npoints,
+		int nclusters, float **clusters, unsigned long long *rng, int nthreads)
+{
+	float  *min_dist = (float*)  malloc(npoints * sizeof(float));
+	double *prefix   = (double*) calloc(nthreads + 1, sizeof(double));
+	double  target   = 0;
+	int     i, j, k, chosen;
+
+	chosen = (int)(uniform(rng) * npoints);
+	for (j=0; j<nfeatures; j++)
+		clusters[0][j] = feature[chosen][j];
+	for (i=0; i<npoints; i++)
+		min_dist[i] = FLT_MAX;
+
+	for (k=1; k<nclusters; k++) {
+		chosen = -1;
+#pragma omp parallel num_threads(nthreads) private(i)
+		{
+			int    tid = omp_get_thread_num(), nt = omp_get_num_threads();
+			int    lo = (long long)npoints * tid / nt, hi = (long long)npoints * (tid + 1) / nt;
+			double sum = 0;
+
+			for (i=lo; i<hi; i++) {
+				float dist = euclid_dist_2(feature[i], clusters[k-1], nfeatures);
+				if (dist < min_dist[i])
+					min_dist[i] = dist;
+				sum += min_dist[i];
+			}
+			prefix[tid+1] = sum;
+#pragma omp barrier
+#pragma omp single
+			{
+				int t;
+				for (t=0; t<nt; t++)
+					prefix[t+1] += prefix[t];
+				target = uniform(rng) * prefix[nt];
+			}
+			if (target >= prefix[tid] && target < prefix[tid+1]) {
+				sum = prefix[tid];
+				for (i=lo; i<hi; i++) {
+					sum += min_dist[i];
+					if (target < sum && min_dist[i] > 0) {
+						chosen = i;
+						break;
+					}
+				}
+			}
+		}
+		/* rounding at the very top of the range, or fewer distinct
+		   points than centres */
+		if (chosen < 0)
+			for (chosen=npoints-1; chosen>0 && min_dist[chosen]==0; chosen--)
+				;
+		for (j=0; j<nfeatures; j++)
+			clusters[k][j] = feature[chosen][j];
+	}
+
+	free(prefix);
+	free(min_dist);
+}
+
 /*----< kmeans_clustering() >---------------------------------------------*/
 float** kmeans_clustering(float **feature,    /* in: [npoints][nfeatures] */
 		int     nfeatures,
@@ -125,6 +204,21 @@ float** kmeans_clustering(float **feature,    /* in: [npoints][nfeatures] */
 		int    *membership,
 		int     numThreads) /* out: [npoints] */
 {
+	return kmeans_clustering_params(feature, nfeatures, npoints, nclusters,
+			threshold, membership, numThreads, NULL);
+}
+
+/*----< kmeans_clustering_params() >--------------------------------------*/
+/* params NULL is the benchmark run, see kmeans.h */
+float** kmeans_clustering_params(float **feature,    /* in: [npoints][nfeatures] */
+		int     nfeatures,
+		int     npoints,
+		int     nclusters,
+		float   threshold,
+		int    *membership,      /* out: [npoints] */
+		int     numThreads,
+		struct kmeans_params *params)
+{
 
 	int      i, j, k, n=0, index, loop=0;
 	int     *new_centers_len;			/* [nclusters]: no. of points in each cluster */
@@ -150,6 +244,11 @@ float** kmeans_clustering(float **feature,    /* in: [npoints][nfeatures] */
 	for (i=1; i<nclusters; i++)
 		clusters[i] = clusters[i-1] + nfeatures;
 
+	if (params && params->seeding == KMEANS_SEED_PLUSPLUS) {
+		unsigned long long rng = params->seed;
+		seed_plusplus(feature, nfeatures, npoints, nclusters, clusters, &rng, nthreads);
+	}
+	else {
 	/* randomly pick cluster centers */
 	for (i=0; i<nclusters; i++) {
 		//n = (int)rand() % npoints;
@@ -157,6 +256,7 @@ float** kmeans_clustering(float **feature,    /* in: [npoints][nfeatures] */
 			clusters[i][j] = feature[n][j];
 		n++;
 	}
+	}
 
 	for (i=0; i<npoints; i++)
 		membership[i] = -1;
@@ -244,13 +344,30 @@ float** kmeans_clustering(float **feature,    /* in: [npoints][nfeatures] */
 			new_centers_len[i] = 0;   /* set back to 0 */
 		}
 
-	} while (loop++ < iteration);
+	} while (params ? (++loop < params->max_loops && delta > threshold) : loop++ < iteration);
 
 	double end = gettime();
 
 	//printf("Time for %d loops clustering is %lf seconds.\n", iteration, end - start);
 
+	if (params) {
+		double inertia = 0.0;
+#pragma omp parallel for num_threads(nthreads) private(i,index) schedule(static) reduction(+:inertia)
+		for (i=0; i<npoints; i++) {
+			index = find_nearest_point(feature[i], nfeatures, clusters, nclusters);
+			inertia += euclid_dist_2(feature[i], clusters[index], nfeatures);
+		}
+		params->loops   = loop;
+		params->inertia = inertia;
+	}
 
+	for (i=0; i<nthreads; i++)
+		for (j=0; j<nclusters; j++)
+			free(partial_new_centers[i][j]);
+	free(partial_new_centers[0]);
+	free(partial_new_centers);
+	free(partial_new_centers_len[0]);
+	free(partial_new_centers_len);
 	free(new_centers[0]);
 	free(new_centers);
 	free(new_centers_len);
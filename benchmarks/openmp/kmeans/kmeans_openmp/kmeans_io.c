@@ -0,0 +1,331 @@
+/*************************************************************************/
+/**   File:         kmeans_io.c                                         **/
+/**   Description:  Loads the objects to be clustered into a padded,    **/
+/**                 cache-line aligned feature matrix.                  **/
+/*************************************************************************/
+
+/*
+ * Text files hold one object per line: an id followed by its attributes,
+ * separated by blanks, tabs or commas.  All threads read and parse the
+ * file at once.  Each one preads its share of the bytes, moves its start
+ * to the next line and counts the objects in its share (a memchr-speed
+ * scan); after a prefix sum over the counts it parses its lines straight
+ * into their rows of the matrix.  Numbers take a Clinger fast path and
+ * only fall back to strtod where that cannot round exactly, so the
+ * values are the ones atof() gave.
+ *
+ * Binary files (-b) are two ints, the number of objects and of
+ * attributes, followed by the attributes as floats.  They are mapped.
+ * Rows that already have the padded length and the alignment the kernel
+ * needs are used in place; otherwise they are copied in parallel into a
+ * padded matrix, with the static schedule of the clustering loop, so
+ * every thread first touches the rows it is going to work on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "kmeans.h"
+
+static const double exact_pow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int is_digit(char c) { return (unsigned)(c - '0') < 10; }
+static inline int is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+static inline int is_delim(char c) { return is_blank(c) || c == ',' || c == '\n'; }
+
+/*---< parse_float() >------------------------------------------------------*/
+/* The number at p as atof() reads it; returns the end of the token.
+ * Up to 19 significant digits times an exactly representable power of
+ * ten is correctly rounded in double, anything else goes to strtod. */
+static const char *parse_float(const char *p, const char *end, float *value)
+{
+  const char *start = p;
+  uint64_t mantissa = 0;
+  int      negative = 0, digits = 0, exponent = 0;
+  double   d;
+
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  for (; p < end && is_digit(*p); p++, digits++)
+    mantissa = mantissa * 10 + (*p - '0');
+  if (p < end && *p == '.')
+    for (p++; p < end && is_digit(*p); p++, digits++, exponent--)
+      mantissa = mantissa * 10 + (*p - '0');
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    int e = 0, eneg = 0;
+    if (q < end && (*q == '-' || *q == '+'))
+      eneg = *q++ == '-';
+    if (q < end && is_digit(*q)) {
+      for (; q < end && is_digit(*q) && e < 10000; q++)
+        e = e * 10 + (*q - '0');
+      exponent += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  if (digits > 0 && digits <= 19 && mantissa <= (1ULL << 53) &&
+      exponent >= -22 && exponent <= 22 && (p == end || is_delim(*p))) {
+    d = (double)mantissa;
+    d = exponent < 0 ? d / exact_pow10[-exponent] : d * exact_pow10[exponent];
+    *value = (float)(negative ? -d : d);
+  }
+  else {
+    /* the buffer is NUL terminated, so strtod cannot run off its end */
+    *value = (float)strtod(start, NULL);
+  }
+
+  while (p < end && !is_delim(*p))
+    p++;
+  return p;
+}
+
+/*---< object_line() >------------------------------------------------------*/
+/* Whether the line at p holds an object (it has an id), as strtok saw it */
+static inline int object_line(const char *p, const char *end)
+{
+  while (p < end && is_blank(*p))
+    p++;
+  return p < end && *p != '\n';
+}
+
+/*---< alloc_features() >---------------------------------------------------*/
+static int alloc_features(struct features *f, int npoints, int attributes)
+{
+  size_t i;
+
+  f->npoints   = npoints;
+  f->nfeatures = (attributes + KMEANS_PAD - 1) / KMEANS_PAD * KMEANS_PAD;
+  f->attributes = attributes;
+  f->map       = NULL;
+  f->rows      = (float**) malloc((npoints > 0 ? npoints : 1) * sizeof(float*));
+  if (posix_memalign((void**)&f->data, KMEANS_LINE,
+                     ((size_t)npoints * f->nfeatures + 1) * sizeof(float)) != 0 ||
+      f->rows == NULL) {
+    fprintf(stderr, "Error: cannot allocate %d x %d features\n", npoints, f->nfeatures);
+    return -1;
+  }
+  for (i = 0; i < (size_t)npoints; i++)
+    f->rows[i] = f->data + i * f->nfeatures;
+  return 0;
+}
+
+/*---< read_text_features() >-----------------------------------------------*/
+static int read_text_features(const char *filename, int nthreads, struct features *f)
+{
+  struct stat st;
+  char   *buf;
+  size_t  size;
+  int     fd, attributes = 0, error = 0, bad_line = 0;
+  int    *counts;
+
+  if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Error: no such file (%s)\n", filename);
+    return -1;
+  }
+  size = st.st_size;
+  buf  = (char*) malloc(size + 1);
+  counts = (int*) calloc(nthreads + 1, sizeof(int));
+  if (buf == NULL || counts == NULL) {
+    fprintf(stderr, "Error: cannot allocate a buffer for %s\n", filename);
+    close(fd);
+    free(buf);
+    free(counts);
+    return -1;
+  }
+  buf[size] = '\0';
+
+#pragma omp parallel num_threads(nthreads) default(shared)
+  {
+    int    tid = omp_get_thread_num(), nt = omp_get_num_threads();
+    size_t lo = size * tid / nt, hi = size * (tid + 1) / nt;
+    size_t done;
+    const char *p, *end = buf + size, *chunk_end = buf + hi;
+    int    n = 0, row, j;
+
+    /* read this thread's share of the file */
+    for (done = lo; done < hi; ) {
+      ssize_t r = pread(fd, buf + done, hi - done, done);
+      if (r <= 0) {
+#pragma omp atomic write
+        error = 1;
+        break;
+      }
+      done += r;
+    }
+#pragma omp barrier
+
+    /* this thread owns the lines that start in [lo, hi) */
+    p = buf + lo;
+    if (lo > 0 && p[-1] != '\n') {
+      p = (const char*) memchr(p, '\n', hi - lo);
+      p = p ? p + 1 : chunk_end;
+    }
+    const char *first = p;
+    while (p < chunk_end) {
+      const char *nl = (const char*) memchr(p, '\n', end - p);
+      n += object_line(p, nl ? nl : end);
+      p = nl ? nl + 1 : end;
+    }
+    counts[tid + 1] = n;
+#pragma omp barrier
+
+#pragma omp single
+    {
+      /* the attributes of the first object give the row length */
+      const char *q = buf;
+      int k;
+      while (q < end) {
+        const char *nl = (const char*) memchr(q, '\n', end - q);
+        if (object_line(q, nl ? nl : end))
+          break;
+        q = nl ? nl + 1 : end;
+      }
+      while (q < end && is_blank(*q)) q++;
+      while (q < end && !is_blank(*q) && *q != '\n') q++;       /* the id */
+      while (q < end && *q != '\n') {
+        while (q < end && is_delim(*q) && *q != '\n') q++;
+        if (q == end || *q == '\n') break;
+        attributes++;
+        while (q < end && !is_delim(*q)) q++;
+      }
+      for (k = 0; k < nt; k++)
+        counts[k + 1] += counts[k];
+      if (!error && alloc_features(f, counts[nt], attributes) != 0)
+        error = 1;
+    }
+
+    /* parse, each line straight into its row */
+    if (!error) {
+      row = counts[tid];
+      for (p = first; p < chunk_end; ) {
+        const char *nl = (const char*) memchr(p, '\n', end - p);
+        const char *eol = nl ? nl : end;
+        if (object_line(p, eol)) {
+          float *out = f->rows[row++];
+          while (is_blank(*p)) p++;
+          while (p < eol && !is_blank(*p)) p++;             /* skip the id */
+          for (j = 0; j < attributes; j++) {
+            while (p < eol && is_delim(*p)) p++;
+            if (p == eol) break;
+            p = parse_float(p, eol, &out[j]);
+          }
+          if (j < attributes) {
+#pragma omp atomic write
+            bad_line = row;
+            for (; j < attributes; j++) out[j] = 0;
+          }
+          for (; j < f->nfeatures; j++)
+            out[j] = 0;
+        }
+        p = eol + (nl != NULL);
+      }
+    }
+  }
+
+  close(fd);
+  free(buf);
+  free(counts);
+  if (error) {
+    fprintf(stderr, "Error: cannot read %s\n", filename);
+    return -1;
+  }
+  if (bad_line) {
+    fprintf(stderr, "Error: object %d of %s has fewer than %d attributes\n",
+            bad_line, filename, attributes);
+    return -1;
+  }
+  return 0;
+}
+
+/*---< read_binary_features() >---------------------------------------------*/
+static int read_binary_features(const char *filename, int nthreads, struct features *f)
+{
+  struct stat st;
+  int     fd, header[2];
+  size_t  length;
+  void   *map;
+  float  *in;
+  int     i, pad;
+
+  if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Error: no such file (%s)\n", filename);
+    return -1;
+  }
+  length = st.st_size;
+  map = length >= sizeof(header) ? mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Error: cannot map %s\n", filename);
+    return -1;
+  }
+  memcpy(header, map, sizeof(header));
+  in = (float*)((char*)map + sizeof(header));
+  if (header[0] < 0 || header[1] <= 0 ||
+      length < sizeof(header) + (size_t)header[0] * header[1] * sizeof(float)) {
+    fprintf(stderr, "Error: %s is truncated\n", filename);
+    munmap(map, length);
+    return -1;
+  }
+  madvise(map, length, MADV_WILLNEED);
+
+  pad = header[1] % KMEANS_PAD != 0 || (uintptr_t)in % KMEANS_ROW_ALIGN != 0;
+  if (!pad) {
+    /* used in place */
+    f->npoints   = header[0];
+    f->nfeatures = header[1];
+    f->attributes = header[1];
+    f->rows      = (float**) malloc((f->npoints > 0 ? f->npoints : 1) * sizeof(float*));
+    f->data      = NULL;
+    f->map       = map;
+    f->map_length = length;
+    if (f->rows == NULL) {
+      fprintf(stderr, "Error: cannot allocate %d rows\n", f->npoints);
+      munmap(map, length);
+      return -1;
+    }
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (i = 0; i < f->npoints; i++)
+      f->rows[i] = in + (size_t)i * f->nfeatures;
+    return 0;
+  }
+
+  if (alloc_features(f, header[0], header[1]) != 0) {
+    munmap(map, length);
+    return -1;
+  }
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+  for (i = 0; i < f->npoints; i++) {
+    memcpy(f->rows[i], in + (size_t)i * header[1], header[1] * sizeof(float));
+    memset(f->rows[i] + header[1], 0, (f->nfeatures - header[1]) * sizeof(float));
+  }
+  munmap(map, length);
+  return 0;
+}
+
+/*---< read_features() >----------------------------------------------------*/
+int read_features(const char *filename, int binary, int nthreads, struct features *f)
+{
+  if (binary)
+    return read_binary_features(filename, nthreads, f);
+  return read_text_features(filename, nthreads, f);
+}
+
+/*---< free_features() >----------------------------------------------------*/
+void free_features(struct features *f)
+{
+  if (f->map)
+    munmap(f->map, f->map_length);
+  free(f->data);
+  free(f->rows);
+}
@@ -23,6 +23,7 @@
 #include <assert.h>
 
 #include "common.h"
+#include <parboil.h>
 
 static int do_verify = 0;
 int omp_num_threads = 4;
@@ -180,6 +181,18 @@ main ( int argc, char *argv[] )
   printf("iterated %d times, average time is %lf ms.\n", iteration, averMsecs);
   printf("Time consumed(ms): %lf\n", 1000*get_interval_by_sec(&sw));
 
+  /* 2/3 n^3 flops per factorization, the matrix is read and written once */
+  struct pb_RunRecord record;
+  char size_name[32];
+  snprintf(size_name, sizeof(size_name), "%d", matrix_dim);
+  pb_InitRunRecord(&record, "lud", input_file ? input_file : size_name);
+  record.iterations = iteration;
+  record.seconds = averMsecs * 1e-3;
+  record.flops = 2.0 / 3.0 * matrix_dim * matrix_dim * matrix_dim;
+  record.bytes = 2.0 * sizeof(float) * matrix_dim * matrix_dim;
+  if (pb_EmitRunRecord(&record) != 0)
+    return 1;
+
   if (do_verify){
     printf("After LUD\n");
     /* print_matrix(m, matrix_dim); */
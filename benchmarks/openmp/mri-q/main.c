@@ -28,7 +28,6 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <malloc.h>
 #include <omp.h>
 
@@ -37,10 +36,24 @@
 #include "file.h"
 #include "computeQ.cc"
 
-inline double gettime(){
-  struct timeval t;
-  gettimeofday(&t, NULL);
-  return t.tv_sec + t.tv_usec * 1e-6;
+struct q_args {
+  int numK, numX;
+  float *kx, *ky, *kz;
+  float *x, *y, *z;
+  float *phiR, *phiI;
+  float *phiMag;
+  float *Qr, *Qi;
+};
+
+/* PhiMag and Q, one harness iteration */
+static void
+q_kernel(void *arg)
+{
+  struct q_args *a = (struct q_args *)arg;
+
+  ComputePhiMagCPU(a->numK, a->phiR, a->phiI, a->phiMag);
+  ComputeQCPU(a->numK, a->numX, a->kx, a->ky, a->kz, a->phiMag,
+              a->x, a->y, a->z, a->Qr, a->Qi);
 }
 
 int
@@ -101,75 +114,27 @@ main (int argc, char *argv[]) {
     /* Create CPU data structures */
     createDataStructsCPU(numK, numX, &phiMag, &Qr, &Qi);
 
-    const char* env_itrs = getenv("ITERS");
-    int nIter = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-    const char* env_secs = getenv("SECS");
-    int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
+    struct pb_HarnessConfig config;
+    struct pb_HarnessResult result;
+    struct q_args args = {
+      numK, numX, kx, ky, kz, x, y, z, phiR, phiI, phiMag, Qr, Qi
+    };
 
-    double start_t, end_t;
-    double total_s0, total_s1, total_s2 = 0;
-    int c0, c1, c2 = 0;
-
-    if(secs == -1){
-      fprintf(stderr, "You must set a time larger than 0 seconds!\n");
+    if (pb_InitHarnessConfig(&config) != 0)
       return 1;
 
-    }
-    for(int i = -30; i < nIter; i++)
-    {
-      start_t = gettime();
-
-      ComputePhiMagCPU(numK, phiR, phiI, phiMag);
-
-      //kVals = (struct kValues*)calloc(numK, sizeof (struct kValues));
-      //Kx = (float*)memalign(16, numK * sizeof(float));
-      //ky = (float*)memalign(16, numK * sizeof(float));
-      //Kz = (float*)memalign(16, numK * sizeof(float));
-      //phimag = (float*)memalign(16, numK * sizeof(float));
-      //
-      //  int k;
-      //  #pragma omp parallel for simd
-      //  for (k = 0; k < numK; k++) {
-      //    Kx = kx[k];
-      //    Ky = ky[k];
-      //    Kz = kz[k];
-      //    PhiMag = phiMag[k];
-      //  }
-      ComputeQCPU(numK, numX, kx, ky, kz, phiMag, x, y, z, Qr, Qi);
-
-      end_t = gettime();
-
-      if(i < -20)
-      {
-        c0++;
-        total_s0 += end_t - start_t;
-      }
-      else if(i < -10 && i >= -20)
-      {
-        c1++;
-        total_s1 += end_t - start_t;
-      }
-      else if(i >= -10)
-      {
-        c2++;
-        total_s2 += end_t - start_t;
-        if(i == -1)
-        {
-          double tPerIter = total_s2 / c2;
-          printf("Sampling from the first 10 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-          printf("Sampling from the middle 10 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-          printf("Sampling from the last 10 itrs.\nEstimated time: %lf s.\n", tPerIter);
-          nIter = (int)((double)secs / tPerIter) + 1;
-          printf("Adjust %d iterations to meet %d seconds.\n", nIter, secs);
-          c2 = 0;
-          total_s2 = 0;
-        }
-      }
+    if (pb_RunHarness(&config, q_kernel, &args, &result) != 0)
+      return 1;
+    pb_PrintHarnessResult("mri-q", &result);
+    pb_FreeHarnessResult(&result);
 
+    /* 12 flops per sample and pixel, sin and cos counted as one each */
+    struct pb_RunRecord record;
+    pb_InitRunRecord(&record, "mri-q", params->inpFiles[0]);
+    record.harness = &result;
+    record.timers = &timers;
+    record.flops = 12.0 * numK * numX + 3.0 * numK;
 
-    }
-    double averMsecs = total_s2 / nIter * 1000;
-    printf("itered %d times, average time is %lf ms.\n", nIter, averMsecs);
     if (params->outFile)
     {
       /* Write Q to file */
@@ -192,6 +157,8 @@ main (int argc, char *argv[]) {
     free (Qi);
 
     pb_SwitchToTimer(&timers, pb_TimerID_NONE);
+    if (pb_EmitRunRecord(&record) != 0)
+      return 1;
     pb_PrintTimerSet(&timers);
     pb_FreeParameters(params);
 
@@ -2,9 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
-#include <sys/time.h>
 #include <omp.h>
 
+#include <parboil.h>
+
 #define MAX_ARGS 10
 #define REC_LENGTH 49	// size of a record in db
 #define REC_WINDOW 1024*128	// number of records to read at a time
@@ -15,10 +16,88 @@ struct neighbor {
   double dist;
 };
 
-double gettime() {
-  struct timeval t;
-  gettimeofday(&t,NULL);
-  return t.tv_sec+t.tv_usec*1e-6;
+struct nn_args {
+  char *sandbox;
+  int rec_count;
+  float *z;
+  float target_lat, target_long;
+  struct neighbor *neighbors;
+  int k;
+  /* the persistent team, at most omp_get_max_threads() of them */
+  struct pb_Barrier *barrier;
+  double *dists;		/* [threads][k] */
+  int *candidates;		/* [rec_count], each thread in its range */
+  int *ncandidates;		/* [threads] */
+};
+
+/* Distances of all records and the k nearest of them, one harness
+ * iteration, run by every thread of the team.
+ *
+ * A record is taken by the serial scan below only if its distance is
+ * less than the largest of the k kept so far, and that never grows when
+ * more records are seen.  So every thread runs the scan over its own
+ * records on a copy of the distances kept at the start: what it rejects
+ * the serial scan would reject too.  Thread 0 then runs the serial scan
+ * over the records left, in order, with the same outcome as over all of
+ * them. */
+static void nn_kernel(void *arg) {
+  struct nn_args *a = (struct nn_args *)arg;
+  char *sandbox = a->sandbox, *rec_iter;
+  float *z = a->z;
+  struct neighbor *neighbors = a->neighbors;
+  int tid = omp_get_thread_num(), nthreads = omp_get_num_threads();
+  double *dist = a->dists + tid * a->k, max;
+  int *candidates, count = 0;
+  long lo, hi, i;
+  int c, t, j;
+
+  pb_ThreadRange(a->rec_count, tid, nthreads, &lo, &hi);
+  candidates = a->candidates + lo;
+  for( j = 0 ; j < a->k ; j++ )
+    dist[j] = neighbors[j].dist;
+  for( max = -1, j = 0 ; j < a->k ; j++ )
+    if( dist[j] > max ) max = dist[j];
+
+  for (i = lo; i < hi; i++){
+    rec_iter = sandbox+(i * REC_LENGTH + LATITUDE_POS - 1);
+    float tmp_lat = atof(rec_iter);
+    float tmp_long = atof(rec_iter+5);
+    z[i] = sqrt(( (tmp_lat-a->target_lat) * (tmp_lat-a->target_lat) )+( (tmp_long-a->target_long) * (tmp_long-a->target_long) ));
+    if( z[i] < max ) {
+      candidates[count++] = i;
+      for( j = 0 ; dist[j] != max ; j++ )
+        ;
+      dist[j] = z[i];
+      for( max = -1, j = 0 ; j < a->k ; j++ )
+        if( dist[j] > max ) max = dist[j];
+    }
+  }
+  a->ncandidates[tid] = count;
+  pb_BarrierWait(a->barrier, tid);
+  if (tid != 0)
+    return;
+
+  for( t = 0 ; t < nthreads ; t++ ) {
+    pb_ThreadRange(a->rec_count, t, nthreads, &lo, &hi);
+    for( c = 0 ; c < a->ncandidates[t] ; c++ ) {
+      i = a->candidates[lo + c];
+      float max_dist = -1;
+      int max_idx = 0;
+      // find a neighbor with greatest dist and take his spot if allowed!
+      for( j = 0 ; j < a->k ; j++ ) {
+        if( neighbors[j].dist > max_dist ) {
+          max_dist = neighbors[j].dist;
+          max_idx = j;
+        }
+      }
+      // compare each record with max value to find the nearest neighbor
+      if( z[i] < neighbors[max_idx].dist ) {
+        sandbox[(i+1)*REC_LENGTH-1] = '\0';
+        strcpy(neighbors[max_idx].entry, sandbox +i*REC_LENGTH);
+        neighbors[max_idx].dist = z[i];
+      }
+    }
+  }
 }
 
 /**
@@ -34,8 +113,8 @@ double gettime() {
 int main(int argc, char* argv[]) {
   // double time0 = gettime();
   FILE   *flist,*fp;
-  int    i=0,j=0, k=0, rec_count=0, done=0;
-  char   sandbox[REC_LENGTH * REC_WINDOW], *rec_iter,*rec_iter2, dbname[64];
+  int    j=0, k=0, rec_count=0, done=0;
+  char   sandbox[REC_LENGTH * REC_WINDOW], *rec_iter2, dbname[64];
   struct neighbor *neighbors = NULL;
   float target_lat, target_long, tmp_lat=0, tmp_long=0;
 
@@ -82,32 +161,13 @@ int main(int argc, char* argv[]) {
   z  = (float *) malloc(REC_WINDOW * sizeof(float));
 
 
-  int iter;
-  // const char* env_iter = getenv("ITER");
-  // int iteration = (env_iter != NULL) ? atoi(env_iter) : 1;
-  // printf("[ITERATION NUM]:%d\n", iteration);
-  // printf("only deal with top %d records of db.\n", REC_WINDOW);
-
-  const char* env_itrs = getenv("ITERS");
-  int iteration = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-  const char* env_secs = getenv("SECS");
-  int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
-  //int timeRestrict = (env_secs != NULL) ? 1 : 0;
-
-  double start_t;
-  double end_t;
-  double total_s0, total_s1, total_s2 = 0.0;
-  //double total_s0, total_s1, total_s2;
-  //total_s0 = total_s1 = total_s2 = 0;
-  int c0, c1, c2;
-  c0 = 0;
-  c1 = 0;
-  c2 = 0;
-
-  if(secs == -1){
-    fprintf(stderr, "You must set a time larger than 0 seconds!\n");
+  struct pb_HarnessConfig config;
+  struct pb_HarnessResult result;
+  struct nn_args args;
+  int nthreads = omp_get_max_threads();
+
+  if (pb_InitHarnessConfig(&config) != 0)
     return 1;
-  }
 
   // while(!done) {
   //Read in REC_WINDOW number of records
@@ -136,7 +196,6 @@ int main(int argc, char* argv[]) {
       exit(0);
     }
   }
-  double sTime;
   /* Launch threads to  */
   // Lingjie Zhang modificated on 11/08/2015
   // original code
@@ -149,72 +208,23 @@ int main(int argc, char* argv[]) {
   // #pragma omp barrier
   printf("Processing %d records.\n", rec_count);
 
-  for (iter = -3000 ; iter < iteration; iter++){
-    start_t = gettime();
-    if(iter == 0)
-    sTime = start_t;
-
-
-    #pragma omp parallel for shared (z, target_lat, target_long) private(i,rec_iter)
-    for (i = 0; i < rec_count; i++){
-      rec_iter = sandbox+(i * REC_LENGTH + LATITUDE_POS - 1);
-      float tmp_lat = atof(rec_iter);
-      float tmp_long = atof(rec_iter+5);
-      z[i] = sqrt(( (tmp_lat-target_lat) * (tmp_lat-target_lat) )+( (tmp_long-target_long) * (tmp_long-target_long) ));
-    }
-    #pragma omp barrier
-    // end of Lingjie Zhang's modification
-
-    #pragma omp simd
-    for( i = 0 ; i < rec_count ; i++ ) {
-      float max_dist = -1;
-      int max_idx = 0;
-      // find a neighbor with greatest dist and take his spot if allowed!
-      //#pragma omp simd //not useful
-      for( j = 0 ; j < k ; j++ ) {
-        if( neighbors[j].dist > max_dist ) {
-          max_dist = neighbors[j].dist;
-          max_idx = j;
-        }
-      }
-      // compare each record with max value to find the nearest neighbor
-      if( z[i] < neighbors[max_idx].dist ) {
-        sandbox[(i+1)*REC_LENGTH-1] = '\0';
-        strcpy(neighbors[max_idx].entry, sandbox +i*REC_LENGTH);
-        neighbors[max_idx].dist = z[i];
-      }
-    }
-
-    end_t = gettime();
-
-    if(iter < -2000)
-    {
-      c0++;
-      total_s0 += end_t - start_t;
-    }
-    else if(iter < -1000 && i >= -2000)
-    {
-      c1++;
-      total_s1 += end_t - start_t;
-    }
-    else if(iter >= -1000)
-    {
-      c2++;
-      total_s2 += end_t - start_t;
-      if (iter == -10)
-      {
-        double tPerIter = total_s2 / c2;
-        printf("Sampling from the first 1000 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-        printf("Sampling from the middle 1000 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-        printf("Sampling from the last 1000 itrs.\nEstimated time: %lf s.\n", tPerIter);
-        iteration = (int)((double)secs / tPerIter) + 1;
-        printf("Adjust %d iterations to meet %d seconds.\n", iteration, secs);
-        c2 = 0;
-        total_S2 = 0;
-      }
-    }
-
+  args.sandbox = sandbox;
+  args.rec_count = rec_count;
+  args.z = z;
+  args.target_lat = target_lat;
+  args.target_long = target_long;
+  args.neighbors = neighbors;
+  args.k = k;
+  args.dists = malloc(nthreads * k * sizeof(double));
+  args.candidates = malloc(rec_count * sizeof(int));
+  args.ncandidates = malloc(nthreads * sizeof(int));
+  if (args.dists == NULL || args.candidates == NULL || args.ncandidates == NULL) {
+    fprintf(stderr, "no room for the team\n");
+    exit(1);
   }
+
+  if (pb_RunTeamHarness(&config, nn_kernel, &args, "nn", &args.barrier, &result) != 0)
+    return 1;
   // }//End while loop
 
 
@@ -227,10 +237,22 @@ int main(int argc, char* argv[]) {
   fclose(flist);
 
 
-  // double time1 = gettime();
-
-  printf("total computation time : %15.12f s\n", end_t - sTime);
-  printf("Average time %lfms.\n", (end_t - sTime) / iteration * 1000);
+  pb_PrintHarnessResult("nn", &result);
+  pb_PrintBarrier(args.barrier);
+  pb_FreeHarnessResult(&result);
+  pb_DestroyBarrier(args.barrier);
+  free(args.dists);
+  free(args.candidates);
+  free(args.ncandidates);
+
+  /* Every record is parsed, its distance takes 6 flops with the sqrt */
+  struct pb_RunRecord record;
+  pb_InitRunRecord(&record, "nn", argv[1]);
+  record.harness = &result;
+  record.flops = 6.0 * rec_count;
+  record.bytes = (double)rec_count * REC_LENGTH;
+  if (pb_EmitRunRecord(&record) != 0)
+    return 1;
 
   return 0;
 }
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <parboil.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 void run(int argc, char** argv);
 
@@ -85,7 +89,6 @@ void run(int argc, char** argv)
     double cycles;
 
     int *src, *dst, *temp;
-    int min;
 
     dst = result;
     src = new int[cols];
@@ -95,25 +98,69 @@ void run(int argc, char** argv)
     int iteration = (env_iter != NULL) ? atoi(env_iter) : 1;
     printf("[ITERATION NUM]:%d\n", iteration);
 
+    struct pb_Barrier *barrier = NULL;
+
+    /* One team for all the steps: every thread keeps its columns and
+     * its own copy of the swapped pointers, a barrier ends each row.
+     * The barrier is sized from the team actually started, which a
+     * thread limit or OMP_DYNAMIC may make smaller than asked for. */
     double start = gettime();
-    for (i = 0 ; i<iteration;i++)
-    for (int t = 0; t < rows-1; t++) {
+    #pragma omp parallel private(i)
+    {
+        int tid = 0, nthreads = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        nthreads = omp_get_num_threads();
+#endif
+        #pragma omp single
+        {
+            barrier = pb_CreateBarrier("rows", nthreads);
+            if (barrier == NULL) {
+                fprintf(stderr, "Cannot create the barrier\n");
+                exit(1);
+            }
+        }
+        long lo, hi;
+        pb_ThreadRange(cols, tid, nthreads, &lo, &hi);
+        int *s = src, *d = dst, *swap;
+
+        for (i = 0 ; i<iteration;i++)
+        for (int t = 0; t < rows-1; t++) {
+            swap = s;
+            s = d;
+            d = swap;
+            for(long n = lo; n < hi; n++){
+              int min = s[n];
+              if (n > 0)
+                min = MIN(min, s[n-1]);
+              if (n < cols-1)
+                min = MIN(min, s[n+1]);
+              d[n] = wall[t+1][n]+min;
+            }
+            pb_BarrierWait(barrier, tid);
+        }
+    }
+    if ((long)iteration * (rows-1) % 2 != 0) {
         temp = src;
         src = dst;
         dst = temp;
-        #pragma omp parallel for private(min)
-        for(int n = 0; n < cols; n++){
-          min = src[n];
-          if (n > 0)
-            min = MIN(min, src[n-1]);
-          if (n < cols-1)
-            min = MIN(min, src[n+1]);
-          dst[n] = wall[t+1][n]+min;
-        }
     }
 
     double end = gettime();
     printf("Finish %d iterations, spent %lf secs!\n", iteration, end - start);
+    pb_PrintBarrier(barrier);
+    pb_DestroyBarrier(barrier);
+
+    /* Integer work only: a row of the wall is read and one written per step */
+    struct pb_RunRecord record;
+    char size_name[64];
+    snprintf(size_name, sizeof(size_name), "%dx%d", cols, rows);
+    pb_InitRunRecord(&record, "pathfinder", size_name);
+    record.iterations = iteration;
+    record.seconds = (end - start) / iteration;
+    record.bytes = 2.0 * sizeof(int) * cols * (rows - 1);
+    if (pb_EmitRunRecord(&record) != 0)
+        exit(1);
 
     delete [] data;
     delete [] wall;
@@ -10,11 +10,11 @@
  * Main entry of dense matrix-matrix multiplication kernel
  */
 
+#include <parboil.h>
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <malloc.h>
 #include <vector>
 #include <iostream>
@@ -25,10 +25,20 @@ extern void basicSgemm( char transa, char transb, int m, int n, int k, float alp
 extern bool readColMajorMatrixFile(const char *fn, int &nr_row, int &nr_col, std::vector<float>&v);
 extern bool writeColMajorMatrixFile(const char *fn, int, int, std::vector<float>&);
 
-double gettime(){
-        struct timeval t;
-        gettimeofday(&t, NULL);
-        return t.tv_sec + t.tv_usec * 1e-6;
+struct sgemm_args {
+        int m, n, k;
+        const float *A, *B;
+        float *C;
+};
+
+// C = A^T * B, one harness iteration
+static void sgemm_kernel(void *arg)
+{
+        struct sgemm_args *a = (struct sgemm_args *)arg;
+
+        // Use standard sgemm interface
+        basicSgemm('T', 'N', a->m, a->n, a->k, 1.0f,
+                   a->A, a->m, a->B, a->n, 0.0f, a->C, a->m);
 }
 
 
@@ -62,79 +72,60 @@ main (int argc, char *argv[]) {
                                matBrow, matBcol, matB);
 
 
-        // allocate space for C
-        std::vector<float> matC(matArow*matBcol);
-
-        const char* env_itrs = getenv("ITERS");
-        int nIter = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-        const char* env_secs = getenv("SECS");
-        int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
-        //int timeRestrict = (env_secs != NULL) ? 1 : 0;
-
-        double start_t;
-        double end_t;
-        double total_s0, total_s1, total_s2 = 0.0;
-        //double total_s0, total_s1, total_s2;
-        //total_s0 = total_s1 = total_s2 = 0;
-        int c0, c1, c2;
-        c0 = 0;
-        c1 = 0;
-        c2 = 0;
-
-        if(secs == -1) {
-                fprintf(stderr, "You must set a time larger than 0 seconds!\n");
-                return 1;
+        // Every thread reads all of A^T and B and writes C with a
+        // stride of a column, so their pages are spread over the nodes;
+        // the three share huge pages, faulted in before the harness runs
+        size_t sizeC = (size_t)matArow * matBcol * sizeof(float);
+        struct pb_Arena *matrices = pb_CreateArena("matrices",
+                (matAT.size() + matB.size()) * sizeof(float) + sizeC,
+                PB_ALLOC_INTERLEAVE | PB_ALLOC_HUGE);
+        float *A = NULL, *B = NULL, *C = NULL;
+        if (matrices != NULL) {
+                A = (float *)pb_ArenaAlloc(matrices, matAT.size() * sizeof(float));
+                B = (float *)pb_ArenaAlloc(matrices, matB.size() * sizeof(float));
+                C = (float *)pb_ArenaAlloc(matrices, sizeC);
         }
-
-        for (int i = -30; i<nIter; i++) {
-
-                start_t = gettime();
-
-                // Use standard sgemm interface
-                basicSgemm('T', 'N', matArow, matBcol, matAcol, 1.0f,
-                           &matAT.front(), matArow, &matB.front(), matBcol, 0.0f, &matC.front(),
-                           matArow);
-
-                end_t = gettime();
-
-                if(i < -20)
-                {
-                        c0++;
-                        total_s0 += end_t - start_t;
-                }
-                else if(i < -10 && i >= -20)
-                {
-                        c1++;
-                        total_s1 += end_t - start_t;
-                }
-                else if(i >= -10)
-                {
-                        c2++;
-                        total_s2 += end_t - start_t;
-
-                        if (i == -1)
-                        {
-                                double tPerIter = total_s2 / c2;
-                                printf("Sampling from the first 10 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-                                printf("Sampling from the middle 10 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-                                printf("Sampling from the last 10 itrs.\nEstimated time: %lf s.\n", tPerIter);
-                                nIter = (int)((double)secs / tPerIter) + 1;
-                                printf("Adjust %d iterations to meet %d seconds.\n", nIter, secs);
-                                c2 = 0;
-                                total_s2=0;
-                        }
-                }
+        if (A == NULL || B == NULL || C == NULL) {
+                fprintf(stderr, "Cannot allocate the matrices\n");
+                return 1;
         }
+        memcpy(A, &matAT.front(), matAT.size() * sizeof(float));
+        memcpy(B, &matB.front(), matB.size() * sizeof(float));
+        std::vector<float>().swap(matAT);
+        std::vector<float>().swap(matB);
+
+        struct pb_HarnessConfig config;
+        struct pb_HarnessResult result;
+        struct sgemm_args args = {
+                matArow, matBcol, matAcol, A, B, C
+        };
+
+        if (pb_InitHarnessConfig(&config) != 0)
+                return 1;
 
-        double averMsecs = total_s2 / nIter * 1000;
-        printf("iterated %d times, average time is %lf ms.\n", nIter, averMsecs);
-
-
+        if (pb_RunHarness(&config, sgemm_kernel, &args, &result) != 0)
+                return 1;
+        pb_PrintHarnessResult("sgemm", &result);
+        pb_PrintAllocations();
+        pb_FreeHarnessResult(&result);
+
+        struct pb_RunRecord record;
+        pb_InitRunRecord(&record, "sgemm", argv[1]);
+        record.harness = &result;
+        record.flops = 2.0 * matArow * matBcol * matAcol;
+        record.bytes = sizeof(float) * ((double)matArow * matAcol +
+                                        (double)matAcol * matBcol +
+                                        (double)matArow * matBcol);
+        if (pb_EmitRunRecord(&record) != 0)
+                return 1;
 
         if (argv[4]) {
                 /* Write C to file */
+                std::vector<float> matC(C, C + (size_t)matArow * matBcol);
                 writeColMajorMatrixFile(argv[4], matArow, matBcol, matC);
         }
 
+        pb_DestroyArena(matrices);
+
         return 0;
 }
@@ -9,8 +9,8 @@
 #include <parboil.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <malloc.h>
-#include <sys/time.h>
 
 #include "file.h"
 #include "convert_dataset.h"
@@ -26,6 +26,15 @@ static int generate_vector(float *x_vector, int dim)
   return 0;
 }
 
+// Move an array coo_to_jds allocated into the arena
+static void *arena_copy(struct pb_Arena *arena, void *p, size_t bytes)
+{
+  void *copy = pb_ArenaAlloc(arena, bytes);
+  memcpy(copy, p, bytes);
+  free(p);
+  return copy;
+}
+
 /*
 void jdsmv(int height, int len, float* value, int* perm, int* jds_ptr, int* col_index, float* vector,
 float* result){
@@ -49,10 +58,39 @@ row_index++;
 return;
 }
 */
-double gettime(){
-  struct timeval t;
-  gettimeofday(&t, NULL);
-  return t.tv_sec + t.tv_usec * 1e-6;
+struct jds_args {
+  int dim;
+  float *data;
+  int *indices;
+  int *ptr;
+  int *perm;
+  int *nzcnt;
+  float *x_vector;
+  float *Ax_vector;
+};
+
+// Ax = A * x with A in JDS format, one harness iteration
+static void jds_kernel(void *arg)
+{
+  struct jds_args *a = (struct jds_args *)arg;
+  int i;
+
+  #pragma omp parallel for
+  for (i = 0; i < a->dim; i++) {
+    int k;
+    float sum = 0.0f;
+    int  bound = a->nzcnt[i];
+    for(k=0;k<bound;k++ ) {
+      int j = a->ptr[k] + i;
+      int in = a->indices[j];
+
+      float d = a->data[j];
+      float t = a->x_vector[in];
+
+      sum += d*t;
+    }
+    a->Ax_vector[a->perm[i]] = sum;
+  }
 }
 
 
@@ -116,9 +154,27 @@ int main(int argc, char** argv) {
 
   printf("Transform completed!\n");
 
-  h_Ax_vector=(float*)memalign(16, sizeof(float)*dim);
+  // The matrix and both vectors share one huge page arena, faulted in
+  // before the harness runs.  Rows are split over the threads but every
+  // diagonal of the JDS matrix spans all of them, and x is gathered at
+  // random, so the pages are spread over the nodes.
+  struct pb_Arena *arena = pb_CreateArena("spmv",
+    (size_t)len * (sizeof(float) + sizeof(int)) +
+    ((size_t)depth + dim + nzcnt_len) * sizeof(int) + 2 * (size_t)dim * sizeof(float),
+    PB_ALLOC_INTERLEAVE | PB_ALLOC_HUGE);
+  if (arena == NULL) {
+    fprintf(stderr, "Cannot allocate the matrix and vectors\n");
+    return 1;
+  }
+  h_data=(float*)arena_copy(arena, h_data, sizeof(float)*len);
+  h_indices=(int*)arena_copy(arena, h_indices, sizeof(int)*len);
+  h_ptr=(int*)arena_copy(arena, h_ptr, sizeof(int)*depth);
+  h_perm=(int*)arena_copy(arena, h_perm, sizeof(int)*dim);
+  h_nzcnt=(int*)arena_copy(arena, h_nzcnt, sizeof(int)*nzcnt_len);
+
+  h_Ax_vector=(float*)pb_ArenaAlloc(arena, sizeof(float)*dim);
   printf("Matrix allocation successful!\n");
-  h_x_vector=(float*)memalign(16, sizeof(float)*dim);
+  h_x_vector=(float*)pb_ArenaAlloc(arena, sizeof(float)*dim);
   if(h_x_vector != NULL)
   printf("Vector allocation successful!\n");
   //generate_vector(h_x_vector, dim);
@@ -130,84 +186,33 @@ int main(int argc, char** argv) {
 
   printf("Ready for execution\n");
 
-  const char* env_itrs = getenv("ITERS");
-  int nIter = (env_itrs != NULL) ? atoi(env_itrs) : 1;
-  const char* env_secs = getenv("SECS");
-  int secs = (env_secs != NULL) ? atoi(env_secs) : -1;
-  //int timeRestrict = (env_secs != NULL) ? 1 : 0;
-
-  double start_t;
-  double end_t;
-  double total_s0, total_s1, total_s2 = 0.0;
-  //double total_s0, total_s1, total_s2;
-  //total_s0 = total_s1 = total_s2 = 0;
-  int c0, c1, c2;
-  c0 = 0;
-  c1 = 0;
-  c2 = 0;
-
-  if(secs == -1){
-    fprintf(stderr, "You must set a time larger than 0 seconds!\n");
+  struct pb_HarnessConfig config;
+  struct pb_HarnessResult result;
+  struct jds_args args = {
+    dim, h_data, h_indices, h_ptr, h_perm, h_nzcnt, h_x_vector, h_Ax_vector
+  };
+
+  if (pb_InitHarnessConfig(&config) != 0)
     return 1;
-  }
 
-  int p, i;
   //main execution
-  for(p=-300;p<nIter;p++)
-  {
-
-    start_t = gettime();
-
-    #pragma omp parallel for
-    for (i = 0; i < dim; i++) {
-      int k;
-      float sum = 0.0f;
-      //int  bound = h_nzcnt[i / 32];
-      int  bound = h_nzcnt[i];
-      //#pragma omp simd
-      for(k=0;k<bound;k++ ) {
-        int j = h_ptr[k] + i;
-        int in = h_indices[j];
-
-        float d = h_data[j];
-        float t = h_x_vector[in];
-
-        sum += d*t;
-      }
-      //  #pragma omp critical
-      h_Ax_vector[h_perm[i]] = sum;
-    }
-    end_t = gettime();
-    if(p < -200)
-    {
-      c0++;
-      total_s0 += end_t - start_t;
-    }
-    else if(p < -100 && i >= -200)
-    {
-      c1++;
-      total_s1 += end_t - start_t;
-    }
-    else if(p >= -100)
-    {
-      c2++;
-      total_s2 += end_t - start_t;
-      if (p == -1)
-      {
-        double tPerIter = total_s2 / c2;
-        printf("Sampling from the first 100 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s0 / (double)c0, (int)((double)secs / (total_s0 / (double)c0)));
-        printf("Sampling from the middle 100 itrs.\nEstimated time: %lf s.\nEstimated itr: %d.\n", total_s1 / (double)c1, (int)((double)secs / (total_s1 / (double)c1)));
-        printf("Sampling from the last 100 itrs.\nEstimated time: %lf s.\n", tPerIter);
-        nIter = int((double)secs / tPerIter) + 1;
-        printf("Adjust %d iterations to meet %d seconds.\n", nIter, secs);
-        c2 = 0;
-        total_s2=0;
-      }
-    }
-  }
-
-  double averMsecs = total_s2 / nIter * 1000;
-  printf("iterated %d times, average time is %lf ms.\n", nIter, averMsecs);
+  if (pb_RunHarness(&config, jds_kernel, &args, &result) != 0)
+    return 1;
+  pb_PrintHarnessResult("spmv", &result);
+  pb_PrintAllocations();
+  pb_FreeHarnessResult(&result);
+
+  struct pb_RunRecord record;
+  double nonzeros = 0;
+  int row;
+  for (row = 0; row < dim; row++)
+    nonzeros += h_nzcnt[row];
+  pb_InitRunRecord(&record, "spmv", parameters->inpFiles[0]);
+  record.harness = &result;
+  record.timers = &timers;
+  record.flops = 2 * nonzeros;
+  /* Padded matrix data and indices, x and y */
+  record.bytes = (double)len * (sizeof(float) + sizeof(int)) + 2.0 * dim * sizeof(float);
 
   if (parameters->outFile) {
     pb_SwitchToTimer(&timers, pb_TimerID_IO);
@@ -216,15 +221,11 @@ int main(int argc, char** argv) {
   }
   pb_SwitchToTimer(&timers, pb_TimerID_COMPUTE);
 
-  free (h_data);
-  free (h_indices);
-  free (h_ptr);
-  free (h_perm);
-  free (h_nzcnt);
-  free (h_Ax_vector);
-  free (h_x_vector);
+  pb_DestroyArena (arena);
   pb_SwitchToTimer(&timers, pb_TimerID_NONE);
 
+  if (pb_EmitRunRecord(&record) != 0)
+    return 1;
   pb_PrintTimerSet(&timers);
   pb_FreeParameters(parameters);
 
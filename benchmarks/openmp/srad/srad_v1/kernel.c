@@ -0,0 +1,409 @@
+//====================================================================================================100
+//====================================================================================================100
+//	FUSED SRAD KERNEL
+//====================================================================================================100
+//====================================================================================================100
+
+// One SRAD iteration (derivatives, ICOV, diffusion coefficient, divergence, update) in a single pass
+// over the image. The image is column major, so a column is contiguous. Work is split into strips of
+// TILE_ROWS rows; inside a strip every thread walks its own range of columns and keeps the diffusion
+// coefficients of the current and the next (east) column in two small buffers that hold one halo row
+// for the south neighbour. Directional derivatives are recomputed from the image instead of being
+// stored, and boundaries are clamped by peeling the first/last row and column, so neither the
+// dN/dS/dW/dE/c arrays nor the iN/iS/jW/jE tables are needed. The new image goes to image_next, the
+// caller swaps the two buffers between iterations.
+
+// The ROI statistics that the next iteration needs are gathered in the same pass: every column of the
+// new image leaves its partial sum/sum of squares (in double, strip by strip) in roi_sum/roi_sum2, and
+// pairwise_sum combines the columns afterwards. The summation order depends only on the image size and
+// TILE_ROWS, never on the number of threads, so results are reproducible across thread counts.
+
+// All iterations run in one parallel region. Every thread keeps its columns for the whole run and
+// works out q0sqr from the partials itself, so the iterations are separated by a single barrier. The
+// partials are double buffered by iteration parity: iteration k reads one half and writes the other,
+// which nobody reads again before the barrier that ends iteration k+1.
+
+#ifndef TILE_ROWS
+#define TILE_ROWS 1024																	// rows per strip, 4 columns of it stay in L2
+#endif
+
+//====================================================================================================100
+//	DIFFUSION COEFFICIENT OF ONE PIXEL
+//====================================================================================================100
+
+static inline fp coefficient(	fp Jc,
+										fp vN,
+										fp vS,
+										fp vW,
+										fp vE,
+										fp q0sqr){
+
+	fp dN, dS, dW, dE;
+	fp G2, L, num, den, qsqr, c;
+
+	// directional derivates
+	dN = vN - Jc;
+	dS = vS - Jc;
+	dW = vW - Jc;
+	dE = vE - Jc;
+
+	// normalized discrete gradient mag squared (equ 52,53)
+	G2 = (dN*dN + dS*dS + dW*dW + dE*dE) / (Jc*Jc);
+
+	// normalized discrete laplacian (equ 54)
+	L = (dN + dS + dW + dE) / Jc;
+
+	// ICOV (equ 31/35)
+	num  = (0.5*G2) - ((1.0/16.0)*(L*L));
+	den  = 1 + (.25*L);
+	qsqr = num/(den*den);
+
+	// diffusion coefficent (equ 33), saturated to 0-1 range
+	den = (qsqr-q0sqr) / (q0sqr * (1+q0sqr));
+	c = 1.0 / (1.0+den);
+	return c < 0 ? 0 : (c > 1 ? 1 : c);
+
+}
+
+//====================================================================================================100
+//	UPDATED VALUE OF ONE PIXEL
+//====================================================================================================100
+
+static inline fp update(	fp Jc,
+								fp vN,
+								fp vS,
+								fp vW,
+								fp vE,
+								fp cC,
+								fp cS,
+								fp cE,
+								fp lambda){
+
+	fp D;
+
+	// divergence (equ 58), north and west coefficients are the ones of the pixel itself
+	D = cC*(vN - Jc) + cS*(vS - Jc) + cC*(vW - Jc) + cE*(vE - Jc);
+
+	// image update (equ 61)
+	return Jc + 0.25*lambda*D;
+
+}
+
+//====================================================================================================100
+//	COEFFICIENTS OF ROWS [i0, i1) IN COLUMN j
+//====================================================================================================100
+
+static void coefficient_column(	fp* image,
+												long Nr,
+												long Nc,
+												long j,
+												long i0,
+												long i1,
+												fp q0sqr,
+												fp* c){
+
+	fp* col = image + Nr*j;
+	fp* colW = image + Nr*(j > 0 ? j-1 : 0);									// clamped west column
+	fp* colE = image + Nr*(j < Nc-1 ? j+1 : Nc-1);							// clamped east column
+	long lo = i0 > 0 ? i0 : 1;
+	long hi = i1 < Nr-1 ? i1 : Nr-1;
+	long i;
+
+	// top row, north neighbour clamped
+	if(i0 == 0){
+		c[0] = coefficient(col[0], col[0], col[Nr > 1 ? 1 : 0], colW[0], colE[0], q0sqr);
+	}
+
+	// interior rows
+	#pragma omp simd
+	for(i=lo; i<hi; i++){
+		c[i-i0] = coefficient(col[i], col[i-1], col[i+1], colW[i], colE[i], q0sqr);
+	}
+
+	// bottom row, south neighbour clamped
+	if(i1 == Nr && Nr > 1){
+		i = Nr-1;
+		c[i-i0] = coefficient(col[i], col[i-1], col[i], colW[i], colE[i], q0sqr);
+	}
+
+}
+
+//====================================================================================================100
+//	UPDATE OF ROWS [i0, i1) IN COLUMN j
+//====================================================================================================100
+
+// c holds the coefficients of column j for rows [i0, i1] (the last one only if it exists), cE the
+// ones of the east column for rows [i0, i1).
+
+static void update_column(	fp* image,
+										fp* image_next,
+										long Nr,
+										long Nc,
+										long j,
+										long i0,
+										long i1,
+										fp* c,
+										fp* cE,
+										fp lambda){
+
+	fp* col = image + Nr*j;
+	fp* colW = image + Nr*(j > 0 ? j-1 : 0);
+	fp* colE = image + Nr*(j < Nc-1 ? j+1 : Nc-1);
+	fp* out = image_next + Nr*j;
+	long lo = i0 > 0 ? i0 : 1;
+	long hi = i1 < Nr-1 ? i1 : Nr-1;
+	long i;
+
+	if(i0 == 0){
+		if(Nr > 1){
+			out[0] = update(col[0], col[0], col[1], colW[0], colE[0], c[0], c[1], cE[0], lambda);
+		}
+		else{
+			out[0] = update(col[0], col[0], col[0], colW[0], colE[0], c[0], c[0], cE[0], lambda);
+		}
+	}
+
+	#pragma omp simd
+	for(i=lo; i<hi; i++){
+		out[i] = update(col[i], col[i-1], col[i+1], colW[i], colE[i], c[i-i0], c[i+1-i0], cE[i-i0], lambda);
+	}
+
+	if(i1 == Nr && Nr > 1){
+		i = Nr-1;
+		out[i] = update(col[i], col[i-1], col[i], colW[i], colE[i], c[i-i0], c[i-i0], cE[i-i0], lambda);
+	}
+
+}
+
+//====================================================================================================100
+//	ROI SUMS OF ROWS [i0, i1) IN ONE COLUMN
+//====================================================================================================100
+
+static void roi_column_sum(	fp* col,
+											long i0,
+											long i1,
+											int r1,
+											int r2,
+											double* sum,
+											double* sum2){
+
+	long lo = i0 > r1 ? i0 : r1;
+	long hi = i1 < r2+1 ? i1 : r2+1;
+	double s = 0;
+	double s2 = 0;
+	long i;
+
+	#pragma omp simd reduction(+:s,s2)
+	for(i=lo; i<hi; i++){
+		s  += col[i];
+		s2 += (double)col[i]*col[i];
+	}
+
+	*sum  += s;
+	*sum2 += s2;
+
+}
+
+//====================================================================================================100
+//	PAIRWISE SUM OF THE PER-COLUMN PARTIALS
+//====================================================================================================100
+
+double pairwise_sum(	double* x,
+							long n){
+
+	double s = 0;
+	long i;
+
+	if(n <= 8){
+		for(i=0; i<n; i++){
+			s += x[i];
+		}
+		return s;
+	}
+
+	return pairwise_sum(x, n/2) + pairwise_sum(x + n/2, n - n/2);
+
+}
+
+//====================================================================================================100
+//	ROI PARTIAL SUMS OF COLUMNS [jb, je) (BEFORE THE FIRST ITERATION)
+//====================================================================================================100
+
+static void roi_statistics(	fp* image,
+										long Nr,
+										long jb,
+										long je,
+										int r1,
+										int r2,
+										int c1,
+										int c2,
+										double* roi_sum,
+										double* roi_sum2){
+
+	long i0, j;
+
+	// same strip decomposition as srad_iteration so both produce identical partials
+	for(j=(jb > c1 ? jb : c1); j<je && j<=c2; j++){
+		roi_sum[j] = 0;
+		roi_sum2[j] = 0;
+		for(i0=0; i0<Nr; i0+=TILE_ROWS){
+			roi_column_sum(image + Nr*j, i0, i0+TILE_ROWS < Nr ? i0+TILE_ROWS : Nr, r1, r2, &roi_sum[j], &roi_sum2[j]);
+		}
+	}
+
+}
+
+//====================================================================================================100
+//	q0sqr OF THE ROI FROM ITS PARTIAL SUMS
+//====================================================================================================100
+
+static fp roi_q0sqr(	double* roi_sum,
+								double* roi_sum2,
+								int c1,
+								int c2,
+								long NeROI){
+
+	double sum, sum2;
+	fp meanROI, varROI;
+
+	sum  = pairwise_sum(roi_sum + c1, c2-c1+1);							// sum of ROI values
+	sum2 = pairwise_sum(roi_sum2 + c1, c2-c1+1);							// sum of squares of ROI values
+	meanROI = sum / NeROI;														// mean (average) value of element in ROI
+	varROI  = (sum2 / NeROI) - meanROI*meanROI;								// variance of ROI
+	return varROI / (meanROI*meanROI);											// standard deviation of ROI
+
+}
+
+//====================================================================================================100
+//	ONE ITERATION OVER COLUMNS [jb, je)
+//====================================================================================================100
+
+static void srad_iteration(	fp* image,
+										fp* image_next,
+										long Nr,
+										long Nc,
+										long jb,
+										long je,
+										fp q0sqr,
+										fp lambda,
+										int r1,
+										int r2,
+										int c1,
+										int c2,
+										double* roi_sum,
+										double* roi_sum2){
+
+	fp buffer0[TILE_ROWS+1];
+	fp buffer1[TILE_ROWS+1];
+	fp *c, *cE, *tmp;
+	long i0, i1, i1h, j;
+
+	for(j=jb; j<je; j++){
+		roi_sum[j] = 0;
+		roi_sum2[j] = 0;
+	}
+
+	for(i0=0; i0<Nr && jb<je; i0+=TILE_ROWS){
+
+		i1 = i0+TILE_ROWS < Nr ? i0+TILE_ROWS : Nr;
+		i1h = i1 < Nr ? i1+1 : Nr;												// one halo row below the strip
+
+		c = buffer0;
+		cE = buffer1;
+		coefficient_column(image, Nr, Nc, jb, i0, i1h, q0sqr, c);
+
+		for(j=jb; j<je; j++){
+
+			// east coefficients, the last column is its own east neighbour
+			if(j < Nc-1){
+				coefficient_column(image, Nr, Nc, j+1, i0, i1h, q0sqr, cE);
+				update_column(image, image_next, Nr, Nc, j, i0, i1, c, cE, lambda);
+			}
+			else{
+				update_column(image, image_next, Nr, Nc, j, i0, i1, c, c, lambda);
+			}
+
+			// ROI statistics of the new column while it is still in cache
+			if(j >= c1 && j <= c2){
+				roi_column_sum(image_next + Nr*j, i0, i1, r1, r2, &roi_sum[j], &roi_sum2[j]);
+			}
+
+			// roll the buffers one column east
+			tmp = c;
+			c = cE;
+			cE = tmp;
+
+		}
+
+	}
+
+}
+
+//====================================================================================================100
+//	ALL ITERATIONS
+//====================================================================================================100
+
+// roi_sum and roi_sum2 hold 2*Nc partials each. The result is in image if niter is even, else in
+// image_next. Returns the barrier of the team, sized from the team actually started (a thread limit
+// or OMP_DYNAMIC may make it smaller than threads), or NULL if it could not be created.
+
+struct pb_Barrier* srad_kernel(	fp* image,
+						fp* image_next,
+						long Nr,
+						long Nc,
+						int niter,
+						fp lambda,
+						int r1,
+						int r2,
+						int c1,
+						int c2,
+						double* roi_sum,
+						double* roi_sum2,
+						int threads){
+
+	long NeROI = (long)(r2-r1+1)*(c2-c1+1);
+	struct pb_Barrier* barrier = NULL;
+
+	#pragma omp parallel num_threads(threads)
+	{
+
+		int tid = omp_get_thread_num();
+		int nthreads = omp_get_num_threads();
+		fp *in = image, *out = image_next, *tmp;
+		long jb, je;
+		int iter, half;
+
+		#pragma omp single
+		barrier = pb_CreateBarrier("iterations", nthreads);
+
+		if(barrier != NULL){
+
+			pb_ThreadRange(Nc, tid, nthreads, &jb, &je);
+
+			// ROI partial sums of the initial image, later iterations get them from srad_iteration
+			roi_statistics(in, Nr, jb, je, r1, r2, c1, c2, roi_sum, roi_sum2);
+			pb_BarrierWait(barrier, tid);
+
+			for(iter=0; iter<niter; iter++){
+
+				half = iter % 2;
+
+				// derivatives, diffusion coefficent, divergence & image update in one fused pass
+				srad_iteration(in, out, Nr, Nc, jb, je, roi_q0sqr(roi_sum + Nc*half, roi_sum2 + Nc*half, c1, c2, NeROI),
+									lambda, r1, r2, c1, c2, roi_sum + Nc*(1-half), roi_sum2 + Nc*(1-half));
+				pb_BarrierWait(barrier, tid);
+
+				// the updated image becomes the input of the next iteration
+				tmp = in;
+				in = out;
+				out = tmp;
+
+			}
+
+		}
+
+	}
+
+	return barrier;
+
+}
@@ -25,11 +25,13 @@
 #include <math.h>
 #include <string.h>
 #include <omp.h>
+#include <parboil.h>
 
 #include "define.c"
 #include "graphics.c"
 #include "resize.c"
 #include "timer.c"
+#include "kernel.c"
 
 //====================================================================================================100
 //====================================================================================================100
@@ -63,9 +65,12 @@ int main(int argc, char *argv []){
 	int image_ori_rows;
 	int image_ori_cols;
 	long image_ori_elem;
+	char *image_file = "../../../data/srad/image.pgm";
+	FILE *image_fid;
 
     // inputs image, input paramenters
     fp* image;															// input image
+    fp* image_next;														// output of the current iteration
     long Nr,Nc;													// IMAGE nbr of rows/cols/elements
 	long Ne;
 
@@ -75,32 +80,14 @@ int main(int argc, char *argv []){
 
     // size of IMAGE
 	int r1,r2,c1,c2;												// row/col coordinates of uniform ROI
-	long NeROI;														// ROI nbr of elements
-    
-    // ROI statistics
-    fp meanROI, varROI, q0sqr;											//local region statistics
-    
-    // surrounding pixel indicies
-    int *iN,*iS,*jE,*jW;    
-
-    // center pixel value
-    fp Jc;
-
-	// directional derivatives
-	fp *dN,*dS,*dW,*dE;
     
     // calculation variables
-    fp tmp,sum,sum2;
-    fp G2,L,num,den,qsqr,D;
-       
-    // diffusion coefficient
-    fp *c; 
-	fp cN,cS,cW,cE;
+    double *roi_sum,*roi_sum2;											// per-column ROI partial sums
+    struct pb_Barrier* barrier;											// ends every iteration
+    fp* tmp_image;
     
     // counters
-    int iter;   // primary loop
-    long i,j;    // image row/col
-    long k;      // image single index    
+    long i;      // image index
 
 	// number of threads
 	int threads;
@@ -111,7 +98,7 @@ int main(int argc, char *argv []){
 	// 	GET INPUT PARAMETERS
 	//================================================================================80
 
-	if(argc != 6){
+	if(argc != 6 && argc != 7){
 		printf("ERROR: wrong number of arguments\n");
 		return 0;
 	}
@@ -120,10 +107,18 @@ int main(int argc, char *argv []){
 		lambda = atof(argv[2]);
 		Nr = atoi(argv[3]);						// it is 502 in the original image
 		Nc = atoi(argv[4]);						// it is 458 in the original image
-		threads = atoi(argv[5]);
+		threads = atoi(argv[5]);							// 0 follows OMP_NUM_THREADS
+		if(argc == 7){
+			image_file = argv[6];								// any P2 image, e.g. from tools/datagen
+		}
 	}
 
-	omp_set_num_threads(threads);
+	if(threads > 0){
+		omp_set_num_threads(threads);
+	}
+	else{
+		threads = omp_get_max_threads();
+	}
 	// printf("THREAD %d\n", omp_get_thread_num());
 	// printf("NUMBER OF THREADS: %d\n", omp_get_num_threads());
 
@@ -136,11 +131,19 @@ int main(int argc, char *argv []){
     // read image
 	image_ori_rows = 502;
 	image_ori_cols = 458;
+	image_fid = fopen(image_file, "r");
+	if(image_fid != NULL){
+		if(fscanf(image_fid, "P2 %d %d", &image_ori_cols, &image_ori_rows) != 2){
+			image_ori_rows = 502;
+			image_ori_cols = 458;
+		}
+		fclose(image_fid);
+	}
 	image_ori_elem = image_ori_rows * image_ori_cols;
 
 	image_ori = (fp*)malloc(sizeof(fp) * image_ori_elem);
 
-	read_graphics(	"../../../data/srad/image.pgm",
+	read_graphics(	image_file,
 								image_ori,
 								image_ori_rows,
 								image_ori_cols,
@@ -154,7 +157,8 @@ int main(int argc, char *argv []){
 
 	Ne = Nr*Nc;
 
-	image = (fp*)malloc(sizeof(fp) * Ne);
+	// every thread first touches the columns srad_kernel gives it
+	image = (fp*)pb_Alloc("image", sizeof(fp) * Ne, PB_ALLOC_FIRST_TOUCH);
 
 	resize(	image_ori,
 				image_ori_rows,
@@ -175,40 +179,13 @@ int main(int argc, char *argv []){
     c1     = 0;											// left column index of ROI
     c2     = Nc - 1;									// right column index of ROI
 
-    // ROI image size    
-    NeROI = (r2-r1+1)*(c2-c1+1);											// number of elements in ROI, ROI size
-    
-    // allocate variables for surrounding pixels
-    iN = malloc(sizeof(int*)*Nr) ;									// north surrounding element
-    iS = malloc(sizeof(int*)*Nr) ;									// south surrounding element
-    jW = malloc(sizeof(int*)*Nc) ;									// west surrounding element
-    jE = malloc(sizeof(int*)*Nc) ;									// east surrounding element
-    
-	// allocate variables for directional derivatives
-	dN = malloc(sizeof(fp)*Ne) ;											// north direction derivative
-    dS = malloc(sizeof(fp)*Ne) ;											// south direction derivative
-    dW = malloc(sizeof(fp)*Ne) ;											// west direction derivative
-    dE = malloc(sizeof(fp)*Ne) ;											// east direction derivative
-
-	// allocate variable for diffusion coefficient
-    c  = malloc(sizeof(fp)*Ne) ;											// diffusion coefficient
-        
-    // N/S/W/E indices of surrounding pixels (every element of IMAGE)
-	// #pragma omp parallel
-    for (i=0; i<Nr; i++) {
-        iN[i] = i-1;														// holds index of IMAGE row above
-        iS[i] = i+1;														// holds index of IMAGE row below
-    }
-	// #pragma omp parallel
-    for (j=0; j<Nc; j++) {
-        jW[j] = j-1;														// holds index of IMAGE column on the left
-        jE[j] = j+1;														// holds index of IMAGE column on the right
-    }
-	// N/S/W/E boundary conditions, fix surrounding indices outside boundary of IMAGE
-    iN[0]    = 0;															// changes IMAGE top row index from -1 to 0
-    iS[Nr-1] = Nr-1;														// changes IMAGE bottom row index from Nr to Nr-1 
-    jW[0]    = 0;															// changes IMAGE leftmost column index from -1 to 0
-    jE[Nc-1] = Nc-1;														// changes IMAGE rightmost column index from Nc to Nc-1
+	// allocate second image buffer, iterations alternate between the two
+	image_next = pb_Alloc("image_next", sizeof(fp)*Ne, PB_ALLOC_FIRST_TOUCH) ;
+
+	// per-column ROI partial sums, filled by the update pass of the previous iteration, two sets that
+	// iterations alternate between
+	roi_sum  = malloc(sizeof(double)*Nc*2) ;
+	roi_sum2 = malloc(sizeof(double)*Nc*2) ;
 
 	time5 = get_time();
 
@@ -229,100 +206,23 @@ int main(int argc, char *argv []){
 
 	// printf("iterations: ");
 
-    // primary loop
-    for (iter=0; iter<niter; iter++){										// do for the number of iterations input parameter
-
-		// printf("%d ", iter);
-		// fflush(NULL);
-
-        // ROI statistics for entire ROI (single number for ROI)
-        sum=0; 
-		sum2=0;
-        for (i=r1; i<=r2; i++) {											// do for the range of rows in ROI
-            for (j=c1; j<=c2; j++) {										// do for the range of columns in ROI
-                tmp   = image[i + Nr*j];										// get coresponding value in IMAGE
-                sum  += tmp ;												// take corresponding value and add to sum
-                sum2 += tmp*tmp;											// take square of corresponding value and add to sum2
-            }
-        }
-        meanROI = sum / NeROI;												// gets mean (average) value of element in ROI
-        varROI  = (sum2 / NeROI) - meanROI*meanROI;							// gets variance of ROI
-        q0sqr   = varROI / (meanROI*meanROI);								// gets standard deviation of ROI
-
-        // directional derivatives, ICOV, diffusion coefficent
-		#pragma omp parallel for shared(image, dN, dS, dW, dE, c, Nr, Nc, iN, iS, jW, jE) private(i, j, k, Jc, G2, L, num, den, qsqr)
-		for (j=0; j<Nc; j++) {												// do for the range of columns in IMAGE
-
-            for (i=0; i<Nr; i++) {											// do for the range of rows in IMAGE 
-
-                // current index/pixel
-                k = i + Nr*j;												// get position of current element
-                Jc = image[k];													// get value of the current element
-
-                // directional derivates (every element of IMAGE)
-                dN[k] = image[iN[i] + Nr*j] - Jc;								// north direction derivative
-                dS[k] = image[iS[i] + Nr*j] - Jc;								// south direction derivative
-                dW[k] = image[i + Nr*jW[j]] - Jc;								// west direction derivative
-                dE[k] = image[i + Nr*jE[j]] - Jc;								// east direction derivative
-
-                // normalized discrete gradient mag squared (equ 52,53)
-                G2 = (dN[k]*dN[k] + dS[k]*dS[k]								// gradient (based on derivatives)
-                    + dW[k]*dW[k] + dE[k]*dE[k]) / (Jc*Jc);
-
-                // normalized discrete laplacian (equ 54)
-                L = (dN[k] + dS[k] + dW[k] + dE[k]) / Jc;					// laplacian (based on derivatives)
-
-                // ICOV (equ 31/35)
-                num  = (0.5*G2) - ((1.0/16.0)*(L*L)) ;						// num (based on gradient and laplacian)
-                den  = 1 + (.25*L);											// den (based on laplacian)
-                qsqr = num/(den*den);										// qsqr (based on num and den)
- 
-                // diffusion coefficent (equ 33) (every element of IMAGE)
-                den = (qsqr-q0sqr) / (q0sqr * (1+q0sqr)) ;					// den (based on qsqr and q0sqr)
-                c[k] = 1.0 / (1.0+den) ;									// diffusion coefficient (based on den)
-
-                // saturate diffusion coefficent to 0-1 range
-                if (c[k] < 0)												// if diffusion coefficient < 0
-					{c[k] = 0;}												// ... set to 0
-                else if (c[k] > 1)											// if diffusion coefficient > 1
-					{c[k] = 1;}												// ... set to 1
-
-            }
-
-        }
-
-        // divergence & image update
-		#pragma omp parallel for shared(image, c, Nr, Nc, lambda) private(i, j, k, D, cS, cN, cW, cE)
-        for (j=0; j<Nc; j++) {												// do for the range of columns in IMAGE
-
-			// printf("NUMBER OF THREADS: %d\n", omp_get_num_threads());
-
-            for (i=0; i<Nr; i++) {											// do for the range of rows in IMAGE
-
-                // current index
-                k = i + Nr*j;												// get position of current element
-
-                // diffusion coefficent
-                cN = c[k];													// north diffusion coefficient
-                cS = c[iS[i] + Nr*j];										// south diffusion coefficient
-                cW = c[k];													// west diffusion coefficient
-                cE = c[i + Nr*jE[j]];										// east diffusion coefficient
-
-                // divergence (equ 58)
-                D = cN*dN[k] + cS*dS[k] + cW*dW[k] + cE*dE[k];				// divergence
-
-                // image update (equ 61) (every element of IMAGE)
-                image[k] = image[k] + 0.25*lambda*D;								// updates image (based on input time step and divergence)
-
-            }
-
-        }
-
+	// all iterations in one parallel region, ROI statistics included
+	barrier = srad_kernel(image, image_next, Nr, Nc, niter, lambda, r1, r2, c1, c2, roi_sum, roi_sum2, threads);
+	if(barrier == NULL){
+		printf("ERROR: cannot create the barrier\n");
+		return 1;
 	}
 
-	// printf("\n");
+	// the last updated image is in image_next after an odd number of iterations
+	if(niter % 2){
+		tmp_image = image;
+		image = image_next;
+		image_next = tmp_image;
+	}
 
 	time7 = get_time();
+	pb_PrintAllocations();
+	pb_PrintBarrier(barrier);
 
 	//================================================================================80
 	// 	SCALE IMAGE UP FROM 0-1 TO 0-255 AND COMPRESS
@@ -353,11 +253,11 @@ int main(int argc, char *argv []){
 	//================================================================================80
 
 	free(image_ori);
-	free(image);
-
-    free(iN); free(iS); free(jW); free(jE);									// deallocate surrounding pixel memory
-    free(dN); free(dS); free(dW); free(dE);									// deallocate directional derivative memory
-    free(c);																// deallocate diffusion coefficient memory
+	pb_Free(image);
+	pb_Free(image_next);
+	free(roi_sum);
+	free(roi_sum2);
+	pb_DestroyBarrier(barrier);
 
 	time10 = get_time();
 
@@ -379,6 +279,23 @@ int main(int argc, char *argv []){
 	printf("Total time:\n");
 	printf("%.12f s\n", 																					(float) (time10-time0) / 1000000);
 
+	//================================================================================80
+	//		MACHINE-READABLE RECORD
+	//================================================================================80
+
+	// the fused pass reads the image and writes image_next once per iteration
+	struct pb_RunRecord record;
+	char size_name[64];
+	snprintf(size_name, sizeof(size_name), "%ldx%ld", Nr, Nc);
+	pb_InitRunRecord(&record, "srad_v1", size_name);
+	record.threads = threads;
+	record.iterations = niter;
+	record.seconds = (time7-time6) * 1e-6 / niter;
+	record.bytes = 2.0 * sizeof(fp) * Ne;
+	if(pb_EmitRunRecord(&record) != 0){
+		return 1;
+	}
+
 //====================================================================================================100
 //	END OF FILE
 //====================================================================================================100
@@ -12,6 +12,7 @@
 #include <math.h>
 #include <omp.h>
 #include <sys/time.h>
+#include <parboil.h>
 
 void random_matrix(float *I, int rows, int cols);
 
@@ -37,18 +38,241 @@ double gettime() {
   return t.tv_sec+t.tv_usec*1e-6;
 }
 
+// Fused SRAD iteration. The image is row major; work is split into strips of
+// TILE_COLS columns (plus one halo column for the east neighbour) and every
+// thread walks its own block of rows, keeping the diffusion coefficients of the
+// current and the next (south) row in two small buffers. Derivatives are
+// recomputed instead of stored and the borders are clamped by peeling the
+// first/last row and column, so no dN/dS/dW/dE/c arrays or iN/iS/jW/jE tables
+// are needed. The result is written to Jn.
+//
+// The ROI statistics of Jn are gathered in the same pass: every row leaves its
+// partial sum/sum of squares (in double, strip by strip) in roi_sum/roi_sum2
+// and pairwise_sum combines the rows afterwards. The summation order depends
+// only on the image size and TILE_COLS, so q0sqr does not change with the
+// number of threads.
+//
+// srad_kernel runs all the iterations in one parallel region. Every thread
+// keeps its rows and works out q0sqr from the partials itself, so a single
+// barrier ends an iteration; the partials are double buffered by iteration
+// parity, iteration k reads one half and writes the other.
+
+#ifndef TILE_COLS
+#define TILE_COLS 1024
+#endif
+
+static inline float coefficient(float Jc, float vN, float vS, float vW, float vE, float q0sqr)
+{
+	float dN = vN - Jc;
+	float dS = vS - Jc;
+	float dW = vW - Jc;
+	float dE = vE - Jc;
+
+	float G2 = (dN*dN + dS*dS + dW*dW + dE*dE) / (Jc*Jc);
+	float L = (dN + dS + dW + dE) / Jc;
+
+	float num  = (0.5*G2) - ((1.0/16.0)*(L*L)) ;
+	float den  = 1 + (.25*L);
+	float qsqr = num/(den*den);
+
+	// diffusion coefficent (equ 33), saturated
+	den = (qsqr-q0sqr) / (q0sqr * (1+q0sqr)) ;
+	float c = 1.0 / (1.0+den) ;
+	return c < 0 ? 0 : (c > 1 ? 1 : c);
+}
+
+static inline float update(float Jc, float vN, float vS, float vW, float vE,
+                           float cC, float cS, float cE, float lambda)
+{
+	// divergence (equ 58), north and west coefficients are the pixel's own
+	float D = cC * (vN - Jc) + cS * (vS - Jc) + cC * (vW - Jc) + cE * (vE - Jc);
+
+	// image update (equ 61)
+	return Jc + 0.25*lambda*D;
+}
+
+// coefficients of columns [j0, j1) in row i
+static void coefficient_row(const float *J, int rows, int cols, int i, int j0, int j1, float q0sqr, float *c)
+{
+	const float *row = J + i * cols;
+	const float *rowN = J + (i > 0 ? i - 1 : 0) * cols;
+	const float *rowS = J + (i < rows - 1 ? i + 1 : rows - 1) * cols;
+	int lo = j0 > 0 ? j0 : 1;
+	int hi = j1 < cols - 1 ? j1 : cols - 1;
+
+	if (j0 == 0)
+		c[0] = coefficient(row[0], rowN[0], rowS[0], row[0], row[cols > 1 ? 1 : 0], q0sqr);
+	#pragma omp simd
+	for (int j = lo; j < hi; j++)
+		c[j - j0] = coefficient(row[j], rowN[j], rowS[j], row[j - 1], row[j + 1], q0sqr);
+	if (j1 == cols && cols > 1) {
+		int j = cols - 1;
+		c[j - j0] = coefficient(row[j], rowN[j], rowS[j], row[j - 1], row[j], q0sqr);
+	}
+}
+
+// update of columns [j0, j1) in row i; c holds the coefficients of row i for
+// columns [j0, j1] (the last one only if it exists), cS the ones of the south row
+static void update_row(const float *J, float *Jn, int rows, int cols, int i, int j0, int j1,
+                       const float *c, const float *cS, float lambda)
+{
+	const float *row = J + i * cols;
+	const float *rowN = J + (i > 0 ? i - 1 : 0) * cols;
+	const float *rowS = J + (i < rows - 1 ? i + 1 : rows - 1) * cols;
+	float *out = Jn + i * cols;
+	int lo = j0 > 0 ? j0 : 1;
+	int hi = j1 < cols - 1 ? j1 : cols - 1;
+
+	if (j0 == 0) {
+		float cE = cols > 1 ? c[1] : c[0];
+		out[0] = update(row[0], rowN[0], rowS[0], row[0], row[cols > 1 ? 1 : 0], c[0], cS[0], cE, lambda);
+	}
+	#pragma omp simd
+	for (int j = lo; j < hi; j++)
+		out[j] = update(row[j], rowN[j], rowS[j], row[j - 1], row[j + 1], c[j - j0], cS[j - j0], c[j + 1 - j0], lambda);
+	if (j1 == cols && cols > 1) {
+		int j = cols - 1;
+		out[j] = update(row[j], rowN[j], rowS[j], row[j - 1], row[j], c[j - j0], cS[j - j0], c[j - j0], lambda);
+	}
+}
+
+// ROI sums of columns [j0, j1) in one row
+static void roi_row_sum(const float *row, int j0, int j1, int c1, int c2, double *sum, double *sum2)
+{
+	int lo = j0 > c1 ? j0 : c1;
+	int hi = j1 < c2 + 1 ? j1 : c2 + 1;
+	double s = 0, s2 = 0;
+
+	#pragma omp simd reduction(+:s,s2)
+	for (int j = lo; j < hi; j++) {
+		s  += row[j];
+		s2 += (double)row[j] * row[j];
+	}
+	*sum  += s;
+	*sum2 += s2;
+}
+
+double pairwise_sum(const double *x, int n)
+{
+	if (n <= 8) {
+		double s = 0;
+		for (int i = 0; i < n; i++)
+			s += x[i];
+		return s;
+	}
+	return pairwise_sum(x, n / 2) + pairwise_sum(x + n / 2, n - n / 2);
+}
+
+// ROI partial sums of rows [ib, ie) of the initial image, same strips as
+// srad_iteration
+static void roi_statistics(const float *J, int cols, int ib, int ie, int r1, int r2, int c1, int c2,
+                           double *roi_sum, double *roi_sum2)
+{
+	for (int i = ib > r1 ? ib : r1; i < ie && i <= r2; i++) {
+		roi_sum[i] = 0;
+		roi_sum2[i] = 0;
+		for (int j0 = 0; j0 < cols; j0 += TILE_COLS)
+			roi_row_sum(J + i * cols, j0, j0 + TILE_COLS < cols ? j0 + TILE_COLS : cols, c1, c2,
+			            &roi_sum[i], &roi_sum2[i]);
+	}
+}
+
+// q0sqr of the ROI from its per-row partials
+static float roi_q0sqr(const double *roi_sum, const double *roi_sum2, int r1, int r2, int size_R)
+{
+	double sum  = pairwise_sum(roi_sum + r1, r2 - r1 + 1);
+	double sum2 = pairwise_sum(roi_sum2 + r1, r2 - r1 + 1);
+	float meanROI = sum / size_R;
+	float varROI  = (sum2 / size_R) - meanROI*meanROI;
+	return varROI / (meanROI*meanROI);
+}
+
+// one iteration over rows [ib, ie)
+static void srad_iteration(const float *J, float *Jn, int rows, int cols, int ib, int ie,
+                           float q0sqr, float lambda, int r1, int r2, int c1, int c2,
+                           double *roi_sum, double *roi_sum2)
+{
+	float buffer0[TILE_COLS + 1], buffer1[TILE_COLS + 1];
+
+	for (int i = ib; i < ie; i++) {
+		roi_sum[i] = 0;
+		roi_sum2[i] = 0;
+	}
+
+	for (int j0 = 0; j0 < cols && ib < ie; j0 += TILE_COLS) {
+		int j1 = j0 + TILE_COLS < cols ? j0 + TILE_COLS : cols;
+		int j1h = j1 < cols ? j1 + 1 : cols;
+		float *c = buffer0, *cS = buffer1;
+
+		coefficient_row(J, rows, cols, ib, j0, j1h, q0sqr, c);
+		for (int i = ib; i < ie; i++) {
+			// the last row is its own south neighbour
+			if (i < rows - 1) {
+				coefficient_row(J, rows, cols, i + 1, j0, j1h, q0sqr, cS);
+				update_row(J, Jn, rows, cols, i, j0, j1, c, cS, lambda);
+			} else {
+				update_row(J, Jn, rows, cols, i, j0, j1, c, c, lambda);
+			}
+			// ROI statistics of the new row while it is still in cache
+			if (i >= r1 && i <= r2)
+				roi_row_sum(Jn + i * cols, j0, j1, c1, c2, &roi_sum[i], &roi_sum2[i]);
+			float *tmp = c; c = cS; cS = tmp;
+		}
+	}
+}
+
+// All iterations, ROI statistics of the initial image included. roi_sum and
+// roi_sum2 hold 2 * rows partials each; the result is in J after an even
+// number of iterations, else in Jn. Returns the barrier of the team, sized
+// from the team actually started (a thread limit or OMP_DYNAMIC may make it
+// smaller than OMP_NUM_THREADS), or NULL if it could not be created.
+struct pb_Barrier *srad_kernel(float *J, float *Jn, int rows, int cols, int niter, float lambda,
+                               int r1, int r2, int c1, int c2, double *roi_sum, double *roi_sum2)
+{
+	int size_R = (r2-r1+1)*(c2-c1+1);
+	struct pb_Barrier *barrier = NULL;
+
+#ifdef OPEN
+	#pragma omp parallel
+#endif
+	{
+		int tid = omp_get_thread_num();
+		int nthreads = omp_get_num_threads();
+		long ib, ie;
+		float *in = J, *out = Jn;
+
+#ifdef OPEN
+		#pragma omp single
+#endif
+		barrier = pb_CreateBarrier("iterations", nthreads);
+		if (barrier != NULL) {
+			pb_ThreadRange(rows, tid, nthreads, &ib, &ie);
+			roi_statistics(in, cols, ib, ie, r1, r2, c1, c2, roi_sum, roi_sum2);
+			pb_BarrierWait(barrier, tid);
+
+			for (int iter = 0; iter < niter; iter++) {
+				// per-row partials come from the previous update pass
+				int half = iter % 2;
+				float q0sqr = roi_q0sqr(roi_sum + rows * half, roi_sum2 + rows * half, r1, r2, size_R);
+
+				// derivatives, diffusion coefficent and image update in one pass
+				srad_iteration(in, out, rows, cols, ib, ie, q0sqr, lambda, r1, r2, c1, c2,
+				               roi_sum + rows * (1 - half), roi_sum2 + rows * (1 - half));
+				pb_BarrierWait(barrier, tid);
+				float *tmp = in; in = out; out = tmp;
+			}
+		}
+	}
+	return barrier;
+}
+
 int main(int argc, char* argv[])
 {   
-	int rows, cols, size_I, size_R, niter = 10, iter, k;
-    float *I, *J, q0sqr, sum, sum2, tmp, meanROI,varROI ;
-	float Jc, G2, L, num, den, qsqr;
-	int *iN,*iS,*jE,*jW;
-	float *dN,*dS,*dW,*dE;
+	int rows, cols, size_I, niter = 10, k;
+    float *I, *J, *Jn;
+	double *roi_sum, *roi_sum2;
 	int r1, r2, c1, c2;
-	float cN,cS,cW,cE;
-	float *c, D;
 	float lambda;
-	int i, j;
     int nthreads;
 
 	if (argc == 10)
@@ -73,37 +297,15 @@ int main(int argc, char* argv[])
 
 
 	size_I = cols * rows;
-    size_R = (r2-r1+1)*(c2-c1+1);   
 
 	I = (float *)malloc( size_I * sizeof(float) );
-    J = (float *)malloc( size_I * sizeof(float) );
-	c  = (float *)malloc(sizeof(float)* size_I) ;
-
-    iN = (int *)malloc(sizeof(unsigned int*) * rows) ;
-    iS = (int *)malloc(sizeof(unsigned int*) * rows) ;
-    jW = (int *)malloc(sizeof(unsigned int*) * cols) ;
-    jE = (int *)malloc(sizeof(unsigned int*) * cols) ;    
-
-
-	dN = (float *)malloc(sizeof(float)* size_I) ;
-    dS = (float *)malloc(sizeof(float)* size_I) ;
-    dW = (float *)malloc(sizeof(float)* size_I) ;
-    dE = (float *)malloc(sizeof(float)* size_I) ;    
-    
+	// every thread first touches the rows srad_iteration gives it
+    J = (float *)pb_Alloc("J", size_I * sizeof(float), PB_ALLOC_FIRST_TOUCH);
+    Jn = (float *)pb_Alloc("Jn", size_I * sizeof(float), PB_ALLOC_FIRST_TOUCH);
+	// two sets of per-row partials, iterations alternate between them
+	roi_sum  = (double *)malloc( 2 * rows * sizeof(double) );
+	roi_sum2 = (double *)malloc( 2 * rows * sizeof(double) );
 
-    for (int i=0; i< rows; i++) {
-        iN[i] = i-1;
-        iS[i] = i+1;
-    }    
-    for (int j=0; j< cols; j++) {
-        jW[j] = j-1;
-        jE[j] = j+1;
-    }
-    iN[0]    = 0;
-    iS[rows-1] = rows-1;
-    jW[0]    = 0;
-    jE[cols-1] = cols-1;
-	
 	printf("Randomizing the input matrix\n");
 
     random_matrix(I, rows, cols);
@@ -118,88 +320,34 @@ int main(int argc, char* argv[])
         niter = (env_iter != NULL) ? atoi(env_iter) : 1;
         printf("[ITERATION NUM]:%d\n", niter);
 
+	// the team runs all iterations; the thread count of the command line is
+	// not used, OMP_NUM_THREADS is
         double start = gettime();
-	for (iter=0; iter< niter; iter++){
-		sum=0; sum2=0;     
-		for (i=r1; i<=r2; i++) {
-            for (j=c1; j<=c2; j++) {
-                tmp   = J[i * cols + j];
-                sum  += tmp ;
-                sum2 += tmp*tmp;
-            }
-        }
-        meanROI = sum / size_R;
-        varROI  = (sum2 / size_R) - meanROI*meanROI;
-        q0sqr   = varROI / (meanROI*meanROI);
-		
-
-#ifdef OPEN
-		#pragma omp parallel for simd shared(J, dN, dS, dW, dE, c, rows, cols, iN, iS, jW, jE) private(i, j, k, Jc, G2, L, num, den, qsqr)
-#endif    
-		for (int i = 0 ; i < rows ; i++) {
-            for (int j = 0; j < cols; j++) { 
-		
-				k = i * cols + j;
-				Jc = J[k];
- 
-				// directional derivates
-                dN[k] = J[iN[i] * cols + j] - Jc;
-                dS[k] = J[iS[i] * cols + j] - Jc;
-                dW[k] = J[i * cols + jW[j]] - Jc;
-                dE[k] = J[i * cols + jE[j]] - Jc;
-			
-                G2 = (dN[k]*dN[k] + dS[k]*dS[k] 
-                    + dW[k]*dW[k] + dE[k]*dE[k]) / (Jc*Jc);
-
-   		        L = (dN[k] + dS[k] + dW[k] + dE[k]) / Jc;
-
-				num  = (0.5*G2) - ((1.0/16.0)*(L*L)) ;
-                den  = 1 + (.25*L);
-                qsqr = num/(den*den);
- 
-                // diffusion coefficent (equ 33)
-                den = (qsqr-q0sqr) / (q0sqr * (1+q0sqr)) ;
-                c[k] = 1.0 / (1.0+den) ;
-                
-                // saturate diffusion coefficent
-                if (c[k] < 0) {c[k] = 0;}
-                else if (c[k] > 1) {c[k] = 1;}
-   
-		}
-  
-    }
-#ifdef OPEN
-		#pragma omp parallel for simd shared(J, c, rows, cols, lambda) private(i, j, k, D, cS, cN, cW, cE)
-#endif 
-		for (int i = 0; i < rows; i++) {
-            for (int j = 0; j < cols; j++) {        
-
-                // current index
-                k = i * cols + j;
-                
-                // diffusion coefficent
-					cN = c[k];
-					cS = c[iS[i] * cols + j];
-					cW = c[k];
-					cE = c[i * cols + jE[j]];
-
-                // divergence (equ 58)
-                D = cN * dN[k] + cS * dS[k] + cW * dW[k] + cE * dE[k];
-                
-                // image update (equ 61)
-                J[k] = J[k] + 0.25*lambda*D;
-                #ifdef OUTPUT
-                //printf("%.5f ", J[k]); 
-                #endif //output
-            }
-	            #ifdef OUTPUT
-                //printf("\n"); 
-                #endif //output
-	     }
-
+	struct pb_Barrier *barrier = srad_kernel(J, Jn, rows, cols, niter, lambda, r1, r2, c1, c2,
+	                                         roi_sum, roi_sum2);
+	if (barrier == NULL) {
+		fprintf(stderr, "Cannot create the barrier\n");
+		exit(1);
+	}
+	if (niter % 2) {
+		float *tmp_J = J; J = Jn; Jn = tmp_J;
 	}
         double end = gettime();
         printf("Finish %d iterations, spent %lf secs!\n", niter, end - start);
+	pb_PrintAllocations();
+	pb_PrintBarrier(barrier);
+	pb_DestroyBarrier(barrier);
+
+	// the fused pass reads J and writes Jn once per iteration
+	struct pb_RunRecord record;
+	char size_name[64];
+	snprintf(size_name, sizeof(size_name), "%dx%d", rows, cols);
+	pb_InitRunRecord(&record, "srad_v2", size_name);
+	record.iterations = niter;
+	record.seconds = (end - start) / niter;
+	record.bytes = 2.0 * sizeof(float) * size_I;
+	if (pb_EmitRunRecord(&record) != 0)
+		exit(1);
 
 
 #ifdef OUTPUT
@@ -216,11 +364,10 @@ int main(int argc, char* argv[])
 	printf("Computation Done\n");
 
 	free(I);
-	free(J);
-	free(iN); free(iS); free(jW); free(jE);
-    free(dN); free(dS); free(dW); free(dE);
-
-	free(c);
+	pb_Free(J);
+	pb_Free(Jn);
+	free(roi_sum);
+	free(roi_sum2);
 	return 0;
 }
 
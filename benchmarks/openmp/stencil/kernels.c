@@ -11,14 +11,18 @@
 void cpu_stencil(float c0,float c1, float *A0,float * Anext,const int nx, const int ny, const int nz)
 {
 
-  int i;  
-  #pragma omp parallel for
-	for(i=1;i<nx-1;i++)
+  int k,j;  
+  //the x rows of all planes in order are contiguous: every thread sweeps
+  //its own block of (z,y) rows, the x rows innermost, and the pages of its
+  //rows are local to it; collapsing z and y keeps enough rows for many
+  //threads on shallow grids
+  #pragma omp parallel for collapse(2) schedule(static)
+	for(k=1;k<nz-1;k++)
 	{
-    int j,k;
 		for(j=1;j<ny-1;j++)
 		{
-			for(k=1;k<nz-1;k++)
+			int i;
+			for(i=1;i<nx-1;i++)
 			{
   //i      #pragma omp critical
 				Anext[Index3D (nx, ny, i, j, k)] = 
@@ -27,7 +27,9 @@ def run():
     globals.verdir = parboilfile.Directory(os.path.join(globals.root, 'benchmarks'),
                      [], benchmark.benchmark_scanner())
 
-    platform = sys.argv[3]
+    # 'run BENCHMARK VERSION ...' names the platform directory as VERSION
+    try: platform = sys.argv[3]
+    except IndexError: platform = 'openmp'
     print platform
     bmks = parboilfile.Directory(os.path.join(globals.root,'benchmarks/%s' % platform), 
                      [], benchmark.benchmark_scanner())
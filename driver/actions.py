@@ -9,6 +9,7 @@ from itertools import imap
 import process
 import benchmark
 import globals
+import sweep
 from text import format_columns
 
 from error import ErrorType
@@ -119,6 +120,78 @@ def run_benchmark(bmk, version_name, input_name, check=True, extra_opts=[], plat
 
     return ErrorType.Success
 
+def sweep_benchmarks(tools, platform, workloads, threads, affinities,
+                     outdir, reserve=0, max_jobs=None, secs=10, rebuild=False):
+    """Run every combination of 'tools', 'workloads', thread counts and
+    affinity settings.  Unlike run_benchmark, which runs one configuration
+    through the Parboil makefiles, this drives the per-benchmark Makefiles
+    and datasets/<tool>/<workload>/data.config.mk like run_template.sh,
+    builds each benchmark once and runs independent configurations
+    side by side on disjoint cores."""
+    if not check_affinities(affinities): return ErrorType.RunFailed
+
+    configs = [sweep.Config(t, platform, w, n, a)
+               for t in tools or platform_tools(platform) for w in workloads
+               for n in threads for a in affinities]
+
+    return run_sweep(configs, outdir, reserve=reserve, max_jobs=max_jobs,
+                     secs=secs, rebuild=rebuild)
+
+def scale_benchmarks(tools, platform, workloads, threads, affinities,
+                     outdir, reserve=0, secs=10, rebuild=False, threshold=0.5):
+    """Strong-scaling study: run every benchmark with each thread count
+    and affinity policy, one run at a time on the whole machine, then
+    report speedup, parallel efficiency and Karp-Flatt serial fraction.
+    A one-thread run is always included as the baseline."""
+    if not check_affinities(affinities): return ErrorType.RunFailed
+
+    coresets = sweep.CoreSets(sweep.read_topology(), reserve)
+    if not threads:
+        # Powers of two, then all cores and all hardware threads
+        hw = coresets.total() * coresets.smt
+        threads = [n for n in [2 ** k for k in range(16)] if n < hw]
+        threads += [coresets.total(), hw]
+    threads = sorted(set([1] + threads))
+
+    # Thread counts a policy cannot place are left out rather than failed
+    configs = [sweep.Config(t, platform, w, n, a, exclusive=True)
+               for t in tools or platform_tools(platform) for w in workloads
+               for a in affinities for n in threads
+               if sweep.Config(t, platform, w, n, a).threadCores(coresets.smt)
+                  <= coresets.total()]
+
+    ret = run_sweep(configs, outdir, reserve=reserve, secs=secs, rebuild=rebuild)
+
+    rows = sweep.scaling(os.path.join(outdir, 'results.jsonl'))
+    if rows:
+        print
+        sweep.write_scaling(rows, outdir, threshold)
+        print "Scaling table in %s, curves: cd %s && gnuplot scaling.gp" % \
+              (os.path.join(outdir, 'scaling.csv'), outdir)
+    return ret
+
+def platform_tools(platform):
+    """All benchmarks of a platform directory."""
+    tooldir = os.path.join(globals.root, 'benchmarks', platform)
+    return sorted([t for t in os.listdir(tooldir)
+                   if os.path.isdir(os.path.join(tooldir, t))])
+
+def check_affinities(affinities):
+    for a in affinities:
+        if a not in sweep.AFFINITIES:
+            print "Unknown affinity '" + a + "'"
+            return False
+    return True
+
+def run_sweep(configs, outdir, **kwargs):
+    cachedir = os.path.join(globals.root, 'build', 'sweep-cache')
+    failed = sweep.sweep(configs, outdir, cachedir, **kwargs)
+
+    print "%d of %d runs failed; results in %s" % \
+          (failed, len(configs), os.path.join(outdir, 'results.jsonl'))
+    if failed: return ErrorType.RunFailed
+    return ErrorType.Success
+
 def debug_benchmark(bmk, version_name, input_name, check=True, extra_opts=[], platform=None):
     """Debug the benchmark."""
     try: impl = bmk.impls[version_name]
@@ -6,11 +6,14 @@
 # may print messages and terminate the program, but should not cause
 # any other action to be taken.
 
+import os
+import time
 from sys import stdout
 from optparse import OptionParser
 
 import actions
 import globals
+import sweep
 
 def invalid_option_message(progname, cmd, args):
     print "Unrecognized command '" + cmd + "'"
@@ -50,6 +53,8 @@ def help_options(progname, cmd, args):
             print "  clean     Clean up generated files in a benchmark"
             print "  compile   Compile a benchmark"
             print "  run       Run a benchmark"
+            print "  sweep     Run benchmarks over data sets, thread counts and affinities"
+            print "  scale     Strong-scaling study of benchmarks over thread counts"
             print ""
             print "To get help on a command: " + progname + " help COMMAND"
 
@@ -175,6 +180,97 @@ def run_options(progname, cmd, args):
 
     return OptionGetter(parser.print_help, run)
 
+def sweep_options(progname, cmd, args):
+    usage_string = progname + " sweep [options] [BENCHMARK...]\nRun every combination of BENCHMARK (default: all of the platform), data set,\nthread count and affinity, several at a time on disjoint cores"
+    parser = OptionParser(usage=usage_string)
+    parser.add_option('-p', "--platform", dest="platform", default="openmp",
+                      help="Benchmark platform directory [default: %default]")
+    parser.add_option('-w', "--workloads", dest="workloads", default="normal",
+                      help="Comma-separated data sets [default: %default]")
+    parser.add_option('-t', "--threads", dest="threads", default=None,
+                      help="Comma-separated thread counts [default: all cores]")
+    parser.add_option('-a', "--affinity", dest="affinity", default="close",
+                      help="Comma-separated affinities among none, close, spread, smt [default: %default]")
+    parser.add_option('-r', "--reserve", type="int", dest="reserve", default=0,
+                      help="Cores kept free for the system [default: %default]")
+    parser.add_option('-j', "--jobs", type="int", dest="jobs", default=None,
+                      help="Most runs at a time [default: as many as fit]")
+    parser.add_option('-s', "--secs", type="int", dest="secs", default=10,
+                      help="SECS given to time-bounded benchmarks [default: %default]")
+    parser.add_option('-o', "--output", dest="output", default=None,
+                      help="Directory for the results [default: logs/sweep-DATE]")
+    parser.add_option('-B', "--rebuild", action="store_true", dest="rebuild",
+                      default=False, help="Rebuild cached binaries")
+    parser.add_option('-v', "--verbose",
+                      action="store_true", dest="verbose", default=False,
+                      help="Produce verbose status messages")
+
+    def run():
+        (opts, pos) = parser.parse_args(args)
+        globals.verbose = opts.verbose
+        try:
+            if opts.threads:
+                threads = [int(x) for x in opts.threads.split(',')]
+            else:
+                threads = [len(sweep.read_topology()) - opts.reserve]
+        except ValueError:
+            print "Thread counts must be integers"
+            return None
+
+        workloads = opts.workloads.split(',')
+        affinities = opts.affinity.split(',')
+        outdir = opts.output or os.path.join(globals.root, 'logs',
+                                             time.strftime('sweep-%Y%m%d-%H%M%S'))
+        return lambda: actions.sweep_benchmarks(pos, opts.platform, workloads, threads,
+                                                affinities, outdir, reserve=opts.reserve,
+                                                max_jobs=opts.jobs, secs=opts.secs,
+                                                rebuild=opts.rebuild)
+
+    return OptionGetter(parser.print_help, run)
+
+def scale_options(progname, cmd, args):
+    usage_string = progname + " scale [options] [BENCHMARK...]\nRun BENCHMARK (default: all of the platform) with 1..N threads under each\naffinity policy, one run at a time, and report speedup, parallel efficiency\nand Karp-Flatt serial fraction"
+    parser = OptionParser(usage=usage_string)
+    parser.add_option('-p', "--platform", dest="platform", default="openmp",
+                      help="Benchmark platform directory [default: %default]")
+    parser.add_option('-w', "--workloads", dest="workloads", default="normal",
+                      help="Comma-separated data sets [default: %default]")
+    parser.add_option('-t', "--threads", dest="threads", default=None,
+                      help="Comma-separated thread counts [default: powers of two, all cores, all hardware threads]")
+    parser.add_option('-a', "--affinity", dest="affinity", default="close,spread,smt",
+                      help="Comma-separated policies: close (compact, one thread per core), spread (across packages), smt (two per core), none [default: %default]")
+    parser.add_option('-e', "--efficiency", type="float", dest="threshold", default=0.5,
+                      help="Efficiency reported as the knee of a kernel [default: %default]")
+    parser.add_option('-r', "--reserve", type="int", dest="reserve", default=0,
+                      help="Cores kept free for the system [default: %default]")
+    parser.add_option('-s', "--secs", type="int", dest="secs", default=10,
+                      help="SECS given to time-bounded benchmarks [default: %default]")
+    parser.add_option('-o', "--output", dest="output", default=None,
+                      help="Directory for the results [default: logs/scale-DATE]")
+    parser.add_option('-B', "--rebuild", action="store_true", dest="rebuild",
+                      default=False, help="Rebuild cached binaries")
+    parser.add_option('-v', "--verbose",
+                      action="store_true", dest="verbose", default=False,
+                      help="Produce verbose status messages")
+
+    def run():
+        (opts, pos) = parser.parse_args(args)
+        globals.verbose = opts.verbose
+        try:
+            threads = [int(x) for x in opts.threads.split(',')] if opts.threads else None
+        except ValueError:
+            print "Thread counts must be integers"
+            return None
+
+        outdir = opts.output or os.path.join(globals.root, 'logs',
+                                             time.strftime('scale-%Y%m%d-%H%M%S'))
+        return lambda: actions.scale_benchmarks(pos, opts.platform, opts.workloads.split(','),
+                                                threads, opts.affinity.split(','), outdir,
+                                                reserve=opts.reserve, secs=opts.secs,
+                                                rebuild=opts.rebuild, threshold=opts.threshold)
+
+    return OptionGetter(parser.print_help, run)
+
 def debug_options(progname, cmd, args):
     usage_string = progname + " debug BENCHMARK VERSION INPUT\nRun version VERSION of BENCHMARK with data set INPUT in debugger"
     parser = OptionParser(usage=usage_string)
@@ -216,6 +312,8 @@ parse_mode_options = {
     'clean'    : clean_options,
     'compile'  : compile_options,
     'run'      : run_options,
+    'sweep'    : sweep_options,
+    'scale'    : scale_options,
     'debug'    : debug_options
     }
 
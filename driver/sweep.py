@@ -0,0 +1,512 @@
+# Sweeps over benchmarks, data sets, thread counts and affinity settings,
+# and the strong-scaling figures derived from them.
+#
+# A sweep builds every benchmark once, keeps the binary in a cache keyed
+# by its sources, and then runs the configurations concurrently, each on
+# its own set of physical cores.  Every run gets a private directory for
+# its output files and its PB_RESULTS record, which is merged with the
+# description of the run into one JSON-lines file for the whole sweep.
+
+import os
+import os.path as path
+import sys
+import time
+import json
+import shutil
+import hashlib
+import subprocess
+
+import globals
+
+# Files that take part in the build of a benchmark
+SOURCE_SUFFIXES = ('.c', '.cc', '.cpp', '.cu', '.h', '.hpp', '.mk')
+SOURCE_NAMES = ('Makefile', 'makefile')
+
+# Builds that do not leave benchmarks/<platform>/<tool>/<tool>: the
+# directory make runs in, the make target (None for the default) and the
+# binary, relative to the benchmark directory.  srad runs srad_v1, whose
+# arguments the datagen data sets use.
+BUILDS = {
+    ('openmp', 'srad')   : ('srad_v1', None, 'srad_v1/srad'),
+    ('openmp', 'kmeans') : ('kmeans_openmp', None, 'kmeans_openmp/kmeans'),
+    ('openmp', 'lud')    : ('omp', None, 'omp/lud_omp'),
+    ('openmp', 'nw')     : ('.', None, 'needle'),
+    ('openmp', 'cfd')    : ('.', 'euler3d_cpu', 'euler3d_cpu'),
+    }
+
+def build_layout(platform, tool):
+    """(make directory, make target, binary) of a benchmark, relative to
+    its directory; see BUILDS."""
+    return BUILDS.get((platform, tool), ('.', None, tool))
+
+# OpenMP binding of each affinity setting
+AFFINITIES = {
+    'none'   : {'OMP_PROC_BIND': 'false'},
+    'close'  : {'OMP_PROC_BIND': 'close'},
+    'spread' : {'OMP_PROC_BIND': 'spread'},
+    'smt'    : {'OMP_PROC_BIND': 'close'},
+    }
+
+class Config(object):
+    """One run of a sweep.
+
+    Fields:
+      tool        Benchmark name, a directory of benchmarks/<platform>.
+      platform    Programming model, e.g. 'openmp'.
+      workload    Data set name, a directory of datasets/<tool>.
+      threads     Number of OpenMP threads.
+      affinity    One of the keys of AFFINITIES.  'smt' puts two threads
+                  on each physical core, the others one.
+      exclusive   True if the run gets the whole machine, so that 'close'
+                  and 'spread' place its threads differently and no other
+                  run shares memory bandwidth with it."""
+
+    def __init__(self, tool, platform, workload, threads, affinity,
+                 exclusive=False):
+        self.tool = tool
+        self.platform = platform
+        self.workload = workload
+        self.threads = threads
+        self.affinity = affinity
+        self.exclusive = exclusive
+
+    def name(self):
+        return "%s-%s-%s-t%d-%s" % (self.platform, self.tool, self.workload,
+                                    self.threads, self.affinity)
+
+    def threadCores(self, smt):
+        """Number of physical cores that run threads of this run."""
+        if self.affinity == 'smt' and smt > 1:
+            return (self.threads + smt - 1) / smt
+        return self.threads
+
+    def coresNeeded(self, coresets):
+        """Number of physical cores this run occupies."""
+        if self.exclusive:
+            return max(coresets.total(), self.threadCores(coresets.smt))
+        return self.threadCores(coresets.smt)
+
+# -----------------------------------------------------------------------------
+# Topology
+
+def read_cpu_list(text):
+    """Parse a kernel CPU list such as '0-3,8,10-11'."""
+    cpus = []
+    for part in text.strip().split(','):
+        if not part: continue
+        if '-' in part:
+            (lo, hi) = part.split('-')
+            cpus.extend(range(int(lo), int(hi) + 1))
+        else:
+            cpus.append(int(part))
+    return cpus
+
+def format_cpu_list(cpus):
+    return ",".join([str(c) for c in cpus])
+
+def read_topology():
+    """Return the online CPUs grouped into physical cores, as a list of
+    (package, [cpu, ...]) ordered by package and core."""
+    sysfs = '/sys/devices/system/cpu'
+    try:
+        online = read_cpu_list(open(path.join(sysfs, 'online')).read())
+    except IOError:
+        online = range(os.sysconf('SC_NPROCESSORS_ONLN'))
+
+    cores = {}
+    for cpu in online:
+        topo = path.join(sysfs, 'cpu%d' % cpu, 'topology')
+        try:
+            package = int(open(path.join(topo, 'physical_package_id')).read())
+            core = int(open(path.join(topo, 'core_id')).read())
+        except (IOError, ValueError):
+            (package, core) = (0, cpu)
+        cores.setdefault((package, core), []).append(cpu)
+
+    return [(key[0], sorted(cpus)) for (key, cpus) in sorted(cores.items())]
+
+class CoreSets(object):
+    """Hands out disjoint sets of physical cores.  A set is taken from a
+    single package whenever it fits in one, so that concurrent runs share
+    neither cores nor, where possible, a last-level cache."""
+
+    def __init__(self, topology, reserve=0):
+        # The first 'reserve' cores are left to the system and the runner
+        self.cores = topology[reserve:]
+        self.free = [True] * len(self.cores)
+        self.smt = max([len(cpus) for (pkg, cpus) in self.cores] or [1])
+
+    def total(self):
+        return len(self.cores)
+
+    def take(self, n):
+        """Reserve n cores; return their indices or None if they are
+        not available now."""
+        free = [i for i in range(len(self.cores)) if self.free[i]]
+        if len(free) < n: return None
+
+        # Prefer the package with the fewest free cores that still fits
+        # the request, so that large requests find whole packages later
+        packages = {}
+        for i in free:
+            packages.setdefault(self.cores[i][0], []).append(i)
+        fitting = [ids for ids in packages.values() if len(ids) >= n]
+        if fitting:
+            chosen = min(fitting, key=len)[:n]
+        else:
+            chosen = free[:n]
+
+        for i in chosen: self.free[i] = False
+        return chosen
+
+    def release(self, ids):
+        for i in ids: self.free[i] = True
+
+    def places(self, ids, threads, affinity):
+        """CPUs and OMP_PLACES (None for no binding) of a run with
+        'threads' threads on the cores 'ids'.  'close' and 'smt' use the
+        first cores of 'ids', 'spread' and 'none' all of them.  Except
+        with 'smt' only the first hardware thread of a core runs
+        benchmark threads and its siblings stay idle."""
+        if affinity == 'smt':
+            ids = ids[:(threads + self.smt - 1) / self.smt]
+            cpus = []
+            for i in ids: cpus.extend(self.cores[i][1])
+            return (cpus, ",".join(["{%s}" % format_cpu_list(self.cores[i][1])
+                                    for i in ids]))
+
+        if affinity == 'close': ids = ids[:threads]
+        cpus = [self.cores[i][1][0] for i in ids]
+        if affinity == 'none': return (cpus, None)
+        return (cpus, ",".join(["{%d}" % c for c in cpus]))
+
+# -----------------------------------------------------------------------------
+# Binary cache
+
+def source_fingerprint(tooldir, make_vars):
+    """Hash of everything that goes into a build of the benchmark in
+    'tooldir': its sources and Makefile, the common parboil library and
+    the make variables."""
+    h = hashlib.sha1()
+    common = path.join(globals.root, 'benchmarks', 'common')
+    for top in [tooldir, path.join(common, 'include'), path.join(common, 'src')]:
+        for (dirpath, dirnames, filenames) in os.walk(top):
+            dirnames.sort()
+            # Other versions of the benchmark are not part of this build
+            if dirpath == tooldir and 'src' in dirnames: dirnames.remove('src')
+            for f in sorted(filenames):
+                if not (f.endswith(SOURCE_SUFFIXES) or f in SOURCE_NAMES): continue
+                p = path.join(dirpath, f)
+                h.update(path.relpath(p, globals.root))
+                h.update(open(p, 'rb').read())
+    for (k, v) in sorted(make_vars.items()):
+        h.update("%s=%s\n" % (k, v))
+    return h.hexdigest()[:16]
+
+def cached_binary(platform, tool, cachedir, make_vars={}, rebuild=False):
+    """Return the path of the cached binary of 'tool', building it first
+    if its sources changed since it was cached.  Returns None if the
+    build failed; the compiler output is kept next to the binary."""
+    tooldir = path.join(globals.root, 'benchmarks', platform, tool)
+    (subdir, target, built) = build_layout(platform, tool)
+    makedir = path.normpath(path.join(tooldir, subdir))
+    built = path.join(tooldir, built)
+    key = source_fingerprint(tooldir, make_vars)
+    entry = path.join(cachedir, platform, tool, key)
+    binary = path.join(entry, path.basename(built))
+
+    if path.exists(binary) and not rebuild:
+        return binary
+
+    if not path.isdir(entry): os.makedirs(entry)
+    log = open(path.join(entry, 'compile.log'), 'w')
+    args = ["make"] + ["%s=%s" % kv for kv in sorted(make_vars.items())]
+    if target: args.append(target)
+    print "Building %s/%s (%s)" % (platform, tool, key)
+    subprocess.call(["make", "clean"], cwd=makedir, stdout=log, stderr=subprocess.STDOUT)
+    rc = subprocess.call(args, cwd=makedir, stdout=log, stderr=subprocess.STDOUT)
+    log.close()
+
+    if rc != 0 or not os.access(built, os.X_OK):
+        print "Build of %s/%s failed, see %s" % (platform, tool, path.join(entry, 'compile.log'))
+        return None
+
+    shutil.copy2(built, binary)
+    return binary
+
+# -----------------------------------------------------------------------------
+# Data sets
+
+def read_data_config(tool, workload):
+    """Return (input words, output words) of a data set, from the same
+    datasets/<tool>/<workload>/data.config.mk that run_template.sh
+    sources, or None if there is no such data set."""
+    config = path.join(globals.root, 'datasets', tool, workload, 'data.config.mk')
+    if not path.exists(config): return None
+
+    script = '. "$1"; printf "%s\\n%s\\n" "$in_file" "$out_file"'
+    out = subprocess.Popen(["sh", "-c", script, "sh", config],
+                           cwd=path.dirname(config),
+                           stdout=subprocess.PIPE).communicate()[0]
+    lines = (out.split('\n') + ['', ''])[:2]
+    return (lines[0].split(), lines[1].split())
+
+# -----------------------------------------------------------------------------
+# Running
+
+class Run(object):
+    """A configuration that has been started."""
+
+    def __init__(self, config, rundir, cores, cpus, proc):
+        self.config = config
+        self.rundir = rundir
+        self.cores = cores
+        self.cpus = cpus
+        self.proc = proc
+        self.start = time.time()
+
+def start_run(config, binary, data, coresets, cores, outdir, secs):
+    """Launch one configuration on 'cores' and return its Run."""
+    (in_words, out_words) = data
+    rundir = path.join(outdir, 'runs', config.name())
+    if not path.isdir(rundir): os.makedirs(rundir)
+
+    # Output files go to the run directory so that concurrent runs of a
+    # benchmark do not overwrite each other's output
+    out_words = [w if w.startswith('-') else path.join(rundir, path.basename(w))
+                 for w in out_words]
+
+    (cpus, places) = coresets.places(cores, config.threads, config.affinity)
+    env = dict(os.environ)
+    env.update(globals.program_env or {})
+    env.update(AFFINITIES[config.affinity])
+    env.update({'OMP_NUM_THREADS': str(config.threads),
+                'SECS': str(secs),
+                'PB_RESULTS': path.join(rundir, 'results.jsonl'),
+                'PB_DATASET': config.workload})
+    if places: env['OMP_PLACES'] = places
+    else: env.pop('OMP_PLACES', None)
+
+    args = [binary] + in_words + out_words
+    # taskset keeps threads that OpenMP does not bind on the same CPUs
+    if spawn_prefix(): args = spawn_prefix() + [format_cpu_list(cpus)] + args
+
+    if globals.verbose:
+        print "Running '" + " ".join(args) + "' in " + rundir
+
+    log = open(path.join(rundir, 'output.log'), 'w')
+    proc = subprocess.Popen(args, cwd=rundir, env=env,
+                            stdout=log, stderr=subprocess.STDOUT)
+    log.close()
+    return Run(config, rundir, cores, cpus, proc)
+
+_taskset = None
+
+def spawn_prefix():
+    """['taskset', '-c'] if taskset is installed, else []."""
+    global _taskset
+    if _taskset is None:
+        found = [d for d in os.environ.get('PATH', '').split(os.pathsep)
+                 if os.access(path.join(d, 'taskset'), os.X_OK)]
+        _taskset = ['taskset', '-c'] if found else []
+    return _taskset
+
+def finish_run(run, results):
+    """Merge the records of a finished run with its configuration and
+    append them to the sweep's results file."""
+    c = run.config
+    info = {'run': c.name(), 'platform': c.platform, 'workload': c.workload,
+            'affinity': c.affinity, 'threads_requested': c.threads,
+            'cpus': format_cpu_list(run.cpus), 'exit_status': run.proc.returncode,
+            'run_wall_s': round(time.time() - run.start, 6)}
+
+    records = []
+    try:
+        for line in open(path.join(run.rundir, 'results.jsonl')):
+            if line.strip(): records.append(json.loads(line))
+    except (IOError, ValueError):
+        pass
+    # Benchmarks that do not emit a record still leave one of the run
+    if not records: records = [{'benchmark': c.tool, 'dataset': c.workload}]
+
+    for r in records:
+        r.update(info)
+        results.write(json.dumps(r, sort_keys=True) + "\n")
+    results.flush()
+
+def sweep(configs, outdir, cachedir, reserve=0, max_jobs=None, secs=10,
+          rebuild=False, make_vars={}):
+    """Build and run all configurations.  Returns the number of runs that
+    failed to build, could not be placed or exited with an error."""
+    coresets = CoreSets(read_topology(), reserve)
+    failed = 0
+
+    if not path.isdir(outdir): os.makedirs(outdir)
+
+    # Build every benchmark once, before anything runs, so that builds
+    # do not disturb the measurements
+    binaries = {}
+    for key in sorted(set([(c.platform, c.tool) for c in configs])):
+        binaries[key] = cached_binary(key[0], key[1], cachedir, make_vars, rebuild)
+
+    datas = {}
+    for key in sorted(set([(c.tool, c.workload) for c in configs])):
+        datas[key] = read_data_config(key[0], key[1])
+        if datas[key] is None:
+            print "No data set %s for %s, its runs are skipped" % (key[1], key[0])
+
+    pending = []
+    for c in configs:
+        data = datas[(c.tool, c.workload)]
+        if binaries[(c.platform, c.tool)] is None or data is None:
+            failed += 1
+        elif c.coresNeeded(coresets) > coresets.total():
+            print "%s needs %d cores, only %d available, skipped" % \
+                  (c.name(), c.coresNeeded(coresets), coresets.total())
+            failed += 1
+        else:
+            pending.append((c, data))
+
+    # Largest runs first: they are the hardest to place
+    pending.sort(key=lambda p: -p[0].coresNeeded(coresets))
+
+    results = open(path.join(outdir, 'results.jsonl'), 'a')
+    running = []
+    total = len(pending)
+    done = 0
+    try:
+        while pending or running:
+            # Start every pending run that fits on the free cores
+            for p in list(pending):
+                if max_jobs is not None and len(running) >= max_jobs: break
+                (c, data) = p
+                cores = coresets.take(c.coresNeeded(coresets))
+                if cores is None: continue
+                pending.remove(p)
+                running.append(start_run(c, binaries[(c.platform, c.tool)], data,
+                                         coresets, cores, outdir, secs))
+
+            time.sleep(0.05)
+
+            for run in list(running):
+                if run.proc.poll() is None: continue
+                running.remove(run)
+                coresets.release(run.cores)
+                finish_run(run, results)
+                done += 1
+                status = "ok" if run.proc.returncode == 0 else \
+                         "exit status %d" % run.proc.returncode
+                print "[%d/%d] %s on cpus %s: %s" % \
+                      (done, total, run.config.name(), format_cpu_list(run.cpus), status)
+                if run.proc.returncode != 0: failed += 1
+    except KeyboardInterrupt:
+        for run in running: run.proc.terminate()
+        raise
+    finally:
+        results.close()
+
+    return failed
+
+# -----------------------------------------------------------------------------
+# Scaling
+
+def read_results(results_path):
+    """Seconds per iteration of the successful runs in a results file, as
+    a dictionary from (benchmark, workload, affinity) to a dictionary
+    from thread count to the list of times of its runs.  The thread
+    count is the one the benchmark reports it ran with; runs where that
+    differs from the requested count (a thread argument overriding
+    OMP_NUM_THREADS) are left out with a warning."""
+    times = {}
+    for line in open(results_path):
+        if not line.strip(): continue
+        r = json.loads(line)
+        if r.get('exit_status') != 0: continue
+        # The median resists outliers better; runs without a harness
+        # only have the mean
+        t = r.get('median_s', r.get('mean_s'))
+        if t is None or t <= 0: continue
+        key = (r['benchmark'], r['workload'], r['affinity'])
+        requested = r.get('threads_requested')
+        threads = r.get('threads', requested)
+        if requested is not None and threads != requested:
+            print "%s: ran %d threads instead of %d, left out of the scaling" % \
+                  (r.get('run', "/".join(key)), threads, requested)
+            continue
+        times.setdefault(key, {}).setdefault(threads, []).append(t)
+    return times
+
+def median(xs):
+    xs = sorted(xs)
+    n = len(xs)
+    return xs[n / 2] if n % 2 else 0.5 * (xs[n / 2 - 1] + xs[n / 2])
+
+def scaling(results_path):
+    """Strong-scaling figures of every (benchmark, workload, affinity)
+    with a one-thread run: a list of (benchmark, workload, affinity,
+    threads, seconds, speedup, efficiency, serial fraction).  The serial
+    fraction is the Karp-Flatt metric (1/S - 1/p) / (1 - 1/p), undefined
+    (None) for one thread; if it grows with p the loss is parallel
+    overhead rather than serial code."""
+    rows = []
+    for (key, by_threads) in sorted(read_results(results_path).items()):
+        if 1 not in by_threads: continue
+        t1 = median(by_threads[1])
+        for p in sorted(by_threads):
+            tp = median(by_threads[p])
+            s = t1 / tp
+            e = s / p
+            kf = (1.0 / s - 1.0 / p) / (1.0 - 1.0 / p) if p > 1 else None
+            rows.append(key + (p, tp, s, e, kf))
+    return rows
+
+def write_scaling(rows, outdir, threshold=0.5):
+    """Print the scaling table, write it to scaling.csv and write
+    scaling.gp, a gnuplot script for the speedup and efficiency curves.
+    For every kernel the summary names the thread count of the best
+    speedup and the first one whose efficiency drops below 'threshold'."""
+    csv = open(path.join(outdir, 'scaling.csv'), 'w')
+    csv.write("benchmark,workload,affinity,threads,seconds,speedup,efficiency,karp_flatt\n")
+    print "%-12s %-8s %-7s %7s %12s %8s %6s %8s" % \
+          ("benchmark", "dataset", "policy", "threads", "seconds", "speedup", "eff", "serial")
+
+    groups = []
+    for r in rows:
+        kf = "" if r[7] is None else "%.4f" % r[7]
+        csv.write("%s,%s,%s,%d,%.9g,%.4f,%.4f,%s\n" % (r[:4] + r[4:7] + (kf,)))
+        print "%-12s %-8s %-7s %7d %12.6f %8.2f %6.2f %8s" % (r[:7] + (kf or "-",))
+        if not groups or groups[-1][0] != r[:3]: groups.append((r[:3], []))
+        groups[-1][1].append(r)
+    csv.close()
+
+    print
+    for (key, rs) in groups:
+        best = max(rs, key=lambda r: r[5])
+        low = [r[3] for r in rs if r[6] < threshold]
+        msg = "%s/%s/%s: best speedup %.2f at %d threads" % (key + (best[5], best[3]))
+        if low: msg += ", efficiency below %.2f from %d threads" % (threshold, low[0])
+        print msg
+
+    # One data block per kernel and policy, titled by its first line
+    dat = open(path.join(outdir, 'scaling.dat'), 'w')
+    for (key, rs) in groups:
+        dat.write('"%s/%s/%s"\n' % key)
+        for r in rs: dat.write("%d %.9g %.9g\n" % (r[3], r[5], r[6]))
+        dat.write("\n\n")
+    dat.close()
+
+    gp = open(path.join(outdir, 'scaling.gp'), 'w')
+    gp.write("""# gnuplot scaling.gp
+set terminal svg size 900,600
+set key outside right
+set logscale x 2
+set xlabel 'threads'
+set output 'speedup.svg'
+set ylabel 'speedup'
+plot for [i=0:%d] 'scaling.dat' index i using 1:2 with linespoints title columnheader(1)
+set output 'efficiency.svg'
+set ylabel 'parallel efficiency'
+set yrange [0:1.2]
+plot for [i=0:%d] 'scaling.dat' index i using 1:3 with linespoints title columnheader(1)
+""" % (len(groups) - 1, len(groups) - 1))
+    gp.close()
@@ -37,6 +37,9 @@ source $dataconfig
 echo "start running application..."
 echo $in_file
 echo $out_file
+# OpenMP benchmarks also append one JSON record per run to PB_RESULTS
+export PB_RESULTS="${PB_RESULTS:-$LOG_PATH/results.jsonl}"
+export PB_DATASET="$workload"
 SECS=${RUN_SECS} ./$tool $in_file $out_file | tee $LOG_PATH/benchmark_${tool}_${platform}_${dev}_${workload}_perf.log
 echo end running application...
 echo sleep $SLEEP_SECS seconds...
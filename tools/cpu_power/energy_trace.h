@@ -0,0 +1,148 @@
+/* Binary energy trace written by power_gov -t. */
+
+/*! \file energy_trace.h
+ * Layout of the energy trace ring buffer and helpers for the processes
+ * that map it.
+ *
+ * The trace file is a header followed by a ring of fixed-size records and
+ * is meant to be mmap'd. power_gov appends one sample record per node
+ * each period; a benchmark that attaches to the same file appends phase
+ * begin/end records around the regions it wants to attribute. A writer
+ * reserves a slot with an atomic increment of head and publishes it by
+ * storing the slot's sequence number last, so readers skip records that
+ * are still being written or have been overwritten. Times are
+ * CLOCK_MONOTONIC nanoseconds, which all processes share.
+ */
+
+#ifndef _h_energy_trace
+#define _h_energy_trace
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ENERGY_TRACE_MAGIC   0x50525445u /* "ETRP" */
+#define ENERGY_TRACE_VERSION 1
+#define ENERGY_TRACE_DOMAINS 4           /* RAPL_PKG ... RAPL_DRAM */
+#define ENERGY_TRACE_LABEL   32
+
+enum ENERGY_TRACE_TYPE { ENERGY_TRACE_SAMPLE, ENERGY_TRACE_BEGIN, ENERGY_TRACE_END };
+
+typedef struct energy_trace_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_nodes;
+    uint64_t capacity;                              /* records in the ring */
+    uint64_t period_ns;
+    uint32_t domain_mask;                           /* bit d: domain d is sampled */
+    uint32_t running;                               /* cleared when the sampler exits */
+    double   range_joules[ENERGY_TRACE_DOMAINS];    /* counter wraparound */
+    uint64_t overruns;                              /* periods missed by the sampler */
+    uint64_t head;                                  /* records ever reserved */
+    char     pad[40];
+} energy_trace_header_t;
+
+typedef struct energy_trace_record_t {
+    uint64_t seq;                                   /* slot index + 1 once published */
+    uint64_t time_ns;
+    uint32_t type;                                  /* enum ENERGY_TRACE_TYPE */
+    uint32_t id;                                    /* sample: node, phase: pid */
+    union {
+        double joules[ENERGY_TRACE_DOMAINS];        /* raw counters, wrapping */
+        char   label[ENERGY_TRACE_LABEL];
+    } u;
+    uint64_t reserved;
+} energy_trace_record_t;
+
+static inline energy_trace_record_t *
+energy_trace_records(energy_trace_header_t *trace)
+{
+    return (energy_trace_record_t *)(trace + 1);
+}
+
+static inline uint64_t
+energy_trace_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* Reserve the next slot; fill it in and hand it to energy_trace_publish() */
+static inline energy_trace_record_t *
+energy_trace_reserve(energy_trace_header_t *trace, uint64_t *seq)
+{
+    uint64_t               index = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+    energy_trace_record_t *record = &energy_trace_records(trace)[index % trace->capacity];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *seq = index + 1;
+    return record;
+}
+
+static inline void
+energy_trace_publish(energy_trace_record_t *record, uint64_t seq)
+{
+    __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Map a trace that power_gov is writing.
+ * \return the trace, or NULL if path is not a trace
+ */
+static inline energy_trace_header_t *
+energy_trace_attach(const char *path)
+{
+    struct stat            st;
+    energy_trace_header_t *trace;
+    int                    fd = open(path, O_RDWR);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(energy_trace_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    trace = (energy_trace_header_t *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == trace)
+        return NULL;
+    if (ENERGY_TRACE_MAGIC != trace->magic || ENERGY_TRACE_VERSION != trace->version ||
+        sizeof(energy_trace_record_t) != trace->record_size) {
+        munmap(trace, st.st_size);
+        return NULL;
+    }
+    return trace;
+}
+
+static inline void
+energy_trace_detach(energy_trace_header_t *trace)
+{
+    munmap(trace, sizeof(energy_trace_header_t) + trace->capacity * sizeof(energy_trace_record_t));
+}
+
+/*!
+ * \brief Record the begin or end (ENERGY_TRACE_BEGIN/END) of a phase.
+ */
+static inline void
+energy_trace_mark(energy_trace_header_t *trace, enum ENERGY_TRACE_TYPE type, const char *label)
+{
+    uint64_t               seq;
+    energy_trace_record_t *record = energy_trace_reserve(trace, &seq);
+
+    record->time_ns = energy_trace_now();
+    record->type = type;
+    record->id = (uint32_t) getpid();
+    memset(record->u.label, 0, ENERGY_TRACE_LABEL);
+    strncpy(record->u.label, label, ENERGY_TRACE_LABEL - 1);
+    energy_trace_publish(record, seq);
+}
+
+#endif
@@ -14,11 +14,53 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "msr.h"
 
 
+/* One descriptor per CPU, opened on first use and kept until close_msr().
+ * Opening /dev/cpu/N/msr costs far more than the rdmsr behind a pread, so
+ * at sampling rates of 1 kHz the open would dominate every read. */
+static int *msr_fd = NULL;
+static int  msr_fd_count = 0;
+
+static int
+get_msr_fd(int cpu)
+{
+    char msr_path[32];
+    int  i, count;
+
+    if (cpu < 0)
+        return -1;
+
+    if (cpu >= msr_fd_count) {
+        count = (int) sysconf(_SC_NPROCESSORS_CONF);
+        if (count <= cpu)
+            count = cpu + 1;
+        msr_fd = (int *) realloc(msr_fd, count * sizeof(int));
+        if (msr_fd == NULL) {
+            msr_fd_count = 0;
+            return -1;
+        }
+        for (i = msr_fd_count; i < count; i++)
+            msr_fd[i] = -1;
+        msr_fd_count = count;
+    }
+
+    if (msr_fd[cpu] < 0) {
+        sprintf(msr_path, "/dev/cpu/%d/msr", cpu);
+        /* write_msr shares this descriptor, so ask for write access; fall
+         * back to read-only, which is enough for monitoring */
+        msr_fd[cpu] = open(msr_path, O_RDWR);
+        if (msr_fd[cpu] < 0)
+            msr_fd[cpu] = open(msr_path, O_RDONLY);
+    }
+
+    return msr_fd[cpu];
+}
+
 /*
  * read_msr
  *
@@ -29,19 +71,37 @@ read_msr(int       cpu,
          unsigned int address,
          uint64_t *value)
 {
-    int   err = 0;
-    char  msr_path[32];
-    FILE *fp = NULL;
-
-    sprintf(msr_path, "/dev/cpu/%d/msr", cpu);
-    err = ((fp = fopen(msr_path, "r")) == NULL);
-    if (!err)
-        err = (fseek(fp, address, SEEK_CUR) != 0);
-    if (!err)
-        err = (fread(value, sizeof(uint64_t), 1, fp) != 1);
-    if (fp != NULL)
-        fclose(fp);
-    return err;
+    int fd = get_msr_fd(cpu);
+
+    if (fd < 0)
+        return MY_ERROR;
+    if (pread(fd, value, sizeof(uint64_t), address) != sizeof(uint64_t))
+        return MY_ERROR;
+    return 0;
+}
+
+/*
+ * read_msr_batch
+ *
+ * Reads count MSRs of one CPU through its cached descriptor.
+ * Will return 0 on success and MY_ERROR if any read failed.
+ */
+int
+read_msr_batch(int                 cpu,
+               const unsigned int *addresses,
+               uint64_t           *values,
+               int                 count)
+{
+    int fd = get_msr_fd(cpu);
+    int i;
+
+    if (fd < 0)
+        return MY_ERROR;
+    for (i = 0; i < count; i++) {
+        if (pread(fd, &values[i], sizeof(uint64_t), addresses[i]) != sizeof(uint64_t))
+            return MY_ERROR;
+    }
+    return 0;
 }
 
 
@@ -57,18 +117,30 @@ write_msr(int      cpu,
           unsigned int address,
           uint64_t value)
 {
-    int   err = 0;
-    char  msr_path[32];
-    FILE *fp;
-
-    sprintf(msr_path, "/dev/cpu/%d/msr", cpu);
-    err = ((fp = fopen(msr_path, "w")) == NULL);
-    if (!err)
-        err = (fseek(fp, address, SEEK_CUR) != 0);
-    if (!err)
-        err = (fwrite(&value, sizeof(uint64_t), 1, fp) != 1);
-    if (fp != NULL)
-        fclose(fp);
-    return err;
+    int fd = get_msr_fd(cpu);
+
+    if (fd < 0)
+        return MY_ERROR;
+    if (pwrite(fd, &value, sizeof(uint64_t), address) != sizeof(uint64_t))
+        return MY_ERROR;
+    return 0;
 }
 
+/*
+ * close_msr
+ *
+ * Closes the descriptors cached by read_msr/write_msr.
+ */
+void
+close_msr()
+{
+    int i;
+
+    for (i = 0; i < msr_fd_count; i++) {
+        if (msr_fd[i] >= 0)
+            close(msr_fd[i]);
+    }
+    free(msr_fd);
+    msr_fd = NULL;
+    msr_fd_count = 0;
+}
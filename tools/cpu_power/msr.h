@@ -154,10 +154,23 @@ typedef performance_throttling_status_msr_t dram_performance_throttling_status_m
  */
 int read_msr(int cpu, unsigned int address, uint64_t *val);
 
+/**
+ * Read count MSRs on the given CPU, e.g. all energy status registers of a
+ * package for one power sample.
+ *
+ * @return            0 on success and MY_ERROR on failure
+ */
+int read_msr_batch(int cpu, const unsigned int *addresses, uint64_t *values, int count);
+
 /**
  * Write the given value to the given MSR on the given CPU.
  *
  * @return            0 on success and MY_ERROR on failure
  */
 int write_msr(int cpu, unsigned int address, uint64_t val);
+
+/**
+ * Close the per-CPU descriptors that read_msr and write_msr keep open.
+ */
+void close_msr();
 #endif
@@ -17,8 +17,12 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "rapl.h"
+#include "energy_trace.h"
 
 unsigned int  set_rapl = 0;
 unsigned int  print_info = 0;
@@ -35,6 +39,11 @@ int           package = -1;
 unsigned int  delay_us = 0;
 double        delay_unit = 1000000.0;
 
+char         *trace_path = NULL;
+unsigned long trace_records = 1 << 20;
+int           sampler_cpu = 0;
+volatile sig_atomic_t stop_sampling = 0;
+
 int
 print_pkg_rapl_power_limit_control(unsigned int node)
 {
@@ -570,15 +579,51 @@ do_print_info(unsigned int power_domain, unsigned int node)
 }
 
 
+void
+handle_stop_sampling(int sig)
+{
+    stop_sampling = 1;
+}
+
+/*
+ * Sleep until the deadline one period after *next_ns. Deadlines are
+ * absolute, so the time spent reading and writing samples does not add up
+ * into the sampling period. If the sampler fell more than a period behind,
+ * the missed deadlines are skipped instead of being sampled back to back.
+ * Returns the number of skipped periods.
+ */
+unsigned long
+wait_next_period(uint64_t *next_ns)
+{
+    uint64_t        period_ns = (uint64_t) delay_us * 1000;
+    uint64_t        now = energy_trace_now();
+    unsigned long   skipped = 0;
+    struct timespec deadline;
+
+    *next_ns += period_ns;
+    if (now > *next_ns + period_ns) {
+        skipped = (now - *next_ns) / period_ns;
+        *next_ns += skipped * period_ns;
+    }
+
+    deadline.tv_sec = *next_ns / 1000000000ull;
+    deadline.tv_nsec = *next_ns % 1000000000ull;
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) && !stop_sampling)
+        ;
+    return skipped;
+}
+
 void
 do_print_energy_info()
 {
     int i = 0;
     int domain = 0;
     unsigned int node;
-    double new_sample;
+    double sample[RAPL_NR_DOMAIN];
     double delta;
     double power;
+    double interval;
+    uint64_t next_ns, prev_ns, now_ns;
     double **prev_sample = (double**) malloc(num_node * sizeof(double *));
 
     for (i = 0; i < num_node; i++) {
@@ -608,31 +653,34 @@ do_print_energy_info()
     }
     fprintf(stdout, "\n");
 
-    /* Read initial values */
+    /* Read initial values, one batched read per node */
     for (i = node; i < num_node; i++) {
-        for (domain = 0; domain < RAPL_NR_DOMAIN; ++domain) {
-            if(is_supported_domain(domain)) {
-                prev_sample[i][domain] = get_rapl_energy_info(domain, i);
-            }
-        }
+        get_rapl_energy_sample(i, prev_sample[i]);
     }
+    prev_ns = next_ns = energy_trace_now();
 
     /* Begin sampling */
-    while (1) {
-        usleep(delay_us);
+    while (!stop_sampling) {
+        wait_next_period(&next_ns);
+
+        /* Divide by the interval actually elapsed, which differs from
+         * the period when deadlines were skipped */
+        now_ns = energy_trace_now();
+        interval = (now_ns - prev_ns) * 1e-9;
+        prev_ns = now_ns;
 
         for (i = node; i < num_node; i++) {
+            get_rapl_energy_sample(i, sample);
             fprintf(stdout, "%d", i);
             for (domain = 0; domain < RAPL_NR_DOMAIN; ++domain) {
                 if(is_supported_domain(domain)) {
-                    new_sample = get_rapl_energy_info(domain, i);
-                    delta = new_sample - prev_sample[i][domain];
+                    delta = sample[domain] - prev_sample[i][domain];
                     /* Handle wraparound */
                     if (delta < 0) {
-                        delta += MAX_ENERGY_STATUS_JOULES;
+                        delta += get_rapl_energy_range(domain);
                     }
-                    prev_sample[i][domain] = new_sample;
-                    power = delta / ((double) delay_us / delay_unit);
+                    prev_sample[i][domain] = sample[domain];
+                    power = delta / interval;
                     fprintf(stdout, ",%.0lf",power);
                 }
             }
@@ -648,6 +696,88 @@ do_print_energy_info()
     free(prev_sample); 
 }
 
+/*
+ * Sample into the binary ring buffer at trace_path instead of printing.
+ * The sampler runs pinned to sampler_cpu until SIGINT or SIGTERM; every
+ * period it appends one record with the raw energy counters of each node.
+ * Convert the trace with trace2csv.
+ */
+void
+do_trace_energy_info()
+{
+    energy_trace_header_t *trace;
+    energy_trace_record_t *record;
+    size_t                 size = sizeof(energy_trace_header_t) + trace_records * sizeof(energy_trace_record_t);
+    uint64_t               next_ns, seq;
+    unsigned int           first, last, i, domain;
+    struct sigaction       sa;
+    int                    fd;
+
+    first = (-1 != package) ? package : 0;
+    last = (-1 != package) ? package + 1 : num_node;
+
+    fd = open(trace_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || 0 != ftruncate(fd, size)) {
+        perror(trace_path);
+        _exit(-1);
+    }
+    /* Populate the ring up front so the sampler never takes a page fault */
+    trace = (energy_trace_header_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == trace) {
+        perror(trace_path);
+        _exit(-1);
+    }
+
+    trace->version = ENERGY_TRACE_VERSION;
+    trace->record_size = sizeof(energy_trace_record_t);
+    trace->num_nodes = num_node;
+    trace->capacity = trace_records;
+    trace->period_ns = (uint64_t) delay_us * 1000;
+    for (domain = 0; domain < RAPL_NR_DOMAIN; domain++) {
+        if (is_supported_domain(domain)) {
+            trace->domain_mask |= 1u << domain;
+            trace->range_joules[domain] = get_rapl_energy_range(domain);
+        }
+    }
+    trace->running = 1;
+    __atomic_store_n(&trace->magic, ENERGY_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    if (0 != bind_context(sampler_cpu)) {
+        fprintf(stdout, "Could not pin the sampler to CPU %d.\n", sampler_cpu);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop_sampling;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stdout, "Tracing every %u us into %s, stop with Ctrl-C.\n", delay_us, trace_path);
+    fflush(stdout);
+
+    next_ns = energy_trace_now();
+    while (!stop_sampling) {
+        trace->overruns += wait_next_period(&next_ns);
+        if (stop_sampling)
+            break;
+
+        for (i = first; i < last; i++) {
+            record = energy_trace_reserve(trace, &seq);
+            get_rapl_energy_sample(i, record->u.joules);
+            record->time_ns = energy_trace_now();
+            record->type = ENERGY_TRACE_SAMPLE;
+            record->id = i;
+            energy_trace_publish(record, seq);
+        }
+    }
+
+    trace->running = 0;
+    fprintf(stdout, "%llu records, %llu missed periods.\n",
+            (unsigned long long) trace->head, (unsigned long long) trace->overruns);
+    msync(trace, size, MS_SYNC);
+    munmap(trace, size);
+}
+
 void
 usage()
 {
@@ -656,6 +786,8 @@ usage()
     fprintf(stdout, "%s\n", progname);
     fprintf(stdout, "\nTo print energy info: \n");
     fprintf(stdout, "%s -e [delay_ms] [-p [package] optional]\n", progname);
+    fprintf(stdout, "\nTo trace energy into a binary ring buffer (convert with trace2csv): \n");
+    fprintf(stdout, "%s -e [delay_ms] -t [trace_file] [-n [records] optional] [-c [cpu] optional] [-p [package] optional]\n", progname);
     fprintf(stdout, "\nTo change RAPL settings: \n");
     fprintf(stdout, "%s -r [RAPL_setting] -s [setting_value] -d [power domain] [-p [package] optional]\n", progname);
     fprintf(stdout, "\n\t The available RAPL settings are:\n");
@@ -690,11 +822,11 @@ menu_1:
     if(0 == delay_ms_temp) {
         _exit(0);
     }
-    if(delay_ms_temp > 50) {
+    if(delay_ms_temp >= 1) {
         delay_us = delay_ms_temp * 1000;
         do_print_energy_info();
     } else {
-        fprintf(stdout, "Delay must be greater than 50 ms.\n");
+        fprintf(stdout, "Delay must be at least 1 ms.\n");
         goto menu_1;
     }
 }
@@ -927,7 +1059,7 @@ cmdline(int argc, char **argv)
         _exit(0);
     }
 
-    while ((opt = getopt(argc, argv, "ie:hr:s:d:p:")) != -1) {
+    while ((opt = getopt(argc, argv, "ie:hr:s:d:p:t:n:c:")) != -1) {
         switch (opt) {
         case 'i':
             print_info = 1;
@@ -935,16 +1067,29 @@ cmdline(int argc, char **argv)
         case 'e':
             print_energy_info = 1;
             delay_ms_temp = atoi(optarg);
-            if(delay_ms_temp > 50) {
+            if(delay_ms_temp >= 1) {
                 delay_us = delay_ms_temp * 1000;
             } else {
-                fprintf(stdout, "Delay must be greater than 50 ms.\n");
+                fprintf(stdout, "Delay must be at least 1 ms.\n");
                 _exit(-1);
             }
             break;
         case 'p':
             package = atoi(optarg);
             break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'n':
+            trace_records = strtoul(optarg, NULL, 10);
+            if (0 == trace_records) {
+                fprintf(stdout, "The trace must hold at least one record.\n");
+                _exit(-1);
+            }
+            break;
+        case 'c':
+            sampler_cpu = atoi(optarg);
+            break;
         case 'r':
             svalue = optarg;
             set_rapl = 1;
@@ -971,6 +1116,11 @@ cmdline(int argc, char **argv)
     }
 
 
+    if (trace_path && !print_energy_info) {
+        fprintf(stdout, "Option -t must be used with -e.\n");
+        _exit(-1);
+    }
+
     if (opt_s || opt_r) {
         if (!(opt_s && opt_r && opt_d)) {
             fprintf(stdout, "Options -r, -d and -s must be used together.\n");
@@ -994,6 +1144,12 @@ main(int argc, char **argv)
 
     cmdline(argc, argv);
 
+    // Only the MSR backend reaches the limit and policy registers
+    if ((print_info || set_rapl) && RAPL_BACKEND_MSR != get_rapl_backend()) {
+        fprintf(stdout, "Options -i and -r need the msr backend (RAPL_BACKEND=msr).\n");
+        return MY_ERROR;
+    }
+
     // Determine the node(s)/package(s) to access
     int          all_packages = 1;        // access all packages
     unsigned int node = 0;
@@ -1024,7 +1180,9 @@ main(int argc, char **argv)
         }
     }
 
-    if (print_energy_info)
+    if (print_energy_info && trace_path)
+        do_trace_energy_info();
+    else if (print_energy_info)
         do_print_energy_info();
 
     for (i = node; i < num_node; i++) {
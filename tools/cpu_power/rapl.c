@@ -30,6 +30,8 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <stdint.h>
 #include <sched.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "cpuid.h"
 #include "msr.h"
@@ -44,10 +46,34 @@ double RAPL_TIME_UNIT;
 double RAPL_ENERGY_UNIT;
 double RAPL_POWER_UNIT;
 
+double MAX_ENERGY_STATUS_JOULES;
+double MAX_THROTTLED_TIME_SECONDS;
+
 unsigned int  num_nodes = 0;
 unsigned int  os_cpu_count = 0;
 APIC_ID_t *os_map;
 
+/* Energy sampling backend, see set_rapl_backend() */
+enum RAPL_BACKEND rapl_backend = RAPL_BACKEND_MSR;
+unsigned int      rapl_backend_set = 0;
+char              rapl_backend_arg[256];
+
+/* Energy status register of each power domain, in RAPL_* order */
+const unsigned int ENERGY_STATUS_MSR[RAPL_NR_DOMAIN] = {
+    MSR_RAPL_PKG_ENERGY_STATUS,
+    MSR_RAPL_PP0_ENERGY_STATUS,
+    MSR_RAPL_PP1_ENERGY_STATUS,
+    MSR_RAPL_DRAM_ENERGY_STATUS
+};
+
+/* powercap backend: energy_uj of every node and domain, kept open */
+int          *powercap_fd = NULL;
+double        powercap_range_joules[RAPL_NR_DOMAIN];
+
+/* mock backend: constant power per domain, counted in RAPL energy units */
+double          mock_watts[RAPL_NR_DOMAIN];
+struct timespec mock_start;
+
 /* Pre-computed variables used for time-window calculation */
 const double LN2 = 0.69314718055994530941723212145817656807550013436025;
 const double A_F[4] = { 1.0, 1.1, 1.2, 1.3 };
@@ -170,6 +196,249 @@ build_topology() {
     return err;
 }
 
+/* Energy sampling backends */
+
+/*!
+ * \brief Select where energy samples come from.
+ *
+ * Must be called before init_rapl(). Without a call, init_rapl() reads the
+ * RAPL_BACKEND environment variable (see set_rapl_backend_name()) and
+ * falls back to the MSR backend.
+ *
+ * - RAPL_BACKEND_MSR reads the energy status MSRs through /dev/cpu/N/msr.
+ *   It is the only backend that supports the power limit and policy
+ *   registers.
+ * - RAPL_BACKEND_POWERCAP reads energy_uj of the intel-rapl zones below
+ *   arg (/sys/class/powercap if NULL); it needs no msr module or root.
+ * - RAPL_BACKEND_MOCK synthesizes counters that advance at a constant
+ *   power, for testing without RAPL hardware. arg is a comma separated
+ *   list of nodes=N, pkg=W, pp0=W, pp1=W and dram=W (default: 1 node,
+ *   60/35/0/12 W); a domain at 0 W is reported as unsupported.
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int
+set_rapl_backend(enum RAPL_BACKEND backend, const char *arg)
+{
+    if (backend != RAPL_BACKEND_MSR && backend != RAPL_BACKEND_POWERCAP &&
+        backend != RAPL_BACKEND_MOCK)
+        return MY_ERROR;
+
+    rapl_backend = backend;
+    rapl_backend_set = 1;
+    rapl_backend_arg[0] = '\0';
+    if (NULL != arg) {
+        strncpy(rapl_backend_arg, arg, sizeof(rapl_backend_arg) - 1);
+        rapl_backend_arg[sizeof(rapl_backend_arg) - 1] = '\0';
+    }
+    return 0;
+}
+
+/*!
+ * \brief Select the energy sampling backend by name.
+ *
+ * name is msr, powercap or mock, optionally followed by a colon and the
+ * backend argument, e.g. powercap:/sys/class/powercap or mock:nodes=2,pkg=80.
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int
+set_rapl_backend_name(const char *name)
+{
+    const char *arg = strchr(name, ':');
+    size_t      len = arg ? (size_t)(arg - name) : strlen(name);
+
+    if (arg)
+        arg++;
+    if (len == 3 && 0 == strncmp(name, "msr", len))
+        return set_rapl_backend(RAPL_BACKEND_MSR, arg);
+    if (len == 8 && 0 == strncmp(name, "powercap", len))
+        return set_rapl_backend(RAPL_BACKEND_POWERCAP, arg);
+    if (len == 4 && 0 == strncmp(name, "mock", len))
+        return set_rapl_backend(RAPL_BACKEND_MOCK, arg);
+    return MY_ERROR;
+}
+
+/*!
+ * \brief Get the energy sampling backend in use.
+ */
+enum RAPL_BACKEND
+get_rapl_backend()
+{
+    return rapl_backend;
+}
+
+/* Mark a domain as available for the non-MSR backends */
+void
+set_domain_supported(unsigned int power_domain)
+{
+    static const unsigned int limit_msr[RAPL_NR_DOMAIN] = {
+        MSR_RAPL_PKG_POWER_LIMIT, MSR_RAPL_PP0_POWER_LIMIT,
+        MSR_RAPL_PP1_POWER_LIMIT, MSR_RAPL_DRAM_POWER_LIMIT
+    };
+
+    msr_support_table[limit_msr[power_domain] & MSR_SUPPORT_MASK] = 1;
+    msr_support_table[ENERGY_STATUS_MSR[power_domain] & MSR_SUPPORT_MASK] = 1;
+}
+
+int
+read_powercap_file(int fd, unsigned long long *value)
+{
+    char    buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+
+    if (n <= 0)
+        return MY_ERROR;
+    buf[n] = '\0';
+    *value = strtoull(buf, NULL, 10);
+    return 0;
+}
+
+/* Open energy_uj of the zone in dir if it is a RAPL power domain */
+void
+open_powercap_zone(const char *dir, unsigned int node)
+{
+    char               path[512], name[64];
+    unsigned long long range;
+    int                fd, n, domain;
+
+    snprintf(path, sizeof(path), "%s/name", dir);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+    n = read(fd, name, sizeof(name) - 1);
+    close(fd);
+    if (n <= 0)
+        return;
+    name[n] = '\0';
+
+    if (0 == strncmp(name, "package", 7))
+        domain = RAPL_PKG;
+    else if (0 == strncmp(name, "core", 4))
+        domain = RAPL_PP0;
+    else if (0 == strncmp(name, "uncore", 6))
+        domain = RAPL_PP1;
+    else if (0 == strncmp(name, "dram", 4))
+        domain = RAPL_DRAM;
+    else
+        return;
+
+    snprintf(path, sizeof(path), "%s/max_energy_range_uj", dir);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+    n = read_powercap_file(fd, &range);
+    close(fd);
+    if (n != 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/energy_uj", dir);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+
+    powercap_fd[node * RAPL_NR_DOMAIN + domain] = fd;
+    powercap_range_joules[domain] = range * 1e-6;
+    set_domain_supported(domain);
+}
+
+/* intel-rapl:N is package N, intel-rapl:N:M are its core/uncore/dram zones */
+int
+init_powercap(const char *root)
+{
+    char         dir[512];
+    unsigned int node, sub, i;
+
+    for (num_nodes = 0; ; num_nodes++) {
+        snprintf(dir, sizeof(dir), "%s/intel-rapl:%u", root, num_nodes);
+        if (0 != access(dir, F_OK))
+            break;
+    }
+    if (0 == num_nodes) {
+        fprintf(stderr, "No RAPL zones found under %s.\n", root);
+        return MY_ERROR;
+    }
+
+    powercap_fd = (int *) malloc(num_nodes * RAPL_NR_DOMAIN * sizeof(int));
+    for (i = 0; i < num_nodes * RAPL_NR_DOMAIN; i++)
+        powercap_fd[i] = -1;
+
+    for (node = 0; node < num_nodes; node++) {
+        snprintf(dir, sizeof(dir), "%s/intel-rapl:%u", root, node);
+        open_powercap_zone(dir, node);
+        for (sub = 0; ; sub++) {
+            snprintf(dir, sizeof(dir), "%s/intel-rapl:%u/intel-rapl:%u:%u", root, node, node, sub);
+            if (0 != access(dir, F_OK))
+                break;
+            open_powercap_zone(dir, node);
+        }
+    }
+
+    if (!is_supported_domain(RAPL_PKG)) {
+        fprintf(stderr, "No readable package energy counter under %s.\n", root);
+        return MY_ERROR;
+    }
+
+    /* energy_uj is already in joules * 1e6 */
+    RAPL_ENERGY_UNIT = 1e-6;
+    MAX_ENERGY_STATUS_JOULES = powercap_range_joules[RAPL_PKG];
+
+    return 0;
+}
+
+int
+init_mock(const char *options)
+{
+    char         buf[256];
+    char        *opt, *save = NULL;
+    double       value;
+    unsigned int domain;
+
+    num_nodes = 1;
+    mock_watts[RAPL_PKG] = 60.0;
+    mock_watts[RAPL_PP0] = 35.0;
+    mock_watts[RAPL_PP1] = 0.0;
+    mock_watts[RAPL_DRAM] = 12.0;
+
+    strncpy(buf, options, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (opt = strtok_r(buf, ",", &save); NULL != opt; opt = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(opt, '=');
+        if (NULL == eq) {
+            fprintf(stderr, "Invalid mock option %s.\n", opt);
+            return MY_ERROR;
+        }
+        *eq = '\0';
+        value = atof(eq + 1);
+        if (0 == strcmp(opt, "nodes") && value >= 1)
+            num_nodes = (unsigned int) value;
+        else if (0 == strcmp(opt, "pkg"))
+            mock_watts[RAPL_PKG] = value;
+        else if (0 == strcmp(opt, "pp0"))
+            mock_watts[RAPL_PP0] = value;
+        else if (0 == strcmp(opt, "pp1"))
+            mock_watts[RAPL_PP1] = value;
+        else if (0 == strcmp(opt, "dram"))
+            mock_watts[RAPL_DRAM] = value;
+        else {
+            fprintf(stderr, "Invalid mock option %s.\n", opt);
+            return MY_ERROR;
+        }
+    }
+
+    for (domain = 0; domain < RAPL_NR_DOMAIN; domain++) {
+        if (mock_watts[domain] > 0)
+            set_domain_supported(domain);
+    }
+
+    /* Units of a Sandy Bridge server */
+    RAPL_TIME_UNIT = 1.0 / B2POW(10);
+    RAPL_ENERGY_UNIT = 1.0 / B2POW(16);
+    RAPL_POWER_UNIT = 1.0 / B2POW(3);
+    MAX_ENERGY_STATUS_JOULES = (double)(RAPL_ENERGY_UNIT * (pow(2, 32) - 1));
+    MAX_THROTTLED_TIME_SECONDS = (double)(RAPL_TIME_UNIT * (pow(2, 32) - 1));
+
+    clock_gettime(CLOCK_MONOTONIC, &mock_start);
+    return 0;
+}
+
 /*!
  * \brief Intialize the power_gov library for use.
  *
@@ -182,9 +451,27 @@ init_rapl()
     int          err = 0;
     unsigned int processor_signature;
 
-    processor_signature = get_processor_signature();
+    if (!rapl_backend_set && NULL != getenv("RAPL_BACKEND")) {
+        err = set_rapl_backend_name(getenv("RAPL_BACKEND"));
+        if (err) {
+            fprintf(stderr, "Unknown RAPL_BACKEND %s, expected msr, powercap[:root] or mock[:options].\n", getenv("RAPL_BACKEND"));
+            return MY_ERROR;
+        }
+    }
+
     msr_support_table = (unsigned char*) calloc(MSR_SUPPORT_MASK, sizeof(unsigned char));
 
+    switch (rapl_backend) {
+    case RAPL_BACKEND_POWERCAP:
+        return init_powercap(rapl_backend_arg[0] ? rapl_backend_arg : "/sys/class/powercap");
+    case RAPL_BACKEND_MOCK:
+        return init_mock(rapl_backend_arg);
+    default:
+        break;
+    }
+
+    processor_signature = get_processor_signature();
+
     switch (processor_signature) {
     case 0x206a7:                /* SandyBridge client*/
         msr_support_table[MSR_RAPL_POWER_UNIT & MSR_SUPPORT_MASK]          = 1;
@@ -261,6 +548,17 @@ terminate_rapl()
     if(NULL != msr_support_table)
         free(msr_support_table);
 
+    if(NULL != powercap_fd) {
+        for (i = 0; i < num_nodes * RAPL_NR_DOMAIN; i++) {
+            if (powercap_fd[i] >= 0)
+                close(powercap_fd[i]);
+        }
+        free(powercap_fd);
+        powercap_fd = NULL;
+    }
+
+    close_msr();
+
     return 0;
 }
 
@@ -1186,3 +1484,84 @@ read_rapl_units()
     return err;
 }
 
+/* Batched energy sampling */
+
+/*!
+ * \brief Sample the energy counters of all supported domains of a node.
+ *
+ * One call reads every supported domain of the node in a batch: the
+ * energy status MSRs through one open descriptor, or the powercap zones
+ * with one pread each. joules must hold RAPL_NR_DOMAIN values and is
+ * indexed by RAPL_PKG ... RAPL_DRAM; unsupported domains read 0. The
+ * counters wrap at get_rapl_energy_range().
+ *
+ * \return 0 on success, -1 otherwise
+ */
+int
+get_rapl_energy_sample(unsigned int node, double *joules)
+{
+    unsigned int       addresses[RAPL_NR_DOMAIN];
+    unsigned int       domains[RAPL_NR_DOMAIN];
+    uint64_t           values[RAPL_NR_DOMAIN];
+    unsigned long long uj;
+    struct timespec    now;
+    double             elapsed;
+    unsigned int       domain, count = 0, i;
+    int                err = 0, fd;
+
+    if (node >= num_nodes)
+        return MY_ERROR;
+
+    for (domain = 0; domain < RAPL_NR_DOMAIN; domain++)
+        joules[domain] = 0.0;
+
+    switch (rapl_backend) {
+    case RAPL_BACKEND_MSR:
+        for (domain = 0; domain < RAPL_NR_DOMAIN; domain++) {
+            if (is_supported_domain(domain)) {
+                addresses[count] = ENERGY_STATUS_MSR[domain];
+                domains[count++] = domain;
+            }
+        }
+        err = read_msr_batch(pkg_node_to_cpu(node), addresses, values, count);
+        for (i = 0; !err && i < count; i++)
+            joules[domains[i]] = convert_to_joules(((energy_status_msr_t *)&values[i])->total_energy_consumed);
+        break;
+    case RAPL_BACKEND_POWERCAP:
+        for (domain = 0; domain < RAPL_NR_DOMAIN; domain++) {
+            fd = powercap_fd[node * RAPL_NR_DOMAIN + domain];
+            if (fd < 0)
+                continue;
+            if (read_powercap_file(fd, &uj) != 0)
+                err = MY_ERROR;
+            else
+                joules[domain] = uj * 1e-6;
+        }
+        break;
+    case RAPL_BACKEND_MOCK:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - mock_start.tv_sec) + (now.tv_nsec - mock_start.tv_nsec) * 1e-9;
+        for (domain = 0; domain < RAPL_NR_DOMAIN; domain++) {
+            /* Quantized and wrapped like the 32 bit status register */
+            uint32_t raw = (uint32_t)(uint64_t)(mock_watts[domain] * elapsed / RAPL_ENERGY_UNIT);
+            joules[domain] = convert_to_joules(raw);
+        }
+        break;
+    }
+
+    return err;
+}
+
+/*!
+ * \brief Get the value at which the energy counter of a domain wraps around.
+ *
+ * \return wraparound value in joules
+ */
+double
+get_rapl_energy_range(unsigned int power_domain)
+{
+    if (RAPL_BACKEND_POWERCAP == rapl_backend && power_domain < RAPL_NR_DOMAIN &&
+        powercap_range_joules[power_domain] > 0)
+        return powercap_range_joules[power_domain];
+    return MAX_ENERGY_STATUS_JOULES;
+}
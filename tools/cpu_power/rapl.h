@@ -38,13 +38,26 @@ typedef struct APIC_ID_t {
     unsigned int os_id;
 }APIC_ID_t;
 
+/*! \brief Sources of energy samples, see set_rapl_backend() */
+enum RAPL_BACKEND { RAPL_BACKEND_MSR, RAPL_BACKEND_POWERCAP, RAPL_BACKEND_MOCK };
+
+int           set_rapl_backend(enum RAPL_BACKEND backend, const char *arg);
+int           set_rapl_backend_name(const char *name);
+enum RAPL_BACKEND get_rapl_backend();
+
 int           init_rapl();
 int           terminate_rapl();
+int           bind_context(unsigned int cpu);
+
+/* Batched energy sampling: all supported domains of a node in one call.
+ * joules holds RAPL_NR_DOMAIN values. */
+int           get_rapl_energy_sample(unsigned int node, double *joules);
+double        get_rapl_energy_range(unsigned int power_domain);
 
 /* Wraparound values for total energy consumed and accumulated throttled time.
  * These values are computed within init_rapl(). */
-double MAX_ENERGY_STATUS_JOULES;   /* default: 65536 */
-double MAX_THROTTLED_TIME_SECONDS; /* default: 4194304 */
+extern double MAX_ENERGY_STATUS_JOULES;   /* default: 65536 */
+extern double MAX_THROTTLED_TIME_SECONDS; /* default: 4194304 */
 
 unsigned int  get_num_rapl_nodes_pkg();
 unsigned int  get_num_rapl_nodes_pp0();
@@ -0,0 +1,137 @@
+/* Convert an energy trace written by power_gov -t to CSV. */
+
+/*
+ * Usage: trace2csv trace_file > trace.csv
+ *
+ * One row per record, ordered by time:
+ *   time_s,record,id,<domains>,label
+ * time_s is relative to the first record. Sample rows (id = node) give
+ * the average power in watts of every sampled domain since the previous
+ * sample of the same node; the first sample of a node only sets the
+ * baseline and is not printed. Phase rows (record = begin or end, id =
+ * pid of the process that marked it) carry the label and no power.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "energy_trace.h"
+
+const char *domain_names[ENERGY_TRACE_DOMAINS] = { "PKG", "PP0", "PP1", "DRAM" };
+
+int
+compare_records(const void *a, const void *b)
+{
+    const energy_trace_record_t *x = (const energy_trace_record_t *) a;
+    const energy_trace_record_t *y = (const energy_trace_record_t *) b;
+
+    if (x->time_ns != y->time_ns)
+        return x->time_ns < y->time_ns ? -1 : 1;
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct stat            st;
+    energy_trace_header_t *trace;
+    energy_trace_record_t *ring, *records, *r;
+    uint64_t               head, first, i, count = 0, seq;
+    double                *prev_joules;
+    uint64_t              *prev_ns;
+    double                 delta, seconds;
+    unsigned int           domain;
+    int                    fd;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s trace_file > trace.csv\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || 0 != fstat(fd, &st)) {
+        perror(argv[1]);
+        return 1;
+    }
+    trace = (energy_trace_header_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == trace || st.st_size < (off_t)sizeof(energy_trace_header_t) ||
+        ENERGY_TRACE_MAGIC != trace->magic || ENERGY_TRACE_VERSION != trace->version ||
+        sizeof(energy_trace_record_t) != trace->record_size ||
+        st.st_size < (off_t)(sizeof(energy_trace_header_t) + trace->capacity * sizeof(energy_trace_record_t))) {
+        fprintf(stderr, "%s is not an energy trace.\n", argv[1]);
+        return 1;
+    }
+
+    /* Snapshot the records still in the ring; the sampler may be running */
+    ring = energy_trace_records(trace);
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+    first = head > trace->capacity ? head - trace->capacity : 0;
+    records = (energy_trace_record_t *) malloc((head - first) * sizeof(energy_trace_record_t) + 1);
+    for (i = first; i < head; i++) {
+        r = &ring[i % trace->capacity];
+        seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        if (seq != i + 1)
+            continue;               /* Being written, or overwritten */
+        records[count] = *r;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);   /* Copy before the recheck */
+        if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq)
+            count++;
+    }
+    if (trace->overruns)
+        fprintf(stderr, "Warning: the sampler missed %llu periods.\n", (unsigned long long) trace->overruns);
+    if (first > 0)
+        fprintf(stderr, "Warning: the ring wrapped, the first %llu records are lost.\n", (unsigned long long) first);
+
+    qsort(records, count, sizeof(energy_trace_record_t), compare_records);
+
+    prev_joules = (double *) calloc((size_t) trace->num_nodes * ENERGY_TRACE_DOMAINS, sizeof(double));
+    prev_ns = (uint64_t *) calloc(trace->num_nodes, sizeof(uint64_t));
+
+    printf("time_s,record,id");
+    for (domain = 0; domain < ENERGY_TRACE_DOMAINS; domain++) {
+        if (trace->domain_mask & (1u << domain))
+            printf(",%s", domain_names[domain]);
+    }
+    printf(",label\n");
+
+    for (i = 0; i < count; i++) {
+        r = &records[i];
+        seconds = (r->time_ns - records[0].time_ns) * 1e-9;
+
+        if (ENERGY_TRACE_SAMPLE == r->type) {
+            double *prev;
+
+            if (r->id >= trace->num_nodes)
+                continue;
+            prev = &prev_joules[r->id * ENERGY_TRACE_DOMAINS];
+            if (prev_ns[r->id] != 0 && r->time_ns > prev_ns[r->id]) {
+                printf("%.6f,sample,%u", seconds, r->id);
+                for (domain = 0; domain < ENERGY_TRACE_DOMAINS; domain++) {
+                    if (!(trace->domain_mask & (1u << domain)))
+                        continue;
+                    delta = r->u.joules[domain] - prev[domain];
+                    if (delta < 0)
+                        delta += trace->range_joules[domain];
+                    printf(",%.3f", delta / ((r->time_ns - prev_ns[r->id]) * 1e-9));
+                }
+                printf(",\n");
+            }
+            for (domain = 0; domain < ENERGY_TRACE_DOMAINS; domain++)
+                prev[domain] = r->u.joules[domain];
+            prev_ns[r->id] = r->time_ns;
+        } else {
+            printf("%.6f,%s,%u", seconds, ENERGY_TRACE_BEGIN == r->type ? "begin" : "end", r->id);
+            for (domain = 0; domain < ENERGY_TRACE_DOMAINS; domain++) {
+                if (trace->domain_mask & (1u << domain))
+                    printf(",");
+            }
+            printf(",%.*s\n", ENERGY_TRACE_LABEL, r->u.label);
+        }
+    }
+
+    free(prev_ns);
+    free(prev_joules);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,1017 @@
+/* Synthetic data sets for the OpenMP benchmarks.
+ *
+ * Every generator writes its benchmark's own input format at any size,
+ * together with a data.config.mk that run_template.sh and the sweep
+ * driver can source.  Values come from a counter-based generator keyed
+ * on (seed, stream, index), so a data set depends only on its size and
+ * seed, never on the number of threads that produced it.  Output is
+ * formatted in parallel, chunk by chunk, and written with pwrite at
+ * offsets obtained from a prefix sum over the chunk lengths. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static uint64_t seed = 1;
+static const char *outdir = ".";
+
+/****************************************************************************/
+/* Random numbers */
+
+/* SplitMix64 finalizer; consecutive counters give independent values */
+static inline uint64_t
+mix64(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* The i-th value of stream s */
+static inline uint64_t
+rnd(uint64_t s, uint64_t i)
+{
+  return mix64(mix64(seed * 0x9e3779b97f4a7c15ULL + s) + i);
+}
+
+/* Uniform in [0, 1) */
+static inline double
+rnd_unit(uint64_t s, uint64_t i)
+{
+  return (rnd(s, i) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Uniform in [0, n) */
+static inline uint64_t
+rnd_below(uint64_t s, uint64_t i, uint64_t n)
+{
+  return (uint64_t)(rnd_unit(s, i) * n);
+}
+
+/****************************************************************************/
+/* Parallel output */
+
+#define CHUNK_BYTES (4 << 20)
+
+/* Format items [first, first + count) into buf and return its length.
+ * buf holds count times the generator's bound on the bytes per item. */
+typedef size_t (*format_fn)(void *ctx, int64_t first, int64_t count, char *buf);
+
+struct outfile {
+  char path[PATH_MAX];
+  int fd;
+  off_t offset;
+};
+
+static void
+die(const char *what, const char *path)
+{
+  fprintf(stderr, "datagen: %s %s: %s\n", what, path, strerror(errno));
+  exit(1);
+}
+
+static void
+open_output(struct outfile *f, const char *name)
+{
+  snprintf(f->path, sizeof(f->path), "%s/%s", outdir, name);
+  f->fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (f->fd < 0)
+    die("cannot create", f->path);
+  f->offset = 0;
+}
+
+static void
+close_output(struct outfile *f)
+{
+  if (ftruncate(f->fd, f->offset) != 0 || close(f->fd) != 0)
+    die("cannot write", f->path);
+  printf("  %s (%.1f MB)\n", f->path, f->offset / 1e6);
+}
+
+static void
+write_all(struct outfile *f, const char *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t n = pwrite(f->fd, buf, len, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      die("cannot write", f->path);
+    }
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+}
+
+/* Append a header written by one thread */
+static void
+write_header(struct outfile *f, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void
+write_header(struct outfile *f, const char *fmt, ...)
+{
+  char buf[256];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  write_all(f, buf, len, f->offset);
+  f->offset += len;
+}
+
+static void
+write_raw(struct outfile *f, const void *buf, size_t len)
+{
+  write_all(f, (const char *)buf, len, f->offset);
+  f->offset += len;
+}
+
+/* Append n items, at most item_bytes each, formatted by fmt.  Batches of
+ * chunks are formatted in parallel, placed by a prefix sum of their
+ * lengths and written in parallel. */
+static void
+write_items(struct outfile *f, int64_t n, size_t item_bytes, format_fn fmt, void *ctx)
+{
+  int nthreads = 1, nchunks, c;
+  int64_t chunk = CHUNK_BYTES / item_bytes, batch;
+  char **bufs;
+  size_t *lens;
+  off_t *offs;
+
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  nchunks = 2 * nthreads;
+  if (chunk < 1)
+    chunk = 1;
+  bufs = (char **) malloc(nchunks * sizeof(char *));
+  lens = (size_t *) malloc(nchunks * sizeof(size_t));
+  offs = (off_t *) malloc(nchunks * sizeof(off_t));
+  for (c = 0; c < nchunks; c++)
+    bufs[c] = (char *) malloc(chunk * item_bytes);
+
+  for (batch = 0; batch < n; batch += nchunks * chunk) {
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (c = 0; c < nchunks; c++) {
+      int64_t first = batch + c * chunk;
+      int64_t count = n - first < chunk ? n - first : chunk;
+      lens[c] = count > 0 ? fmt(ctx, first, count, bufs[c]) : 0;
+    }
+
+    for (c = 0; c < nchunks; c++) {
+      offs[c] = f->offset;
+      f->offset += lens[c];
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (c = 0; c < nchunks; c++)
+      if (lens[c] > 0)
+        write_all(f, bufs[c], lens[c], offs[c]);
+  }
+
+  for (c = 0; c < nchunks; c++)
+    free(bufs[c]);
+  free(bufs);
+  free(lens);
+  free(offs);
+}
+
+/* Fast decimal formatting; snprintf dominates text output otherwise */
+static inline char *
+put_uint(char *p, uint64_t v)
+{
+  char tmp[20];
+  int n = 0;
+
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n)
+    *p++ = tmp[--n];
+  return p;
+}
+
+/* v with the given number of decimals, |v| < 2^63 / 10^decimals */
+static inline char *
+put_fixed(char *p, double v, int decimals)
+{
+  static const double scale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+  uint64_t whole, frac, s = (uint64_t)scale[decimals];
+  int64_t q;
+  int i;
+
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  q = llround(v * scale[decimals]);
+  whole = q / s;
+  frac = q % s;
+  p = put_uint(p, whole);
+  if (decimals > 0) {
+    *p++ = '.';
+    for (i = decimals - 1; i >= 0; i--) {
+      p[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+    p += decimals;
+  }
+  return p;
+}
+
+/* mkdir -p */
+static int
+mkdir_p(const char *dir)
+{
+  char path[PATH_MAX], *p;
+
+  snprintf(path, sizeof(path), "%s", dir);
+  for (p = path + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  if (mkdir(path, 0755) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+/****************************************************************************/
+/* data.config.mk */
+
+/* Write the in_file and out_file words of run_template.sh.  Paths are
+ * made absolute, since the benchmark runs in its own directory. */
+static void
+write_config(const char *in_file, const char *out_file)
+{
+  char path[PATH_MAX], dir[PATH_MAX];
+  FILE *fp;
+
+  if (realpath(outdir, dir) == NULL)
+    die("cannot resolve", outdir);
+  snprintf(path, sizeof(path), "%s/data.config.mk", outdir);
+  if ((fp = fopen(path, "w")) == NULL)
+    die("cannot create", path);
+  fprintf(fp, "# Generated by datagen, seed %llu\n", (unsigned long long)seed);
+  fprintf(fp, "dir=%s\n", dir);
+  fprintf(fp, "in_file=\"%s\"\n", in_file);
+  fprintf(fp, "out_file=\"%s\"\n", out_file);
+  fclose(fp);
+  printf("  %s\n", path);
+}
+
+/****************************************************************************/
+/* bfs: R-MAT graph in the Rodinia text format */
+
+/* Quadrant probabilities of the Graph500 Kronecker generator */
+#define RMAT_A 0.57
+#define RMAT_B 0.19
+#define RMAT_C 0.19
+
+struct graph {
+  int64_t nodes;
+  int64_t *start;			/* CSR offsets, nodes + 1 */
+  int32_t *dest;
+  int32_t *cost;
+};
+
+/* Endpoints of the e-th R-MAT edge, scrambled so that the hubs are not
+ * all at low node ids */
+static void
+rmat_edge(int scale, int64_t e, int64_t *u, int64_t *v)
+{
+  int64_t a = 0, b = 0, mask = ((int64_t)1 << scale) - 1;
+  int level;
+
+  for (level = 0; level < scale; level++) {
+    double r = rnd_unit(1, e * scale + level);
+    int down = r >= RMAT_A + RMAT_B;
+    int right = (r >= RMAT_A && r < RMAT_A + RMAT_B) || r >= RMAT_A + RMAT_B + RMAT_C;
+    a = (a << 1) | down;
+    b = (b << 1) | right;
+  }
+  /* An odd multiplier permutes the ids modulo 2^scale */
+  *u = (a * 0x9e3779b97f4a7c15ULL + seed) & mask;
+  *v = (b * 0x9e3779b97f4a7c15ULL + seed) & mask;
+}
+
+/* Undirected graph: every generated edge is stored in both directions */
+static void
+build_rmat(struct graph *g, int scale, int64_t edges)
+{
+  int64_t n = (int64_t)1 << scale, i, e;
+  int64_t *fill;
+
+  g->nodes = n;
+  g->start = (int64_t *) calloc(n + 1, sizeof(int64_t));
+  fill = (int64_t *) malloc(n * sizeof(int64_t));
+
+  #pragma omp parallel for
+  for (e = 0; e < edges; e++) {
+    int64_t u, v;
+    rmat_edge(scale, e, &u, &v);
+    #pragma omp atomic
+    g->start[u + 1]++;
+    #pragma omp atomic
+    g->start[v + 1]++;
+  }
+
+  for (i = 0; i < n; i++)
+    g->start[i + 1] += g->start[i];
+  memcpy(fill, g->start, n * sizeof(int64_t));
+
+  g->dest = (int32_t *) malloc(g->start[n] * sizeof(int32_t));
+  g->cost = (int32_t *) malloc(g->start[n] * sizeof(int32_t));
+
+  #pragma omp parallel for
+  for (e = 0; e < edges; e++) {
+    int64_t u, v, pu, pv;
+    int32_t cost = 1 + rnd_below(2, e, 10);
+    rmat_edge(scale, e, &u, &v);
+    #pragma omp atomic capture
+    pu = fill[u]++;
+    #pragma omp atomic capture
+    pv = fill[v]++;
+    g->dest[pu] = v;
+    g->cost[pu] = cost;
+    g->dest[pv] = u;
+    g->cost[pv] = cost;
+  }
+  free(fill);
+
+  /* The scatter order depends on the schedule; sort every list so that
+   * the file does not */
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for (i = 0; i < n; i++) {
+    int64_t lo = g->start[i], hi = g->start[i + 1], j, k;
+    for (j = lo + 1; j < hi; j++) {
+      int32_t d = g->dest[j], c = g->cost[j];
+      for (k = j; k > lo && (g->dest[k - 1] > d || (g->dest[k - 1] == d && g->cost[k - 1] > c)); k--) {
+        g->dest[k] = g->dest[k - 1];
+        g->cost[k] = g->cost[k - 1];
+      }
+      g->dest[k] = d;
+      g->cost[k] = c;
+    }
+  }
+}
+
+static size_t
+format_nodes(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct graph *g = (struct graph *)ctx;
+  char *p = buf;
+  int64_t i;
+
+  for (i = first; i < first + count; i++) {
+    p = put_uint(p, g->start[i]);
+    *p++ = ' ';
+    p = put_uint(p, g->start[i + 1] - g->start[i]);
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static size_t
+format_edges(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct graph *g = (struct graph *)ctx;
+  char *p = buf;
+  int64_t i;
+
+  for (i = first; i < first + count; i++) {
+    p = put_uint(p, g->dest[i]);
+    *p++ = ' ';
+    p = put_uint(p, g->cost[i]);
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static void
+gen_bfs(int argc, char **argv)
+{
+  int scale = argc > 0 ? atoi(argv[0]) : 20;
+  int degree = argc > 1 ? atoi(argv[1]) : 8;
+  struct graph g;
+  struct outfile f;
+  int64_t i, source = 0;
+
+  if (scale < 1 || scale > 30 || degree < 1) {
+    fputs("bfs: scale must be 1-30 and the edge factor positive\n", stderr);
+    exit(1);
+  }
+
+  build_rmat(&g, scale, (int64_t)degree << scale);
+  if (g.start[g.nodes] > INT_MAX) {
+    fputs("bfs: the edge list exceeds the int indices of the benchmark\n", stderr);
+    exit(1);
+  }
+
+  /* Start from the largest hub, which is never isolated */
+  for (i = 1; i < g.nodes; i++)
+    if (g.start[i + 1] - g.start[i] > g.start[source + 1] - g.start[source])
+      source = i;
+
+  open_output(&f, "graph.txt");
+  write_header(&f, "%lld\n", (long long)g.nodes);
+  write_items(&f, g.nodes, 2 * 21, format_nodes, &g);
+  write_header(&f, "\n%lld\n\n%lld\n", (long long)source, (long long)g.start[g.nodes]);
+  write_items(&f, g.start[g.nodes], 2 * 12, format_edges, &g);
+  close_output(&f);
+
+  write_config("-i $dir/graph.txt", "-o result.txt");
+
+  free(g.start);
+  free(g.dest);
+  free(g.cost);
+}
+
+/****************************************************************************/
+/* spmv: symmetric Matrix Market matrix and a raw float vector */
+
+struct matrix {
+  int64_t n;
+  int width;			/* Entries per row below the diagonal */
+  int powerlaw;
+};
+
+/* Column of the k-th entry of row i below the diagonal.  Banded matrices
+ * stay within a band of 4 * width; power-law ones draw columns with a
+ * density falling like 1/col, which gives a few very dense columns (and
+ * by symmetry rows).  Duplicates are possible and left to the reader,
+ * which adds them up like any Matrix Market consumer. */
+static inline int64_t
+matrix_col(const struct matrix *m, int64_t i, int k)
+{
+  uint64_t idx = (uint64_t)i * m->width + k;
+
+  if (i == 0)
+    return 0;
+  if (m->powerlaw)
+    return (int64_t)exp(rnd_unit(3, idx) * log(i + 1.0)) - 1;
+  {
+    int64_t band = 4 * m->width < i ? 4 * m->width : i;
+    return i - 1 - (int64_t)rnd_below(3, idx, band);
+  }
+}
+
+static inline int
+matrix_row_entries(const struct matrix *m, int64_t i)
+{
+  return i < m->width ? (int)i : m->width;
+}
+
+static size_t
+format_matrix_rows(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct matrix *m = (struct matrix *)ctx;
+  char *p = buf;
+  int64_t i;
+  int k;
+
+  for (i = first; i < first + count; i++) {
+    int entries = matrix_row_entries(m, i);
+    for (k = 0; k < entries; k++) {
+      p = put_uint(p, i + 1);
+      *p++ = ' ';
+      p = put_uint(p, matrix_col(m, i, k) + 1);
+      *p++ = ' ';
+      p = put_fixed(p, rnd_unit(4, (uint64_t)i * m->width + k) - 0.5, 6);
+      *p++ = '\n';
+    }
+    /* A dominant diagonal keeps the matrix well conditioned */
+    p = put_uint(p, i + 1);
+    *p++ = ' ';
+    p = put_uint(p, i + 1);
+    *p++ = ' ';
+    p = put_fixed(p, m->width + 1 + rnd_unit(5, i), 6);
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static size_t
+format_vector(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  float *v = (float *)buf;
+  int64_t i;
+
+  (void)ctx;
+  for (i = 0; i < count; i++)
+    v[i] = rnd_unit(6, first + i);
+  return count * sizeof(float);
+}
+
+static void
+gen_spmv(int argc, char **argv)
+{
+  struct matrix m;
+  struct outfile f;
+  int64_t nnz, i;
+
+  m.n = argc > 0 ? atoll(argv[0]) : 100000;
+  m.width = argc > 1 ? atoi(argv[1]) : 16;
+  m.powerlaw = argc > 2 && strcmp(argv[2], "powerlaw") == 0;
+  if (m.n < 1 || m.n > INT_MAX || m.width < 1 ||
+      (argc > 2 && !m.powerlaw && strcmp(argv[2], "band") != 0)) {
+    fputs("spmv: usage: spmv rows [width [band|powerlaw]]\n", stderr);
+    exit(1);
+  }
+
+  nnz = m.n;
+  for (i = 0; i < m.width && i < m.n; i++)
+    nnz += i;
+  if (m.n > m.width)
+    nnz += (m.n - m.width) * m.width;
+
+  open_output(&f, "matrix.mtx");
+  write_header(&f, "%%%%MatrixMarket matrix coordinate real symmetric\n");
+  write_header(&f, "%% datagen %s, seed %llu\n",
+               m.powerlaw ? "power-law" : "banded", (unsigned long long)seed);
+  write_header(&f, "%lld %lld %lld\n", (long long)m.n, (long long)m.n, (long long)nnz);
+  write_items(&f, m.n, (m.width + 1) * 48, format_matrix_rows, &m);
+  close_output(&f);
+
+  open_output(&f, "vector.bin");
+  write_items(&f, m.n, sizeof(float), format_vector, NULL);
+  close_output(&f);
+
+  write_config("-i $dir/matrix.mtx,$dir/vector.bin", "-o result.dat");
+}
+
+/****************************************************************************/
+/* cutcp: atoms in a PQR file */
+
+struct atoms {
+  double box;			/* Edge of the cube, in Angstrom */
+};
+
+/* Atoms are spread uniformly with charges of either sign, like the
+ * solvated systems the benchmark was written for */
+static size_t
+format_atoms(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct atoms *a = (struct atoms *)ctx;
+  char *p = buf;
+  int64_t i;
+  int d;
+
+  for (i = first; i < first + count; i++) {
+    memcpy(p, "ATOM  ", 6);
+    p += 6;
+    p = put_uint(p, i + 1);
+    memcpy(p, " X RES ", 7);
+    p += 7;
+    p = put_uint(p, i / 3 + 1);
+    for (d = 0; d < 3; d++) {
+      *p++ = ' ';
+      p = put_fixed(p, rnd_unit(7 + d, i) * a->box, 3);
+    }
+    *p++ = ' ';
+    p = put_fixed(p, rnd_unit(10, i) * 2 - 1, 4);
+    memcpy(p, " 1.5\n", 5);
+    p += 5;
+  }
+  return p - buf;
+}
+
+static void
+gen_cutcp(int argc, char **argv)
+{
+  int64_t n = argc > 0 ? atoll(argv[0]) : 100000;
+  struct atoms a;
+  struct outfile f;
+
+  if (n < 1 || n > INT_MAX) {
+    fputs("cutcp: the atom count must be positive\n", stderr);
+    exit(1);
+  }
+  /* Water-like density, about 0.1 atoms per cubic Angstrom */
+  a.box = argc > 1 ? atof(argv[1]) : cbrt(n / 0.1);
+
+  open_output(&f, "atoms.pqr");
+  write_items(&f, n, 128, format_atoms, &a);
+  write_header(&f, "END\n");
+  close_output(&f);
+
+  write_config("-i $dir/atoms.pqr", "-o result.dat");
+}
+
+/****************************************************************************/
+/* histo: binary image of bin indices */
+
+struct image {
+  int64_t width, height;
+  unsigned int bins;
+};
+
+/* Values cluster around a few peaks, so some bins saturate while most
+ * stay low, which is what makes the benchmark's output interesting */
+static size_t
+format_histo_rows(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct image *im = (struct image *)ctx;
+  unsigned int *out = (unsigned int *)buf;
+  int64_t i, x, k = 0;
+
+  for (i = first; i < first + count; i++)
+    for (x = 0; x < im->width; x++) {
+      uint64_t idx = (uint64_t)i * im->width + x;
+      double peak = (rnd_below(11, idx, 8) + 0.5) / 8;
+      double u = rnd_unit(12, idx) + rnd_unit(13, idx) - 1;
+      double v = peak + u * 0.05;
+      if (v < 0)
+        v = 0;
+      out[k++] = (unsigned int)(v * (im->bins - 1) + 0.5) % im->bins;
+    }
+  return k * sizeof(unsigned int);
+}
+
+static void
+gen_histo(int argc, char **argv)
+{
+  struct image im;
+  struct outfile f;
+  unsigned int header[4];
+
+  im.width = argc > 0 ? atoll(argv[0]) : 4096;
+  im.height = argc > 1 ? atoll(argv[1]) : 4096;
+  header[2] = argc > 2 ? atoi(argv[2]) : 256;
+  header[3] = argc > 3 ? atoi(argv[3]) : 4096;
+  if (im.width < 1 || im.height < 1 || im.width * im.height > UINT_MAX ||
+      header[2] < 1 || header[3] < 1) {
+    fputs("histo: usage: histo width height [histo_width histo_height]\n", stderr);
+    exit(1);
+  }
+  header[0] = im.width;
+  header[1] = im.height;
+  im.bins = header[2] * header[3];
+
+  open_output(&f, "img.bin");
+  write_raw(&f, header, sizeof(header));
+  write_items(&f, im.height, im.width * sizeof(unsigned int), format_histo_rows, &im);
+  close_output(&f);
+
+  write_config("-i $dir/img.bin", "-o result.bmp -- 20");
+}
+
+/****************************************************************************/
+/* stencil: raw float volume */
+
+struct volume {
+  int64_t nx, ny, nz;
+};
+
+static size_t
+format_volume_rows(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct volume *vol = (struct volume *)ctx;
+  float *out = (float *)buf;
+  int64_t i;
+
+  for (i = 0; i < count * vol->nx; i++)
+    out[i] = rnd_unit(14, first * vol->nx + i);
+  return count * vol->nx * sizeof(float);
+}
+
+static void
+gen_stencil(int argc, char **argv)
+{
+  struct volume vol;
+  struct outfile f;
+  char in_file[128];
+
+  vol.nx = argc > 0 ? atoll(argv[0]) : 512;
+  vol.ny = argc > 1 ? atoll(argv[1]) : vol.nx;
+  vol.nz = argc > 2 ? atoll(argv[2]) : 64;
+  if (vol.nx < 3 || vol.ny < 3 || vol.nz < 3 || vol.nx * vol.ny * vol.nz > INT_MAX) {
+    fputs("stencil: usage: stencil nx [ny [nz]], each at least 3\n", stderr);
+    exit(1);
+  }
+
+  /* The benchmark reads x fastest, then y, then z */
+  open_output(&f, "input.bin");
+  write_items(&f, vol.ny * vol.nz, vol.nx * sizeof(float), format_volume_rows, &vol);
+  close_output(&f);
+
+  snprintf(in_file, sizeof(in_file), "-i $dir/input.bin -- %lld %lld %lld 100",
+           (long long)vol.nx, (long long)vol.ny, (long long)vol.nz);
+  write_config(in_file, "-o result.bin");
+}
+
+/****************************************************************************/
+/* hotspot: temperature and power grids, one value per line */
+
+struct chip {
+  int64_t rows, cols;
+  int64_t hot;			/* Number of hot blocks */
+};
+
+/* Power is low everywhere except in a few hot functional blocks */
+static size_t
+format_power(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct chip *c = (struct chip *)ctx;
+  char *p = buf;
+  int64_t i, b;
+
+  for (i = first; i < first + count; i++) {
+    int64_t r = i / c->cols, col = i % c->cols;
+    double w = 1e-6 * rnd_unit(15, i);
+    for (b = 0; b < c->hot; b++) {
+      int64_t r0 = rnd_below(16, 2 * b, c->rows), c0 = rnd_below(16, 2 * b + 1, c->cols);
+      if (r >= r0 && r < r0 + c->rows / 16 + 1 && col >= c0 && col < c0 + c->cols / 16 + 1) {
+        w += 1e-4 * (0.5 + rnd_unit(17, b));
+        break;
+      }
+    }
+    p = put_fixed(p, w, 6);
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static size_t
+format_temp(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  char *p = buf;
+  int64_t i;
+
+  (void)ctx;
+  for (i = first; i < first + count; i++) {
+    p = put_fixed(p, 323 + 20 * rnd_unit(18, i), 4);
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static void
+gen_hotspot(int argc, char **argv)
+{
+  struct chip c;
+  struct outfile f;
+  char in_file[128];
+
+  c.rows = argc > 0 ? atoll(argv[0]) : 1024;
+  c.cols = argc > 1 ? atoll(argv[1]) : c.rows;
+  if (c.rows < 1 || c.cols < 1 || c.rows * c.cols > INT_MAX) {
+    fputs("hotspot: usage: hotspot rows [cols]\n", stderr);
+    exit(1);
+  }
+  c.hot = 8;
+
+  open_output(&f, "temp.txt");
+  write_items(&f, c.rows * c.cols, 24, format_temp, &c);
+  close_output(&f);
+
+  open_output(&f, "power.txt");
+  write_items(&f, c.rows * c.cols, 24, format_power, &c);
+  close_output(&f);
+
+  /* 0 threads: the run's OMP_NUM_THREADS */
+  snprintf(in_file, sizeof(in_file), "%lld %lld 100 0 $dir/temp.txt $dir/power.txt",
+           (long long)c.rows, (long long)c.cols);
+  write_config(in_file, "output.out");
+}
+
+/****************************************************************************/
+/* srad: ultrasound-like P2 image */
+
+struct pgm {
+  int64_t rows, cols;
+};
+
+/* Smooth structures under multiplicative speckle, the noise that SRAD
+ * removes */
+static size_t
+format_pgm_rows(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct pgm *im = (struct pgm *)ctx;
+  char *p = buf;
+  int64_t i, j;
+
+  for (i = first; i < first + count; i++) {
+    for (j = 0; j < im->cols; j++) {
+      double y = (double)i / im->rows, x = (double)j / im->cols;
+      double base = 0.5 + 0.3 * sin(6.283 * 3 * x) * cos(6.283 * 2 * y);
+      double speckle = -log(1 - rnd_unit(19, (uint64_t)i * im->cols + j));
+      int v = (int)(255 * base * speckle * 0.5);
+      p = put_uint(p, v > 255 ? 255 : v);
+      *p++ = j + 1 < im->cols ? ' ' : '\n';
+    }
+  }
+  return p - buf;
+}
+
+static void
+gen_srad(int argc, char **argv)
+{
+  struct pgm im;
+  struct outfile f;
+  char in_file[128];
+
+  im.rows = argc > 0 ? atoll(argv[0]) : 502;
+  im.cols = argc > 1 ? atoll(argv[1]) : 458;
+  if (im.rows < 2 || im.cols < 2 || im.rows * im.cols > INT_MAX) {
+    fputs("srad: usage: srad rows [cols]\n", stderr);
+    exit(1);
+  }
+
+  /* graphics.c skips exactly three header lines */
+  open_output(&f, "image.pgm");
+  write_header(&f, "P2\n%lld %lld\n255\n", (long long)im.cols, (long long)im.rows);
+  write_items(&f, im.rows, im.cols * 4, format_pgm_rows, &im);
+  close_output(&f);
+
+  /* 0 threads: the run's OMP_NUM_THREADS */
+  snprintf(in_file, sizeof(in_file), "100 0.5 %lld %lld 0 $dir/image.pgm",
+           (long long)im.rows, (long long)im.cols);
+  write_config(in_file, "");
+}
+
+/****************************************************************************/
+/* kmeans: binary points around hidden centres (kmeans -b) */
+
+struct points {
+  int64_t n;
+  int features, clusters;
+};
+
+static size_t
+format_points(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  struct points *pt = (struct points *)ctx;
+  float *out = (float *)buf;
+  int64_t i, k = 0;
+  int d;
+
+  for (i = first; i < first + count; i++) {
+    uint64_t c = rnd_below(20, i, pt->clusters);
+    for (d = 0; d < pt->features; d++) {
+      double centre = rnd_unit(21, c * pt->features + d) * 100;
+      double noise = rnd_unit(22, (uint64_t)i * pt->features + d) +
+        rnd_unit(23, (uint64_t)i * pt->features + d) - 1;
+      out[k++] = centre + 5 * noise;
+    }
+  }
+  return k * sizeof(float);
+}
+
+static void
+gen_kmeans(int argc, char **argv)
+{
+  struct points pt;
+  struct outfile f;
+  int header[2];
+  char in_file[64];
+
+  pt.n = argc > 0 ? atoll(argv[0]) : 1000000;
+  pt.features = argc > 1 ? atoi(argv[1]) : 34;
+  pt.clusters = argc > 2 ? atoi(argv[2]) : 5;
+  if (pt.n < 1 || pt.n > INT_MAX || pt.features < 1 || pt.clusters < 1) {
+    fputs("kmeans: usage: kmeans points [features [clusters]]\n", stderr);
+    exit(1);
+  }
+  header[0] = pt.n;
+  header[1] = pt.features;
+
+  open_output(&f, "points.bin");
+  write_raw(&f, header, sizeof(header));
+  write_items(&f, pt.n, pt.features * sizeof(float), format_points, &pt);
+  close_output(&f);
+
+  /* kmeans declares -b with an argument */
+  snprintf(in_file, sizeof(in_file), "-b 1 -i $dir/points.bin -k %d", pt.clusters);
+  write_config(in_file, "");
+}
+
+/****************************************************************************/
+/* lud: diagonally dominant text matrix */
+
+static size_t
+format_lud_rows(void *ctx, int64_t first, int64_t count, char *buf)
+{
+  int64_t n = *(int64_t *)ctx, i, j;
+  char *p = buf;
+
+  for (i = first; i < first + count; i++) {
+    for (j = 0; j < n; j++) {
+      double v = rnd_unit(24, (uint64_t)i * n + j);
+      p = put_fixed(p, i == j ? v + n : v, 6);
+      *p++ = ' ';
+    }
+    *p++ = '\n';
+  }
+  return p - buf;
+}
+
+static void
+gen_lud(int argc, char **argv)
+{
+  int64_t n = argc > 0 ? atoll(argv[0]) : 2048;
+  struct outfile f;
+
+  if (n < 1 || n > 65536) {
+    fputs("lud: the matrix dimension must be 1-65536\n", stderr);
+    exit(1);
+  }
+
+  open_output(&f, "matrix.dat");
+  write_header(&f, "%lld\n", (long long)n);
+  write_items(&f, n, n * 24 + 1, format_lud_rows, &n);
+  close_output(&f);
+
+  write_config("-i $dir/matrix.dat", "");
+}
+
+/****************************************************************************/
+/* Driver */
+
+struct generator {
+  const char *name;
+  void (*generate)(int argc, char **argv);
+  const char *args;
+};
+
+static const struct generator generators[] = {
+  { "bfs", gen_bfs, "scale [edgefactor]      2^scale nodes, R-MAT edges" },
+  { "spmv", gen_spmv, "rows [width [band|powerlaw]]" },
+  { "cutcp", gen_cutcp, "atoms [box]" },
+  { "histo", gen_histo, "width height [histo_width histo_height]" },
+  { "stencil", gen_stencil, "nx [ny [nz]]" },
+  { "hotspot", gen_hotspot, "rows [cols]" },
+  { "srad", gen_srad, "rows [cols]" },
+  { "kmeans", gen_kmeans, "points [features [clusters]]" },
+  { "lud", gen_lud, "n" },
+  { NULL, NULL, NULL }
+};
+
+static void
+usage(const char *prog)
+{
+  const struct generator *g;
+
+  fprintf(stderr, "Usage: %s [-s seed] [-d dir] benchmark size...\n\n", prog);
+  for (g = generators; g->name; g++)
+    fprintf(stderr, "  %-8s %s\n", g->name, g->args);
+  fputs("\nThe files and a data.config.mk for run_template.sh go to dir, e.g.\n"
+        "datasets/bfs/scale24.  The same size and seed always give the same\n"
+        "files, whatever the number of threads.\n", stderr);
+  exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+  const struct generator *g;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:d:h")) != -1) {
+    switch (opt) {
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'd':
+      outdir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc)
+    usage(argv[0]);
+
+  for (g = generators; g->name; g++)
+    if (strcmp(g->name, argv[optind]) == 0)
+      break;
+  if (g->name == NULL)
+    usage(argv[0]);
+
+  if (mkdir_p(outdir) != 0)
+    die("cannot create", outdir);
+
+  printf("Generating %s, seed %llu\n", g->name, (unsigned long long)seed);
+  g->generate(argc - optind - 1, argv + optind + 1);
+  return 0;
+}